@@ -26,6 +26,7 @@
 //  File				:	containers.h
 //  Classes				:	CDictionary
 //							CHash
+//							CInternHash
 //							CTrie
 //							CPqueue
 //							CMemPool
@@ -225,6 +226,127 @@ private:
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	hashBytes
+// Description			:
+/// \brief					Mix a block of memory into a running hash key
+// Return Value			:	The new key
+// Comments				:	FNV-1a
+inline unsigned int	hashBytes(unsigned int key,const void *data,size_t size) {
+	const unsigned char	*src	=	(const unsigned char *) data;
+
+	for (;size>0;size--)	key	=	(key ^ *src++) * 16777619u;
+
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInternHash
+// Description			:
+/// \brief					Hash table that keeps a single copy of every distinct item
+// Comments				:	itemType must be reference counted and must provide
+//							hash() and equals(). The table holds a reference
+//							to every item it stores
+template <class itemType>	class CInternHash {
+
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CInternBucket
+	// Description			:
+/// \brief					Hash table entry
+	// Comments				:
+	class CInternBucket {
+	public:
+		itemType		*item;
+		unsigned int	key;
+		CInternBucket	*next;
+	};
+
+public:
+						// Constructor
+						CInternHash(int nb = 7) {
+							int			i;
+							nBuckets	=	1 << nb;
+							numItems	=	0;
+							buckets		=	new CInternBucket*[nBuckets];
+							for (i=0;i<nBuckets;i++)
+								buckets[i]	=	NULL;
+						}
+
+						// Destructor
+						~CInternHash() {
+							release();
+							delete [] buckets;
+						}
+
+						// Return the stored item that is equal to this one (storing it if it is new)
+	itemType			*intern(itemType *it) {
+							const unsigned int	k		=	it->hash();
+							CInternBucket		*h;
+
+							for (h=buckets[k & (nBuckets-1)];h!=NULL;h=h->next) {
+								if (h->item == it)									return it;
+								if ((h->key == k) && (h->item->equals(it)))			return h->item;
+							}
+
+							if (numItems >= 2*nBuckets)	rehash();
+
+							h				=	new CInternBucket;
+							h->item			=	it;
+							h->key			=	k;
+							h->next			=	buckets[k & (nBuckets-1)];
+							buckets[k & (nBuckets-1)]	=	h;
+							numItems++;
+							it->attach();
+
+							return it;
+						}
+
+						// Drop all the items
+	void				release() {
+							CInternBucket	*h;
+							int				i;
+
+							for (i=0;i<nBuckets;i++) {
+								while((h=buckets[i]) != NULL) {
+									buckets[i]	=	h->next;
+									h->item->detach();
+									delete h;
+								}
+							}
+
+							numItems	=	0;
+						}
+
+	int					numItems;		// The number of distinct items stored
+private:
+						// Double the number of buckets
+	void				rehash() {
+							const int		nnBuckets	=	nBuckets*2;
+							CInternBucket	**nBucketArray	=	new CInternBucket*[nnBuckets];
+							CInternBucket	*h;
+							int				i;
+
+							for (i=0;i<nnBuckets;i++)	nBucketArray[i]	=	NULL;
+
+							for (i=0;i<nBuckets;i++) {
+								while((h=buckets[i]) != NULL) {
+									buckets[i]						=	h->next;
+									h->next							=	nBucketArray[h->key & (nnBuckets-1)];
+									nBucketArray[h->key & (nnBuckets-1)]	=	h;
+								}
+							}
+
+							delete [] buckets;
+							buckets		=	nBucketArray;
+							nBuckets	=	nnBuckets;
+						}
+
+	int					nBuckets;		// The number of buckets
+	CInternBucket		**buckets;		// The array of buckets
+};
+
+
+
 
 
 
@@ -0,0 +1,124 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	half.h
+//  Classes				:	CHalf
+//  Description			:
+/// \brief					16 bit IEEE floating point numbers
+//
+////////////////////////////////////////////////////////////////////////
+#ifndef HALF_H
+#define HALF_H
+
+#include "global.h"
+
+// The largest finite half
+#define	HALF_MAX	65504.0f
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	floatToHalf
+// Description			:
+/// \brief					Convert a float into half precision
+// Return Value			:	The bits of the half
+// Comments				:	Rounds to nearest, overflows to infinity
+inline unsigned short	floatToHalf(float f) {
+	union { float f; unsigned int i; } v;
+	v.f	=	f;
+
+	const unsigned int	sign		=	(v.i >> 16) & 0x8000;
+	const int			exponent	=	(int) ((v.i >> 23) & 0xFF) - 127 + 15;
+	unsigned int		mantissa	=	v.i & 0x007FFFFF;
+
+	if (exponent >= 31) {
+		// Infinity / NaN / overflow
+		if (((v.i >> 23) & 0xFF) == 0xFF)	return (unsigned short) (sign | 0x7C00 | (mantissa ? 0x200 : 0));
+		return (unsigned short) (sign | 0x7C00);
+	} else if (exponent <= 0) {
+		// Denormal or zero
+		if (exponent < -10)	return (unsigned short) sign;
+
+		mantissa	|=	0x00800000;
+		const int	shift	=	14 - exponent;
+		unsigned int	h	=	mantissa >> shift;
+		if ((mantissa >> (shift-1)) & 1)	h++;
+		return (unsigned short) (sign | h);
+	} else {
+		unsigned int	h	=	sign | (exponent << 10) | (mantissa >> 13);
+
+		// Round to nearest (a carry into the exponent is fine)
+		if (mantissa & 0x00001000)	h++;
+		return (unsigned short) h;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	halfToFloat
+// Description			:
+/// \brief					Convert a half into a float
+// Return Value			:	The float
+// Comments				:
+inline float	halfToFloat(unsigned short h) {
+	union { float f; unsigned int i; } v;
+
+	const unsigned int	sign		=	(h & 0x8000) << 16;
+	unsigned int		exponent	=	(h >> 10) & 0x1F;
+	unsigned int		mantissa	=	h & 0x03FF;
+
+	if (exponent == 0) {
+		if (mantissa == 0) {
+			v.i	=	sign;
+		} else {
+			// Normalize the denormal
+			exponent	=	127 - 15 + 1;
+			while((mantissa & 0x0400) == 0) {
+				mantissa	<<=	1;
+				exponent--;
+			}
+			mantissa	&=	0x03FF;
+			v.i	=	sign | (exponent << 23) | (mantissa << 13);
+		}
+	} else if (exponent == 31) {
+		v.i	=	sign | 0x7F800000 | (mantissa << 13);
+	} else {
+		v.i	=	sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+	}
+
+	return v.f;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CHalf
+// Description			:
+/// \brief					A half that behaves like a float in the arithmetic
+// Comments				:	Same size and layout as the half in the files
+class CHalf {
+public:
+					operator float() const		{	return halfToFloat(bits);	}
+
+	unsigned short	bits;
+};
+
+#endif
+
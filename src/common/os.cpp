@@ -64,6 +64,9 @@
 #include <sys/sysctl.h>
 #include <dlfcn.h>
 #include <glob.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 // << Unix
 #endif
@@ -222,6 +225,20 @@ char			*osEnvironment(const char *name) {
 	return getenv(name);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	osProcessId
+// Description			:
+/// \brief					Get the id of the running process
+// Return Value			:	The process id
+// Comments				:
+int				osProcessId() {
+#ifdef _WIN32
+	return (int) GetCurrentProcessId();
+#else
+	return (int) getpid();
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	osFileExists
 // Description			:
@@ -238,6 +255,64 @@ int		osFileExists(const char *name) {
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	osMapFile
+// Description			:
+/// \brief					Map a file into memory for reading
+// Return Value			:	The mapped data (NULL if the file can not be mapped)
+// Comments				:	The size of the file is returned in size
+void	*osMapFile(const char *name,size_t &size) {
+#ifdef _WIN32
+	HANDLE	file,mapping;
+	void	*data;
+
+	file	=	CreateFile(name,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+	if (file == INVALID_HANDLE_VALUE)	return NULL;
+
+	size	=	(size_t) GetFileSize(file,NULL);
+	mapping	=	CreateFileMapping(file,NULL,PAGE_READONLY,0,0,NULL);
+	CloseHandle(file);
+	if (mapping == NULL)	return NULL;
+
+	// The view keeps the mapping alive
+	data	=	MapViewOfFile(mapping,FILE_MAP_READ,0,0,0);
+	CloseHandle(mapping);
+
+	return data;
+#else
+	struct stat	st;
+	void		*data;
+	int			fd;
+
+	if ((fd = open(name,O_RDONLY)) < 0)	return NULL;
+
+	if ((fstat(fd,&st) != 0) || (st.st_size == 0)) {
+		close(fd);
+		return NULL;
+	}
+
+	size	=	(size_t) st.st_size;
+	data	=	mmap(NULL,size,PROT_READ,MAP_SHARED,fd,0);
+	close(fd);
+
+	return (data == MAP_FAILED) ? NULL : data;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	osUnmapFile
+// Description			:
+/// \brief					Unmap a file mapped by osMapFile
+// Return Value			:	-
+// Comments				:
+void	osUnmapFile(void *data,size_t size) {
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(data,size);
+#endif
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 // Function				:	osFixSlashes
@@ -423,6 +498,20 @@ float	osTime() {
 	return (float) (ti.tv_sec - osStartTimeSec) + (ti.tv_usec - osStartTimeMsec) / 1000000.0f;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	osClock
+// Description			:
+/// \brief					Get the time in microseconds
+// Return Value			:
+// Comments				:	Unlike osTime, this keeps microsecond precision for long runs
+double	osClock() {
+	struct timeval	ti;
+
+	gettimeofday(&ti, NULL);
+
+	return (double) (ti.tv_sec - osStartTimeSec)*1000000.0 + (double) (ti.tv_usec - osStartTimeMsec);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	osTime
 // Description			:
@@ -474,6 +563,20 @@ int		osWaitThread(TThread	thread) {
 	return 0;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	osSleep
+// Description			:
+/// \brief					Suspend the calling thread
+// Return Value			:
+// Comments				:	The argument is in milliseconds
+void	osSleep(int milliseconds) {
+#ifdef _WIN32
+	Sleep(milliseconds);
+#else
+	usleep(milliseconds*1000);
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	osCreateMutex
 // Description			:
@@ -66,6 +66,8 @@ class CRWLock {
 #define TRWLock         CRWLock
 #define	TFunPrefix		DWORD WINAPI
 #define	TFunReturn		return 0
+#define	osFseek			_fseeki64		// Seek/tell with 64 bit file offsets
+#define	osFtell			_ftelli64
 typedef LPTHREAD_START_ROUTINE	TFun;
 
 #define	OS_DIR_SEPERATOR					'\\'
@@ -101,6 +103,8 @@ typedef LPTHREAD_START_ROUTINE	TFun;
 #define TRWLock			pthread_rwlock_t
 #define	TFunPrefix		void *
 #define	TFunReturn		return NULL
+#define	osFseek			fseeko			// Seek/tell with 64 bit file offsets
+#define	osFtell			ftello
 typedef void			*(*TFun)(void *);
 
 
@@ -146,11 +150,16 @@ void			*osResolve(void *,const char *);
 // Get an environment variable (return NULL if non existent)
 char			*osEnvironment(const char *);
 
+// Get the id of the running process
+int				osProcessId();
+
 // File io
 int				osFileExists(const char *);
 void			osFixSlashes(char *);
 void			osTempdir(char *result, size_t resultsize);
 void			osTempname(const char *,const char *,char*);
+void			*osMapFile(const char *,size_t &);
+void			osUnmapFile(void *,size_t);
 
 // Directory IO
 void			osCreateDir(const char *);
@@ -162,11 +171,13 @@ void			osEnumerate(const char *,int (*callback)(const char *,void *),void *);
 
 // Time functions
 float			osTime();
+double			osClock();
 float			osCPUTime();
 
 // Sync. functions
 TThread			osCreateThread(TFun,void *);
 int				osWaitThread(TThread);
+void			osSleep(int);
 void			osCreateMutex(TMutex &);
 void			osDeleteMutex(TMutex &);
 void			osCreateSemaphore(TMutex &,int);
@@ -197,6 +208,20 @@ inline	void	osLock(TMutex &mutex) {
 #endif
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	osTryLock
+// Description			:
+/// \brief					Lock a mutex if it is not already held
+// Return Value			:	TRUE if the mutex was acquired
+// Comments				:
+inline	int		osTryLock(TMutex &mutex) {
+#ifdef _WIN32
+	return (TryEnterCriticalSection(&mutex) != 0);
+#else
+	return (pthread_mutex_trylock(&mutex) == 0);
+#endif
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	osUnlock
 // Description			:
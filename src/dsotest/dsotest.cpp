@@ -69,3 +69,18 @@ SHADEOP(green1) {
 	result[2]	=	0;
 }
 
+// The same thing for the whole grid at once
+SHADEOP_BATCH(green1) {
+	char	*result	=	argv[0];
+
+	for (int i=0;i<numVertices;i++,result+=argSteps[0]) {
+		if ((tags == NULL) || (tags[i] == 0)) {
+			float	*dest	=	(float *) result;
+
+			dest[0]	=	0;
+			dest[1]	=	1;
+			dest[2]	=	0;
+		}
+	}
+}
+
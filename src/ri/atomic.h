@@ -26,8 +26,8 @@
 //  File				:	atomic.h
 //  Classes				:	-
 //  Description			:
-/// \brief					This file contains the atomic increment and decrement
-//							to ensure consistency in multi-threaded environments
+/// \brief					This file contains the atomic increment, decrement, add and the
+//							memory barrier to ensure consistency in multi-threaded environments
 //							without kernel synchronization.
 //
 //							The Windoze and Apple implementations are pretty standard
@@ -64,6 +64,22 @@ inline int	atomicDecrement(volatile int *pointer) {
 	return InterlockedDecrement((volatile LONG *) pointer);
 }
 
+inline int	atomicAdd(volatile int *pointer,int value) {
+	return InterlockedExchangeAdd((volatile LONG *) pointer,value) + value;
+}
+
+inline int	atomicExchange(volatile int *pointer,int value) {
+	return InterlockedExchange((volatile LONG *) pointer,value);
+}
+
+inline long long	atomicAdd64(volatile long long *pointer,long long value) {
+	return InterlockedExchangeAdd64((volatile LONGLONG *) pointer,value) + value;
+}
+
+inline void	memoryBarrier() {
+	MemoryBarrier();
+}
+
 ///////////////////////////////////////////////////////////////
 // Apple
 #elif defined(__APPLE__) || defined(__APPLE_CC__)
@@ -79,6 +95,26 @@ inline int atomicDecrement(int32_t *ptr) {
 	return OSAtomicDecrement32Barrier(ptr);
 }
 
+inline int atomicAdd(int32_t *ptr,int32_t value) {
+	return OSAtomicAdd32Barrier(value,ptr);
+}
+
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+	return OSAtomicAdd64Barrier(value,(volatile int64_t *) ptr);
+}
+
+inline int atomicExchange(volatile int32_t *ptr,int32_t value) {
+	int32_t	old;
+	do {
+		old	=	*ptr;
+	} while(!OSAtomicCompareAndSwap32Barrier(old,value,ptr));
+	return old;
+}
+
+inline void memoryBarrier() {
+	OSMemoryBarrier();
+}
+
 ///////////////////////////////////////////////////////////////
 // GCC (i386 or x86_64)
 #elif (defined(__i386__) && defined(__GNUC__) || defined(__x86_64__)  && defined(__GNUC__))
@@ -105,6 +141,45 @@ inline int atomicDecrement(volatile int *ptr) {
     return ret;
 }
 
+inline int atomicAdd(volatile int *ptr,int value) {
+    int ret = value;
+    asm volatile("lock\n"
+                 "xaddl %0,%1\n"
+                 : "+r" (ret), "+m" (*ptr)
+                 :
+                 : "memory");
+    return ret + value;
+}
+
+#if defined(__x86_64__)
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+    long long ret = value;
+    asm volatile("lock\n"
+                 "xaddq %0,%1\n"
+                 : "+r" (ret), "+m" (*ptr)
+                 :
+                 : "memory");
+    return ret + value;
+}
+#else
+// There is no 64 bit xadd on i386, let the compiler loop on cmpxchg8b
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+    return __sync_add_and_fetch(ptr,value);
+}
+#endif
+
+inline int atomicExchange(volatile int *ptr,int value) {
+    asm volatile("xchgl %0,%1\n"
+                 : "+r" (value), "+m" (*ptr)
+                 :
+                 : "memory");
+    return value;
+}
+
+inline void memoryBarrier() {
+    asm volatile("mfence\n" : : : "memory");
+}
+
 ///////////////////////////////////////////////////////////////
 // GCC (MIPS)
 #elif defined(__GNUC__) && defined( __PPC__)
@@ -136,6 +211,56 @@ inline int atomicDecrement(volatile int *ptr) {
     return ret;
 }
 
+inline int atomicAdd(volatile int *ptr,int value) {
+    register int ret;
+    asm volatile("lwarx  %0, 0, %2\n"
+                 "add    %0, %3, %0\n"
+                 "stwcx. %0, 0, %2\n"
+                 "bne-   $-12\n"
+                 : "=&r" (ret), "=m" (*ptr)
+                 : "r" (ptr), "r" (value)
+                 : "cc", "memory");
+    return ret;
+}
+
+#if defined(__PPC64__)
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+    register long long ret;
+    asm volatile("ldarx  %0, 0, %2\n"
+                 "add    %0, %3, %0\n"
+                 "stdcx. %0, 0, %2\n"
+                 "bne-   $-12\n"
+                 : "=&r" (ret), "=m" (*ptr)
+                 : "r" (ptr), "r" (value)
+                 : "cc", "memory");
+    return ret;
+}
+#else
+// There is no 64 bit reservation on 32 bit PowerPC
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+	osLock(CRenderer::atomicMutex);
+	value	=	(*ptr += value);
+	osUnlock(CRenderer::atomicMutex);
+	return value;
+}
+#endif
+
+inline int atomicExchange(volatile int *ptr,int value) {
+    register int ret;
+    asm volatile("lwarx  %0, 0, %2\n"
+                 "stwcx. %3, 0, %2\n"
+                 "bne-   $-8\n"
+                 "isync\n"
+                 : "=&r" (ret), "=m" (*ptr)
+                 : "r" (ptr), "r" (value)
+                 : "cc", "memory");
+    return ret;
+}
+
+inline void memoryBarrier() {
+    asm volatile("sync\n" : : : "memory");
+}
+
 ///////////////////////////////////////////////////////////////
 // Generic
 #else
@@ -161,8 +286,95 @@ inline int atomicDecrement(volatile int *ptr) {
 	return value;
 }
 
+inline int atomicAdd(volatile int *ptr,int value) {
+	osLock(CRenderer::atomicMutex);
+	value	=	(*ptr += value);
+	osUnlock(CRenderer::atomicMutex);
+	return value;
+}
+
+inline long long atomicAdd64(volatile long long *ptr,long long value) {
+	osLock(CRenderer::atomicMutex);
+	value	=	(*ptr += value);
+	osUnlock(CRenderer::atomicMutex);
+	return value;
+}
+
+inline int atomicExchange(volatile int *ptr,int value) {
+	int	old;
+	osLock(CRenderer::atomicMutex);
+	old		=	*ptr;
+	*ptr	=	value;
+	osUnlock(CRenderer::atomicMutex);
+	return old;
+}
+
+inline void memoryBarrier() {
+	osLock(CRenderer::atomicMutex);
+	osUnlock(CRenderer::atomicMutex);
+}
+
 #endif
 
+
+
+
+////////////////////////////////////////////////////////////////////////
+// Spin locks
+//
+// These are for the small objects that are created and destroyed too
+// often to carry an OS mutex around. The lock can be held for a while
+// (the rasterizer dices and shades under it), so the waiting threads
+// give up their time slice instead of burning it
+
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
+typedef	volatile int	TSpinLock;
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	spinCreate
+// Description			:
+/// \brief					Initialize a spin lock (unlocked)
+// Return Value			:
+// Comments				:
+inline	void	spinCreate(TSpinLock &lock) {
+	lock	=	0;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	spinLock
+// Description			:
+/// \brief					Acquire a spin lock
+// Return Value			:
+// Comments				:	We only try the atomic exchange when the lock looks free
+inline	void	spinLock(TSpinLock &lock) {
+	while(atomicExchange(&lock,1) != 0) {
+		while(lock != 0) {
+#ifdef _WIN32
+			Sleep(0);
+#else
+			sched_yield();
+#endif
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	spinUnlock
+// Description			:
+/// \brief					Release a spin lock
+// Return Value			:
+// Comments				:	The exchange is also a barrier for the writes done under the lock,
+//							except on PowerPC where it has no release semantics
+inline	void	spinUnlock(TSpinLock &lock) {
+#if defined(__GNUC__) && defined(__PPC__) && !defined(__APPLE__) && !defined(__APPLE_CC__)
+	memoryBarrier();
+#endif
+	atomicExchange(&lock,0);
+}
+
 #endif
 
 
@@ -33,6 +33,7 @@
 #include <string.h>
 
 #include "attributes.h"
+#include "common/containers.h"
 #include "ri_config.h"
 #include "ri.h"
 #include "stats.h"
@@ -108,6 +109,7 @@ CAttributes::CAttributes() {
 	minSplits					=	0;		// This should no longer be needed with convergent dicing
 	rasterExpand				=	0.5f;	// This could be significantly lowered for many primitives
 	bias						=	0.01f;
+	radianceCacheError			=	0;
 
 	transmissionHitMode			=	'p';
 	diffuseHitMode				=	'p';
@@ -129,6 +131,7 @@ CAttributes::CAttributes() {
 	irradianceMaxError			=	0.6f;
 	irradianceMaxPixelDistance	=	20.0f;
 	photonEstimator				=	100;
+	photonMaxError				=	PHOTON_CACHE_MAX_ERROR;
 	photonIor[0]				=	1.5;
 	photonIor[1]				=	1.5;
 	maxDiffuseDepth				=	1;
@@ -233,6 +236,144 @@ CAttributes::~CAttributes(){
 	if (next != NULL)			delete next;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	stringEqual
+// Description			:	NULL safe string comparison
+// Return Value			:	TRUE if the strings are the same
+// Comments				:
+static inline int	stringEqual(const char *s1,const char *s2) {
+	if (s1 == s2)					return TRUE;
+	if ((s1 == NULL) || (s2 == NULL))	return FALSE;
+	return (strcmp(s1,s2) == 0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	shaderEqual
+// Description			:	NULL safe shader instance comparison
+// Return Value			:	TRUE if the instances shade identically
+// Comments				:
+static inline int	shaderEqual(const CShaderInstance *s1,const CShaderInstance *s2) {
+	if (s1 == s2)					return TRUE;
+	if ((s1 == NULL) || (s2 == NULL))	return FALSE;
+	return s1->equals(s2);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CAttributes
+// Method				:	hash
+// Description			:
+/// \brief					Compute a hash key for the attribute state
+// Return Value			:	The key
+// Comments				:	Only covers the fields that commonly differ, equals() does the rest
+unsigned int	CAttributes::hash() const {
+	unsigned int		key	=	2166136261u;
+	const CAttributes	*cAttributes;
+
+	for (cAttributes=this;cAttributes!=NULL;cAttributes=cAttributes->next) {
+		if (cAttributes->surface != NULL)		key	=	hashBytes(key,cAttributes->surface->getName(),strlen(cAttributes->surface->getName()));
+		if (cAttributes->displacement != NULL)	key	=	hashBytes(key,cAttributes->displacement->getName(),strlen(cAttributes->displacement->getName()));
+		key	=	hashBytes(key,&cAttributes->flags,sizeof(unsigned int));
+		key	=	hashBytes(key,cAttributes->surfaceColor,sizeof(vector));
+		key	=	hashBytes(key,cAttributes->surfaceOpacity,sizeof(vector));
+		key	=	hashBytes(key,&cAttributes->shadingRate,sizeof(float));
+		if (cAttributes->name != NULL)	key	=	hashBytes(key,cAttributes->name,(int) strlen(cAttributes->name));
+	}
+
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CAttributes
+// Method				:	equals
+// Description			:
+/// \brief					Check if two attribute states are identical
+// Return Value			:	TRUE if they are
+// Comments				:	Shaders are compared by their parameter values, the lights
+//							and the photon maps by identity
+int		CAttributes::equals(const CAttributes *other) const {
+	const CAttributes	*a;
+	const CAttributes	*b;
+	const CActiveLight	*cLight,*oLight;
+	int					numLights;
+
+	for (a=this,b=other;(a!=NULL) && (b!=NULL);a=a->next,b=b->next) {
+		if (a == b)	continue;
+
+		if ((!shaderEqual(a->surface,b->surface))			||
+			(!shaderEqual(a->displacement,b->displacement))	||
+			(!shaderEqual(a->atmosphere,b->atmosphere))		||
+			(!shaderEqual(a->interior,b->interior))			||
+			(!shaderEqual(a->exterior,b->exterior))			||
+			(a->usedParameters != b->usedParameters)		||
+			(a->flags != b->flags))							return FALSE;
+
+		if ((memcmp(a->surfaceColor,b->surfaceColor,sizeof(vector)) != 0)		||
+			(memcmp(a->surfaceOpacity,b->surfaceOpacity,sizeof(vector)) != 0)	||
+			(memcmp(a->s,b->s,sizeof(float)*4) != 0)							||
+			(memcmp(a->t,b->t,sizeof(float)*4) != 0)							||
+			(memcmp(a->bmin,b->bmin,sizeof(vector)) != 0)						||
+			(memcmp(a->bmax,b->bmax,sizeof(vector)) != 0)						||
+			(memcmp(a->uBasis,b->uBasis,sizeof(matrix)) != 0)					||
+			(memcmp(a->vBasis,b->vBasis,sizeof(matrix)) != 0)					||
+			(memcmp(a->photonIor,b->photonIor,sizeof(float)*2) != 0)			||
+			(memcmp(a->lodRange,b->lodRange,sizeof(float)*4) != 0))				return FALSE;
+
+		if ((a->bexpand != b->bexpand)										||
+			(a->uStep != b->uStep)											||
+			(a->vStep != b->vStep)											||
+			(a->maxDisplacement != b->maxDisplacement)						||
+			(a->shadingRate != b->shadingRate)								||
+			(a->motionFactor != b->motionFactor)							||
+			(a->numUProbes != b->numUProbes)								||
+			(a->numVProbes != b->numVProbes)								||
+			(a->minSplits != b->minSplits)									||
+			(a->rasterExpand != b->rasterExpand)							||
+			(a->bias != b->bias)											||
+			(a->radianceCacheError != b->radianceCacheError)				||
+			(a->transmissionHitMode != b->transmissionHitMode)				||
+			(a->specularHitMode != b->specularHitMode)						||
+			(a->diffuseHitMode != b->diffuseHitMode)						||
+			(a->cameraHitMode != b->cameraHitMode)							||
+			(a->emit != b->emit)											||
+			(a->relativeEmit != b->relativeEmit)							||
+			(a->shadingModel != b->shadingModel)							||
+			(a->globalMap != b->globalMap)									||
+			(a->causticMap != b->causticMap)								||
+			(a->irradianceMaxError != b->irradianceMaxError)				||
+			(a->irradianceMaxPixelDistance != b->irradianceMaxPixelDistance)	||
+			(a->photonEstimator != b->photonEstimator)						||
+			(a->photonMaxError != b->photonMaxError)						||
+			(a->maxDiffuseDepth != b->maxDiffuseDepth)						||
+			(a->maxSpecularDepth != b->maxSpecularDepth)					||
+			(a->shootStep != b->shootStep)									||
+			(a->lodSize != b->lodSize)										||
+			(a->lodImportance != b->lodImportance))							return FALSE;
+
+		if ((!stringEqual(a->name,b->name))									||
+			(!stringEqual(a->maxDisplacementSpace,b->maxDisplacementSpace))	||
+			(!stringEqual(a->globalMapName,b->globalMapName))				||
+			(!stringEqual(a->causticMapName,b->causticMapName))				||
+			(!stringEqual(a->irradianceHandle,b->irradianceHandle))			||
+			(!stringEqual(a->irradianceHandleMode,b->irradianceHandleMode)))	return FALSE;
+
+		// Copies reverse the light list, so compare the lights as sets
+		for (numLights=0,cLight=a->lightSources;cLight!=NULL;cLight=cLight->next,numLights++) {
+			for (oLight=b->lightSources;oLight!=NULL;oLight=oLight->next)
+				if (oLight->light == cLight->light)	break;
+
+			if (oLight == NULL)	return FALSE;
+		}
+
+		for (oLight=b->lightSources;oLight!=NULL;oLight=oLight->next,numLights--);
+
+		if (numLights != 0)									return FALSE;
+
+		if (!a->userAttributes.equals(b->userAttributes))	return FALSE;
+	}
+
+	return (a == b);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CAttributes
 // Method				:	addLight
@@ -463,7 +604,10 @@ int		CAttributes::find(const char *name,const char *category,EVariableType &type
 		if (strcmp(name,RI_BIAS) == 0)					{	type	=	TYPE_FLOAT;		value	=	&bias;					return TRUE;}
 		else if (strcmp(name,RI_MAXDIFFUSEDEPTH) == 0)	{	type	=	TYPE_INTEGER;	value	=	&maxDiffuseDepth;		return TRUE;}
 		else if (strcmp(name,RI_MAXSPECULARDEPTH) == 0)	{	type	=	TYPE_INTEGER;	value	=	&maxSpecularDepth;		return TRUE;}
+		else if (strcmp(name,RI_RADIANCECACHEERROR) == 0){	type	=	TYPE_FLOAT;		value	=	&radianceCacheError;	return TRUE;}
 		else if (strcmp(name,RI_DISPLACEMENTS) == 0)	{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & ATTRIBUTES_FLAGS_DISPLACEMENTS) != 0;			return TRUE;}
+		else if (strcmp(name,RI_ROUNDCURVES) == 0)		{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & ATTRIBUTES_FLAGS_ROUND_CURVES) != 0;			return TRUE;}
+		else if (strcmp(name,RI_ROUNDPOINTS) == 0)		{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & ATTRIBUTES_FLAGS_ROUND_POINTS) != 0;			return TRUE;}
 	}
 
 	if ((category == NULL) || (strcmp(category,RI_IRRADIANCE) == 0)) {
@@ -478,6 +622,7 @@ int		CAttributes::find(const char *name,const char *category,EVariableType &type
 		else if (strcmp(name,RI_IOR) == 0)				{	type	=	TYPE_FLOAT;		value	=	photonIor;				return TRUE;}
 		else if (strcmp(name,RI_IORRANGE) == 0)			{	type	=	TYPE_FLOAT;		value	=	photonIor;				return TRUE;}
 		else if (strcmp(name,RI_ESTIMATOR) == 0)		{	type	=	TYPE_INTEGER;	value	=	&photonEstimator;		return TRUE;}
+		else if (strcmp(name,RI_MAXERROR) == 0)			{	type	=	TYPE_FLOAT;		value	=	&photonMaxError;		return TRUE;}
 		else if (strcmp(name,RI_SHADINGMODEL) == 0)		{	type	=	TYPE_STRING;	value	=	findShadingModel(shadingModel);		return TRUE;}
 	}
 
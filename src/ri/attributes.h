@@ -62,6 +62,8 @@ const	unsigned int		ATTRIBUTES_FLAGS_SHADE_HIDDEN				=	1 << 22;	// Shade even if
 const	unsigned int		ATTRIBUTES_FLAGS_SHADE_BACKFACE				=	1 << 23;	// Shade even if backfacing
 const	unsigned int		ATTRIBUTES_FLAGS_DOUBLE_SIDED				=	1 << 24;	// The surface is double sided
 const	unsigned int		ATTRIBUTES_FLAGS_SAMPLEMOTION				=	1 << 25;	// Sample the time in tracing rays
+const	unsigned int		ATTRIBUTES_FLAGS_ROUND_CURVES				=	1 << 26;	// Raytrace curves as round tubes instead of flat ribbons
+const	unsigned int		ATTRIBUTES_FLAGS_ROUND_POINTS				=	1 << 27;	// Raytrace points as spheres instead of discs facing the ray
 
 
 // The minimum shading rate
@@ -109,6 +111,8 @@ public:
 		CVariable			*findParameter(const char *);				// Find a shader parameter
 		void				restore(const CAttributes *other,int shading,int geometrymodification,int geometrydefinition,int hiding);
 		int					find(const char *name,const char *category,EVariableType &type,const void *&value,int &intValue,float &floatValue) const;
+		unsigned int		hash() const;								// Used to find identical attribute states
+		int					equals(const CAttributes *other) const;
 		
 		CAttributes			*next;										// points to the next attribute if there's motion blur
 
@@ -146,6 +150,7 @@ public:
 		int					minSplits;									// The minimum number of splits
 		float				rasterExpand;								// The expansion coefficient during the sampling
 		float				bias;										// The bias amount expressed in the camera coordinates
+		float				radianceCacheError;							// Reuse the shaded grids of the patches for rays this much wider than a grid cell (0 = never)
 
 		char				transmissionHitMode;						// Either: 'p' = Look at the primitive   or   's' = Execute the shader
 		char				specularHitMode;							// Either: 'p' = Look at the primitive   or   's' = Execute the shader
@@ -166,6 +171,7 @@ public:
 		float				irradianceMaxError;							// The error threshold for the irradiance cache
 		float				irradianceMaxPixelDistance;					// The maximum pixel distance between the samples for trradiance caching
 		int					photonEstimator;							// The total number of photons to use to estimate irradiance
+		float				photonMaxError;								// The radius of a cached photon map estimate relative to the lookup radius
 		float				photonIor[2];								// Index of refraction range used for the dielectic shading model
 		int					maxDiffuseDepth;							// The maximum number of diffuse bounces before going to the photon map
 		int					maxSpecularDepth;							// The maximum number of specular bounces before giving up
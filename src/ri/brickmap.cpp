@@ -45,7 +45,7 @@
 // The static members of the CBrickMap class
 CBrickMap	*CBrickMap::brickMaps		=	NULL;			// List of brickmaps in memory
 int			CBrickMap::referenceNumber	=	0;				// The last reference number
-int			CBrickMap::currentMemory	=	0;				// The currently used memory abount
+TStatCounter	CBrickMap::currentMemory	=	0;				// The currently used memory abount
 int			CBrickMap::maxMemory		=	0;				// The maximum memory for brickmaps
 int			CBrickMap::detailLevel		=	2;				// The detail level
 int			CBrickMap::drawType			=	0;				// Draw boxes
@@ -134,6 +134,8 @@ CBrickMap::CBrickMap(FILE *in,const char *name,const float *from,const float *to
 	file			=	in;
 	modifying		=	FALSE;
 	osCreateMutex(mutex);
+	numLookups		=	0;
+	numCacheHits	=	0;
 
 	// Read the header offset
 	fseek(file,-(long)sizeof(int),SEEK_END);
@@ -196,6 +198,8 @@ CBrickMap::CBrickMap(const char *name,const float *bmi,const float *bma,const fl
 	file			=	NULL;
 	modifying		=	TRUE;
 	osCreateMutex(mutex);
+	numLookups		=	0;
+	numCacheHits	=	0;
 
 
 	// Compute the bounding cube
@@ -253,6 +257,10 @@ CBrickMap::~CBrickMap() {
 	// Close the file if not already have done so
 	if (file != NULL)	fclose(file);
 
+	// Account for the lookups in one go
+	stats.addShared(STAT_BRICKMAP_LOOKUPS,numLookups);
+	stats.addShared(STAT_BRICKMAP_CACHE_HITS,numCacheHits);
+
 	osDeleteMutex(mutex);
 }
 
@@ -453,6 +461,33 @@ void	CBrickMap::store(const float *data,const float *cP,const float *cN,float dP
 // Return Value			:	-
 // Comments				:
 void		CBrickMap::lookup(float *data,const float *cP,const float *cN,float dP) {
+	filteredLookup(data,cP,cN,dP);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CBrickMap
+// Method				:	lookup
+// Description			:
+/// \brief					Lookup a number of points at once
+// Return Value			:	-
+// Comments				:	The brickmap is locked per brick, so other threads can
+//							use it between our bricks
+void		CBrickMap::lookup(int numLookups,float *data,const float *cP,const float *cN,const float *dP) {
+	int	i;
+
+	for (i=0;i<numLookups;i++) {
+		filteredLookup(data + i*dataSize,cP + i*3,cN + i*3,dP[i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CBrickMap
+// Method				:	filteredLookup
+// Description			:
+/// \brief					Lookup data interpolating between the two nearest levels
+// Return Value			:	-
+// Comments				:
+void		CBrickMap::filteredLookup(float *data,const float *cP,const float *cN,float dP) {
 	dP	*=	dPscale;
 
 	float	depthf		=	log(side*LEAF_FACTOR/dP)*InvLog2;
@@ -479,12 +514,8 @@ void		CBrickMap::lookup(float *data,const float *cP,const float *cN,float dP) {
 	}
 
 	// Perform the lookup
-	osLock(mutex);
-	atomicIncrement(&stats.numBrickmapLookups);
-	atomicIncrement(&stats.numBrickmapLookups);
 	lookup(P,N,dP,data0,depth,normalFactor);
 	lookup(P,N,dP,data1,depth+1,normalFactor);
-	osUnlock(mutex);
 
 	for (i=0;i<dataSize;i++)	data[i]	=	data0[i]*(1-t) + data1[i]*t;
 }
@@ -497,11 +528,13 @@ void		CBrickMap::lookup(float *data,const float *cP,const float *cN,float dP) {
 // Description			:
 /// \brief					Lookup a particular depth
 // Return Value			:	-
-// Comments				:
+// Comments				:	The mutex is held while we use a brick since a flush
+//							may page it out as soon as we let go
 void		CBrickMap::lookup(const float *P,const float *N,float dP,float *data,int depth,float normalFactor) {
-	CBrick	*cBrick;
-	float	totalWeight	=	0;
-	int		i;
+	CBrick			*cBrick;
+	float			totalWeight	=	0;
+	TStatCounter	lookupCount	=	1;		// The lookup is counted under the first lock
+	int				i;
 
 	// Clear the data
 	for (i=0;i<dataSize;i++)	data[i]	=	0;
@@ -509,6 +542,10 @@ void		CBrickMap::lookup(const float *P,const float *N,float dP,float *data,int d
 	// Find the brick we want to look at
 	forEachBrick(depth)
 		int		cDepth,cx,cy,cz;
+
+		osLock(mutex);
+		numLookups	+=	lookupCount;
+		lookupCount	=	0;
 		
 		// iterate all levels until we hit a valid sample
 		for (cx=x,cy=y,cz=z,cDepth=depth;cDepth>=0;cx=cx>>1,cy=cy>>1,cz=cz>>1,cDepth--) {
@@ -535,6 +572,8 @@ void		CBrickMap::lookup(const float *P,const float *N,float dP,float *data,int d
 			// If we hit anything, we're done
 			if(totalWeight > 0) break;
 		}
+
+		osUnlock(mutex);
 	}
 		
 	// Normalize the data
@@ -717,7 +756,7 @@ CBrickMap::CBrick	*CBrickMap::loadBrick(int fileIndex) {
 	CVoxel	*cVoxel,*tVoxel;
 	int		i,j;
 
-	atomicIncrement(&stats.numBrickmapCachePageins);
+	stats.addShared(STAT_BRICKMAP_CACHE_PAGEINS,1);
 	
 	// Seek to the right position in file
 	if (file == NULL)	file	=	ropen(name,"w+",fileBrickMap);
@@ -1357,7 +1396,7 @@ void				CBrickMap::flushBrickMap(int allBricks) {
 	// Swap out the bricks
 	if (allBricks == FALSE) {
 		numNodes						=	numNodes >> 1;
-		stats.numBrickmapCachePageouts	+=	numNodes;
+		stats.addShared(STAT_BRICKMAP_CACHE_PAGEOUTS,numNodes);
 	}
 	
 
@@ -1538,26 +1577,38 @@ void	makeBrickMap(int nb,const char **src,const char *dest,TSearchpath *searchPa
 	
 	// FIXME: deal with multiple brickmaps
 	if (CRenderer::locateFile(fileName,src[0],searchPath)) {
-		FILE *in;
+		FILE		*in;
+		CPointCloud	*cPtCloud	=	NULL;
+
 		if ((in	=	ropen(fileName,"rb",filePointCloud,TRUE)) != NULL) {
+			cPtCloud	=	new CPointCloud(filePointCloud,identityMatrix,identityMatrix,in);
+		} else if ((in	=	ropen(fileName,"rb",filePagedPointCloud,TRUE)) != NULL) {
+			cPtCloud	=	new CPointCloud(filePointCloud,identityMatrix,identityMatrix,in,TRUE);
+		}
+
+		if (cPtCloud != NULL) {
 
 			// create backing store in a temp file
 			// FIXME: make osTempname not always prefix dir
 			sprintf(tempName,"%s.tmp",dest);
 
-			CPointCloud *cPtCloud	=	new CPointCloud(filePointCloud,identityMatrix,identityMatrix,in);
 			CBrickMap	*cBMap		=	new CBrickMap(tempName,cPtCloud->bmin,cPtCloud->bmax,identityMatrix,identityMatrix,cPtCloud->toNDC,cPtCloud->channels,cPtCloud->numChannels,maxDepth);
-			float		*data		=	cPtCloud->data.array;
-			for (i=1;i<=cPtCloud->numItems;i++) {
-				CPointCloudPoint	*p	=	cPtCloud->items + i;
-				float			 	*C	=	data + p->entryNumber;
-				const float			R	=	p->dP * radiusScale;
+			float		*C			=	(float *) alloca(cPtCloud->dataSize*sizeof(float));
+			const int	numPoints	=	cPtCloud->getNumPoints();
+			for (i=1;i<=numPoints;i++) {
+				vector	P,N;
+				float	dP;
+
+				// Go through getPoint so that paged point clouds are read a page at a time
+				cPtCloud->getPoint(i,C,P,N,&dP);
+
+				const float			R	=	dP * radiusScale;
 				// guard against duff data making the map too deep
 				if (R<C_EPSILON || R!=R) continue;
 
-				assert(inBox(cPtCloud->bmin,cPtCloud->bmax,p->P));
+				assert(inBox(cPtCloud->bmin,cPtCloud->bmax,P));
 
-				cBMap->store(C,p->P,p->N,R);
+				cBMap->store(C,P,N,R);
 			}
 			
 			cBMap->finalize();
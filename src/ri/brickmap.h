@@ -138,7 +138,7 @@ public:
 												assert(cNode->fileIndex != -1);
 												cNode->brick = loadBrick(cNode->fileIndex);
 											} else {
-												atomicIncrement(&stats.numBrickmapCacheHits);
+												numCacheHits++;
 											}
 
 											if (n != NULL) *n = cNode;
@@ -198,7 +198,7 @@ public:
 												assert(cNode->fileIndex != -1);
 												cNode->brick = loadBrick(cNode->fileIndex);
 											} else {
-												atomicIncrement(&stats.numBrickmapCacheHits);
+												numCacheHits++;
 											}
 
 											if (n != NULL) *n = cNode;
@@ -210,6 +210,7 @@ public:
 								}
 
 			void				lookup(float *data,const float *P,const float *N,float dP);
+			void				lookup(int numLookups,float *data,const float *P,const float *N,const float *dP);
 			void				lookup(float *,const float *,const float *,const float *,const float *,CShadingContext *) {	assert(FALSE);	}
 			void				store(const float *data,const float *P,const float *N,float dP);
 				
@@ -226,6 +227,7 @@ public:
 	static	void				shutdownBrickMap();
 protected:
 			void				lookup(const float *P,const float *N,float dP,float *data,int depth,float normalFactor);
+			void				filteredLookup(float *data,const float *P,const float *N,float dP);
 			void				flushBricks(int allBricks);		// Free memory by flushing bricks
 			CBrick				*newBrick(int clear);			// Allocate a brick
 			CBrick				*loadBrick(int fileIndex);		// Load a brick
@@ -240,13 +242,15 @@ protected:
 			CBrickMap			*nextMap;						// Maintain a linked list of brickmaps
 			int					modifying;
 			TMutex				mutex;
+			TStatCounter		numLookups;						// The lookups (counted under the mutex, added to the stats when the map dies)
+			TStatCounter		numCacheHits;					// The brick cache hits (counted under the mutex)
 
 
 																// Some static variables
 
 	static	CBrickMap			*brickMaps;						// The list of brick maps
 	static	int					referenceNumber;				// The last access number
-	static	int					currentMemory;					// The amount of used memory
+	static	TStatCounter		currentMemory;					// The amount of used memory
 	static	int					maxMemory;						// The maximum amount of memory to allocate
 	static	int					detailLevel;					// The brickmap detail level for visualization
 	static	int					drawType;						// Which type to draw
@@ -256,6 +260,7 @@ protected:
 	static	void				brickQuickSort(CBrickNode **nodes,int start,int end);
 	
 	friend class CBrickMapGeometry;
+	friend class CVolume;
 };
 
 
@@ -386,3 +386,19 @@ void	CGatherBundle::post() {
 	depth++;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CGatherBundle
+// Method				:	cacheable
+// Description			:
+// Return Value			:	TRUE if the hits can be shaded from the radiance caches
+// Comments				:
+int		CGatherBundle::cacheable() {
+
+	// Every output must be either Ci or Oi
+	for (CGatherVariable *cVariable=outputVars;cVariable!=NULL;cVariable=cVariable->next) {
+		if (cVariable->cacheable() == FALSE)	return FALSE;
+	}
+
+	return TRUE;
+}
+
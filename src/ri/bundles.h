@@ -61,6 +61,7 @@ public:
 		void					postShade(int,CRay **,float **);
 		void					postShade(int,CRay **);
 		void					post();
+		int						cacheable()		{	return TRUE;	}
 };
 
 
@@ -135,6 +136,7 @@ public:
 	void			postShade(int nr,CRay **r,float **varying);
 	void			postShade(int nr,CRay **r);
 	void			post();
+	int				cacheable();
 
 	CGatherRay		*raysBase;
 	CRay			**raysStorage;
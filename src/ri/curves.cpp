@@ -97,6 +97,44 @@ static	inline	void	makeCubicBound(float *bmin,float *bmax,const float *v0,const
 	addBox(bmin,bmax,vtmp3);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	curveVertices
+// Description			:
+/// \brief					Find the control vertices to sample the curve with
+// Return Value			:	The control vertices of the first sample
+// Comments				:	Raytraced moving curves are sampled at arbitrary times, so we
+//							interpolate the control vertices for every sample into buffer
+static	const float	*curveVertices(const CCurve::CBase *base,int numControls,int numVertices,const float *time,unsigned int up,float *buffer,int &step,int &stride) {
+	const CVertexData	*variables	=	base->variables;
+	const int			vertexSize	=	variables->vertexSize;
+
+	if ((variables->moving == FALSE) || (up & PARAMETER_BEGIN_SAMPLE)) {
+		step	=	0;
+		stride	=	(variables->moving ? vertexSize*2 : vertexSize);
+		return base->vertex;
+	} else if (up & PARAMETER_END_SAMPLE) {
+		step	=	0;
+		stride	=	vertexSize*2;
+		return base->vertex + vertexSize;
+	} else {
+		float	*dest	=	buffer;
+		int		i,j,k;
+
+		for (i=0;i<numVertices;i++) {
+			const float	ctime	=	time[i];
+			const float	*src	=	base->vertex;
+
+			for (j=0;j<numControls;j++,src+=vertexSize*2) {
+				for (k=0;k<vertexSize;k++)	*dest++	=	src[k]*(1-ctime) + src[vertexSize+k]*ctime;
+			}
+		}
+
+		step	=	numControls*vertexSize;
+		stride	=	vertexSize;
+		return buffer;
+	}
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CCurve
@@ -129,6 +167,92 @@ CCurve::~CCurve() {
 	base->detach();
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCurve
+// Method				:	shade
+// Description			:
+/// \brief					Shade the curves hit by rays
+// Return Value			:	-
+// Comments				:	The hit point and the normal are passed to sample() in P and Ng
+//							so that round curves are shaded as tubes
+void			CCurve::shade(CShadingContext *context,int numRays,CRay **rays) {
+	float	**varying	=	context->currentShadingState->varying;
+	float	*u			=	varying[VARIABLE_U];
+	float	*v			=	varying[VARIABLE_V];
+	float	*time		=	varying[VARIABLE_TIME];
+	float	*I			=	varying[VARIABLE_I];
+	float	*P			=	varying[VARIABLE_P];
+	float	*N			=	varying[VARIABLE_NG];
+	float	*du			=	varying[VARIABLE_DU];
+	int		i;
+
+	for (i=numRays;i>0;i--) {
+		const CRay	*cRay	=	*rays++;
+
+		*u++	=	cRay->u;						// The intersection u
+		*v++	=	cRay->v;						// The intersection v
+		*time++	=	cRay->time;						// The intersection time
+		*du++	=	cRay->da*cRay->t + cRay->db;	// The ray differential
+		mulvf(I,cRay->dir,cRay->t);					// Compute the I vector
+		addvv(P,cRay->from,I);						// The intersection point
+		movvv(N,cRay->N);							// The intersection normal
+		I		+=	3;
+		P		+=	3;
+		N		+=	3;
+	}
+
+	context->shade(this,numRays,1,SHADING_2D,0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCurve
+// Method				:	restoreHits
+// Description			:
+/// \brief					Replace the sampled centerline with the ray hits
+// Return Value			:	-
+// Comments				:	hits holds the points and then the normals shade() passed in.
+//							interpolate() moves P across the curve by the width,
+//							so we move the hit point back by the same amount here
+void			CCurve::restoreHits(int numVertices,float **varying,float ***locals,const float *hits) const {
+	const float	*hitP	=	hits;
+	const float	*hitN	=	hits + numVertices*3;
+	float		*P		=	varying[VARIABLE_P];
+	float		*N		=	varying[VARIABLE_NG];
+	float		*dPdu	=	varying[VARIABLE_DPDU];
+	const float	*dPdv	=	varying[VARIABLE_DPDV];
+	const float	*u		=	varying[VARIABLE_U];
+	const float	*size;
+	int			sizeStep;
+	vector		tmp;
+	int			i;
+
+	// We need the width now, interpolate() will dispatch the parameters again
+	if (base->parameters != NULL)	base->parameters->dispatch(numVertices,varying,locals);
+
+	if (base->sizeEntry == VARIABLE_WIDTH) {
+		size		=	varying[VARIABLE_WIDTH];
+		sizeStep	=	1;
+	} else {
+		assert(base->sizeEntry == VARIABLE_CONSTANTWIDTH);
+		size		=	varying[VARIABLE_CONSTANTWIDTH];
+		sizeStep	=	0;
+	}
+
+	for (i=numVertices;i>0;i--,P+=3,N+=3,dPdu+=3,dPdv+=3,hitP+=3,hitN+=3,size+=sizeStep) {
+
+		// u goes around the tube
+		movvv(N,hitN);
+		crossvv(tmp,N,dPdv);
+		if (dotvv(tmp,tmp) > C_EPSILON) {
+			normalizevf(tmp);
+			movvv(dPdu,tmp);
+		}
+
+		mulvf(tmp,dPdu,(*u++ - 0.5f)*size[0]);
+		subvv(P,hitP,tmp);
+	}
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CCubicCurve
@@ -290,6 +414,183 @@ void			CCurve::dice(CShadingContext *rasterizer) {
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCurve
+// Method				:	intersect
+// Description			:
+/// \brief					Intersect the curve with a ray
+// Return Value			:	-
+// Comments				:	Curves are never tesselated for raytracing. We recursively split the
+//							Bezier segment in the ray space until it is flat and intersect the pieces
+void			CCurve::intersect(CShadingContext *context,CRay *cRay) {
+
+	if (! (cRay->flags & attributes->flags) )	return;
+
+	if (attributes->flags & ATTRIBUTES_FLAGS_LOD) {
+		const float importance = attributes->lodImportance;
+		if (importance >= 0) {
+			if (cRay->jimp > importance)			return;
+		} else {
+			if ((1-cRay->jimp) >= -importance)		return;
+		}
+	}
+
+	vector		cv[4];			// The control vertices in the camera space
+	vector		rv[4];			// The control vertices in the ray space
+	vector		X,Y,tmp;
+	const float	*D			=	cRay->dir;
+	const float	maxWidth	=	max(base->width[0],base->width[1]);
+	float		L0;
+	int			depth,i;
+
+	// Get the curve at the ray time
+	bezier(cv,cRay->time);
+
+	// Create a coordinate system where the ray is the z axis
+	if (absf(D[0]) > absf(D[1]))	initv(X,-D[2],0,D[0]);
+	else							initv(X,0,D[2],-D[1]);
+	normalizevf(X);
+	crossvv(Y,D,X);
+
+	for (i=0;i<4;i++) {
+		subvv(tmp,cv[i],cRay->from);
+		rv[i][0]	=	dotvv(tmp,X);
+		rv[i][1]	=	dotvv(tmp,Y);
+		rv[i][2]	=	dotvv(tmp,D);
+	}
+
+	// Figure out how many times we need to split so that the pieces are flat
+	for (L0=0,i=0;i<2;i++) {
+		L0	=	max(L0,absf(rv[i][0] - 2*rv[i+1][0] + rv[i+2][0]));
+		L0	=	max(L0,absf(rv[i][1] - 2*rv[i+1][1] + rv[i+2][1]));
+		L0	=	max(L0,absf(rv[i][2] - 2*rv[i+1][2] + rv[i+2][2]));
+	}
+
+	depth	=	0;
+	if ((L0 > 0) && (maxWidth > 0)) {
+		const float	r0	=	logf(1.41421356f*6*L0 / (8*maxWidth*CURVE_SPLIT_TOLERANCE)) / logf(4);
+
+		depth	=	min(max((int) ceilf(r0),0),CURVE_MAX_SPLIT_DEPTH);
+	}
+
+	intersect(cRay,cv,rv,0,1,maxWidth*0.5f,depth);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCurve
+// Method				:	intersect
+// Description			:
+/// \brief					Intersect a piece of the curve with a ray
+// Return Value			:	-
+// Comments				:	cv is the entire segment in the camera space, rv is the piece
+//							[vs,ve] of it in the ray space, r is the maximum radius of the curve
+void			CCurve::intersect(CRay *cRay,const vector *cv,const vector *rv,float vs,float ve,float r,int depth) {
+	float	xmin,xmax,ymin,ymax,zmin,zmax;
+	int		i;
+
+	// Cull the piece against the ray
+	xmin	=	xmax	=	rv[0][0];
+	ymin	=	ymax	=	rv[0][1];
+	zmin	=	zmax	=	rv[0][2];
+	for (i=1;i<4;i++) {
+		xmin	=	min(xmin,rv[i][0]);	xmax	=	max(xmax,rv[i][0]);
+		ymin	=	min(ymin,rv[i][1]);	ymax	=	max(ymax,rv[i][1]);
+		zmin	=	min(zmin,rv[i][2]);	zmax	=	max(zmax,rv[i][2]);
+	}
+
+	if (((xmin - r) > 0) || ((xmax + r) < 0))				return;
+	if (((ymin - r) > 0) || ((ymax + r) < 0))				return;
+	if (((zmax + r) < cRay->tmin) || ((zmin - r) > cRay->t))	return;
+
+	if (depth > 0) {
+		vector		sv[7],mid;
+		const float	vm	=	(vs + ve)*0.5f;
+
+		// Split the piece in half (de Casteljau)
+		movvv(sv[0],rv[0]);
+		interpolatev(sv[1],rv[0],rv[1],0.5f);
+		interpolatev(mid,rv[1],rv[2],0.5f);
+		interpolatev(sv[5],rv[2],rv[3],0.5f);
+		interpolatev(sv[2],sv[1],mid,0.5f);
+		interpolatev(sv[4],mid,sv[5],0.5f);
+		interpolatev(sv[3],sv[2],sv[4],0.5f);
+		movvv(sv[6],rv[3]);
+
+		intersect(cRay,cv,sv,vs,vm,r,depth-1);
+		intersect(cRay,cv,sv+3,vm,ve,r,depth-1);
+		return;
+	}
+
+	// The piece is flat, find the closest point to the ray on it
+	const float	dx	=	rv[3][0] - rv[0][0];
+	const float	dy	=	rv[3][1] - rv[0][1];
+	const float	l	=	dx*dx + dy*dy;
+	float		w	=	(l > 0 ? -(rv[0][0]*dx + rv[0][1]*dy) / l : 0);
+
+	w	=	min(max(w,0),1);
+
+	// Evaluate the segment there
+	const float	v	=	vs + w*(ve - vs);
+	const float	iv	=	1 - v;
+	const float	b0	=	iv*iv*iv;
+	const float	b1	=	3*v*iv*iv;
+	const float	b2	=	3*v*v*iv;
+	const float	b3	=	v*v*v;
+	vector		P,dPdv,Pr,perp;
+
+	for (i=0;i<3;i++) {
+		P[i]	=	b0*cv[0][i] + b1*cv[1][i] + b2*cv[2][i] + b3*cv[3][i];
+		dPdv[i]	=	iv*iv*(cv[1][i] - cv[0][i]) + 2*v*iv*(cv[2][i] - cv[1][i]) + v*v*(cv[3][i] - cv[2][i]);
+	}
+
+	// The distance between the ray and the curve
+	subvv(Pr,P,cRay->from);
+	const float	z		=	dotvv(Pr,cRay->dir);
+	mulvf(perp,cRay->dir,-z);
+	addvv(perp,Pr);
+
+	const float	d2		=	dotvv(perp,perp);
+	const float	width	=	base->width[0]*iv + base->width[1]*v;
+	const float	hw		=	width*0.5f;
+
+	if (d2 >= hw*hw)	return;
+
+	// Tubes are hit in the front, ribbons face the ray
+	float	t	=	z;
+	if (attributes->flags & ATTRIBUTES_FLAGS_ROUND_CURVES)	t	-=	sqrtf(hw*hw - d2);
+
+	if ((t <= cRay->tmin) || (t >= cRay->t))	return;
+
+	// u goes across the curve
+	vector		side,N,tmp;
+	crossvv(side,cRay->dir,dPdv);
+	const float	sl	=	lengthv(side);
+
+	cRay->object	=	this;
+	cRay->t			=	t;
+	cRay->u			=	(sl > C_EPSILON ? 0.5f - dotvv(side,perp) / (sl*width) : 0.5f);
+	cRay->v			=	v;
+
+	// Compute the normal perpendicular to the curve
+	if (attributes->flags & ATTRIBUTES_FLAGS_ROUND_CURVES) {
+		mulvf(N,cRay->dir,t);
+		addvv(N,cRay->from);
+		subvv(N,P);
+	} else {
+		mulvf(N,cRay->dir,-1);
+	}
+
+	const float	tl	=	dotvv(dPdv,dPdv);
+	if (tl > C_EPSILON) {
+		mulvf(tmp,dPdv,dotvv(N,dPdv) / tl);
+		subvv(N,tmp);
+	}
+
+	if (dotvv(N,N) > C_EPSILON)	movvv(cRay->N,N);
+	else						mulvf(cRay->N,cRay->dir,-1);
+}
+
+
 
 
 
@@ -383,32 +684,40 @@ void			CCubicCurve::sample(int start,int numVertices,float **varying,float ***lo
 	const	float	*v1;
 	const	float	*v2;
 	const	float	*v3;
+	const	float	*cvs;
+	int				cvStep,cvStride;
 
 	intr	=	intrStart	=	(float *) alloca(numVertices*vertexSize*sizeof(float));
 
-	if ((variables->moving == FALSE) || (up & PARAMETER_BEGIN_SAMPLE)) {
-		v0		=	base->vertex;
-		v1		=	v0 + vs;
-		v2		=	v1 + vs;
-		v3		=	v2 + vs;
-	} else {
-		// Curves can not be raytraced, so we must be sampling at the beginning or the end
-		assert(up & PARAMETER_END_SAMPLE);
-		v0		=	base->vertex + vertexSize;
-		v1		=	v0 + vs;
-		v2		=	v1 + vs;
-		v3		=	v2 + vs;
-	}
-	
 	// We should start from beginning
 	assert(start == 0);
 
+	// Find the control vertices (per sample if we're raytraced and moving)
+	float			*buffer	=	NULL;
+	if ((variables->moving) && !(up & (PARAMETER_BEGIN_SAMPLE | PARAMETER_END_SAMPLE)))
+		buffer	=	(float *) alloca(numVertices*4*vertexSize*sizeof(float));
+	const float		*cvBase	=	curveVertices(base,4,numVertices,varying[VARIABLE_TIME],up,buffer,cvStep,cvStride);
+
+	// Save the ray hits before we overwrite them
+	float			*hits	=	NULL;
+	if (!(up & (PARAMETER_BEGIN_SAMPLE | PARAMETER_END_SAMPLE))) {
+		hits	=	(float *) alloca(numVertices*6*sizeof(float));
+		memcpy(hits,varying[VARIABLE_P],numVertices*3*sizeof(float));
+		memcpy(hits + numVertices*3,varying[VARIABLE_NG],numVertices*3*sizeof(float));
+	}
+
 	const	float	*v					=	varying[VARIABLE_V];
-	for (int i=numVertices;i>0;i--) {
+	cvs		=	cvBase;
+	for (int i=numVertices;i>0;i--,cvs+=cvStep) {
 		const	float	cv				=	*v++;
 		float			vb[4];
 		float			tmp[4];
 
+		v0		=	cvs;
+		v1		=	v0 + cvStride;
+		v2		=	v1 + cvStride;
+		v3		=	v2 + cvStride;
+
 		vb[3]	=	1;
 		vb[2]	=	cv;
 		vb[1]	=	cv*cv;
@@ -437,12 +746,18 @@ void			CCubicCurve::sample(int start,int numVertices,float **varying,float ***lo
 	float		*N		=	varying[VARIABLE_NG];
 
 	v	=	varying[VARIABLE_V];
+	cvs	=	cvBase;
 
-	for (int i=numVertices;i>0;i--,P+=3,dPdu+=3,dPdv+=3,N+=3) {
+	for (int i=numVertices;i>0;i--,P+=3,dPdu+=3,dPdv+=3,N+=3,cvs+=cvStep) {
 		const	float	cv	= *v++;
 		float			vb[4];
 		float			tmp[4];
 
+		v0		=	cvs;
+		v1		=	v0 + cvStride;
+		v2		=	v1 + cvStride;
+		v3		=	v2 + cvStride;
+
 		vb[3]	=	0;
 		vb[2]	=	1;
 		vb[1]	=	2*cv;
@@ -495,6 +810,8 @@ void			CCubicCurve::sample(int start,int numVertices,float **varying,float ***lo
 		crossvv(N,dPdv,dPdu);
 		normalizevf(dPdu);
 	}
+
+	if (hits != NULL)	restoreHits(numVertices,varying,locals,hits);
 	
 	// Compute dPdtime
 	if (up & PARAMETER_DPDTIME) {
@@ -560,6 +877,44 @@ void			CCubicCurve::splitToChildren(CShadingContext *rasterizer) {
 	rasterizer->drawObject(c1);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCubicCurve
+// Method				:	bezier
+// Description			:
+/// \brief					Get the Bezier control vertices of the curve
+// Return Value			:	-
+// Comments				:
+void			CCubicCurve::bezier(vector *cv,float time) const {
+	const	float		*vBasis		=	attributes->vBasis;
+	const	CVertexData	*variables	=	base->variables;
+	const	int			vertexSize	=	variables->vertexSize;
+	vector				v[4];
+	int					i,j;
+
+	// Find the control vertices at the time
+	for (i=0;i<4;i++) {
+		if (variables->moving) {
+			const float	*src	=	base->vertex + i*vertexSize*2;
+
+			interpolatev(v[i],src,src + vertexSize,time);
+		} else {
+			movvv(v[i],base->vertex + i*vertexSize);
+		}
+	}
+
+	// Convert them to the Bezier basis
+	for (i=0;i<3;i++) {
+		float	c[4];	// The power basis coefficients (c[0] is for v^3)
+
+		for (j=0;j<4;j++)	c[j]	=	vBasis[element(0,j)]*v[0][i] + vBasis[element(1,j)]*v[1][i] + vBasis[element(2,j)]*v[2][i] + vBasis[element(3,j)]*v[3][i];
+
+		cv[0][i]	=	c[3];
+		cv[1][i]	=	c[3] + c[2] / (float) 3;
+		cv[2][i]	=	c[3] + (2*c[2] + c[1]) / (float) 3;
+		cv[3][i]	=	c[3] + c[2] + c[1] + c[0];
+	}
+}
+
 
 
 
@@ -630,23 +985,34 @@ void			CLinearCurve::sample(int start,int numVertices,float **varying,float ***l
 	const	int		numSavedVertices	=	numVertices;
 	const	float	*v0;
 	const	float	*v1;
+	const	float	*cvs;
+	int				cvStep,cvStride;
 
 	intr	=	intrStart	=	(float *) alloca(numVertices*vertexSize*sizeof(float));
 
-	if ((variables->moving == FALSE) || (up & PARAMETER_BEGIN_SAMPLE)) {
-		v0					=	base->vertex;
-		v1					=	v0 + vs;
-	} else {
-		v0					=	base->vertex + vertexSize;
-		v1					=	v0 + vs;
-	}
-	
 	assert(start == 0);
 
+	// Find the control vertices (per sample if we're raytraced and moving)
+	float			*buffer	=	NULL;
+	if ((variables->moving) && !(up & (PARAMETER_BEGIN_SAMPLE | PARAMETER_END_SAMPLE)))
+		buffer	=	(float *) alloca(numVertices*2*vertexSize*sizeof(float));
+	const float		*cvBase	=	curveVertices(base,2,numVertices,varying[VARIABLE_TIME],up,buffer,cvStep,cvStride);
+
+	// Save the ray hits before we overwrite them
+	float			*hits	=	NULL;
+	if (!(up & (PARAMETER_BEGIN_SAMPLE | PARAMETER_END_SAMPLE))) {
+		hits	=	(float *) alloca(numVertices*6*sizeof(float));
+		memcpy(hits,varying[VARIABLE_P],numVertices*3*sizeof(float));
+		memcpy(hits + numVertices*3,varying[VARIABLE_NG],numVertices*3*sizeof(float));
+	}
+
 	const	float	*v = varying[VARIABLE_V];
-	for (j=numVertices;j>0;j--) {
+	for (cvs=cvBase,j=numVertices;j>0;j--,cvs+=cvStep) {
 		const	float	cv	=	*v++;
 
+		v0		=	cvs;
+		v1		=	v0 + cvStride;
+
 		*intr++	=	(v0[0]*(1.0f-cv) + v1[0]*cv);
 		*intr++	=	(v0[1]*(1.0f-cv) + v1[1]*cv);
 		*intr++	=	(v0[2]*(1.0f-cv) + v1[2]*cv);
@@ -665,12 +1031,16 @@ void			CLinearCurve::sample(int start,int numVertices,float **varying,float ***l
 	const float	*P		=	varying[VARIABLE_P];
 	float		*N		=	varying[VARIABLE_NG];
 
-	for (j=numVertices;j>0;j--,P+=3,dPdu+=3,dPdv+=3,N+=3) {
+	for (cvs=cvBase,j=numVertices;j>0;j--,P+=3,dPdu+=3,dPdv+=3,N+=3,cvs+=cvStep) {
+		v0		=	cvs;
+		v1		=	v0 + cvStride;
 		subvv(dPdv,v1,v0);
 		crossvv(dPdu,dPdv,P);
 		crossvv(N,dPdv,dPdu);
 		normalizevf(dPdu);
 	}
+
+	if (hits != NULL)	restoreHits(numVertices,varying,locals,hits);
 	
 	// Compute dPdtime
 	if (up & PARAMETER_DPDTIME) {
@@ -723,6 +1093,29 @@ void			CLinearCurve::splitToChildren(CShadingContext *rasterizer) {
 	rasterizer->drawObject(c1);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CLinearCurve
+// Method				:	bezier
+// Description			:
+/// \brief					Get the Bezier control vertices of the curve
+// Return Value			:	-
+// Comments				:	The line is elevated to a cubic so it can share the intersection code
+void			CLinearCurve::bezier(vector *cv,float time) const {
+	const	CVertexData	*variables	=	base->variables;
+	const	int			vertexSize	=	variables->vertexSize;
+
+	if (variables->moving) {
+		interpolatev(cv[0],base->vertex,base->vertex + vertexSize,time);
+		interpolatev(cv[3],base->vertex + vertexSize*2,base->vertex + vertexSize*3,time);
+	} else {
+		movvv(cv[0],base->vertex);
+		movvv(cv[3],base->vertex + vertexSize);
+	}
+
+	interpolatev(cv[1],cv[0],cv[3],1 / (float) 3);
+	interpolatev(cv[2],cv[0],cv[3],2 / (float) 3);
+}
+
 
 
 
@@ -736,6 +1129,52 @@ void			CLinearCurve::splitToChildren(CShadingContext *rasterizer) {
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	curveWidth
+// Description			:
+/// \brief					Find the width at the two ends of a curve segment
+// Return Value			:	-
+// Comments				:	maxSize is the maximum half width, used when there are no widths.
+//							vertices are the 2 (linear) or 4 (cubic, vBasis != NULL) control
+//							vertices of the segment
+static	void	curveWidth(float *width,const CPl *pl,const CPlParameter *sizeParameter,int curve,int varying0,int varying1,const int *vertices,const float *vBasis,float maxSize) {
+	width[0]	=	width[1]	=	maxSize*2;
+
+	if (sizeParameter == NULL)	return;
+
+	const float	*data	=	pl->data0 + sizeParameter->index;
+
+	switch(sizeParameter->container) {
+	case CONTAINER_CONSTANT:
+		width[0]	=	width[1]	=	data[0];
+		break;
+	case CONTAINER_UNIFORM:
+		width[0]	=	width[1]	=	data[curve];
+		break;
+	case CONTAINER_VARYING:
+		width[0]	=	data[varying0];
+		width[1]	=	data[varying1];
+		break;
+	case CONTAINER_VERTEX:
+		if (vBasis != NULL) {
+			float	c[4];	// The power basis coefficients (c[0] is for v^3)
+			int		j;
+
+			// Evaluate the basis at the ends of the segment as the dicing does
+			for (j=0;j<4;j++)	c[j]	=	vBasis[element(0,j)]*data[vertices[0]] + vBasis[element(1,j)]*data[vertices[1]] + vBasis[element(2,j)]*data[vertices[2]] + vBasis[element(3,j)]*data[vertices[3]];
+
+			width[0]	=	c[3];
+			width[1]	=	c[3] + c[2] + c[1] + c[0];
+		} else {
+			width[0]	=	data[vertices[0]];
+			width[1]	=	data[vertices[1]];
+		}
+		break;
+	default:
+		break;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	CCurveMesh
 // Description			:
@@ -748,6 +1187,8 @@ CCurveMesh::CCurveMesh(CAttributes *a,CXform *x,CPl *c,int d,int nv,int nc,int *
 
 	atomicIncrement(&stats.numGprims);
 
+	flags			|=	OBJECT_EXPAND_INSTANCE;		// We shade the rays ourselves
+
 	// Attach to the PL
 	pl				=	c;
 
@@ -900,6 +1341,18 @@ void	CCurveMesh::instantiate(CAttributes *a,CXform *x,CRendererContext *c) const
 	c->addObject(new CCurveMesh(a,nx,pl->clone(a),degree,numVertices,numCurves,nverts,wrap));
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CCurveMesh
+// Method				:	intersect
+// Description			:
+/// \brief					Intersect with a ray
+// Return Value			:	-
+// Comments				:	The curve segments become the children, which intersect the rays themselves
+void	CCurveMesh::intersect(CShadingContext *context,CRay *ray) {
+
+	if (children == NULL)	create(context);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CCurveMesh
 // Method				:	dice
@@ -944,6 +1397,7 @@ void	CCurveMesh::create(CShadingContext *context) {
 	pl->collect(vertexSize,vertex,CONTAINER_VERTEX,context->threadMemory);	// Obtain the vertex data
 
 	// Multiply the curve width by the expansion in the coordinate system
+	const CPlParameter	*sizeParameter	=	NULL;
 	{
 		const float expansion	=	powf(fabsf(determinantm(xform->from)), 1.0f / 3.0f);
 		
@@ -951,6 +1405,8 @@ void	CCurveMesh::create(CShadingContext *context) {
 			const CVariable	*cVar	=	pl->parameters[i].variable;
 
 			if (cVar == sizeVariable) {
+				sizeParameter	=	pl->parameters + i;
+
 				const	int	np		=	pl->parameters[i].numItems;
 				float		*vertex	=	pl->data0 + pl->parameters[i].index;
 
@@ -984,10 +1440,14 @@ void	CCurveMesh::create(CShadingContext *context) {
 			const	int	nvars	=	ncsegs + 1 - wrap;
 
 			for (j=0;j<ncsegs;j++,k++) {
-				float			*v0		=	baseVertex + (cVertex+(j*attributes->vStep + 0) % nverts[i])*vertexSize;
-				float			*v1		=	baseVertex + (cVertex+(j*attributes->vStep + 1) % nverts[i])*vertexSize;
-				float			*v2		=	baseVertex + (cVertex+(j*attributes->vStep + 2) % nverts[i])*vertexSize;
-				float			*v3		=	baseVertex + (cVertex+(j*attributes->vStep + 3) % nverts[i])*vertexSize;
+				const int		vertices[4]	=	{	cVertex+(j*attributes->vStep + 0) % nverts[i],
+												cVertex+(j*attributes->vStep + 1) % nverts[i],
+												cVertex+(j*attributes->vStep + 2) % nverts[i],
+												cVertex+(j*attributes->vStep + 3) % nverts[i]	};
+				float			*v0		=	baseVertex + vertices[0]*vertexSize;
+				float			*v1		=	baseVertex + vertices[1]*vertexSize;
+				float			*v2		=	baseVertex + vertices[2]*vertexSize;
+				float			*v3		=	baseVertex + vertices[3]*vertexSize;
 				CParameter		*parameters;
 				CCurve			*cCurve;
 				CCurve::CBase	*base	=	new CCurve::CBase;
@@ -1002,6 +1462,7 @@ void	CCurveMesh::create(CShadingContext *context) {
 				base->variables		=	variables;
 				base->sizeEntry		=	sizeVariable->entry;
 				base->parameters	=	parameters;
+				curveWidth(base->width,pl,sizeParameter,i,t+j,t+(j+1)%nvars,vertices,attributes->vBasis,maxSize);
 				base->vertex		=	new float[vertexSize*4];
 				memcpy(base->vertex + 0*vertexSize,v0,vertexSize*sizeof(float));
 				memcpy(base->vertex + 1*vertexSize,v1,vertexSize*sizeof(float));
@@ -1028,8 +1489,9 @@ void	CCurveMesh::create(CShadingContext *context) {
 			const	int	nvars	=	nverts[i];
 
 			for (j=0;j<ncsegs;j++,k++) {
-				float			*v0		=	baseVertex + (cVertex+(j + 0) % nverts[i])*vertexSize;
-				float			*v1		=	baseVertex + (cVertex+(j + 1) % nverts[i])*vertexSize;
+				const int		vertices[2]	=	{	cVertex+(j + 0) % nverts[i],	cVertex+(j + 1) % nverts[i]	};
+				float			*v0		=	baseVertex + vertices[0]*vertexSize;
+				float			*v1		=	baseVertex + vertices[1]*vertexSize;
 				CParameter		*parameters;
 				CCurve			*cCurve;
 				CCurve::CBase	*base	=	new CCurve::CBase;
@@ -1044,6 +1506,7 @@ void	CCurveMesh::create(CShadingContext *context) {
 				base->variables		=	variables;
 				base->sizeEntry		=	sizeVariable->entry;
 				base->parameters	=	parameters;
+				curveWidth(base->width,pl,sizeParameter,i,t+j,t+(j+1)%nvars,vertices,NULL,maxSize);
 				base->vertex		=	new float[vertexSize*2];
 				memcpy(base->vertex + 0*vertexSize,v0,vertexSize*sizeof(float));
 				memcpy(base->vertex + 1*vertexSize,v1,vertexSize*sizeof(float));
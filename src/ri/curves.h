@@ -64,6 +64,7 @@ public:
 
 						int				sizeEntry;		// The size variable entry
 						float			maxSize;		// The maximum size of the curve
+						float			width[2];		// The width at the two ends of the curve (used for raytracing)
 						CVertexData		*variables;		// The variables for the curve
 						CParameter		*parameters;	// Da parameters
 						float			*vertex;		// Da vertex data
@@ -74,8 +75,10 @@ public:
 					~CCurve();
 
 					// Object interface
+	void			intersect(CShadingContext *,CRay *);
 	void			dice(CShadingContext *);
 	void			instantiate(CAttributes *,CXform *,CRendererContext *) const	{	assert(FALSE);	}
+	void			shade(CShadingContext *,int,CRay **);
 
 					// Surface interface
 	int				moving() const													{	return base->variables->moving;	}
@@ -83,6 +86,10 @@ public:
 
 protected:
 	virtual	void	splitToChildren(CShadingContext *)	=	0;
+	virtual	void	bezier(vector *,float) const		=	0;	// Get the Bezier control vertices at a time
+
+	void			intersect(CRay *,const vector *,const vector *,float,float,float,int);
+	void			restoreHits(int,float **,float ***,const float *) const;
 
 	CBase			*base;
 	float			vmin,vmax;		// The parametric range of the curves
@@ -104,6 +111,7 @@ public:
 
 protected:
 	void			splitToChildren(CShadingContext *);
+	void			bezier(vector *,float) const;
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -121,6 +129,7 @@ public:
 
 protected:
 	void			splitToChildren(CShadingContext *);
+	void			bezier(vector *,float) const;
 };
 
 
@@ -136,7 +145,7 @@ public:
 							~CCurveMesh();
 
 							// Object interface
-		void				intersect(CShadingContext *,CRay *)	{	}
+		void				intersect(CShadingContext *,CRay *);
 		void				dice(CShadingContext *rasterizer);
 		void				instantiate(CAttributes *,CXform *,CRendererContext *) const;
 		
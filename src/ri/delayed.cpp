@@ -32,8 +32,10 @@
 
 #include "delayed.h"
 #include "stats.h"
+#include "profiler.h"
 #include "renderer.h"
 #include "rendererContext.h"
+#include "shading.h"
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -67,6 +69,9 @@ CDelayedObject::CDelayedObject(CAttributes *a,CXform *x,const float *bmin,const
 
 	dataRefCount[0]++;
 
+	// We don't know what the procedural will create, so instances of us are expanded
+	flags						|=	OBJECT_EXPAND_INSTANCE;
+
 	xform->transformBound(this->bmin,this->bmax);
 	makeBound(this->bmin,this->bmax);
 }
@@ -99,7 +104,7 @@ void	CDelayedObject::intersect(CShadingContext *context,CRay *cRay) {
 		
 	// Process the object
 	if (processed == FALSE) {
-		osLock(CRenderer::delayedMutex);
+		profilerLock(CRenderer::delayedMutex,context->thread,"delayedMutex");
 		if (processed == FALSE) {
 			CRenderer::context->processDelayedObject(context,this,subdivisionFunction,data,bmin,bmax);
 			processed	=	TRUE;
@@ -120,7 +125,7 @@ void	CDelayedObject::dice(CShadingContext *r) {
 	
 	// Process the object
 	if (processed == FALSE) {
-		osLock(CRenderer::delayedMutex);
+		profilerLock(CRenderer::delayedMutex,r->thread,"delayedMutex");
 		if (processed == FALSE) {
 			CRenderer::context->processDelayedObject(r,this,subdivisionFunction,data,bmin,bmax);
 			processed	=	TRUE;
@@ -166,12 +171,18 @@ void	CDelayedObject::instantiate(CAttributes *a,CXform *x,CRendererContext *c) c
 /// \brief					Ctor
 // Return Value			:	-
 // Comments				:
-CDelayedInstance::CDelayedInstance(CAttributes *a,CXform *x,CObject *in) : CObject(a,x) {
+CDelayedInstance::CDelayedInstance(CAttributes *a,CXform *x,CObject *in,CInstanceMaster *m) : CObject(a,x) {
 	atomicIncrement(&stats.numDelayeds);
 
 	instance		=	in;
+	master			=	m;
 	processed		=	FALSE;
 
+	if (master != NULL) {
+		master->attach();
+		flags		|=	OBJECT_INSTANCE;
+	}
+
 	initv(bmin,C_INFINITY);
 	initv(bmax,-C_INFINITY);
 
@@ -179,6 +190,9 @@ CDelayedInstance::CDelayedInstance(CAttributes *a,CXform *x,CObject *in) : CObje
 	for (cObject=instance;cObject!=NULL;cObject=cObject->sibling) {
 		addBox(bmin,bmax,cObject->bmin);
 		addBox(bmin,bmax,cObject->bmax);
+
+		// If this is nested in a shared instance, it must be expanded as well
+		flags		|=	(cObject->flags & OBJECT_EXPAND_INSTANCE);
 	}
 
 	xform->transformBound(this->bmin,this->bmax);
@@ -194,6 +208,8 @@ CDelayedInstance::CDelayedInstance(CAttributes *a,CXform *x,CObject *in) : CObje
 // Comments				:
 CDelayedInstance::~CDelayedInstance() {
 	atomicDecrement(&stats.numDelayeds);
+
+	if (master != NULL)	master->detach();
 }
 
 
@@ -204,16 +220,107 @@ CDelayedInstance::~CDelayedInstance() {
 // Return Value			:	-
 // Comments				:
 void	CDelayedInstance::intersect(CShadingContext *context,CRay *cRay) {
-	
-	// Process the instance
-	if (processed == FALSE) {
-		osLock(CRenderer::delayedMutex);
+
+	// Expanded instances are processed into children
+	if (master == NULL) {
 		if (processed == FALSE) {
-			CRenderer::context->processDelayedInstance(context,this);
-			processed	=	TRUE;
+			profilerLock(CRenderer::delayedMutex,context->thread,"delayedMutex");
+			if (processed == FALSE) {
+				CRenderer::context->processDelayedInstance(context,this);
+				processed	=	TRUE;
+			}
+			osUnlock(CRenderer::delayedMutex);
+		}
+
+		return;
+	}
+
+	// Create the shared hierarchy
+	if (master->root == NULL) {
+		profilerLock(CRenderer::delayedMutex,context->thread,"delayedMutex");
+		if (master->root == NULL) {
+			CRenderer::context->processInstanceMaster(context,master);
 		}
 		osUnlock(CRenderer::delayedMutex);
 	}
+
+	// Save the camera space ray and the current hit record
+	CSurface			*object		=	cRay->object;
+	CDelayedInstance	*instance	=	cRay->instance;
+	CTesselationPatch	*patch		=	cRay->patch;
+	const float			u			=	cRay->u;
+	const float			v			=	cRay->v;
+	const float			t			=	cRay->t;
+	const float			tmin		=	cRay->tmin;
+	const float			db			=	cRay->db;
+	vector				from,dir,N;
+	dvector				invDir;
+
+	movvv(N,cRay->N);
+	movvv(from,cRay->from);
+	movvv(dir,cRay->dir);
+	movvv(invDir,cRay->invDir);
+
+	// Transform the ray into the object space, the length of the direction scales the distances
+	mulmp(cRay->from,xform->to,from);
+	mulmv(cRay->dir,xform->to,dir);
+
+	const float	l			=	lengthv(cRay->dir);
+	const float	il			=	1 / l;
+
+	mulvf(cRay->dir,il);
+	const float	tObject		=	(t < C_INFINITY ? t*l : C_INFINITY);
+
+	cRay->t					=	tObject;
+	cRay->tmin				=	tmin*l;
+	cRay->db				=	db*l;
+	cRay->invDir[0]			=	1.0 / (double) cRay->dir[0];
+	cRay->invDir[1]			=	1.0 / (double) cRay->dir[1];
+	cRay->invDir[2]			=	1.0 / (double) cRay->dir[2];
+
+	context->trace(cRay,master->root);
+
+	// Transform the intersection back into the camera space (instances of the same
+	// master share the surfaces, so a hit is decided by the distance, not the object)
+	if (cRay->t < tObject) {
+		vector	tmp;
+
+		mulmn(tmp,xform->to,cRay->N);
+		movvv(cRay->N,tmp);
+		cRay->t				=	cRay->t*il;
+		cRay->instance		=	this;
+	} else {
+		cRay->t				=	t;
+		cRay->u				=	u;
+		cRay->v				=	v;
+		cRay->object		=	object;
+		cRay->instance		=	instance;
+		cRay->patch			=	patch;
+		movvv(cRay->N,N);
+	}
+
+	movvv(cRay->from,from);
+	movvv(cRay->dir,dir);
+	movvv(cRay->invDir,invDir);
+	cRay->tmin				=	tmin;
+	cRay->db				=	db;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CDelayedInstance
+// Method				:	shade
+// Description			:
+/// \brief					Shade the rays that hit an object in the master
+// Return Value			:	-
+// Comments				:
+void	CDelayedInstance::shade(CShadingContext *context,CSurface *surface,int numRays,CRay **rays) {
+	CInstanceSurface	*cSurface	=	new CInstanceSurface(attributes,xform,surface);
+
+	cSurface->attach();
+	cSurface->shade(context,numRays,rays);
+	cSurface->detach();
 }
 
 
@@ -224,10 +331,31 @@ void	CDelayedInstance::intersect(CShadingContext *context,CRay *cRay) {
 // Return Value			:	-
 // Comments				:
 void	CDelayedInstance::dice(CShadingContext *r) {
+
+	// The raytracer uses the shared hierarchy, so the expanded objects are only rasterized
+	if (master != NULL) {
+		CObject	*objects,*cObject,*nObject;
+
+		profilerLock(CRenderer::delayedMutex,r->thread,"delayedMutex");
+		objects		=	CRenderer::context->expandDelayedInstance(this);
+		osUnlock(CRenderer::delayedMutex);
+
+		for (cObject=objects;cObject!=NULL;cObject=nObject) {
+			nObject	=	cObject->sibling;
+
+			cObject->attach();
+			
+			r->drawObject(cObject);
+			
+			cObject->detach();
+		}
+
+		return;
+	}
 	
 	// Process the instance
 	if (processed == FALSE) {
-		osLock(CRenderer::delayedMutex);
+		profilerLock(CRenderer::delayedMutex,r->thread,"delayedMutex");
 		if (processed == FALSE) {
 			CRenderer::context->processDelayedInstance(r,this);
 			processed	=	TRUE;
@@ -255,3 +383,129 @@ void	CDelayedInstance::instantiate(CAttributes *a,CXform *x,CRendererContext *c)
 	c->addObject(new CDelayedInstance(a,nx,instance));
 }
 
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceMaster
+// Method				:	CInstanceMaster
+// Description			:
+/// \brief					Ctor
+// Return Value			:	-
+// Comments				:
+CInstanceMaster::CInstanceMaster(CAttributes *a,CObject *o) {
+	attributes		=	a;
+	attributes->attach();
+	objects			=	o;
+	root			=	NULL;
+	next			=	NULL;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceMaster
+// Method				:	~CInstanceMaster
+// Description			:
+/// \brief					Dtor
+// Return Value			:	-
+// Comments				:
+CInstanceMaster::~CInstanceMaster() {
+	if (root != NULL)	root->destroy();
+
+	attributes->detach();
+}
+
+
+
+
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Method				:	CInstanceSurface
+// Description			:
+/// \brief					Ctor
+// Return Value			:	-
+// Comments				:
+CInstanceSurface::CInstanceSurface(CAttributes *a,CXform *x,CSurface *s) : CSurface(a,x) {
+	surface			=	s;
+	surface->attach();
+
+	movvv(bmin,surface->bmin);
+	movvv(bmax,surface->bmax);
+	xform->transformBound(bmin,bmax);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Method				:	~CInstanceSurface
+// Description			:
+/// \brief					Dtor
+// Return Value			:	-
+// Comments				:
+CInstanceSurface::~CInstanceSurface() {
+	surface->detach();
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Method				:	moving
+// Description			:	See object.h
+// Return Value			:	-
+// Comments				:
+int		CInstanceSurface::moving() const {
+	return surface->moving();
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Method				:	sample
+// Description			:	See object.h
+// Return Value			:	-
+// Comments				:	The surface samples itself in the object space, we transform the
+//							geometric variables it computed into the camera space
+void	CInstanceSurface::sample(int start,int numVertices,float **varying,float ***locals,unsigned int &up) const {
+	const unsigned int	requested	=	up;
+	const float			*from		=	xform->from;
+	const float			*to			=	xform->to;
+	float				*dest;
+	int					i;
+
+	surface->sample(start,numVertices,varying,locals,up);
+
+	const unsigned int	computed	=	requested & ~up;
+
+	if (computed & PARAMETER_P) {
+		for (dest=varying[VARIABLE_P]+start*3,i=numVertices;i>0;i--,dest+=3)			mulmp(dest,from,dest);
+	}
+
+	if (computed & PARAMETER_DPDU) {
+		for (dest=varying[VARIABLE_DPDU]+start*3,i=numVertices;i>0;i--,dest+=3)		mulmv(dest,from,dest);
+	}
+
+	if (computed & PARAMETER_DPDV) {
+		for (dest=varying[VARIABLE_DPDV]+start*3,i=numVertices;i>0;i--,dest+=3)		mulmv(dest,from,dest);
+	}
+
+	if (computed & PARAMETER_DPDTIME) {
+		for (dest=varying[VARIABLE_DPDTIME]+start*3,i=numVertices;i>0;i--,dest+=3)	mulmv(dest,from,dest);
+	}
+
+	if (computed & PARAMETER_NG) {
+		for (dest=varying[VARIABLE_NG]+start*3,i=numVertices;i>0;i--,dest+=3)		mulmn(dest,to,dest);
+	}
+
+	if (computed & PARAMETER_N & ~PARAMETER_NG) {
+		for (dest=varying[VARIABLE_N]+start*3,i=numVertices;i>0;i--,dest+=3)			mulmn(dest,to,dest);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Method				:	interpolate
+// Description			:	See object.h
+// Return Value			:	-
+// Comments				:
+void	CInstanceSurface::interpolate(int numVertices,float **varying,float ***locals) const {
+	surface->interpolate(numVertices,varying,locals);
+}
@@ -82,25 +82,69 @@ public:
 };
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceMaster
+// Description			:
+/// \brief					Holds the object space hierarchy shared by the raytraced instances of an object
+// Comments				:	The hierarchy is created when the first ray hits one of the instances
+class	CInstanceMaster : public CRefCounter {
+public:
+							CInstanceMaster(CAttributes *,CObject *);
+							~CInstanceMaster();
+
+	CAttributes				*attributes;			// The attributes of the instances
+	CObject					*objects;				// The instanced objects
+	CObject					* volatile root;		// The shared hierarchy
+	CInstanceMaster			*next;					// The next master of the same objects (with different attributes)
+};
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CDelayedInstance
 // Description			:
 /// \brief					Contains an instance object
-// Comments				:
+// Comments				:	If there is a master, rays are transformed into the object space
+//							and traced through its hierarchy instead of expanding the instance
 class	CDelayedInstance : public CObject {
 public:
-							CDelayedInstance(CAttributes *,CXform *,CObject *);
+							CDelayedInstance(CAttributes *,CXform *,CObject *,CInstanceMaster *master=NULL);
 							~CDelayedInstance();
 
 							// Object interface
 	void					intersect(CShadingContext *,CRay *);
 	void					dice(CShadingContext *);
 	void					instantiate(CAttributes *,CXform *,CRendererContext *) const;
+
+							// Shade the rays that hit an object in the master
+	void					shade(CShadingContext *,CSurface *,int,CRay **);
 	
 	CObject					*instance;
+	CInstanceMaster			*master;
 	int						processed;
 };
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CInstanceSurface
+// Description			:
+/// \brief					Transforms an object space surface of a master into the camera space
+// Comments				:	This is only created temporarily to shade the rays that hit a shared instance
+class	CInstanceSurface : public CSurface {
+public:
+							CInstanceSurface(CAttributes *,CXform *,CSurface *);
+							~CInstanceSurface();
+
+							// Object interface
+	void					instantiate(CAttributes *,CXform *,CRendererContext *) const	{	assert(FALSE);	}
+
+							// Surface interface
+	int						moving() const;
+	void					sample(int,int,float **,float ***,unsigned int &) const;
+	void					interpolate(int,float **,float ***) const;
+
+	CSurface				*surface;
+};
+
+
 #endif
 
@@ -63,60 +63,85 @@ CDepository::~CDepository() {
 // Return Value			:	-
 // Comments				:
 void		CDepository::lookup(float *C,const float *P,const float *N) {
-	int						numFound	=	0;
-	int						maxFound	=	5;
-	const CDepositorySample	**indices	=	(const CDepositorySample **)	alloca((maxFound+1)*sizeof(CDepositorySample *)); 
-	float					*distances	=	(float	*)						alloca((maxFound+1)*sizeof(float)); 
-	CLookup					l;
-	float					totalWeight;
-
-	distances[0]	=	C_INFINITY;
-
-	l.maxFound		=	maxFound;
-	l.numFound		=	0;
-	movvv(l.P,P);
-	movvv(l.N,N);
-	l.gotHeap		=	FALSE;
-	l.indices		=	indices;
-	l.distances		=	distances;
-
-	CMap<CDepositorySample>::lookupWithN(&l,1);
-
-	numFound		=	l.numFound;
-
-	totalWeight		=	0;
-
-	C[0]			=	0;
-	C[1]			=	0;
-	C[2]			=	0;
-	C[3]			=	0;
-
-	for (int i=1;i<=numFound;i++) {
-		const		CDepositorySample	*p	=	indices[i];
-		const float	t1						=	distances[i] / (distances[0] + C_EPSILON);
-		const float	t2						=	sqrtf(max(1 - dotvv(N,p->N),0));
-		float		weight					=	1 / (t1 + 10*t2 + C_EPSILON);
-
-		if (weight < C_EPSILON) weight = C_EPSILON;
-
-		assert(distances[i] <= distances[0]);
-
-		C[0]		+=	p->C[0]*weight;
-		C[1]		+=	p->C[1]*weight;
-		C[2]		+=	p->C[2]*weight;
-		C[3]		+=	p->C[3]*weight;
-		totalWeight	+=	weight;						
-	}
-
-	if (totalWeight > 0) {
-		assert(totalWeight > 0);
+	lookup(1,C,P,N);
+}
 
-		// Normalize the sum
-		totalWeight		=	1 / totalWeight;
-		C[0]			*=	totalWeight;
-		C[1]			*=	totalWeight;
-		C[2]			*=	totalWeight;
-		C[3]			*=	totalWeight;
+///////////////////////////////////////////////////////////////////////
+// Class				:	CDepository
+// Method				:	lookup
+// Description			:
+/// \brief					Lookup a number of points at once
+// Return Value			:	-
+// Comments				:	C holds 4 floats per lookup
+void		CDepository::lookup(int numLookups,float *C,const float *P,const float *N) {
+	const int				maxFound	=	5;
+	const CDepositorySample	**indices	=	(const CDepositorySample **)	alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(CDepositorySample *)); 
+	float					*distances	=	(float	*)						alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(float)); 
+	CLookup					lookups[MAP_BATCH_SIZE];
+	CLookup					*active[MAP_BATCH_SIZE];
+	float					totalWeight;
+	int						i,k;
+
+	while(numLookups > 0) {
+		const int	numBatch	=	min(numLookups,MAP_BATCH_SIZE);
+
+		for (k=0;k<numBatch;k++) {
+			CLookup	*l		=	lookups + k;
+
+			l->distances	=	distances + k*(maxFound+1);
+			l->indices		=	indices + k*(maxFound+1);
+			l->distances[0]	=	C_INFINITY;
+			l->maxFound		=	maxFound;
+			l->numFound		=	0;
+			l->gotHeap		=	FALSE;
+			movvv(l->P,P + k*3);
+			movvv(l->N,N + k*3);
+			active[k]		=	l;
+		}
+
+		CMap<CDepositorySample>::lookupBatch(active,numBatch);
+
+		for (k=0;k<numBatch;k++,C+=4,N+=3) {
+			const CLookup	*l	=	lookups + k;
+
+			totalWeight		=	0;
+
+			C[0]			=	0;
+			C[1]			=	0;
+			C[2]			=	0;
+			C[3]			=	0;
+
+			for (i=1;i<=l->numFound;i++) {
+				const		CDepositorySample	*p	=	l->indices[i];
+				const float	t1						=	l->distances[i] / (l->distances[0] + C_EPSILON);
+				const float	t2						=	sqrtf(max(1 - dotvv(N,p->N),0));
+				float		weight					=	1 / (t1 + 10*t2 + C_EPSILON);
+
+				if (weight < C_EPSILON) weight = C_EPSILON;
+
+				assert(l->distances[i] <= l->distances[0]);
+
+				C[0]		+=	p->C[0]*weight;
+				C[1]		+=	p->C[1]*weight;
+				C[2]		+=	p->C[2]*weight;
+				C[3]		+=	p->C[3]*weight;
+				totalWeight	+=	weight;						
+			}
+
+			if (totalWeight > 0) {
+				assert(totalWeight > 0);
+
+				// Normalize the sum
+				totalWeight		=	1 / totalWeight;
+				C[0]			*=	totalWeight;
+				C[1]			*=	totalWeight;
+				C[2]			*=	totalWeight;
+				C[3]			*=	totalWeight;
+			}
+		}
+
+		P			+=	numBatch*3;
+		numLookups	-=	numBatch;
 	}
 }
 
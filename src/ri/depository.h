@@ -57,6 +57,7 @@ public:
 				~CDepository();
 
 	void		lookup(float *,const float *,const float *);
+	void		lookup(int,float *,const float *,const float *);
 };
 
 
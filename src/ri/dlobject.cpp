@@ -48,6 +48,8 @@
 CDLObject::CDLObject(CAttributes *a,CXform *x,void *handle,void *data,const float *bmi,const float *bma,dloInitFunction initFunction,dloIntersectFunction intersectFunction,dloTiniFunction tiniFunction) : CSurface(a,x) {
 	atomicIncrement(&stats.numGprims);
 
+	flags					|=	OBJECT_EXPAND_INSTANCE;		// We shade the rays ourselves
+
 	this->handle			=	handle;
 	this->initFunction		=	initFunction;
 	this->intersectFunction	=	intersectFunction;
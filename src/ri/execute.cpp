@@ -42,6 +42,7 @@
 #include "photonMap.h"
 #include "texture3d.h"
 #include "irradiance.h"
+#include "volume.h"
 #include "bundles.h"
 #include "error.h"
 #include "renderer.h"
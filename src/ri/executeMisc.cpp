@@ -921,8 +921,8 @@ void	CShadingContext::traceTransmission(int numRays,CTraceLocation *rays,int pro
 				// Are we shooting this ray for real?
 				if (probeOnly) {
 
-					// No, just query an intersection and record the distance
-					trace(cRay);
+					// No, just query an occluder and record the distance
+					traceAny(cRay);
 					rays->t					+=	cRay->t*multiplier;
 				} else {
 					*cRays++				=	cRay++;
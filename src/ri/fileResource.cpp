@@ -42,6 +42,7 @@ const	char	*fileIrradianceCache	=	"IrradianceCache";
 const	char	*fileGatherCache		=	"GatherCache";
 const	char	*fileTransparencyShadow	=	"TransparencyShadow";
 const	char	*filePointCloud			=	"PointCloud";
+const	char	*filePagedPointCloud	=	"PagedPointCloud";
 const	char	*fileBrickMap			=	"BrickMap";
 
 
@@ -42,6 +42,7 @@ extern	const	char	*fileIrradianceCache;
 extern	const	char	*fileGatherCache;
 extern	const	char	*fileTransparencyShadow;
 extern	const	char	*filePointCloud;
+extern	const	char	*filePagedPointCloud;
 extern	const	char	*fileBrickMap;
 
 const	unsigned	int	magicNumber			=	123456789;
@@ -215,42 +215,60 @@ DEFSHORTFUNC(TraceV				,"trace"				,"c=pv!"		,TRACEEXPR_PRE,TRACEEXPR,TRACEEXPR_
 								scratch->occlusionParams.environment	=	lookup->environment;									\
 								scratch->occlusionParams.pointHierarchy	=	lookup->pointHierarchy;									\
 																																	\
-								float	C[7];																						\
 								float	**channelValues = (float **) ralloc(lookup->numChannels*sizeof(const float *),threadMemory);\
 																																	\
 								for (int channel=0;channel<lookup->numChannels;++channel) {											\
 									operand(lookup->channelIndex[channel],channelValues[channel],float *);							\
 								}																									\
-								const float	savedSamples	=	scratch->traceParams.samples;										\
+								float	*lookupP		=	(float *) ralloc(numVertices*(12+7+1)*sizeof(float),threadMemory);		\
+								float	*lookupN		=	lookupP + numVertices*3;												\
+								float	*lookupdPdu		=	lookupN + numVertices*3;												\
+								float	*lookupdPdv		=	lookupdPdu + numVertices*3;												\
+								float	*lookupC		=	lookupdPdv + numVertices*3;												\
+								float	*lookupSamples	=	lookupC + numVertices*7;												\
+								float	**lookupRes		=	(float **) ralloc(numVertices*sizeof(float *),threadMemory);			\
+								int		*lookupVertex	=	(int *) ralloc(numVertices*sizeof(int),threadMemory);					\
+								int		numLookups		=	0;																		\
+								int		vertex			=	0;																		\
 								scratch->occlusionParams.occlusion	=	__occlusion;
 
 
 #define	IDEXPR(__occlusion)		plReady();																							\
-								mulvf(dPdu,*du);																					\
-								mulvf(dPdv,*dv);																					\
-								scratch->traceParams.samples	=	*op3;															\
-								cache->lookup(C,op1,dPdu,dPdv,op2,this);															\
-								texture3Dunpack(C,lookup->numChannels,channelValues,lookup->channelEntry,lookup->channelSize);		\
-								if (__occlusion)	*res	=	C[3];																\
-								else				movvv(res,C);
+								mulvf(lookupdPdu + numLookups*3,dPdu,*du);															\
+								mulvf(lookupdPdv + numLookups*3,dPdv,*dv);															\
+								movvv(lookupP + numLookups*3,op1);																	\
+								movvv(lookupN + numLookups*3,op2);																	\
+								lookupSamples[numLookups]	=	*op3;																\
+								lookupVertex[numLookups]	=	vertex;																\
+								lookupRes[numLookups++]		=	res;
 
 
 #define	IDEXPR_UPDATE(__n)		FUN4EXPR_UPDATE(__n,3,3,1)																			\
 								plStep();																							\
 								dPdu	+=	3;																						\
 								dPdv	+=	3;																						\
-								du++;	dv++;																						\
-								for (int channel=0;channel<lookup->numChannels;++channel) {											\
-									channelValues[channel]	+=	lookup->channelSize[channel];										\
-								}
-
-#define	IDEXPR_POST(__occlusion)													\
-								if (__occlusion)	{								\
-									expandFloat(res);								\
-								} else {											\
-									expandVector(res);								\
-								}													\
-								scratch->traceParams.samples	=	savedSamples;	\
+								du++;	dv++;	vertex++;
+
+// Do all the lookups in one go so that the cache misses are sampled together
+#define	IDEXPR_POST(__occlusion)																									\
+								if (numLookups > 0) {																				\
+									cache->lookup(numLookups,lookupC,lookupP,lookupdPdu,lookupdPdv,lookupN,lookupSamples,this);		\
+									float	**channelDest	=	(float **) ralloc(lookup->numChannels*sizeof(float *),threadMemory);	\
+									for (int i=0;i<numLookups;i++) {																\
+										const float	*C	=	lookupC + i*7;															\
+										for (int channel=0;channel<lookup->numChannels;++channel) {									\
+											channelDest[channel]	=	channelValues[channel] + lookupVertex[i]*lookup->channelSize[channel];	\
+										}																							\
+										texture3Dunpack(C,lookup->numChannels,channelDest,lookup->channelEntry,lookup->channelSize);	\
+										if (__occlusion)	*lookupRes[i]	=	C[3];												\
+										else				movvv(lookupRes[i],C);													\
+									}																								\
+								}																									\
+								if (__occlusion)	{																				\
+									expandFloat(res);																				\
+								} else {																							\
+									expandVector(res);																				\
+								}																									\
 								plEnd();
 #else
 #define	IDEXPR_PRE
@@ -286,18 +304,28 @@ DEFSHORTFUNC(Indirectdiffuse	,"indirectdiffuse"	,"c=pnf!"	,IDEXPR_PRE(FALSE),IDE
 								const int	estimator	=	(scratch->photonmapParams.estimator == 0 ? currentShadingState->currentObject->attributes->photonEstimator : (int) scratch->photonmapParams.estimator);	\
 								operand(0,res,float *);															\
 								operand(2,op2,const float *);													\
-								operand(3,op3,const float *);
+								operand(3,op3,const float *);													\
+								float		*lookupP	=	(float *)	ralloc(numVertices*6*sizeof(float),threadMemory);	\
+								float		**lookupRes	=	(float **)	ralloc(numVertices*sizeof(float *),threadMemory);	\
+								int			numLookups	=	0;
 
 
 #define	PHOTONMAPEXPR			plReady();																		\
-								map->lookup(res,op2,estimator);
+								movvv(lookupP + numLookups*3,op2);												\
+								lookupRes[numLookups++]	=	res;
 
 #define	PHOTONMAPEXPR_UPDATE	res	+=	3;																		\
 								op2	+=	3;																		\
 								op3	+=	3;																		\
 								plStep();
 
-#define	PHOTONMAPEXPR_POST		expandVector(res);	plEnd();
+// Do all the lookups in one go
+#define	PHOTONMAPEXPR_POST		if (numLookups > 0) {															\
+									float	*C	=	lookupP + numLookups*3;										\
+									map->lookup(numLookups,C,lookupP,NULL,estimator,currentShadingState->currentObject->attributes->photonMaxError);	\
+									for (int i=0;i<numLookups;i++,C+=3)	movvv(lookupRes[i],C);					\
+								}																				\
+								expandVector(res);	plEnd();
 
 #else
 #define	PHOTONMAPEXPR_PRE
@@ -331,16 +359,25 @@ DEFSHORTFUNC(Photonmap			,"photonmap"	,"c=Spn!"	,PHOTONMAPEXPR_PRE,PHOTONMAPEXPR
 								const float	*op2;																\
 								const int	estimator	=	(scratch->photonmapParams.estimator == 0 ? currentShadingState->currentObject->attributes->photonEstimator : (int) scratch->photonmapParams.estimator);	\
 								operand(0,res,float *);															\
-								operand(2,op2,const float *);
+								operand(2,op2,const float *);													\
+								float		*lookupP	=	(float *)	ralloc(numVertices*6*sizeof(float),threadMemory);	\
+								float		**lookupRes	=	(float **)	ralloc(numVertices*sizeof(float *),threadMemory);	\
+								int			numLookups	=	0;
 
 #define	PHOTONMAP2EXPR			plReady();																		\
-								map->lookup(res,op2,estimator);
+								movvv(lookupP + numLookups*3,op2);												\
+								lookupRes[numLookups++]	=	res;
 
 #define	PHOTONMAP2EXPR_UPDATE	res	+=	3;																		\
 								op2	+=	3;																		\
 								plStep();
 
-#define	PHOTONMAP2EXPR_POST		expandVector(res);	plEnd();
+#define	PHOTONMAP2EXPR_POST		if (numLookups > 0) {															\
+									float	*C	=	lookupP + numLookups*3;										\
+									map->lookup(numLookups,C,lookupP,NULL,estimator,currentShadingState->currentObject->attributes->photonMaxError);	\
+									for (int i=0;i<numLookups;i++,C+=3)	movvv(lookupRes[i],C);					\
+								}																				\
+								expandVector(res);	plEnd();
 
 #else
 #define	PHOTONMAP2EXPR_PRE
@@ -45,6 +45,7 @@
 // Return Value			:	-
 // Comments				:
 CImplicit::CImplicit(CAttributes *a,CXform *x,int frame,const char *name,float ss,float sf) : CSurface(a,x) {
+	flags	|=	OBJECT_EXPAND_INSTANCE;		// We shade the rays ourselves
 	handle	=	osLoadModule(name);
 
 	if (handle != NULL) {
@@ -44,10 +44,36 @@
 #include "debug.h"
 #include "pointHierarchy.h"
 #include "shaderPl.h"
+#include "atomic.h"
 
 const	float	weightNormalDenominator	=	(float) (1 / (1 - cos(radians(10))));
 const	float	horizonCutoff			=	(float) cosf((float) radians(80));
 
+// The arrays of a flat cache file, in the order they appear in the file
+enum {
+	FLAT_NODES,
+	FLAT_P,
+	FLAT_N,
+	FLAT_IRRADIANCE,
+	FLAT_ENVDIR,
+	FLAT_COVERAGE,
+	FLAT_DP,
+	FLAT_GRADIENTS,
+	FLAT_SCALES,
+	FLAT_NUM_SECTIONS
+};
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	hemisphereStrata
+// Description			:
+/// \brief					Compute the number of theta/phi strata for a number of samples
+// Return Value			:	-
+// Comments				:
+static	inline	void	hemisphereStrata(float samples,int &nt,int &np) {
+	nt	=	(int) (sqrtf(samples / (float) C_PI) + 0.5);
+	np	=	(int) (C_PI*nt + 0.5);
+}
+
 ///////////////////////////////////////////////////////////////////////
 //
 //
@@ -69,7 +95,7 @@ CTexture3d::CChannel	CIrradianceCache::cacheChannels[3]	=	{
 /// \brief					Ctor
 // Return Value			:
 // Comments				:
-CIrradianceCache::CIrradianceCache(const char *name,unsigned int f,FILE *in,const float *from,const float *to,const float *tondc) : CTexture3d(name,from,to,tondc,3,cacheChannels) {
+CIrradianceCache::CIrradianceCache(const char *name,unsigned int f,FILE *in,const float *from,const float *to,const float *tondc,const char *fileName) : CTexture3d(name,from,to,tondc,3,cacheChannels) {
 	int	i;
 
 	assert(dataSize == 7);
@@ -79,23 +105,68 @@ CIrradianceCache::CIrradianceCache(const char *name,unsigned int f,FILE *in,cons
 	root				=	NULL;
 	maxDepth			=	1;
 	flags				=	f;
+	journal				=	NULL;
+	flatData			=	NULL;
+	flatSize			=	0;
+	flatMapped			=	FALSE;
+	flatMaxDepth		=	0;
+	numFlatNodes		=	0;
+	numFlatSamples		=	0;
+	flatNodes			=	NULL;
+	flatP				=	NULL;
+	flatN				=	NULL;
+	flatIrradiance		=	NULL;
+	flatEnvdir			=	NULL;
+	flatCoverage		=	NULL;
+	flatdP				=	NULL;
+	flatGradients		=	NULL;
+	flatQGradients		=	NULL;
+	flatGradientScale	=	NULL;
 	osCreateMutex(mutex);
 
 	// Are we reading from file ?
 	if (flags & CACHE_READ) {
-		if (in == NULL)	in	=	ropen(name,"rb",fileIrradianceCache);
+		if (fileName == NULL)	fileName	=	name;
+		if (in == NULL)			in			=	ropen(fileName,"rb",fileIrradianceCache);
 
 		if (in != NULL) {
-		
-			// Read the samples
-			fread(&maxDepth,	sizeof(int),1,in);
-			root	=	readNode(in);
+			int	tag;
+
+			// Flat files start with -1, the old ones with the octree depth
+			fread(&tag,			sizeof(int),1,in);
+
+			if (tag == -1) {
+				if (readFlat(in,fileName) == TRUE) {
+
+					// We're going to write the samples back, so we need them in the octree
+					if ((flags & CACHE_WRITE) && (numFlatNodes > 0)) {
+						maxDepth	=	max(flatMaxDepth,1);
+						root		=	materializeNode(0);
+						unmapFlat();
+					}
+				} else {
+					error(CODE_BADFILE,"Irradiance cache \"%s\" is corrupt or of incompatible version\n",fileName);
+				}
+			} else {
+				// Read the samples
+				maxDepth	=	tag;
+				root		=	readNode(in);
+			}
 
 			// Close the file
 			fclose(in);
 		}
 	}
 
+	// Are we using the samples in the file ?
+	if ((root == NULL) && (numFlatNodes > 0)) {
+		root			=	(CCacheNode *) memory->alloc(sizeof(CCacheNode));
+		for (i=0;i<8;i++)	root->children[i]	=	NULL;
+		movvv(root->center,flatNodes[0].center);
+		root->side		=	flatNodes[0].side;
+		root->samples	=	NULL;
+	}
+
 	// Are we creating a fresh cache ?
 	if (root == NULL) {
 		vector	center,bmin,bmax;
@@ -136,45 +207,401 @@ CIrradianceCache::~CIrradianceCache() {
 			if (out != NULL) {
 			
 				// Write the samples
-				fwrite(&maxDepth,	sizeof(int),1,out);
-				writeNode(out,root);
+				writeFlat(out);
 
 				fclose(out);
 			}
 		}
 	}
 
+	// Delete the sample journal
+	if (journal != NULL)	delete journal;
+
+	// Release the cache file
+	unmapFlat();
+
 	// Delete the memory pool
 	delete memory;
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	flatSectionSize
+// Description			:
+/// \brief					The size of an array in a flat cache file
+// Return Value			:	The size in bytes
+// Comments				:
+static	size_t	flatSectionSize(int section,int numNodes,int numSamples,int quantized) {
+	switch(section) {
+	case FLAT_NODES:		return numNodes*sizeof(CIrradianceCache::CFlatNode);
+	case FLAT_P:
+	case FLAT_N:
+	case FLAT_IRRADIANCE:
+	case FLAT_ENVDIR:		return numSamples*3*sizeof(float);
+	case FLAT_COVERAGE:
+	case FLAT_DP:			return numSamples*sizeof(float);
+	case FLAT_GRADIENTS:	return numSamples*42*(quantized ? sizeof(short) : sizeof(float));
+	case FLAT_SCALES:		return quantized ? numSamples*2*sizeof(float) : 0;
+	}
+
+	return 0;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CIrradianceCache
-// Method				:	writeNode
+// Method				:	writeFlat
 // Description			:
-/// \brief					Write a node into a file
+/// \brief					Write the cache into a file
 // Return Value			:
+// Comments				:	The octree is written depth first as a node array followed by
+//							one array per sample field, each aligned so the file can be mapped
+void			CIrradianceCache::writeFlat(FILE *out) {
+	CArray<CFlatNode>		nodes;
+	CArray<CCacheSample *>	samples;
+	const int				quantized	=	(CRenderer::flags & OPTIONS_FLAGS_COMPRESS_CACHES) != 0;
+	const char				zero[16]	=	{ 0 };
+	uint64_t				offsets[FLAT_NUM_SECTIONS];
+	int						header[6];
+	uint64_t				pos;
+	int						i,j,k;
+
+	flattenNode(root,nodes,samples);
+
+	header[0]	=	-1;
+	header[1]	=	IRRADIANCE_CACHE_VERSION;
+	header[2]	=	quantized;
+	header[3]	=	maxDepth;
+	header[4]	=	nodes.numItems;
+	header[5]	=	samples.numItems;
+
+	// Lay the arrays out
+	pos			=	(uint64_t) osFtell(out) + sizeof(header) + sizeof(offsets);
+	for (i=0;i<FLAT_NUM_SECTIONS;i++) {
+		pos			=	(pos + 15) & ~((uint64_t) 15);
+		offsets[i]	=	pos;
+		pos			+=	flatSectionSize(i,nodes.numItems,samples.numItems,quantized);
+	}
+
+	fwrite(header,sizeof(int),6,out);
+	fwrite(offsets,sizeof(uint64_t),FLAT_NUM_SECTIONS,out);
+
+	// Gather and write the arrays
+	const int		numSamples	=	samples.numItems;
+	float			*buffer		=	new float[numSamples*44 + 1];
+	short			*qBuffer	=	(short *) buffer;
+	float			*scales		=	buffer + numSamples*42;
+
+	for (i=0;i<FLAT_NUM_SECTIONS;i++) {
+		const size_t	size	=	flatSectionSize(i,nodes.numItems,numSamples,quantized);
+		const void		*data	=	buffer;
+
+		// Pad to the alignment
+		fwrite(zero,1,(size_t) (offsets[i] - (uint64_t) osFtell(out)),out);
+
+		switch(i) {
+		case FLAT_NODES:
+			data	=	nodes.array;
+			break;
+		case FLAT_P:
+			for (j=0;j<numSamples;j++)	movvv(buffer + j*3,samples.array[j]->P);
+			break;
+		case FLAT_N:
+			for (j=0;j<numSamples;j++)	movvv(buffer + j*3,samples.array[j]->N);
+			break;
+		case FLAT_IRRADIANCE:
+			for (j=0;j<numSamples;j++)	movvv(buffer + j*3,samples.array[j]->irradiance);
+			break;
+		case FLAT_ENVDIR:
+			for (j=0;j<numSamples;j++)	movvv(buffer + j*3,samples.array[j]->envdir);
+			break;
+		case FLAT_COVERAGE:
+			for (j=0;j<numSamples;j++)	buffer[j]	=	samples.array[j]->coverage;
+			break;
+		case FLAT_DP:
+			for (j=0;j<numSamples;j++)	buffer[j]	=	samples.array[j]->dP;
+			break;
+		case FLAT_GRADIENTS:
+			if (quantized) {
+				// Quantize each gradient against its largest component
+				for (j=0;j<numSamples;j++) {
+					const CCacheSample	*cSample	=	samples.array[j];
+					float				sP			=	0;
+					float				sR			=	0;
+
+					for (k=0;k<21;k++) {
+						sP	=	max(sP,absf(cSample->gP[k]));
+						sR	=	max(sR,absf(cSample->gR[k]));
+					}
+
+					scales[j*2]		=	sP / 32767.0f;
+					scales[j*2 + 1]	=	sR / 32767.0f;
+
+					sP	=	(sP > 0) ? 32767.0f / sP : 0;
+					sR	=	(sR > 0) ? 32767.0f / sR : 0;
+
+					for (k=0;k<21;k++) {
+						qBuffer[j*42 + k]		=	(short) floorf(cSample->gP[k]*sP + 0.5f);
+						qBuffer[j*42 + k + 21]	=	(short) floorf(cSample->gR[k]*sR + 0.5f);
+					}
+				}
+			} else {
+				for (j=0;j<numSamples;j++) {
+					memcpy(buffer + j*42,		samples.array[j]->gP,21*sizeof(float));
+					memcpy(buffer + j*42 + 21,	samples.array[j]->gR,21*sizeof(float));
+				}
+			}
+			break;
+		case FLAT_SCALES:
+			data	=	scales;
+			break;
+		}
+
+		if (size > 0)	fwrite(data,1,size,out);
+	}
+
+	delete[] buffer;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	flattenNode
+// Description			:
+/// \brief					Convert a subtree into the file layout
+// Return Value			:	The index of the node
 // Comments				:
-void			CIrradianceCache::writeNode(FILE *out,CCacheNode *cNode) {
-	int				numSamples,i;
+int				CIrradianceCache::flattenNode(CCacheNode *cNode,CArray<CFlatNode> &nodes,CArray<CCacheSample *> &samples) {
+	CFlatNode		node;
 	CCacheSample	*cSample;
+	const int		index	=	nodes.numItems;
+	int				i;
+
+	movvv(node.center,cNode->center);
+	node.side			=	cNode->side;
+	node.firstSample	=	samples.numItems;
+	node.numSamples		=	0;
+	for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next,node.numSamples++)	samples.push(cSample);
+	for (i=0;i<8;i++)	node.children[i]	=	-1;
+	nodes.push(node);
+
+	// The children come right after us
+	for (i=0;i<8;i++) {
+		if (cNode->children[i] != NULL) {
+			const int	child			=	flattenNode(cNode->children[i],nodes,samples);
+			nodes.array[index].children[i]	=	child;
+		}
+	}
+
+	return index;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	readFlat
+// Description			:
+/// \brief					Map a flat cache file
+// Return Value			:	TRUE on success
+// Comments				:	The file is paged in by the OS as the lookups touch it. If it
+//							can not be mapped, it is read into the memory instead
+int				CIrradianceCache::readFlat(FILE *in,const char *fileName) {
+	uint64_t	offsets[FLAT_NUM_SECTIONS];
+	int			header[5];
+	int			i;
+
+	if (fread(header,sizeof(int),5,in) != 5)									return FALSE;
+	if (fread(offsets,sizeof(uint64_t),FLAT_NUM_SECTIONS,in) != FLAT_NUM_SECTIONS)	return FALSE;
+	if ((header[0] != IRRADIANCE_CACHE_VERSION) || (header[3] < 0) || (header[4] < 0))	return FALSE;
+	if ((header[2] < 0) || (header[2] > IRRADIANCE_MAX_FLAT_DEPTH))						return FALSE;
+
+	if ((flatData = (char *) osMapFile(fileName,flatSize)) != NULL) {
+		flatMapped	=	TRUE;
+	} else {
+		osFseek(in,0,SEEK_END);
+		flatSize	=	(size_t) osFtell(in);
+		flatData	=	new char[flatSize];
+		osFseek(in,0,SEEK_SET);
+		if (fread(flatData,1,flatSize,in) != flatSize) {
+			unmapFlat();
+			return FALSE;
+		}
+	}
+
+	// Make sure the arrays are in the file
+	for (i=0;i<FLAT_NUM_SECTIONS;i++) {
+		if ((offsets[i] & 15) || (offsets[i] > flatSize) || (flatSectionSize(i,header[3],header[4],header[1]) > flatSize - offsets[i])) {
+			unmapFlat();
+			return FALSE;
+		}
+	}
+
+	flatMaxDepth		=	header[2];
+	numFlatNodes		=	header[3];
+	numFlatSamples		=	header[4];
+	flatNodes			=	(const CFlatNode *) (flatData + offsets[FLAT_NODES]);
+	flatP				=	(const float *) (flatData + offsets[FLAT_P]);
+	flatN				=	(const float *) (flatData + offsets[FLAT_N]);
+	flatIrradiance		=	(const float *) (flatData + offsets[FLAT_IRRADIANCE]);
+	flatEnvdir			=	(const float *) (flatData + offsets[FLAT_ENVDIR]);
+	flatCoverage		=	(const float *) (flatData + offsets[FLAT_COVERAGE]);
+	flatdP				=	(const float *) (flatData + offsets[FLAT_DP]);
+	if (header[1]) {
+		flatQGradients		=	(const short *) (flatData + offsets[FLAT_GRADIENTS]);
+		flatGradientScale	=	(const float *) (flatData + offsets[FLAT_SCALES]);
+	} else {
+		flatGradients		=	(const float *) (flatData + offsets[FLAT_GRADIENTS]);
+	}
+
+	// The lookups trust the octree, so make sure it is one
+	if (checkFlat() == FALSE) {
+		unmapFlat();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	checkFlat
+// Description			:
+/// \brief					Verify the octree of a mapped cache file
+// Return Value			:	TRUE if the nodes are consistent
+// Comments				:	The children must come after their parent (depth first) and
+//							have a single parent, the sample ranges must be in the file and
+//							no node can be deeper than the depth in the header since that
+//							sizes the traversal stacks
+int				CIrradianceCache::checkFlat() {
+	int	*depths;
+	int	i,j;
+	int	result	=	TRUE;
+
+	if (numFlatNodes == 0)	return TRUE;
+
+	depths		=	new int[numFlatNodes];
+	for (i=0;i<numFlatNodes;i++)	depths[i]	=	-1;
+	depths[0]	=	0;
+
+	for (i=0;(i<numFlatNodes) && result;i++) {
+		const CFlatNode	*cNode	=	flatNodes + i;
+
+		if (	(depths[i] < 0) ||
+				(cNode->firstSample < 0) || (cNode->numSamples < 0) ||
+				(cNode->numSamples > numFlatSamples - cNode->firstSample)) {
+			result	=	FALSE;
+			break;
+		}
+
+		for (j=0;j<8;j++) {
+			const int	child	=	cNode->children[j];
+
+			if (child == -1)	continue;
+
+			if (	(child <= i) || (child >= numFlatNodes) ||
+					(depths[child] >= 0) || (depths[i] >= flatMaxDepth)) {
+				result	=	FALSE;
+				break;
+			}
+
+			depths[child]	=	depths[i] + 1;
+		}
+	}
+
+	delete[] depths;
+
+	return result;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	unmapFlat
+// Description			:
+/// \brief					Release the cache file
+// Return Value			:
+// Comments				:
+void			CIrradianceCache::unmapFlat() {
+	if (flatData != NULL) {
+		if (flatMapped)	osUnmapFile(flatData,flatSize);
+		else			delete[] flatData;
+	}
+
+	flatData			=	NULL;
+	flatSize			=	0;
+	flatMapped			=	FALSE;
+	numFlatNodes		=	0;
+	numFlatSamples		=	0;
+	flatNodes			=	NULL;
+	flatP				=	NULL;
+	flatN				=	NULL;
+	flatIrradiance		=	NULL;
+	flatEnvdir			=	NULL;
+	flatCoverage		=	NULL;
+	flatdP				=	NULL;
+	flatGradients		=	NULL;
+	flatQGradients		=	NULL;
+	flatGradientScale	=	NULL;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	flatSample
+// Description			:
+/// \brief					Decode a sample of the cache file
+// Return Value			:
+// Comments				:
+void			CIrradianceCache::flatSample(CCacheSample *cSample,int i) const {
+	int	k;
+
+	movvv(cSample->P,			flatP + i*3);
+	movvv(cSample->N,			flatN + i*3);
+	movvv(cSample->irradiance,	flatIrradiance + i*3);
+	movvv(cSample->envdir,		flatEnvdir + i*3);
+	cSample->coverage	=	flatCoverage[i];
+	cSample->dP			=	flatdP[i];
+	cSample->next		=	NULL;
+
+	if (flatQGradients != NULL) {
+		const short	*src	=	flatQGradients + i*42;
+		const float	sP		=	flatGradientScale[i*2];
+		const float	sR		=	flatGradientScale[i*2 + 1];
+
+		for (k=0;k<21;k++) {
+			cSample->gP[k]	=	src[k]*sP;
+			cSample->gR[k]	=	src[k + 21]*sR;
+		}
+	} else {
+		memcpy(cSample->gP,flatGradients + i*42,		21*sizeof(float));
+		memcpy(cSample->gR,flatGradients + i*42 + 21,	21*sizeof(float));
+	}
+}
 
-	fwrite(cNode->center,	sizeof(vector),1,out);
-	fwrite(&cNode->side,	sizeof(float),1,out);
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	materializeNode
+// Description			:
+/// \brief					Load a subtree of the cache file into the octree
+// Return Value			:	The node
+// Comments				:
+CIrradianceCache::CCacheNode		*CIrradianceCache::materializeNode(int index) {
+	const CFlatNode	*fNode	=	flatNodes + index;
+	CCacheNode		*cNode	=	(CCacheNode *) memory->alloc(sizeof(CCacheNode));
+	int				i;
 
-	for (cSample=cNode->samples,numSamples=0;cSample!=NULL;cSample=cSample->next,numSamples++);
+	movvv(cNode->center,fNode->center);
+	cNode->side		=	fNode->side;
+	cNode->samples	=	NULL;
 
-	fwrite(&numSamples,		sizeof(int),1,out);
+	for (i=fNode->numSamples-1;i>=0;i--) {
+		CCacheSample	*cSample	=	(CCacheSample *) memory->alloc(sizeof(CCacheSample));
 
-	for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next) {
-		fwrite(cSample,		sizeof(CCacheSample),1,out);
+		flatSample(cSample,fNode->firstSample + i);
+		cSample->next				=	cNode->samples;
+		cNode->samples				=	cSample;
 	}
 
-	fwrite(cNode->children,	sizeof(CCacheNode *),8,out);
 	for (i=0;i<8;i++) {
-		if (cNode->children[i] != NULL)	writeNode(out,cNode->children[i]);
+		cNode->children[i]	=	(fNode->children[i] >= 0) ? materializeNode(fNode->children[i]) : NULL;
 	}
+
+	return cNode;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -217,164 +644,316 @@ CIrradianceCache::CCacheNode		*CIrradianceCache::readNode(FILE *in) {
 // Return Value			:
 // Comments				:
 void	CIrradianceCache::lookup(float *C,const float *cP,const float *cdPdu,const float *cdPdv,const float *cN,CShadingContext *context) {
+	const float	samples	=	context->currentShadingState->scratch.traceParams.samples;
+
+	lookup(1,C,cP,cdPdu,cdPdv,cN,&samples,context);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	lookup
+// Description			:
+/// \brief					Lookup da cache for a bunch of points
+// Return Value			:
+// Comments				:	The points that can not be interpolated from the cache are sampled
+//							together. Misses that are close enough to be covered by each other's
+//							samples are deferred to the next round so that we don't create more
+//							samples than a point by point lookup would
+void	CIrradianceCache::lookup(int numLookups,float *C,const float *cP,const float *cdPdu,const float *cdPdv,const float *cN,const float *samples,CShadingContext *context) {
 	const CShadingScratch	*scratch		=	&(context->currentShadingState->scratch);
+	int						i,j,k;
 
 	// Is this a point based lookup?
 	if ((scratch->occlusionParams.pointbased) && (scratch->occlusionParams.pointHierarchy != NULL)) {
-		int	i;
+		for (i=0;i<numLookups;i++,C+=7,cP+=3,cdPdu+=3,cdPdv+=3,cN+=3) {
+			for (j=0;j<7;j++)	C[j]	=	0;
 
-		for (i=0;i<7;i++)	C[i]	=	0;
-
-		scratch->occlusionParams.pointHierarchy->lookup(C,cP,cdPdu,cdPdv,cN,context);
-	} else {
-		CCacheSample		*cSample;
-		CCacheNode			*cNode;
-		float				totalWeight		=	0;
-		CCacheNode			**stackBase		=	(CCacheNode **)	alloca(maxDepth*sizeof(CCacheNode *)*8);
-		CCacheNode			**stack;
-		int					i;
-		float				coverage;
-		vector				irradiance,envdir;
-		vector				P,N;
-		
-		// A small value for discard-smoothing of irradiance
-		const float			smallSampleWeight = (flags & CACHE_SAMPLE) ? 0.1f : 0.0f;
+			scratch->occlusionParams.pointHierarchy->lookup(C,cP,cdPdu,cdPdv,cN,context);
+		}
+		return;
+	}
 
-		// Transform the lookup point to the correct coordinate system
-		mulmp(P,to,cP);
-		mulmn(N,from,cN);
-		
-		// Init the result
-		coverage	=	0;
-		initv(irradiance,0);
-		initv(envdir,0);
+	memBegin(context->threadMemory);
 
-		// The weighting algorithm is that described in [Tabellion and Lamorlette 2004]
-		// We need to convert the max error as in Wald to Tabellion 
-		// The default value of maxError is 0.4f
-		const float			K		=	0.4f / scratch->occlusionParams.maxError;
-
-		// Note, we do not need to lock the data for reading
-		// if word-writes are atomic
-		
-		// Prepare for the non recursive tree traversal
-		stack		=	stackBase;
-		*stack++	=	root;
-		while(stack > stackBase) {
-			cNode	=	*(--stack);
-
-			// Sum the values in this level
-			for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next) {
-				vector	D;
+	float	*P			=	(float *) ralloc(numLookups*12*sizeof(float),context->threadMemory);
+	float	*N			=	P + numLookups*3;
+	float	*dPdu		=	N + numLookups*3;
+	float	*dPdv		=	dPdu + numLookups*3;
+	float	*reach		=	(float *) ralloc(numLookups*sizeof(float),context->threadMemory);
+	int		*misses		=	(int *) ralloc(numLookups*3*sizeof(int),context->threadMemory);
+	int		*deferred	=	misses + numLookups;
+	int		*selected	=	deferred + numLookups;
+	int		numMisses	=	0;
 
-				// D = vector from sample to query point
-				subvv(D,P,cSample->P);
+	// The furthest a new sample can be interpolated from is maxPixelDist*db / K (see sample)
+	const float	reachScale	=	(scratch->occlusionParams.maxError != 0) ? scratch->occlusionParams.maxPixelDist*scratch->occlusionParams.maxError / 0.4f : 0;
 
-				// Ignore sample in the front
-				float	a	=	dotvv(D,cSample->N);
-				if ((a*a / (dotvv(D,D) + C_EPSILON)) > 0.1)	continue;
+	// Interpolate whatever we can
+	for (i=0;i<numLookups;i++) {
+		float	*cC	=	C + i*7;
 
-				// Positional error
-				float	e1 = sqrtf(dotvv(D,D)) / cSample->dP;
-
-				// Directional error
-				float	e2 =	1 - dotvv(N,cSample->N);
-				if (e2 < 0)	e2	=	0;
-				e2		=	sqrtf(e2*weightNormalDenominator);
+		// Transform the lookup point to the correct coordinate system
+		mulmp(P + i*3,to,cP + i*3);
+		mulmn(N + i*3,from,cN + i*3);
 
-				// Compute the weight
-				float	w		=	1 - K*max(e1,e2);
-				if (w > context->urand()*smallSampleWeight) {
-					vector	ntmp;
+		if (interpolate(cC,P + i*3,N + i*3,context) == FALSE) {
 
-					crossvv(ntmp,cSample->N,N);
-					
-					// Sum the sample
-					totalWeight		+=	w;
-					coverage		+=	w*(cSample->coverage		+ dotvv(cSample->gP+0*3,D) + dotvv(cSample->gR+0*3,ntmp));
-					irradiance[0]	+=	w*(cSample->irradiance[0]	+ dotvv(cSample->gP+1*3,D) + dotvv(cSample->gR+1*3,ntmp));
-					irradiance[1]	+=	w*(cSample->irradiance[1]	+ dotvv(cSample->gP+2*3,D) + dotvv(cSample->gR+2*3,ntmp));
-					irradiance[2]	+=	w*(cSample->irradiance[2]	+ dotvv(cSample->gP+3*3,D) + dotvv(cSample->gR+3*3,ntmp));
-					envdir[0]		+=	w*(cSample->envdir[0]		+ dotvv(cSample->gP+4*3,D) + dotvv(cSample->gR+4*3,ntmp));
-					envdir[1]		+=	w*(cSample->envdir[1]		+ dotvv(cSample->gP+5*3,D) + dotvv(cSample->gR+5*3,ntmp));
-					envdir[2]		+=	w*(cSample->envdir[2]		+ dotvv(cSample->gP+6*3,D) + dotvv(cSample->gR+6*3,ntmp));
-				}
-			}
+			// Are we sampling the cache ?
+			if (flags & CACHE_SAMPLE) {
 
-			// Check the children
-			for (i=0;i<8;i++) {
-				CCacheNode	*tNode;
+				// Convert the tangent space
+				mulmv(dPdu + i*3,to,cdPdu + i*3);
+				mulmv(dPdv + i*3,to,cdPdv + i*3);
 
-				if ((tNode = cNode->children[i]) != NULL) {
-					const float	tSide	=	tNode->side;
+				reach[i]				=	reachScale*(lengthv(dPdu + i*3) + lengthv(dPdv + i*3))*0.5f;
+				misses[numMisses++]		=	i;
+			} else {
 
-					if (	((tNode->center[0] + tSide) > P[0])	&&
-							((tNode->center[1] + tSide) > P[1])	&&
-							((tNode->center[2] + tSide) > P[2])	&&
-							((tNode->center[0] - tSide) < P[0])	&&
-							((tNode->center[1] - tSide) < P[1])	&&
-							((tNode->center[2] - tSide) < P[2])) {
-						*stack++	=	tNode;
-					}
-				}
+				// No joy
+				cC[0]	=	0;
+				cC[1]	=	0;
+				cC[2]	=	0;
+				cC[3]	=	1;
+				cC[4]	=	0;
+				cC[5]	=	0;
+				cC[6]	=	0;
 			}
 		}
+	}
 
-		// Do we have anything ?
-		if (totalWeight > C_EPSILON) {
-			double	normalizer	=	1 / totalWeight;
+	// Sample the misses
+	while(numMisses > 0) {
+		int	numSelected	=	0;
+		int	numDeferred	=	0;
+		int	numRays		=	0;
+		int	nt,np;
 
-			normalizevf(envdir);
+		// Pick the misses that can not be covered by the samples we're about to create
+		for (i=0;i<numMisses;i++) {
+			const int	cMiss	=	misses[i];
+			const float	*cPm	=	P + cMiss*3;
 
-			C[0]			=	(float) (irradiance[0]*normalizer);
-			C[1]			=	(float) (irradiance[1]*normalizer);
-			C[2]			=	(float) (irradiance[2]*normalizer);
-			C[3]			=	(float) (coverage*normalizer);
-			mulmv(C+4,from,envdir);		// envdir is stored in the target coordinate system
-		} else {
-			// Are we sampling the cache ?
-			if (flags & CACHE_SAMPLE) {
-				vector	dPdu,dPdv;
+			for (k=0;k<numSelected;k++) {
+				const int	cSelected	=	selected[k];
+				vector		D;
 
-				// Convert the tangent space
-				mulmv(dPdu,to,cdPdu);
-				mulmv(dPdv,to,cdPdv);
+				subvv(D,cPm,P + cSelected*3);
+				if (dotvv(D,D) < reach[cSelected]*reach[cSelected])	break;
+			}
 
-				// Create a new sample
-				sample(C,P,dPdu,dPdv,N,context);
-				mulmv(C+4,from,C+4);	// envdir is stored in the target coordinate system
+			if (k < numSelected) {
+				deferred[numDeferred++]		=	cMiss;
 			} else {
+				selected[numSelected++]		=	cMiss;
+			}
+		}
 
-				// No joy
-				C[0]	=	0;
-				C[1]	=	0;
-				C[2]	=	0;
-				C[3]	=	1;
-				C[4]	=	0;
-				C[5]	=	0;
-				C[6]	=	0;
+		// Sample them in batches of bounded size
+		for (i=0,j=0;i<numSelected;i++) {
+			hemisphereStrata(samples[selected[i]],nt,np);
+			numRays		+=	nt*np;
+
+			if ((numRays >= IRRADIANCE_BATCH_SIZE) || (i == (numSelected-1))) {
+				sample(i-j+1,selected+j,C,P,dPdu,dPdv,N,samples,context);
+				j			=	i+1;
+				numRays		=	0;
+			}
+		}
+
+		// See if the deferred ones can now be interpolated
+		for (numMisses=0,i=0;i<numDeferred;i++) {
+			const int	cDeferred	=	deferred[i];
+
+			if (interpolate(C + cDeferred*7,P + cDeferred*3,N + cDeferred*3,context) == FALSE) {
+				misses[numMisses++]	=	cDeferred;
 			}
 		}
+	}
+
+	for (i=0;i<numLookups;i++,C+=7) {
+
+		// envdir is stored in the target coordinate system
+		mulmv(C+4,from,C+4);
 
 		// Make sure we don't have NaNs
 		assert(dotvv(C,C) >= 0);
 	}
+
+	memEnd(context->threadMemory);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	sampleWeight
+// Description			:
+/// \brief					Compute the interpolation weight of a cache sample
+// Return Value			:	FALSE if the sample is in front of the point
+// Comments				:	D is set to the vector from the sample to the point
+static	inline	int		sampleWeight(float &w,float *D,const float *P,const float *N,const float *sP,const float *sN,float sdP,float K) {
+
+	// D = vector from sample to query point
+	subvv(D,P,sP);
+
+	// Ignore sample in the front
+	float	a	=	dotvv(D,sN);
+	if ((a*a / (dotvv(D,D) + C_EPSILON)) > 0.1)	return FALSE;
+
+	// Positional error
+	float	e1 = sqrtf(dotvv(D,D)) / sdP;
+
+	// Directional error
+	float	e2 =	1 - dotvv(N,sN);
+	if (e2 < 0)	e2	=	0;
+	e2		=	sqrtf(e2*weightNormalDenominator);
+
+	// Compute the weight
+	w		=	1 - K*max(e1,e2);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	sumSample
+// Description			:
+/// \brief					Add a weighted cache sample to the interpolation sums
+// Return Value			:	-
+// Comments				:	The sums are in the same order as the lookup result
+static	inline	void	sumSample(float *sums,float w,const float *D,const float *N,const CIrradianceCache::CCacheSample *cSample) {
+	vector	ntmp;
+
+	crossvv(ntmp,cSample->N,N);
+
+	sums[0]		+=	w*(cSample->irradiance[0]	+ dotvv(cSample->gP+1*3,D) + dotvv(cSample->gR+1*3,ntmp));
+	sums[1]		+=	w*(cSample->irradiance[1]	+ dotvv(cSample->gP+2*3,D) + dotvv(cSample->gR+2*3,ntmp));
+	sums[2]		+=	w*(cSample->irradiance[2]	+ dotvv(cSample->gP+3*3,D) + dotvv(cSample->gR+3*3,ntmp));
+	sums[3]		+=	w*(cSample->coverage		+ dotvv(cSample->gP+0*3,D) + dotvv(cSample->gR+0*3,ntmp));
+	sums[4]		+=	w*(cSample->envdir[0]		+ dotvv(cSample->gP+4*3,D) + dotvv(cSample->gR+4*3,ntmp));
+	sums[5]		+=	w*(cSample->envdir[1]		+ dotvv(cSample->gP+5*3,D) + dotvv(cSample->gR+5*3,ntmp));
+	sums[6]		+=	w*(cSample->envdir[2]		+ dotvv(cSample->gP+6*3,D) + dotvv(cSample->gR+6*3,ntmp));
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CIrradianceCache
+// Method				:	interpolate
+// Description			:
+/// \brief					Interpolate the cached samples around a point
+// Return Value			:	TRUE if there were samples to interpolate
+// Comments				:	P and N must be in the cache coordinate system, so is the envdir in C
+int		CIrradianceCache::interpolate(float *C,const float *P,const float *N,CShadingContext *context) {
+	const CShadingScratch	*scratch		=	&(context->currentShadingState->scratch);
+	CCacheSample			*cSample;
+	CCacheNode				*cNode;
+	float					totalWeight		=	0;
+	CCacheNode				**stackBase		=	(CCacheNode **)	alloca(maxDepth*sizeof(CCacheNode *)*8);
+	CCacheNode				**stack;
+	int						i,j;
+	float					sums[7];
+	vector					D;
+	float					w;
+
+	// A small value for discard-smoothing of irradiance
+	const float				smallSampleWeight = (flags & CACHE_SAMPLE) ? 0.1f : 0.0f;
+
+	// Init the result
+	for (i=0;i<7;i++)	sums[i]	=	0;
+
+	// The weighting algorithm is that described in [Tabellion and Lamorlette 2004]
+	// We need to convert the max error as in Wald to Tabellion
+	// The default value of maxError is 0.4f
+	const float				K		=	0.4f / scratch->occlusionParams.maxError;
 
+	// Note, we do not need to lock the data for reading
+	// if word-writes are atomic
+
+	// Prepare for the non recursive tree traversal
+	stack		=	stackBase;
+	*stack++	=	root;
+	while(stack > stackBase) {
+		cNode	=	*(--stack);
+
+		// Sum the values in this level
+		for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next) {
+			if (sampleWeight(w,D,P,N,cSample->P,cSample->N,cSample->dP,K) == FALSE)	continue;
+
+			if (w > context->urand()*smallSampleWeight) {
+				totalWeight		+=	w;
+				sumSample(sums,w,D,N,cSample);
+			}
+		}
 
+		// Check the children
+		for (i=0;i<8;i++) {
+			CCacheNode	*tNode;
 
+			if ((tNode = cNode->children[i]) != NULL) {
+				const float	tSide	=	tNode->side;
+
+				if (	((tNode->center[0] + tSide) > P[0])	&&
+						((tNode->center[1] + tSide) > P[1])	&&
+						((tNode->center[2] + tSide) > P[2])	&&
+						((tNode->center[0] - tSide) < P[0])	&&
+						((tNode->center[1] - tSide) < P[1])	&&
+						((tNode->center[2] - tSide) < P[2])) {
+					*stack++	=	tNode;
+				}
+			}
+		}
+	}
 
+	// Sum the samples in the cache file, only the pages we touch are read
+	if (numFlatNodes > 0) {
+		int				*flatStackBase	=	(int *) alloca((flatMaxDepth+1)*sizeof(int)*8);
+		int				*flatStack		=	flatStackBase;
+		CCacheSample	fSample;
 
+		*flatStack++	=	0;
+		while(flatStack > flatStackBase) {
+			const CFlatNode	*fNode	=	flatNodes + *(--flatStack);
 
+			for (j=fNode->firstSample;j<fNode->firstSample+fNode->numSamples;j++) {
+				if (sampleWeight(w,D,P,N,flatP + j*3,flatN + j*3,flatdP[j],K) == FALSE)	continue;
 
+				if (w > context->urand()*smallSampleWeight) {
+					flatSample(&fSample,j);
+					totalWeight		+=	w;
+					sumSample(sums,w,D,N,&fSample);
+				}
+			}
 
+			for (i=0;i<8;i++) {
+				if (fNode->children[i] >= 0) {
+					const CFlatNode	*tNode	=	flatNodes + fNode->children[i];
+					const float		tSide	=	tNode->side;
 
+					if (	((tNode->center[0] + tSide) > P[0])	&&
+							((tNode->center[1] + tSide) > P[1])	&&
+							((tNode->center[2] + tSide) > P[2])	&&
+							((tNode->center[0] - tSide) < P[0])	&&
+							((tNode->center[1] - tSide) < P[1])	&&
+							((tNode->center[2] - tSide) < P[2])) {
+						*flatStack++	=	fNode->children[i];
+					}
+				}
+			}
+		}
+	}
 
+	// Do we have anything ?
+	if (totalWeight > C_EPSILON) {
+		double	normalizer	=	1 / totalWeight;
 
+		normalizevf(sums + 4);
 
+		C[0]			=	(float) (sums[0]*normalizer);
+		C[1]			=	(float) (sums[1]*normalizer);
+		C[2]			=	(float) (sums[2]*normalizer);
+		C[3]			=	(float) (sums[3]*normalizer);
+		movvv(C+4,sums + 4);
 
+		return TRUE;
+	}
 
+	return FALSE;
+}
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CHemisphereSample
@@ -551,323 +1130,353 @@ inline	void	rotGradient(float *dP,int np,int nt,CHemisphereSample *h,const float
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CHemispherePoint
+// Description			:
+/// \brief					This class is used to hold data about a point being sampled in a batch
+// Comments				:	-
+class	CHemispherePoint {
+public:
+		vector							X,Y;			// The tangent frame (randomly rotated about N)
+		int								nt,np;			// The number of strata in theta and phi
+		float							db;				// The ray differential at the origin
+		const float						*strata;		// The stratified directions (see sample)
+		CHemisphereSample				*hemisphere;	// The first hemisphere sample of this point
+		int								save;			// TRUE if the sample should go into the cache
+		CIrradianceCache::CCacheSample	sample;			// The sample to save
+};
+
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CIrradianceCache
 // Method				:	sample
 // Description			:
-/// \brief					Sample the occlusion
+/// \brief					Sample the occlusion for a bunch of points
 // Return Value			:
-// Comments				:
-void		CIrradianceCache::sample(float *C,const float *P,const float *dPdu,const float *dPdv,const float *N,CShadingContext *context) {
-	CCacheSample			*cSample;
-	int						i,j;
-	float					coverage;
-	vector					irradiance;
-	vector					envdir;
-	float					rMean;
-	CRay					ray;
-	vector					X,Y;
-	CCacheNode				*cNode;
-	int						depth;
+// Comments				:	indices selects the points to sample from P,dPdu,dPdv,N and samples,
+//							the results go into C in the cache coordinate system.
+//							All the hemisphere rays are created first, traced back to back and
+//							then resolved so that the environment lookups are done together
+void		CIrradianceCache::sample(int numPoints,const int *indices,float *C,const float *P,const float *dPdu,const float *dPdv,const float *N,const float *samples,CShadingContext *context) {
+	CShadingScratch			*scratch		=	&(context->currentShadingState->scratch);
+	CEnvironment			*environment	=	scratch->occlusionParams.environment;
+	const int				occlusion		=	(scratch->occlusionParams.occlusion == TRUE);
+	const int				save			=	(scratch->occlusionParams.maxError != 0);
+	CHemispherePoint		*points,*cPoint;
+	TMemCheckpoint			checkpoint;
+	CHemisphereSample		*hemisphere,*cHemisphere;
+	CRay					*rays,*cRay;
+	int						*pending;
+	int						numPending		=	0;
+	const float				*jitter			=	NULL;
+	int						jitterNt		=	0;
+	int						jitterNp		=	0;
+	int						numRays			=	0;
+	int						i,j,k;
+
+	// The batch memory is released before we return so that the batches of a lookup don't pile up
+	memSave(checkpoint,context->threadMemory);
+
+	points		=	(CHemispherePoint *) ralloc(numPoints*sizeof(CHemispherePoint),context->threadMemory);
+
+	// Count the rays
+	for (k=0,cPoint=points;k<numPoints;k++,cPoint++) {
+		hemisphereStrata(samples[indices[k]],cPoint->nt,cPoint->np);
+		numRays	+=	cPoint->nt*cPoint->np;
+	}
 
 	// Allocate memory
-	const CShadingScratch	*scratch		=	&(context->currentShadingState->scratch);
-	const int				nt				=	(int) (sqrtf(scratch->traceParams.samples / (float) C_PI) + 0.5);
-	const int				np				=	(int) (C_PI*nt + 0.5);
-	const int				numSamples		=	nt*np;
-	CHemisphereSample		*hemisphere		=	(CHemisphereSample *) alloca(numSamples*sizeof(CHemisphereSample));
-	
-	// initialize texture lookups if needed
-	if (scratch->occlusionParams.environment) {
-		CTextureLookup::staticInit(&(context->currentShadingState->scratch));
+	cHemisphere	=	hemisphere	=	(CHemisphereSample *) ralloc(numRays*sizeof(CHemisphereSample),context->threadMemory);
+	cRay		=	rays		=	(CRay *) ralloc(numRays*sizeof(CRay),context->threadMemory);
+	pending						=	(int *) ralloc(numRays*sizeof(int),context->threadMemory);
+
+	// Create the rays
+	for (k=0,cPoint=points;k<numPoints;k++,cPoint++) {
+		const int	cIndex	=	indices[k];
+		const float	*cP		=	P + cIndex*3;
+		const float	*cN		=	N + cIndex*3;
+		const float	*cdPdu	=	dPdu + cIndex*3;
+		const float	*cdPdv	=	dPdv + cIndex*3;
+		const int	nt		=	cPoint->nt;
+		const int	np		=	cPoint->np;
+		vector		X,Y;
+
+		// Create an orthanormal coordinate system
+		if (dotvv(cdPdu,cdPdu) > 0) {
+			normalizevf(X,cdPdu);
+			crossvv(Y,cN,X);
+		} else if (dotvv(cdPdv,cdPdv) > 0) {
+			normalizevf(X,cdPdv);
+			crossvv(Y,cN,X);
+		} else {
+			// At this point, we're pretty screwed, so why not use the P
+			normalizevf(X,cP);
+			crossvv(Y,cN,X);
+		}
+
+		// Rotate the tangent frame of every point randomly about the normal
+		const float	rotation	=	(float) (2*C_PI*context->urand());
+		const float	cosRotation	=	cosf(rotation);
+		const float	sinRotation	=	sinf(rotation);
+
+		for (i=0;i<3;i++) {
+			cPoint->X[i]		=	X[i]*cosRotation + Y[i]*sinRotation;
+			cPoint->Y[i]		=	Y[i]*cosRotation - X[i]*sinRotation;
+		}
+
+		// The points share the jitter within the strata
+		if ((nt != jitterNt) || (np != jitterNp)) {
+			float	*cJitter	=	(float *) ralloc(nt*np*2*sizeof(float),context->threadMemory);
+
+			for (jitter=cJitter,i=nt*np;i>0;i--,cJitter+=2) {
+				cJitter[0]		=	context->urand();
+				cJitter[1]		=	context->urand();
+			}
+
+			jitterNt	=	nt;
+			jitterNp	=	np;
+		}
+
+		// Create the stratified directions in the tangent space (x,y,cos theta), the jitter
+		// is offset per point so that neighbouring points don't sample the same directions
+		float		*strata		=	(float *) ralloc(nt*np*3*sizeof(float),context->threadMemory);
+		{
+			const float	offsetTheta	=	context->urand();
+			const float	offsetPhi	=	context->urand();
+			const float	*cJitter	=	jitter;
+			float		*nStratum	=	strata;
+
+			for (i=0;i<nt;i++) {
+				for (j=0;j<np;j++,nStratum+=3,cJitter+=2) {
+					float	u	=	cJitter[0] + offsetTheta;
+					float	v	=	cJitter[1] + offsetPhi;
+
+					if (u >= 1)	u	-=	1;
+					if (v >= 1)	v	-=	1;
+
+					const float	sinTheta	=	sqrtf((i+u) / (float) nt);
+					const float	phi			=	(float) (2*C_PI*(j+v) / (float) np);
+
+					nStratum[0]			=	cosf(phi)*sinTheta;
+					nStratum[1]			=	sinf(phi)*sinTheta;
+					nStratum[2]			=	sqrtf(1 - sinTheta*sinTheta);
+				}
+			}
+		}
+
+		// Calculate the ray differentials (use average spread in theta and phi)
+		const float da			=	tanf((float) C_PI/(2*(nt+np)));
+		const float db			=	(lengthv(cdPdu) + lengthv(cdPdv))*0.5f;
+
+		cPoint->db				=	db;
+		cPoint->strata			=	strata;
+		cPoint->hemisphere		=	cHemisphere;
+		cHemisphere				+=	nt*np;
+
+		const float	*cStratum	=	strata;
+		const float	*cX			=	cPoint->X;
+		const float	*cY			=	cPoint->Y;
+		for (i=nt*np;i>0;i--,cStratum+=3,cRay++) {
+			float rv[2];
+			context->random2d.get(rv);
+
+			cRay->dir[0]			=	cX[0]*cStratum[0] + cY[0]*cStratum[1] + cN[0]*cStratum[2];
+			cRay->dir[1]			=	cX[1]*cStratum[0] + cY[1]*cStratum[1] + cN[1]*cStratum[2];
+			cRay->dir[2]			=	cX[2]*cStratum[0] + cY[2]*cStratum[1] + cN[2]*cStratum[2];
+
+			const float originJitterX = (rv[0] - 0.5f)*scratch->traceParams.sampleBase;
+			const float originJitterY = (rv[1] - 0.5f)*scratch->traceParams.sampleBase;
+
+			cRay->from[COMP_X]		=	cP[COMP_X] + originJitterX*cdPdu[0] + originJitterY*cdPdv[0];
+			cRay->from[COMP_Y]		=	cP[COMP_Y] + originJitterX*cdPdu[1] + originJitterY*cdPdv[1];
+			cRay->from[COMP_Z]		=	cP[COMP_Z] + originJitterX*cdPdu[2] + originJitterY*cdPdv[2];
+
+			cRay->flags				=	ATTRIBUTES_FLAGS_DIFFUSE_VISIBLE;
+			cRay->tmin				=	scratch->traceParams.bias;
+			cRay->t					=	scratch->traceParams.maxDist;
+			cRay->time				=	0;
+			cRay->da				=	da;
+			cRay->db				=	db;
+
+			// Transform the ray into the right coordinate system
+			mulmp(cRay->from,from,cRay->from);
+			mulmv(cRay->dir,from,cRay->dir);
+		}
 	}
-	
-	// Create an orthanormal coordinate system
-	if (dotvv(dPdu,dPdu) > 0) {
-		normalizevf(X,dPdu);
-		crossvv(Y,N,X);
-	} else if (dotvv(dPdv,dPdv) > 0) {
-		normalizevf(X,dPdv);
-		crossvv(Y,N,X);
+
+	// Trace the rays back to back, if the samples are not going into the cache any occluder will do
+	if (occlusion) {
+		context->numOcclusionRays			+=	numRays;
+		context->numOcclusionSamples		+=	numPoints;
+
+		if (save)	for (i=0;i<numRays;i++)	context->trace(rays + i);
+		else		for (i=0;i<numRays;i++)	context->traceAny(rays + i);
 	} else {
-		// At this point, we're pretty screwed, so why not use the P
-		normalizevf(X,P);
-		crossvv(Y,N,X);
+		context->numIndirectDiffuseRays		+=	numRays;
+		context->numIndirectDiffuseSamples	+=	numPoints;
+
+		for (i=0;i<numRays;i++)	context->trace(rays + i);
 	}
 
-	// Sample the hemisphere
-	coverage						=	0;
-	initv(irradiance,0);
-	initv(envdir,0);
-	rMean							=	C_INFINITY;
-	
-	// Calculate the ray differentials (use average spread in theta and phi)
-	const float da					=	tanf((float) C_PI/(2*(nt+np)));
-	const float db					=	(lengthv(dPdu) + lengthv(dPdv))*0.5f;
-	
-	if (scratch->occlusionParams.occlusion == TRUE) {
+	// Resolve the intersections
+	for (i=0,cRay=rays,cHemisphere=hemisphere;i<numRays;i++,cRay++,cHemisphere++) {
 
-		// We're shading for occlusion
-		context->numOcclusionRays			+=	numSamples;
-		context->numOcclusionSamples++;
+		// Do we have an intersection ?
+		if (cRay->object != NULL) {
+			CAttributes	*attributes	=	cRay->object->attributes;
+			CPhotonMap	*globalMap;
 
-		for (i=0;i<nt;i++) {
-			for (j=0;j<np;j++,hemisphere++) {
-				float rv[2];
-				context->random2d.get(rv);
-
-				float		tmp			=	sqrtf((i+context->urand()) / (float) nt);
-				const float	phi			=	(float) (2*C_PI*(j+context->urand()) / (float) np);
-				const float	cosPhi		=	(cosf(phi)*tmp);
-				const float	sinPhi		=	(sinf(phi)*tmp);
-
-				tmp						=	sqrtf(1 - tmp*tmp);
-
-				ray.dir[0]				=	X[0]*cosPhi + Y[0]*sinPhi + N[0]*tmp;
-				ray.dir[1]				=	X[1]*cosPhi + Y[1]*sinPhi + N[1]*tmp;
-				ray.dir[2]				=	X[2]*cosPhi + Y[2]*sinPhi + N[2]*tmp;
-
-				const float originJitterX = (rv[0] - 0.5f)*scratch->traceParams.sampleBase;
-				const float originJitterY = (rv[1] - 0.5f)*scratch->traceParams.sampleBase;
-				
-				ray.from[COMP_X]		=	P[COMP_X] + originJitterX*dPdu[0] + originJitterY*dPdv[0];
-				ray.from[COMP_Y]		=	P[COMP_Y] + originJitterX*dPdu[1] + originJitterY*dPdv[1];
-				ray.from[COMP_Z]		=	P[COMP_Z] + originJitterX*dPdu[2] + originJitterY*dPdv[2];
-
-				ray.flags				=	ATTRIBUTES_FLAGS_DIFFUSE_VISIBLE;
-				ray.tmin				=	scratch->traceParams.bias;
-				ray.t					=	scratch->traceParams.maxDist;
-				ray.time				=	0;
-				ray.da					=	da;
-				ray.db					=	db;
-
-				// Transform the ray into the right coordinate system
-				mulmp(ray.from,from,ray.from);
-				mulmv(ray.dir,from,ray.dir);
-
-				context->trace(&ray);
-
-				// Do we have an intersection ?
-				if (ray.object != NULL) {
-					const float	*color		=	ray.object->attributes->surfaceColor;
-
-					// Yes
-					coverage++;
-					addvv(irradiance,color);
-
-					hemisphere->coverage	=	1;
-					initv(hemisphere->envdir,0);
-					movvv(hemisphere->irradiance,color);
-				} else {
-					// No
-					hemisphere->coverage	=	0;
-					addvv(envdir,ray.dir);
-					movvv(hemisphere->envdir,ray.dir);
-					
-					// GSH : Texture lookup for misses
-					if(scratch->occlusionParams.environment != NULL){
-						CEnvironment *tex = scratch->occlusionParams.environment;
-						vector D0,D1,D2,D3;
-						vector color;
-
-						// GSHTODO: Add in the dCosPhi and dSinPhi
-						movvv(D0,ray.dir);
-						movvv(D1,ray.dir);
-						movvv(D2,ray.dir);
-						movvv(D3,ray.dir);
-						
-						float savedSamples = scratch->traceParams.samples;
-						context->currentShadingState->scratch.traceParams.samples = 1;
-						tex->lookup(color,D0,D1,D2,D3,context);
-						context->currentShadingState->scratch.traceParams.samples = savedSamples;
-						
-						addvv(irradiance,color);
-						movvv(hemisphere->irradiance,color);
-					} else{
-						initv(hemisphere->irradiance,0);
-					}
-				}
+			// Yes
+			if (occlusion) {
+				movvv(cHemisphere->irradiance,attributes->surfaceColor);
+			} else if ((globalMap = attributes->globalMap) != NULL) {
+				vector		hitP,hitN,hitC;
+
+				normalizev(hitN,cRay->N);
+				mulvf(hitP,cRay->dir,cRay->t);
+				addvv(hitP,cRay->from);
+
+				if(dotvv(cRay->dir,hitN) > 0)
+					mulvf(hitN,-1);
+
+				globalMap->lookup(hitC,hitP,hitN,attributes->photonEstimator,attributes->photonMaxError);
 
-				hemisphere->depth			=	ray.t;
-				hemisphere->invDepth		=	1 / ray.t;
+				// HACK: Avoid too bright spots
+				const float	brightness	=	max(max(hitC[0],hitC[1]),hitC[2]);
+				if (brightness > scratch->occlusionParams.maxBrightness)	mulvf(hitC,scratch->occlusionParams.maxBrightness/brightness);
 
-				if (tmp > horizonCutoff)	rMean =	min(rMean,ray.t);
-				
-				movvv(hemisphere->dir,ray.dir);
+				mulvv(hitC,attributes->surfaceColor);
+				movvv(cHemisphere->irradiance,hitC);
 
-				assert(hemisphere->invDepth > 0);
+				context->numIndirectDiffusePhotonmapLookups++;
+			} else {
+				initv(cHemisphere->irradiance,0);
 			}
+
+			cHemisphere->coverage	=	1;
+			initv(cHemisphere->envdir,0);
+		} else {
+			// No
+			cHemisphere->coverage	=	0;
+			movvv(cHemisphere->envdir,cRay->dir);
+
+			// GSH : Texture lookup for misses
+			if (environment != NULL)	pending[numPending++]	=	i;
+			else if (occlusion)			initv(cHemisphere->irradiance,0);
+			else						movvv(cHemisphere->irradiance,scratch->occlusionParams.environmentColor);
 		}
-	} else {
 
-		// We're shading for indirectdiffuse
-		context->numIndirectDiffuseRays	+=	numSamples;
-		context->numIndirectDiffuseSamples++;
+		cHemisphere->depth			=	cRay->t;
+		cHemisphere->invDepth		=	1 / cRay->t;
+		movvv(cHemisphere->dir,cRay->dir);
 
-		for (i=0;i<nt;i++) {
-			for (j=0;j<np;j++,hemisphere++) {
-				float rv[2];
-				context->random2d.get(rv);
-				
-				float		tmp			=	sqrtf((i+context->urand()) / (float) nt);
-				const float	phi			=	(float) (2*C_PI*(j+context->urand()) / (float) np);
-				const float	cosPhi		=	(cosf(phi)*tmp);
-				const float	sinPhi		=	(sinf(phi)*tmp);
-
-				tmp						=	sqrtf(1 - tmp*tmp);
-
-				ray.dir[0]				=	X[0]*cosPhi + Y[0]*sinPhi + N[0]*tmp;
-				ray.dir[1]				=	X[1]*cosPhi + Y[1]*sinPhi + N[1]*tmp;
-				ray.dir[2]				=	X[2]*cosPhi + Y[2]*sinPhi + N[2]*tmp;
-
-				const float originJitterX = (rv[0] - 0.5f)*scratch->traceParams.sampleBase;
-				const float originJitterY = (rv[1] - 0.5f)*scratch->traceParams.sampleBase;
-				
-				ray.from[COMP_X]		=	P[COMP_X] + originJitterX*dPdu[0] + originJitterY*dPdv[0];
-				ray.from[COMP_Y]		=	P[COMP_Y] + originJitterX*dPdu[1] + originJitterY*dPdv[1];
-				ray.from[COMP_Z]		=	P[COMP_Z] + originJitterX*dPdu[2] + originJitterY*dPdv[2];
-
-				ray.flags				=	ATTRIBUTES_FLAGS_DIFFUSE_VISIBLE;
-				ray.tmin				=	scratch->traceParams.bias;
-				ray.t					=	scratch->traceParams.maxDist;
-				ray.time				=	0;
-				ray.da					=	da;
-				ray.db					=	db;
-
-				// Transform the ray into the right coordinate system
-				mulmp(ray.from,from,ray.from);
-				mulmv(ray.dir,from,ray.dir);
-
-				context->trace(&ray);
-
-				// Do we have an intersection ?
-				if (ray.object != NULL) {
-					vector		P,N,C;
-					CAttributes	*attributes	=	ray.object->attributes;
-					CPhotonMap	*globalMap;
-
-					if ((globalMap = attributes->globalMap) != NULL) {
-						normalizev(N,ray.N);
-						mulvf(P,ray.dir,ray.t);
-						addvv(P,ray.from);
-						
-						if(dotvv(ray.dir,N) > 0)
-							mulvf(N,-1);
-
-						globalMap->lookup(C,P,N,attributes->photonEstimator);
-
-						// HACK: Avoid too bright spots
-						tmp	=	max(max(C[0],C[1]),C[2]);
-						if (tmp > scratch->occlusionParams.maxBrightness)	mulvf(C,scratch->occlusionParams.maxBrightness/tmp);
-						
-						mulvv(C,attributes->surfaceColor);
-						addvv(irradiance,C);
-						movvv(hemisphere->irradiance,C);
-
-						context->numIndirectDiffusePhotonmapLookups++;
-					} else {
-						initv(hemisphere->irradiance,0);
-					}
+		assert(cHemisphere->invDepth > 0);
+	}
 
-					// Yes
-					coverage++;
+	// Lookup the environment for all the misses
+	if (numPending > 0) {
+		const float	savedSamples		=	scratch->traceParams.samples;
 
-					hemisphere->coverage	=	1;
-					initv(hemisphere->envdir,0);
-				} else {
-					// No
-					hemisphere->coverage	=	0;
-					addvv(envdir,ray.dir);
-					movvv(hemisphere->envdir,ray.dir);
-					
-					// GSH : Texture lookup for misses
-					if(scratch->occlusionParams.environment != NULL){
-						CEnvironment *tex = scratch->occlusionParams.environment;
-						vector D0,D1,D2,D3;
-						vector color;
-
-						// GSHTODO: Add in the dCosPhi and dSinPhi
-						movvv(D0,ray.dir);
-						movvv(D1,ray.dir);
-						movvv(D2,ray.dir);
-						movvv(D3,ray.dir);
-						
-						float savedSamples = scratch->traceParams.samples;
-						context->currentShadingState->scratch.traceParams.samples = 1;
-						tex->lookup(color,D0,D1,D2,D3,context);
-						context->currentShadingState->scratch.traceParams.samples = savedSamples;
-						
-						addvv(irradiance,color);
-						movvv(hemisphere->irradiance,color);
-					} else{
-						movvv(hemisphere->irradiance,scratch->occlusionParams.environmentColor);
-						addvv(irradiance,scratch->occlusionParams.environmentColor);
-					}
-				}
+		CTextureLookup::staticInit(scratch);
 
-				hemisphere->depth			=	ray.t;
-				hemisphere->invDepth		=	1 / ray.t;
+		scratch->traceParams.samples	=	1;
+		for (i=0;i<numPending;i++) {
+			const float	*D	=	rays[pending[i]].dir;
 
-				if (tmp > horizonCutoff)	rMean =	min(rMean,ray.t);
+			// GSHTODO: Add in the dCosPhi and dSinPhi
+			environment->lookup(hemisphere[pending[i]].irradiance,D,D,D,D,context);
+		}
+		scratch->traceParams.samples	=	savedSamples;
+	}
 
-				movvv(hemisphere->dir,ray.dir);
+	// Integrate the hemispheres
+	for (k=0,cPoint=points;k<numPoints;k++,cPoint++) {
+		const int		nt			=	cPoint->nt;
+		const int		np			=	cPoint->np;
+		const float		*cStratum	=	cPoint->strata;
+		float			*cC			=	C + indices[k]*7;
+		float			coverage	=	0;
+		float			rMean		=	C_INFINITY;
+		vector			irradiance,envdir;
 
-				assert(hemisphere->invDepth > 0);
-			}
+		initv(irradiance,0);
+		initv(envdir,0);
+
+		for (i=nt*np,cHemisphere=cPoint->hemisphere;i>0;i--,cHemisphere++,cStratum+=3) {
+			coverage	+=	cHemisphere->coverage;
+			addvv(irradiance,cHemisphere->irradiance);
+			addvv(envdir,cHemisphere->envdir);
+
+			if (cStratum[2] > horizonCutoff)	rMean =	min(rMean,cHemisphere->depth);
+		}
+
+		// Normalize
+		const float	tmp			=	1 / (float) (nt*np);
+		coverage				*=	tmp;
+		mulvf(irradiance,tmp);
+		normalizevf(envdir);
+
+		// Record the value
+		cC[0]					=	irradiance[0];
+		cC[1]					=	irradiance[1];
+		cC[2]					=	irradiance[2];
+		cC[3]					=	coverage;
+		cC[4]					=	envdir[0];
+		cC[5]					=	envdir[1];
+		cC[6]					=	envdir[2];
+
+		// Should we save it ?
+		cPoint->save			=	(save && (coverage < 1-C_EPSILON));
+		if (cPoint->save) {
+			CCacheSample	*cSample	=	&cPoint->sample;
+
+			// Compute the gradients of the illumination
+			posGradient(cSample->gP,np,nt,cPoint->hemisphere,cPoint->X,cPoint->Y);
+			rotGradient(cSample->gR,np,nt,cPoint->hemisphere,cPoint->X,cPoint->Y);
+
+			// Compute the radius of validity
+			rMean					*=	0.5f;
+
+			// Clamp the radius of validity
+			rMean					=	min(rMean,cPoint->db*scratch->occlusionParams.maxPixelDist);
+
+			// Record the data (in the target coordinate system)
+			movvv(cSample->P,P + indices[k]*3);
+			movvv(cSample->N,N + indices[k]*3);
+			cSample->dP				=	rMean;
+			cSample->coverage		=	coverage;
+			movvv(cSample->envdir,envdir);
+			movvv(cSample->irradiance,irradiance);
 		}
 	}
-	hemisphere				-=	np*nt;
-	
-	// Normalize
-	const float	tmp			=	1 / (float) numSamples;
-	coverage				*=	tmp;
-	mulvf(irradiance,tmp);
-	normalizevf(envdir);
-
-	// Record the value
-	C[0]					=	irradiance[0];
-	C[1]					=	irradiance[1];
-	C[2]					=	irradiance[2];
-	C[3]					=	coverage;
-	C[4]					=	envdir[0];
-	C[5]					=	envdir[1];
-	C[6]					=	envdir[2];
-
-	// Should we save it ?
-	if ((scratch->occlusionParams.maxError != 0) && (coverage < 1-C_EPSILON)) {
-
-		// We're modifying, lock the thing
-		osLock(mutex);
-		
+
+	if (save == FALSE) {
+		memRestore(checkpoint,context->threadMemory);
+		return;
+	}
+
+	// The error multiplier
+	const float		K		=	0.4f / scratch->occlusionParams.maxError;
+
+	// We're modifying, lock the thing
+	osLock(mutex);
+
+	for (k=0,cPoint=points;k<numPoints;k++,cPoint++) {
+		CCacheSample	*cSample;
+		CCacheNode		*cNode;
+		int				depth;
+
+		if (cPoint->save == FALSE)	continue;
+
 		// Create the sample
 		cSample					=	(CCacheSample *) memory->alloc(sizeof(CCacheSample));
+		*cSample				=	cPoint->sample;
 
-		// Compute the gradients of the illumination
-		posGradient(cSample->gP,np,nt,hemisphere,X,Y);
-		rotGradient(cSample->gR,np,nt,hemisphere,X,Y);
-		
-		// Compute the radius of validity
-		rMean					*=	0.5f;
-
-		// Clamp the radius of validity
-		rMean					=	min(rMean,db*scratch->occlusionParams.maxPixelDist);
-		
-		// Record the data (in the target coordinate system)
-		movvv(cSample->P,P);
-		movvv(cSample->N,N);
-		cSample->dP				=	rMean;
-		cSample->coverage		=	coverage;
-		movvv(cSample->envdir,envdir);
-		movvv(cSample->irradiance,irradiance);
-		
 		// Do the neighbour clamping trick
 		clamp(cSample);
-		rMean	=	cSample->dP;	// copy dP back so we get the right place in the octree
-		
-		// The error multiplier
-		const float		K		=	0.4f / scratch->occlusionParams.maxError;
-		rMean					/=	K;
-		
+		const float	rMean		=	cSample->dP / K;	// use the clamped dP so we get the right place in the octree
+
 		// Insert the new sample into the cache
 		cNode					=	root;
 		depth					=	0;
@@ -875,7 +1484,7 @@ void		CIrradianceCache::sample(float *C,const float *P,const float *dPdu,const f
 			depth++;
 
 			for (j=0,i=0;i<3;i++) {
-				if (P[i] > cNode->center[i]) {
+				if (cSample->P[i] > cNode->center[i]) {
 					j			|=	1 << i;
 				}
 			}
@@ -884,28 +1493,37 @@ void		CIrradianceCache::sample(float *C,const float *P,const float *dPdu,const f
 				CCacheNode	*nNode	=	(CCacheNode *) memory->alloc(sizeof(CCacheNode));
 
 				for (i=0;i<3;i++) {
-					if (P[i] > cNode->center[i]) {
+					if (cSample->P[i] > cNode->center[i]) {
 						nNode->center[i]	=	cNode->center[i] + cNode->side*0.25f;
 					} else {
 						nNode->center[i]	=	cNode->center[i] - cNode->side*0.25f;
 					}
 				}
 
-				cNode->children[j]	=	nNode;
 				nNode->side			=	cNode->side*0.5f;
 				nNode->samples		=	NULL;
 				for (i=0;i<8;i++)	nNode->children[i]	=	NULL;
+
+				// The lookups do not lock, publish the node after it's filled in
+				memoryBarrier();
+				cNode->children[j]	=	nNode;
 			}
 
 			cNode			=	cNode->children[j];
 		}
 
 		cSample->next	=	cNode->samples;
+		memoryBarrier();
 		cNode->samples	=	cSample;
 		maxDepth		=	max(depth,maxDepth);
 
-		osUnlock(mutex);
+		// Record the sample so that a remote channel can send it
+		if (journal != NULL)	journal->push(cSample);
 	}
+
+	osUnlock(mutex);
+
+	memRestore(checkpoint,context->threadMemory);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -957,6 +1575,43 @@ void		CIrradianceCache::clamp(CCacheSample *nSample) {
 			}
 		}
 	}
+
+	// The samples in the cache file are read only, so only the new sample is clamped
+	if (numFlatNodes > 0) {
+		int		*flatStackBase	=	(int *) alloca((flatMaxDepth+1)*sizeof(int)*8);
+		int		*flatStack		=	flatStackBase;
+		int		j;
+
+		*flatStack++	=	0;
+		while(flatStack > flatStackBase) {
+			const CFlatNode	*fNode	=	flatNodes + *(--flatStack);
+
+			for (j=fNode->firstSample;j<fNode->firstSample+fNode->numSamples;j++) {
+				vector	D;
+
+				subvv(D,flatP + j*3,nSample->P);
+				const float 	l	= 	(dotvv(D,D) > C_EPSILON) ? lengthv(D) : C_EPSILON;
+
+				nSample->dP		=	min(nSample->dP,flatdP[j] + l);
+			}
+
+			for (i=0;i<8;i++) {
+				if (fNode->children[i] >= 0) {
+					const CFlatNode	*tNode	=	flatNodes + fNode->children[i];
+					const float		tSide	=	tNode->side*4;
+
+					if (	((tNode->center[0] + tSide) > nSample->P[0])	&&
+							((tNode->center[1] + tSide) > nSample->P[1])	&&
+							((tNode->center[2] + tSide) > nSample->P[2])	&&
+							((tNode->center[0] - tSide) < nSample->P[0])	&&
+							((tNode->center[1] - tSide) < nSample->P[1])	&&
+							((tNode->center[2] - tSide) < nSample->P[2])) {
+						*flatStack++	=	fNode->children[i];
+					}
+				}
+			}
+		}
+	}
 }
 
 
@@ -1018,6 +1673,24 @@ void		CIrradianceCache::draw() {
 		}
 	}
 
+	// Draw the samples in the cache file
+	for (i=0;i<numFlatSamples;i++,j--,cP+=3,cN+=3,cdP++,cC+=3) {
+		if (j == 0)	{
+			if (drawDiscs)		drawDisks(chunkSize,P,dP,N,C);
+			else			 	drawPoints(chunkSize,P,C);
+			cP	=	P;
+			cC	=	C;
+			cN	=	N;
+			cdP	=	dP;
+			j	=	chunkSize;
+		}
+
+		movvv(cP,flatP + i*3);
+		movvv(cN,flatN + i*3);
+		*cdP		=	flatdP[i];
+		movvv(cC,flatIrradiance + i*3);
+	}
+
 	if (j != chunkSize) {
 		if (drawDiscs)		drawDisks(chunkSize-j,P,dP,N,C);
 		else			 	drawPoints(chunkSize-j,P,C);
@@ -34,6 +34,7 @@
 #include "common/global.h"
 #include "common/os.h"
 #include "common/algebra.h"
+#include "common/containers.h"
 #include "options.h"
 #include "shader.h"
 #include "texture3d.h"
@@ -97,25 +98,48 @@ public:
 		float				side;				// The side length of the node
 	};
 
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CFlatNode
+	// Description			:
+/// \brief					A node of the octree as it is stored in the cache file
+	// Comments				:	The nodes are stored depth first so the samples of a subtree
+	//							are contiguous in the file
+	class	CFlatNode {
+	public:
+		vector				center;				// The center of the node
+		float				side;				// The side length of the node
+		int					firstSample;		// The index of the first sample of the node
+		int					numSamples;			// The number of samples in the node
+		int					children[8];		// The children (-1 if none)
+	};
+
 public:
 
-								CIrradianceCache(const char *name,unsigned int flags,FILE *in,const float *from,const float *to,const float *tondc=NULL);
+								CIrradianceCache(const char *name,unsigned int flags,FILE *in,const float *from,const float *to,const float *tondc=NULL,const char *fileName=NULL);
 								~CIrradianceCache();
 
 		void					lookup(float *,const float *,const float *,float)		{	assert(FALSE);	}
 		void					store(const float *,const float *,const float *,float)	{	assert(FALSE);	}
 
 		void					lookup(float *,const float *,const float *,const float *,const float *,CShadingContext *);
+		void					lookup(int,float *,const float *,const float *,const float *,const float *,const float *,CShadingContext *);
 
 		void					draw();
 		int						keyDown(int key);
 		
 		void					bound(float *bmin,float *bmax);
 private:
-		void					writeNode(FILE *,CCacheNode *);
 		CCacheNode				*readNode(FILE *);
-
-		void					sample(float *,const float *,const float *,const float *,const float *,CShadingContext *);
+		int						readFlat(FILE *,const char *);
+		int						checkFlat();
+		void					writeFlat(FILE *);
+		int						flattenNode(CCacheNode *,CArray<CFlatNode> &,CArray<CCacheSample *> &);
+		CCacheNode				*materializeNode(int);
+		void					flatSample(CCacheSample *,int) const;
+		void					unmapFlat();
+
+		int						interpolate(float *,const float *,const float *,CShadingContext *);
+		void					sample(int,const int *,float *,const float *,const float *,const float *,const float *,const float *,CShadingContext *);
 		void					clamp(CCacheSample *);
 
 		CMemStack				*memory;
@@ -123,6 +147,25 @@ private:
 		CCacheNode				*root;
 		int						maxDepth;
 		int						flags;
+		CArray<CCacheSample *>	*journal;					// The samples we own, in the order they were created (only kept for network renders)
+
+		// The cache file we're reading from (if it is not loaded into the octree)
+		char					*flatData;					// The file data
+		size_t					flatSize;					// The size of the file
+		int						flatMapped;					// TRUE if the data is mapped
+		int						flatMaxDepth;				// The depth of the file octree
+		int						numFlatNodes;				// The number of nodes in the file
+		int						numFlatSamples;				// The number of samples in the file
+		const CFlatNode			*flatNodes;					// The file octree
+		const float				*flatP;						// The sample positions
+		const float				*flatN;						// The sample normals
+		const float				*flatIrradiance;			// The sample irradiances
+		const float				*flatEnvdir;				// The sample environment directions
+		const float				*flatCoverage;				// The sample coverages
+		const float				*flatdP;					// The sample radii
+		const float				*flatGradients;				// The translational + rotational gradients (NULL if quantized)
+		const short				*flatQGradients;			// The quantized gradients (NULL if not quantized)
+		const float				*flatGradientScale;			// The translational and rotational scale of the quantized gradients
 		
 		TMutex					mutex;
 		
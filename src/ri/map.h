@@ -63,6 +63,9 @@
 // Debug and build options
 //#define PHOTON_DEBUG
 
+// The number of lookups that are walked through the tree together in a batch
+#define	MAP_BATCH_SIZE	32
+
 // Some extern variables defined in photon.cpp
 extern	const float				costheta[];
 extern	const float				sintheta[];
@@ -291,6 +294,9 @@ protected:
 					vector		P,N;
 					float		*distances;
 					const T		**indices;
+
+					// Batched lookups accept every item that is close enough by default
+					static inline int	valid(const CLookup *,const T *,float) { return TRUE; }
 				};
 
 			///////////////////////////////////////////////////////////////////////
@@ -475,6 +481,116 @@ public:
 							}
 						}
 
+						///////////////////////////////////////////////////////////////////////
+						// Class				:	CMap
+						// Method				:	lookupBatch
+						// Description			:
+/// \brief					Locate the nearest items for a number of lookups
+						// Return Value			:	-
+						// Comments				:	The lookups are split into groups of MAP_BATCH_SIZE and each
+						//							group walks the tree once. Every lookup has its own heap so
+						//							this is thread safe as long as the map is not modified.
+						//							N is used to weight the distances (zero N gives plain lookups)
+						//							and L::valid() can reject individual items
+				template <class L>
+				void	lookupBatch(L **lookups,int numLookups) {
+							for (;numLookups > 0;lookups+=MAP_BATCH_SIZE,numLookups-=MAP_BATCH_SIZE) {
+								lookupBatch(lookups,min(numLookups,MAP_BATCH_SIZE),1);
+							}
+						}
+
+						///////////////////////////////////////////////////////////////////////
+						// Class				:	CMap
+						// Method				:	lookupBatch
+						// Description			:
+/// \brief					Walk a subtree with a group of active lookups
+						// Return Value			:	Internally used
+						// Comments				:	Every lookup still visits its near child first. The lookups
+						//							on the minority side are routed back into the majority child
+						//							after it has been searched, so no lookup is pruned
+						//							with a larger radius than it would be when searched alone
+				template <class L>
+				void	lookupBatch(L **active,int numActive,int index) {
+							const T		*photon		=	&items[index];
+							float		*dist		=	(float *) alloca(numActive*sizeof(float));
+							int			i;
+
+							if (index < numItemsh) {
+								const int	axis		=	photon->flags;
+								const float	split		=	photon->P[axis];
+								L			**side		=	(L **) alloca(numActive*sizeof(L *));
+								L			**cross		=	(L **) alloca(numActive*sizeof(L *));
+								float		*sideDist	=	(float *) alloca(numActive*sizeof(float));
+								int			numLeft		=	0;
+								int			numRight	=	0;
+								int			numCross;
+
+								// Sort the lookups by the side of the splitting plane they're on
+								// (left ones are at the start, right ones are at the end of side)
+								for (i=0;i<numActive;i++)	dist[i]	=	active[i]->P[axis] - split;
+								for (i=0;i<numActive;i++) {
+									if (dist[i] > 0) {
+										numRight++;
+										side[numActive-numRight]		=	active[i];
+										sideDist[numActive-numRight]	=	dist[i];
+									} else {
+										side[numLeft]					=	active[i];
+										sideDist[numLeft]				=	dist[i];
+										numLeft++;
+									}
+								}
+
+								// Search the child that most of the lookups are in first
+								L			**first,**second;
+								const float	*firstDist,*secondDist;
+								int			numFirst,numSecond,firstChild,secondChild;
+
+								if (numLeft >= numRight) {
+									first		=	side;							firstDist	=	sideDist;
+									numFirst	=	numLeft;						firstChild	=	2*index;
+									second		=	side + numLeft;					secondDist	=	sideDist + numLeft;
+									numSecond	=	numRight;						secondChild	=	2*index+1;
+								} else {
+									first		=	side + numLeft;					firstDist	=	sideDist + numLeft;
+									numFirst	=	numRight;						firstChild	=	2*index+1;
+									second		=	side;							secondDist	=	sideDist;
+									numSecond	=	numLeft;						secondChild	=	2*index;
+								}
+
+								lookupBatch(first,numFirst,firstChild);
+
+								// The second child gets its own lookups and the ones that still straddle the plane
+								for (numCross=0,i=0;i<numSecond;i++)	cross[numCross++]	=	second[i];
+								for (i=0;i<numFirst;i++) {
+									if (firstDist[i]*firstDist[i] < first[i]->distances[0])	cross[numCross++]	=	first[i];
+								}
+								if (numCross > 0)	lookupBatch(cross,numCross,secondChild);
+
+								// Go back to the first child for the minority lookups that straddle the plane
+								for (numCross=0,i=0;i<numSecond;i++) {
+									if (secondDist[i]*secondDist[i] < second[i]->distances[0])	cross[numCross++]	=	second[i];
+								}
+								if (numCross > 0)	lookupBatch(cross,numCross,firstChild);
+							}
+
+							// Compute the distances for the whole group in one go
+							for (i=0;i<numActive;i++) {
+								const L		*l	=	active[i];
+								const float	Dx	=	photon->P[0] - l->P[0];
+								const float	Dy	=	photon->P[1] - l->P[1];
+								const float	Dz	=	photon->P[2] - l->P[2];
+								const float	t	=	Dx*l->N[0] + Dy*l->N[1] + Dz*l->N[2];
+
+								dist[i]			=	Dx*Dx + Dy*Dy + Dz*Dz + t*t*16;
+							}
+
+							for (i=0;i<numActive;i++) {
+								if (dist[i] < active[i]->distances[0]) {
+									if (L::valid(active[i],photon,dist[i]))	insert(active[i],dist[i],photon);
+								}
+							}
+						}
+
 						///////////////////////////////////////////////////////////////////////
 						// Class				:	CMap
 						// Method				:	insert
@@ -37,6 +37,7 @@
 #include "ri.h"
 #include "shading.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "surface.h"
 #include "rendererContext.h"
@@ -71,6 +72,8 @@ CObject::CObject(CAttributes *a,CXform *x) {
 	
 	children	=	NULL;
 	sibling		=	NULL;
+
+	motionBound	=	NULL;
 }
 
 
@@ -86,6 +89,8 @@ CObject::~CObject() {
 
 	attributes->detach();
 	xform->detach();
+
+	if (motionBound != NULL)	delete [] motionBound;
 }
 
 
@@ -138,6 +143,68 @@ static	float	getDisp(const float *mat,float disp) {
 #undef urand
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	expandBound
+// Description			:
+/// \brief					Grow a bounding box by a fraction of its size and the displacement
+// Return Value			:	-
+// Comments				:
+static	void	expandBound(float *bmin,float *bmax,float bexpand,float maxDisp) {
+	vector	D;
+	float	maxD;
+
+	subvv(D,bmax,bmin);
+	maxD	=	D[0];
+	maxD	=	max(D[1],maxD);
+	maxD	=	max(D[2],maxD);
+	maxD	*=	bexpand;
+
+	maxD	+=	maxDisp;
+
+	// Expand the bound accordingly
+	subvf(bmin,maxD);
+	addvf(bmax,maxD);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	motionCluster
+// Description			:
+/// \brief					Compute the motion bound of a cluster
+// Return Value			:	-
+// Comments				:	The cluster only gets a motion bound if one of its children is moving,
+//							the stationary children are the same at both keys. Interpolating the
+//							union of the key bounds always contains the interpolated child bounds
+static	void	motionCluster(CObject *cluster) {
+	CObject	*cObject;
+
+	for (cObject=cluster->children;cObject!=NULL;cObject=cObject->sibling) {
+		if (cObject->motionBound != NULL)	break;
+	}
+
+	if (cObject == NULL)	return;
+
+	float	*bound			=	new float[12];
+	cluster->motionBound	=	bound;
+	initv(bound + 0,C_INFINITY);
+	initv(bound + 3,-C_INFINITY);
+	initv(bound + 6,C_INFINITY);
+	initv(bound + 9,-C_INFINITY);
+
+	for (cObject=cluster->children;cObject!=NULL;cObject=cObject->sibling) {
+		if (cObject->motionBound != NULL) {
+			addBox(bound + 0,bound + 3,cObject->motionBound + 0);
+			addBox(bound + 0,bound + 3,cObject->motionBound + 3);
+			addBox(bound + 6,bound + 9,cObject->motionBound + 6);
+			addBox(bound + 6,bound + 9,cObject->motionBound + 9);
+		} else {
+			addBox(bound + 0,bound + 3,cObject->bmin);
+			addBox(bound + 0,bound + 3,cObject->bmax);
+			addBox(bound + 6,bound + 9,cObject->bmin);
+			addBox(bound + 6,bound + 9,cObject->bmax);
+		}
+	}
+}
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CObject
@@ -270,6 +337,10 @@ void		CObject::cluster(CShadingContext *context) {
 	// Recurse
 	front->children	=	frontChildren;
 	back->children	=	backChildren;
+
+	// Bound the moving children at the shutter open and close separately
+	motionCluster(front);
+	motionCluster(back);
 	
 	front->attach();
 	back->attach();
@@ -318,15 +389,44 @@ void		CObject::destroy() {
 // Return Value			:
 // Comments				:
 void		CObject::makeBound(float *bmin,float *bmax) const {
-	vector	D;
-	float	maxD;
-	float	maxDisp = attributes->maxDisplacement;
+	expandBound(bmin,bmax,attributes->bexpand,displacementBound());
+}
 
-	subvv(D,bmax,bmin);
-	maxD	=	D[0];
-	maxD	=	max(D[1],maxD);
-	maxD	=	max(D[2],maxD);
-	maxD	*=	attributes->bexpand;
+///////////////////////////////////////////////////////////////////////
+// Class				:	CObject
+// Method				:	makeMotionBound
+// Description			:
+/// \brief					Bound a moving object
+// Return Value			:
+// Comments				:	The arguments are the bounds at the shutter open and close,
+//							bmin/bmax is set to their union
+void		CObject::makeMotionBound(const float *bmin0,const float *bmax0,const float *bmin1,const float *bmax1) {
+	const float	maxDisp	=	displacementBound();
+
+	if (motionBound == NULL)	motionBound	=	new float[12];
+
+	movvv(motionBound + 0,bmin0);
+	movvv(motionBound + 3,bmax0);
+	movvv(motionBound + 6,bmin1);
+	movvv(motionBound + 9,bmax1);
+	expandBound(motionBound + 0,motionBound + 3,attributes->bexpand,maxDisp);
+	expandBound(motionBound + 6,motionBound + 9,attributes->bexpand,maxDisp);
+
+	movvv(bmin,motionBound + 0);
+	movvv(bmax,motionBound + 3);
+	addBox(bmin,bmax,motionBound + 6);
+	addBox(bmin,bmax,motionBound + 9);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CObject
+// Method				:	displacementBound
+// Description			:
+/// \brief					Find the maximum displacement of the object
+// Return Value			:	The displacement in the camera space
+// Comments				:
+float		CObject::displacementBound() const {
+	float	maxDisp = attributes->maxDisplacement;
 
 	// Add the displacement amount of the surface
 	if (attributes->maxDisplacementSpace != NULL) {
@@ -341,11 +441,7 @@ void		CObject::makeBound(float *bmin,float *bmax) const {
 		attributes->maxDisplacementSpace	=	NULL;
 	}
 
-	maxD	+=	maxDisp;
-
-	// Expand the bound accordingly
-	subvf(bmin,maxD);
-	addvf(bmax,maxD);
+	return maxDisp;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -546,7 +642,7 @@ void				CSurface::intersect(CShadingContext *context,CRay *cRay) {
 	// Do we have a grid ?
 	if (children == NULL) {
 		// Intersect with our bounding box
-		float t = nearestBox(bmin,bmax,cRay->from,cRay->invDir,cRay->tmin,cRay->t);
+		float t = nearestBound(cRay);
 	
 		// Bail out if the hit point is already further than the ray got
 		// Note: this avoids unneeded top level tesselations
@@ -554,7 +650,7 @@ void				CSurface::intersect(CShadingContext *context,CRay *cRay) {
 
 		// We must lock the tesselateMutex so that the list of known tesselation patches
 		// is maintained in a thread safe manner
-		osLock(CRenderer::tesselateMutex);
+		profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");
 
 		if (children == NULL) {
 
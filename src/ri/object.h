@@ -55,6 +55,8 @@ const unsigned int	OBJECT_TESSELATION			=	2;	// Set if the object is an intermed
 const unsigned int	OBJECT_MOVING_TESSELATION	=	4;	// Set if the object is an intermediate tesselation which is moving
 const unsigned int	OBJECT_HIERARCHY_READY		=	8;	// Set if the children pointer is processed
 const unsigned int	OBJECT_TERMINAL_TESSELATION	=	16;	// Set if the object should not be further tesselated
+const unsigned int	OBJECT_INSTANCE				=	32;	// Set if the object is an instance that shares the raytracing hierarchy
+const unsigned int	OBJECT_EXPAND_INSTANCE		=	64;	// Set if the instances of the object can not share the raytracing hierarchy
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -89,15 +91,32 @@ public:
 
 			void			destroy();					// Delete the children/siblings
 
+														// Intersect the ray with the bound at the ray time
+	inline	float			nearestBound(const CRay *ray) const {
+								if (motionBound == NULL)	return nearestBox(bmin,bmax,ray->from,ray->invDir,ray->tmin,ray->t);
+
+								vector	tmin,tmax;
+								interpolatev(tmin,motionBound + 0,motionBound + 6,ray->time);
+								interpolatev(tmax,motionBound + 3,motionBound + 9,ray->time);
+								return nearestBox(tmin,tmax,ray->from,ray->invDir,ray->tmin,ray->t);
+							}
+
 	int						flags;						// Holds object flags
 	CAttributes				*attributes;				// Holds the object attributes
 	CXform					*xform;						// Holds the object xform to the object space
 	CObject					*children,*sibling;			// The hierarchy
 	vector					bmin,bmax;					// The bounding box
+	float					*motionBound;				// The bounding boxes at the shutter open and close (NULL if not moving)
 protected:
 	// This function must be used to expand the bound to take the displacements into account
 	void					makeBound(float *,float *) const;
 
+	// Same as above for a moving object, sets the motion bound and the bounding box
+	void					makeMotionBound(const float *,const float *,const float *,const float *);
+
+	// The displacement bound of the object (in the camera space)
+	float					displacementBound() const;
+
 	// This function can be used to estimate the grid size
 	void					estimateDicing(float *P,int udiv,int vdiv,int &nudiv,int &nvdiv,float shadingRate,int nonrasterorient);
 };
@@ -398,6 +398,8 @@ COptions::COptions() {
 
 	endofframe				=	0;
 	filelog					=	NULL;
+	tracefile				=	NULL;
+	statsfile				=	NULL;
 
 	numThreads              =   osAvailableCPUs();
 	if (numThreads < 1)
@@ -405,6 +407,8 @@ COptions::COptions() {
 
 	maxTextureSize			=	DEFAULT_MAX_TEXTURESIZE;
 	maxBrickSize			=	DEFAULT_MAX_BRICKSIZE;
+	maxPtcSize				=	DEFAULT_MAX_PTCMEMORY;
+	ptcPageSize				=	0;
 
 	maxGridSize				=	DEFAULT_MAX_GRIDSIZE;
 
@@ -418,6 +422,10 @@ COptions::COptions() {
 	netYBuckets				=	DEFAULT_NET_YBUCKETS;
 
 	threadStride			=	DEFAULT_THREAD_STRIDE;
+
+	bucketOrder				=	BUCKET_ORDER_HORIZONTAL;
+
+	maxGridMemory			=	DEFAULT_MAX_GRIDMEMORY;
 	
 	geoCacheMemory			=	DEFAULT_GEO_CACHE_SIZE;
 
@@ -511,6 +519,8 @@ COptions::COptions(const COptions *o) {
 	globalIn				=	(o->globalIn != NULL ? strdup(o->globalIn) : NULL);
 	globalOut				=	(o->globalOut != NULL ? strdup(o->globalOut) : NULL);
 	filelog					=	(o->filelog != NULL ? strdup(o->filelog) : NULL);
+	tracefile				=	(o->tracefile != NULL ? strdup(o->tracefile) : NULL);
+	statsfile				=	(o->statsfile != NULL ? strdup(o->statsfile) : NULL);
 }
 
 
@@ -566,6 +576,8 @@ COptions::~COptions(){
 	if (globalIn				!= NULL)	free(globalIn);
 	if (globalOut				!= NULL)	free(globalOut);
 	if (filelog					!= NULL)	free(filelog);
+	if (tracefile				!= NULL)	free(tracefile);
+	if (statsfile				!= NULL)	free(statsfile);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -777,10 +789,15 @@ int			COptions::find(const char *name,const char *category,EVariableType &type,c
 		else if (strcmp(name,RI_EYESPLITS) == 0)			{	type	=	TYPE_INTEGER;	value	=	&maxEyeSplits;			return TRUE;}
 		else if (strcmp(name,RI_TEXTUREMEMORY) == 0)		{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = maxTextureSize / 1000;	return TRUE;}
 		else if (strcmp(name,RI_BRICKMEMORY) == 0)			{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = maxBrickSize / 1000;		return TRUE;}
+		else if (strcmp(name,RI_PTCMEMORY) == 0)			{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = maxPtcSize / 1000;		return TRUE;}
+		else if (strcmp(name,RI_PTCPAGESIZE) == 0)			{	type	=	TYPE_INTEGER;	value	=	&ptcPageSize;			return TRUE;}
 		else if (strcmp(name,RI_NUMTHREADS) == 0)			{	type	=	TYPE_INTEGER;	value	=	&numThreads;			return TRUE;}
 		else if (strcmp(name,RI_THREADSTRIDE) == 0)			{	type	=	TYPE_INTEGER;	value	=	&threadStride;			return TRUE;}
+		else if (strcmp(name,RI_GRIDMEMORY) == 0)			{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = maxGridMemory / 1000;	return TRUE;}
 		else if (strcmp(name,RI_GEOCACHEMEMORY) == 0)		{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = geoCacheMemory / 1000;	return TRUE;}
 		else if (strcmp(name,RI_INHERITATTRIBUTES) == 0)	{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & OPTIONS_FLAGS_INHERIT_ATTRIBUTES) != 0;				return TRUE;}
+		else if (strcmp(name,RI_TEXTURECOMPRESSION) == 0)	{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & OPTIONS_FLAGS_COMPRESS_TEXTURES) != 0;				return TRUE;}
+		else if (strcmp(name,RI_CACHECOMPRESSION) == 0)		{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & OPTIONS_FLAGS_COMPRESS_CACHES) != 0;				return TRUE;}
 		else if (strcmp(name,"frame") == 0)					{	type	=	TYPE_INTEGER;	value	=	&frame;					return TRUE;}
 	}
 	
@@ -798,6 +815,8 @@ int			COptions::find(const char *name,const char *category,EVariableType &type,c
 	if ((category == NULL) || (strcmp(category,RI_STATISTICS) == 0)) {
 		if (strcmp(name,RI_ENDOFFRAME) == 0)				{	type	=	TYPE_INTEGER;	value	=	&endofframe;			return TRUE;}
 		else if (strcmp(name,RI_FILELOG) == 0)				{	type	=	TYPE_STRING;	value	=	filelog;				return TRUE;}
+		else if (strcmp(name,RI_TRACEFILE) == 0)			{	type	=	TYPE_STRING;	value	=	tracefile;				return TRUE;}
+		else if (strcmp(name,RI_STATSFILE) == 0)			{	type	=	TYPE_STRING;	value	=	statsfile;				return TRUE;}
 		else if (strcmp(name,RI_PROGRESS) == 0)				{	type	=	TYPE_INTEGER;	value	=	NULL;	intValue = (flags & OPTIONS_FLAGS_PROGRESS) != 0;				return TRUE;}
 
 	}
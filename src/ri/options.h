@@ -62,6 +62,15 @@ typedef enum {
 	DEPTH_MID
 } EDepthFilter;
 
+// This is the order the buckets are rendered in
+typedef enum {
+	BUCKET_ORDER_HORIZONTAL,
+	BUCKET_ORDER_VERTICAL,
+	BUCKET_ORDER_SPIRAL,
+	BUCKET_ORDER_HILBERT,
+	BUCKET_ORDER_COST
+} EBucketOrder;
+
 // Options flags
 const	unsigned int		OPTIONS_FLAGS_CUSTOM_SCREENWINDOW	=	1<<0;	// The screenwindow is fixed
 const	unsigned int		OPTIONS_FLAGS_CUSTOM_FRAMEAR		=	1<<1;	// The frame aspect ratio is fixed
@@ -76,6 +85,8 @@ const	unsigned int		OPTIONS_FLAGS_USE_RADIANCE_CACHE	=	1<<17;	// Use the new rad
 const	unsigned int		OPTIONS_FLAGS_PROGRESS				=	1<<18;	// Display the progress
 const	unsigned int		OPTIONS_FLAGS_SAMPLESPECTRUM		=	1<<19;	// Sample the spectrum in photon hider
 const	unsigned int		OPTIONS_FLAGS_SAMPLEMOTION			=	1<<20;	// We want the hider to sample motion blur (perform motion blur)
+const	unsigned int		OPTIONS_FLAGS_COMPRESS_TEXTURES		=	1<<21;	// Keep the wide texture tiles block compressed in the memory
+const	unsigned int		OPTIONS_FLAGS_COMPRESS_CACHES		=	1<<22;	// Quantize the gradients of the irradiance caches we write
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -228,6 +239,8 @@ public:
 
 	int							endofframe;										// The end of frame statstics number
 	char						*filelog;										// The name of the log file
+	char						*tracefile;										// The name of the timeline trace file
+	char						*statsfile;										// The name of the JSON statistics file
 
 	int							numThreads;										// The number of threads working
 
@@ -235,6 +248,9 @@ public:
 
 	int							maxBrickSize;									// Maximum amount of brick data to keep in memory (in bytes)
 
+	int							maxPtcSize;										// Maximum amount of point cloud pages to keep in memory per point cloud (in bytes)
+	int							ptcPageSize;									// The number of points per page when writing point clouds (0 = not paged)
+
 	int							maxGridSize;									// Maximum number of points to shade at a time
 
 	int							maxRayDepth;									// Maximum raytracing recursion depth
@@ -246,6 +262,10 @@ public:
 	int							netXBuckets,netYBuckets;						// The meta bucket size
 
 	int							threadStride;									// The number of buckets to distribute to threads at a time
+
+	EBucketOrder				bucketOrder;									// The order the buckets are rendered in
+
+	int							maxGridMemory;									// The raster grid memory above which bucket dispatch is throttled (0 = no limit)
 	
 	int							geoCacheMemory;									// The ammount of memory to dedicate to tesselation caches
 
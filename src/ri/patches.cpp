@@ -35,6 +35,7 @@
 
 #include "patches.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "shading.h"
 #include "surface.h"
@@ -59,7 +60,7 @@
 	if ((attributes->displacement != NULL) && (attributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS)) {						\
 		/* Do we have a grid ? */								\
 		if (children == NULL) {									\
-			osLock(CRenderer::tesselateMutex);					\
+			profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");	\
 																\
 			if (children == NULL) {								\
 				CTesselationPatch	*tesselation	=	new CTesselationPatch(attributes,xform,this,0,1,0,1,0,0,-1);	\
@@ -101,7 +101,7 @@ CPhotonHider::~CPhotonHider() {
 	phony->detach();
 
 	// Update the stats
-	stats.numPhotonRays		+=		numTracedPhotons;
+	stats.add(thread,STAT_PHOTON_RAYS,numTracedPhotons);
 }
 
 ///////////////////////////////////////////////////////////////////////
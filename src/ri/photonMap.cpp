@@ -39,6 +39,8 @@
 #include "memory.h"
 #include "random.h"
 #include "error.h"
+#include "atomic.h"
+#include "ri_config.h"
 
 // Precomputed conversion tables for the sin/cosine
 const float		costheta[]	=	{	1.000000f,0.999925f,0.999699f,0.999322f,0.998795f,0.998118f,0.997290f,0.996313f,0.995185f,0.993907f,0.992480f,0.990903f,0.989177f,0.987301f,0.985278f,0.983105f,0.980785f,0.978317f,0.975702f,0.972940f,0.970031f,0.966976f,0.963776f,0.960431f,0.956940f,0.953306f,0.949528f,0.945607f,0.941544f,0.937339f,0.932993f,0.928506f,0.923880f,0.919114f,0.914210f,0.909168f,0.903989f,0.898674f,0.893224f,0.887640f,0.881921f,0.876070f,0.870087f,0.863973f,0.857729f,0.851355f,0.844854f,0.838225f,0.831470f,0.824589f,0.817585f,0.810457f,0.803208f,0.795837f,0.788346f,0.780737f,0.773010f,0.765167f,0.757209f,0.749136f,0.740951f,0.732654f,0.724247f,0.715731f,0.707107f,0.698376f,0.689541f,0.680601f,0.671559f,0.662416f,0.653173f,0.643832f,0.634393f,0.624859f,0.615232f,0.605511f,0.595699f,0.585798f,0.575808f,0.565732f,0.555570f,0.545325f,0.534998f,0.524590f,0.514103f,0.503538f,0.492898f,0.482184f,0.471397f,0.460539f,0.449611f,0.438616f,0.427555f,0.416430f,0.405241f,0.393992f,0.382683f,0.371317f,0.359895f,0.348419f,0.336890f,0.325310f,0.313682f,0.302006f,0.290285f,0.278520f,0.266713f,0.254866f,0.242980f,0.231058f,0.219101f,0.207111f,0.195090f,0.183040f,0.170962f,0.158858f,0.146730f,0.134581f,0.122411f,0.110222f,0.098017f,0.085797f,0.073565f,0.061321f,0.049068f,0.036807f,0.024541f,0.012272f,0.000000f,-0.012272f,-0.024541f,-0.036807f,-0.049068f,-0.061321f,-0.073565f,-0.085797f,-0.098017f,-0.110222f,-0.122411f,-0.134581f,-0.146730f,-0.158858f,-0.170962f,-0.183040f,-0.195090f,-0.207111f,-0.219101f,-0.231058f,-0.242980f,-0.254866f,-0.266713f,-0.278520f,-0.290285f,-0.302006f,-0.313682f,-0.325310f,-0.336890f,-0.348419f,-0.359895f,-0.371317f,-0.382683f,-0.393992f,-0.405241f,-0.416430f,-0.427555f,-0.438616f,-0.449611f,-0.460539f,-0.471397f,-0.482184f,-0.492898f,-0.503538f,-0.514103f,-0.524590f,-0.534998f,-0.545325f,-0.555570f,-0.565732f,-0.575808f,-0.585798f,-0.595699f,-0.605511f,-0.615232f,-0.624859f,-0.634393f,-0.643832f,-0.653173f,-0.662416f,-0.671559f,-0.680601f,-0.689541f,-0.698376f,-0.707107f,-0.715731f,-0.724247f,-0.732654f,-0.740951f,-0.749136f,-0.757209f,-0.765167f,-0.773010f,-0.780737f,-0.788346f,-0.795837f,-0.803208f,-0.810457f,-0.817585f,-0.824589f,-0.831470f,-0.838225f,-0.844854f,-0.851355f,-0.857729f,-0.863973f,-0.870087f,-0.876070f,-0.881921f,-0.887640f,-0.893224f,-0.898674f,-0.903989f,-0.909168f,-0.914210f,-0.919114f,-0.923880f,-0.928506f,-0.932993f,-0.937339f,-0.941544f,-0.945607f,-0.949528f,-0.953306f,-0.956940f,-0.960431f,-0.963776f,-0.966976f,-0.970031f,-0.972940f,-0.975702f,-0.978317f,-0.980785f,-0.983105f,-0.985278f,-0.987301f,-0.989177f,-0.990903f,-0.992480f,-0.993907f,-0.995185f,-0.996313f,-0.997290f,-0.998118f,-0.998795f,-0.999322f,-0.999699f,-0.999925f	};
@@ -75,7 +77,8 @@ CPhotonMap::CPhotonMap(const char *n,FILE *in) : CMap<CPhoton>() , CFileResource
 
 	#ifdef PHOTON_LOOKUP_CACHE
 		root			=	NULL;
-		maxDepth		=	1;
+		shards			=	NULL;
+		numShards		=	0;
 	#endif
 	attach();	// Count the fileResource reference
 	modifying		=	FALSE;
@@ -100,13 +103,42 @@ CPhotonMap::CPhotonMap(const char *n,FILE *in) : CMap<CPhoton>() , CFileResource
 		mulmm(from,CRenderer::fromWorld,toWorld);
 		
 		#ifdef PHOTON_LOOKUP_CACHE
+			int	i,j,k;
+
+			// Create the shards, the extra one at the end holds the top levels of the octree
+			numShards		=	1 << (3*PHOTON_CACHE_SHARD_DEPTH);
+			shards			=	new CPhotonShard[numShards+1];
+			for (i=0;i<=numShards;i++) {
+				osCreateMutex(shards[i].mutex);
+				shards[i].memory	=	NULL;
+				shards[i].base		=	NULL;
+				shards[i].numSamples	=	0;
+			}
+
+			CPhotonShard	*top	=	shards + numShards;
+			memoryInit(top->base);
+			top->memory		=	top->base;
+
 			// Initialize the lookup octree
-			root			=	new CPhotonNode;
+			root			=	(CPhotonNode *) ralloc(sizeof(CPhotonNode),top->memory);
 			addvv(root->center,bmin,bmax);
 			mulvf(root->center,1 / (float) 2);
 			root->side		=	max(max(bmax[0]-bmin[0],bmax[1] - bmin[1]),bmax[2] - bmin[2]);
 			root->samples	=	NULL;
-			for (int i=0;i<8;i++) root->children[i]	=	NULL;
+			for (i=0;i<8;i++) root->children[i]	=	NULL;
+
+			// Pre-build the levels above the shards so that no two shards ever create the same node
+			for (i=0;i<numShards;i++) {
+				CPhotonNode	*cNode	=	root;
+
+				for (j=PHOTON_CACHE_SHARD_DEPTH-1;j>=0;j--) {
+					k	=	(i >> (3*j)) & 7;
+
+					if (cNode->children[k] == NULL)	cNode->children[k]	=	newNode(cNode,k,top->memory);
+
+					cNode	=	cNode->children[k];
+				}
+			}
 		#endif
 	} else {
 	
@@ -124,29 +156,17 @@ CPhotonMap::CPhotonMap(const char *n,FILE *in) : CMap<CPhoton>() , CFileResource
 // Comments				:
 CPhotonMap::~CPhotonMap() {
 	#ifdef PHOTON_LOOKUP_CACHE
-		if (root != NULL) {
-			CPhotonNode		**stackBase	=	(CPhotonNode **)	alloca(maxDepth*sizeof(CPhotonNode *)*8);
-			CPhotonNode		**stack;
-			CPhotonNode		*cNode;
-			CPhotonSample	*cSample;
-			int			i;
-	
-			stack		=	stackBase;
-			*stack++	=	root;
-			while(stack > stackBase) {
-				cNode	=	*(--stack);
-	
-				while((cSample=cNode->samples) != NULL) {
-					cNode->samples	=	cSample->next;
-					delete cSample;
-				}
-	
-				for (i=0;i<8;i++) {
-					if (cNode->children[i] != NULL) *stack++	=	cNode->children[i];
-				}
-	
-				delete cNode;
+		if (shards != NULL) {
+			int	i;
+
+			// The nodes and the samples live in the shard arenas
+			for (i=0;i<=numShards;i++) {
+				if (shards[i].base != NULL)	memoryTini(shards[i].base);
+				osDeleteMutex(shards[i].mutex);
+				stats.addShared(STAT_PHOTON_CACHE_SAMPLES,shards[i].numSamples);
 			}
+
+			delete [] shards;
 		}
 	#endif
 
@@ -219,13 +239,14 @@ void	CPhotonMap::write(const CXform *world) {
 // Comments				:	
 int		CPhotonMap::probe(float *C,const float *P,const float *N) {
 	CPhotonNode			*cNode;
-	CPhotonNode			**stackBase	=	(CPhotonNode **)	alloca(maxDepth*sizeof(CPhotonNode *)*8);
+	CPhotonNode			*stackBase[PHOTON_CACHE_MAX_DEPTH*8];
 	CPhotonNode			**stack;
 	CPhotonSample		*cSample;
 	float				totalWeight	=	0;
 	int					i;
 	
 	// Note: if word-stores are atomic, we don't need to lock when doing this
+	// (insert only links a node/sample after it has been filled in)
 	
 	if (root == NULL) return FALSE;
 
@@ -297,56 +318,99 @@ int		CPhotonMap::probe(float *C,const float *P,const float *N) {
 // Description			:
 /// \brief					Insert a sample
 // Return Value			:
-// Comments				:	
+// Comments				:	The top PHOTON_CACHE_SHARD_DEPTH levels of the octree are
+//							pre-built, so we only lock the shard the sample falls into
 void	CPhotonMap::insert(const float *C,const float *P,const float *N,float dP) {
-	CPhotonSample	*cSample	=	new CPhotonSample;
 	CPhotonNode		*cNode		=	root;
+	CPhotonShard	*cShard;
+	CPhotonSample	*cSample;
 	int				depth		=	0;
+	int				shard		=	0;
 	int				i,j;
 
-	// lock the mutex so we're thread safe
-	osLock(mutex);
-	
-	movvv(cSample->C,C);
-	movvv(cSample->P,P);
-	movvv(cSample->N,N);
-	cSample->dP	=	dP;
+	// Walk down the pre-built levels, these never change so we don't need to lock
+	while((depth < PHOTON_CACHE_SHARD_DEPTH) && (cNode->side > (2*dP))) {
+		for (j=0,i=0;i<3;i++) {
+			if (P[i] > cNode->center[i]) {
+				j			|=	1 << i;
+			}
+		}
 
-	while(cNode->side > (2*dP)) {
+		shard	=	(shard << 3) | j;
+		cNode	=	cNode->children[j];
 		depth++;
+	}
+
+	// Samples that are too big for a shard go into the top levels
+	if (depth < PHOTON_CACHE_SHARD_DEPTH)	cShard	=	shards + numShards;
+	else									cShard	=	shards + shard;
 
+	// lock the shard so we're thread safe
+	osLock(cShard->mutex);
+
+	// Create the shard arena on the first insert
+	if (cShard->base == NULL) {
+		memoryInit(cShard->base);
+		cShard->memory	=	cShard->base;
+	}
+
+	while((depth < PHOTON_CACHE_MAX_DEPTH) && (cNode->side > (2*dP))) {
 		for (j=0,i=0;i<3;i++) {
 			if (P[i] > cNode->center[i]) {
 				j			|=	1 << i;
 			}
 		}
 
-		if (cNode->children[j] == NULL)	{
-			CPhotonNode	*nNode	=	(CPhotonNode *) new CPhotonNode;
-
-			for (i=0;i<3;i++) {
-				if (P[i] > cNode->center[i]) {
-					nNode->center[i]	=	cNode->center[i] + cNode->side / (float) 4;
-				} else {
-					nNode->center[i]	=	cNode->center[i] - cNode->side / (float) 4;
-				}
-			}
+		// The lookups don't lock, so the node must be complete before it is linked
+		if (cNode->children[j] == NULL) {
+			CPhotonNode	*nNode	=	newNode(cNode,j,cShard->memory);
 
+			memoryBarrier();
 			cNode->children[j]	=	nNode;
-			nNode->side			=	cNode->side / (float) 2;
-			nNode->samples		=	NULL;
-			for (i=0;i<8;i++)	nNode->children[i]	=	NULL;
 		}
 
 		cNode			=	cNode->children[j];
+		depth++;
 	}
 
+	cSample			=	(CPhotonSample *) ralloc(sizeof(CPhotonSample),cShard->memory);
+	movvv(cSample->C,C);
+	movvv(cSample->P,P);
+	movvv(cSample->N,N);
+	cSample->dP		=	dP;
 	cSample->next	=	cNode->samples;
+	memoryBarrier();
 	cNode->samples	=	cSample;
-	maxDepth		=	max(maxDepth,depth);
+	cShard->numSamples++;
 	
-	// unlock the mutex
-	osUnlock(mutex);
+	// unlock the shard
+	osUnlock(cShard->mutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPhotonMap
+// Method				:	newNode
+// Description			:
+/// \brief					Create the j'th child of a node
+// Return Value			:	The new node
+// Comments				:	The caller links the node into the octree
+CPhotonMap::CPhotonNode	*CPhotonMap::newNode(CPhotonNode *cNode,int j,CMemPage *&memory) {
+	CPhotonNode	*nNode	=	(CPhotonNode *) ralloc(sizeof(CPhotonNode),memory);
+	int			i;
+
+	for (i=0;i<3;i++) {
+		if (j & (1 << i)) {
+			nNode->center[i]	=	cNode->center[i] + cNode->side / (float) 4;
+		} else {
+			nNode->center[i]	=	cNode->center[i] - cNode->side / (float) 4;
+		}
+	}
+
+	nNode->side			=	cNode->side / (float) 2;
+	nNode->samples		=	NULL;
+	for (i=0;i<8;i++)	nNode->children[i]	=	NULL;
+
+	return nNode;
 }
 
 #endif
@@ -360,55 +424,8 @@ void	CPhotonMap::insert(const float *C,const float *P,const float *N,float dP) {
 // Comments				:
 /// \note					Nl	must be normalized
 //							Il	must be normalized
-void	CPhotonMap::lookup(float *Cl,const float *Pl,const float *Nl,int maxFound) {
-	int				numFound;
-	const CPhoton	**indices	=	(const CPhoton **)	alloca((maxFound+1)*sizeof(CPhoton *)); 
-	float			*distances	=	(float	*)			alloca((maxFound+1)*sizeof(float)); 
-	CLookup			l;
-
-	searchRadius		=	(sqrtf(maxFound*maxPower / 0.05f) / (float) C_PI)*0.5f;
-
-	// Lookup the photonmap at the location of the photon
-	distances[0]		=	searchRadius*searchRadius;
-	l.maxFound			=	maxFound;
-	l.numFound			=	0;
-	mulmp(l.P,to,Pl);
-	mulmn(l.N,from,Nl);
-	l.gotHeap			=	FALSE;
-	l.indices			=	indices;
-	l.distances			=	distances;
-
-	#ifdef PHOTON_LOOKUP_CACHE
-	if (!probe(Cl,l.P,l.N)) {
-	#endif
-		CMap<CPhoton>::lookupWithN(&l,1);
-	
-		initv(Cl,0);
-	
-		if ((numFound = l.numFound) < 2)	return;
-	
-		// Accumulate the irradiance
-		for (int i=1;i<=numFound;i++) {
-			const	CPhoton	*p	=	indices[i];
-			vector	I;
-	
-			assert(distances[i] <= distances[0]);
-	
-			itemToDir(I,p->theta,p->phi);
-	
-			if (dotvv(I,l.N) < 0) {
-				addvv(Cl,p->C);
-			}
-		}
-	
-		// Normalize the result
-		mulvf(Cl,(float) (1.0 / (C_PI*distances[0])));
-	
-	#ifdef PHOTON_LOOKUP_CACHE
-		// Insert it into the probe 
-		insert(Cl,l.P,l.N,sqrtf(distances[0])*(float) 0.2);
-	}
-	#endif
+void	CPhotonMap::lookup(float *Cl,const float *Pl,const float *Nl,int maxFound,float maxError) {
+	lookup(1,Cl,Pl,Nl,maxFound,maxError);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -418,53 +435,101 @@ void	CPhotonMap::lookup(float *Cl,const float *Pl,const float *Nl,int maxFound)
 /// \brief					Locate the nearest maxFoundPhoton photons
 // Return Value			:
 // Comments				:
-/// \note					Nl	must be normalized
-//							Il	must be normalized
-void	CPhotonMap::lookup(float *Cl,const float *Pl,int maxFound) {
-	int				numFound	=	0;
-	const CPhoton	**indices	=	(const CPhoton **)	alloca((maxFound+1)*sizeof(CPhoton *)); 
-	float			*distances	=	(float	*)			alloca((maxFound+1)*sizeof(float)); 
-	CLookup			l;
-
-	searchRadius		=	(sqrtf(maxFound*maxPower / 0.05f) / (float) C_PI)*0.5f;
-
-	distances[0]		=	searchRadius*searchRadius;
+void	CPhotonMap::lookup(float *Cl,const float *Pl,int maxFound,float maxError) {
+	lookup(1,Cl,Pl,NULL,maxFound,maxError);
+}
 
-	l.maxFound			=	maxFound;
-	l.numFound			=	0;
-	mulmp(l.P,to,Pl);
-	initv(l.N,0,0,0);
-	l.gotHeap			=	FALSE;
-	l.indices			=	indices;
-	l.distances			=	distances;
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPhotonMap
+// Method				:	lookup
+// Description			:
+/// \brief					Estimate the irradiance at a number of points
+// Return Value			:
+// Comments				:	This is thread safe, every lookup keeps its own heap
+//							maxError is the radius of a cached estimate as a fraction of the
+//							search radius (0 disables the lookup cache)
+/// \note					Nl	must be normalized (or NULL to ignore the normal)
+void	CPhotonMap::lookup(int numLookups,float *Cl,const float *Pl,const float *Nl,int maxFound,float maxError) {
+	const CPhoton	**indices	=	(const CPhoton **)	alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(CPhoton *)); 
+	float			*distances	=	(float	*)			alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(float)); 
+	CLookup			lookups[MAP_BATCH_SIZE];
+	CLookup			*active[MAP_BATCH_SIZE];
+	const float		searchRadius	=	(sqrtf(maxFound*maxPower / 0.05f) / (float) C_PI)*0.5f;
+	int				i,j;
 
 	#ifdef PHOTON_LOOKUP_CACHE
-	if (!probe(Cl,l.P,l.N)) {
+		const int	useCache		=	(root != NULL) && (maxError > 0);
 	#endif
-		CMap<CPhoton>::lookup(&l,1);
-	
-		initv(Cl,0,0,0);
-	
-		if (l.numFound < 2)	return;
-	
-		numFound	=	l.numFound;
-	
-		for (int i=1;i<=numFound;i++) {
-			const	CPhoton	*p	=	indices[i];
-	
-			assert(distances[i] <= distances[0]);
-	
-			addvv(Cl,p->C);
+
+	while(numLookups > 0) {
+		const int	numBatch	=	min(numLookups,MAP_BATCH_SIZE);
+		int			numActive	=	0;
+
+		// Prepare the lookups for this batch
+		for (i=0;i<numBatch;i++) {
+			CLookup	*l		=	lookups + i;
+
+			l->distances	=	distances + i*(maxFound+1);
+			l->indices		=	indices + i*(maxFound+1);
+			l->distances[0]	=	searchRadius*searchRadius;
+			l->maxFound		=	maxFound;
+			l->numFound		=	0;
+			l->gotHeap		=	FALSE;
+			mulmp(l->P,to,Pl + i*3);
+			if (Nl != NULL)	mulmn(l->N,from,Nl + i*3);
+			else			initv(l->N,0,0,0);
+
+			#ifdef PHOTON_LOOKUP_CACHE
+			if (useCache && probe(Cl + i*3,l->P,l->N))	continue;
+			#endif
+
+			active[numActive++]	=	l;
 		}
-		
-		// Normalize the result
-		mulvf(Cl,(float) (1.0 / (C_PI*distances[0])));
-	
-	#ifdef PHOTON_LOOKUP_CACHE
-		// Insert it into the probe 
-		insert(Cl,l.P,l.N,sqrtf(distances[0])*(float) 0.2);
+
+		// Walk the tree once for all the lookups that missed the cache
+		CMap<CPhoton>::lookupBatch(active,numActive);
+
+		// Accumulate the irradiance
+		for (j=0;j<numActive;j++) {
+			const CLookup	*l	=	active[j];
+			float			*C	=	Cl + (l - lookups)*3;
+
+			initv(C,0,0,0);
+
+			if (l->numFound < 2)	continue;
+
+			for (i=1;i<=l->numFound;i++) {
+				const	CPhoton	*p	=	l->indices[i];
+
+				assert(l->distances[i] <= l->distances[0]);
+
+				if (Nl != NULL) {
+					vector	I;
+
+					itemToDir(I,p->theta,p->phi);
+
+					if (dotvv(I,l->N) < 0) {
+						addvv(C,p->C);
+					}
+				} else {
+					addvv(C,p->C);
+				}
+			}
+
+			// Normalize the result
+			mulvf(C,(float) (1.0 / (C_PI*l->distances[0])));
+
+			#ifdef PHOTON_LOOKUP_CACHE
+				// Insert it into the probe 
+				if (useCache)	insert(C,l->P,l->N,sqrtf(l->distances[0])*maxError);
+			#endif
+		}
+
+		Cl			+=	numBatch*3;
+		Pl			+=	numBatch*3;
+		if (Nl != NULL)	Nl	+=	numBatch*3;
+		numLookups	-=	numBatch;
 	}
-	#endif
 }
 
 ///////////////////////////////////////////////////////////////////////
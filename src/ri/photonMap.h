@@ -40,6 +40,7 @@
 #include "xform.h"
 #include "map.h"
 #include "refCounter.h"
+#include "memory.h"
 
 
 
@@ -101,10 +102,18 @@ class	CPhotonMap : public CMap<CPhoton> , public CFileResource, public CView, pu
 
 		class	CPhotonNode {
 		public:
-			vector			center;
-			float			side;
-			CPhotonSample	*samples;
-			CPhotonNode		*children[8];
+			vector					center;
+			float					side;
+			CPhotonSample * volatile	samples;		// Published only after the sample is filled in
+			CPhotonNode * volatile	children[8];	// Published only after the child is filled in
+		};
+
+		class	CPhotonShard {
+		public:
+			TMutex			mutex;			// Serializes the inserts into this shard
+			CMemPage		*memory;		// The current page of the shard arena
+			CMemPage		*base;			// The first page of the shard arena (NULL until the first insert)
+			int				numSamples;		// The samples inserted (counted under the mutex, added to the stats when the map dies)
 		};
 	#endif
 	
@@ -115,8 +124,9 @@ public:
 	void		reset();
 	void		write(const CXform *);
 
-	void		lookup(float *,const float *,int);
-	void		lookup(float *,const float *,const float *,int);
+	void		lookup(float *,const float *,int,float);
+	void		lookup(float *,const float *,const float *,int,float);
+	void		lookup(int,float *,const float *,const float *,int,float);
 	void		balance();
 
 	void		store(const float *,const float *,const float *,const float *);
@@ -127,15 +137,16 @@ public:
 	#ifdef PHOTON_LOOKUP_CACHE
 		int			probe(float *,const float *,const float *);
 		void		insert(const float *,const float *,const float *,float);
+		CPhotonNode	*newNode(CPhotonNode *,int,CMemPage *&);
 
 		CPhotonNode	*root;
-		int			maxDepth;			// The maximum depth of the hierarchy
+		CPhotonShard	*shards;		// The shards (the last one holds the nodes above the shard depth)
+		int			numShards;			// The number of shards below the top levels
 	#endif
 
 	int			modifying;
 	matrix		from,to;
 	float		maxPower;			// The maximum photon power
-	float		searchRadius;
 	TMutex		mutex;				// For synchronization during writing
 };
 
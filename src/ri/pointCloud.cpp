@@ -36,6 +36,9 @@
 #include "memory.h"
 #include "random.h"
 #include "error.h"
+#include "stats.h"
+#include "atomic.h"
+#include "fileResource.h"
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -44,6 +47,7 @@
 
 int			CPointCloud::drawDiscs		=	TRUE;
 int			CPointCloud::drawChannel	=	0;
+int64_t		CPointCloud::maxPageMemory	=	DEFAULT_MAX_PTCMEMORY;
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -57,6 +61,18 @@ CPointCloud::CPointCloud(const char *n,const float *from,const float *to,const f
 	// Create our data areas
 	flush				=	write;
 	maxdP				=	0;
+	pages				=	NULL;
+	numPages			=	0;
+	numPagedPoints		=	0;
+	pageSize			=	0;
+	pageNodes			=	NULL;
+	pageMemory			=	0;
+	firstUnused			=	NULL;
+	lastUnused			=	NULL;
+	pointPage			=	0;
+	numPageins			=	0;
+	numPageouts			=	0;
+	pageFile			=	NULL;
 
 	osCreateMutex(mutex);
 
@@ -79,6 +95,18 @@ CPointCloud::CPointCloud(const char *n,const float *from,const float *to,const f
 	// Create our data areas
 	flush				=	write;
 	maxdP				=	0;
+	pages				=	NULL;
+	numPages			=	0;
+	numPagedPoints		=	0;
+	pageSize			=	0;
+	pageNodes			=	NULL;
+	pageMemory			=	0;
+	firstUnused			=	NULL;
+	lastUnused			=	NULL;
+	pointPage			=	0;
+	numPageins			=	0;
+	numPageouts			=	0;
+	pageFile			=	NULL;
 
 	osCreateMutex(mutex);
 
@@ -101,8 +129,20 @@ CPointCloud::CPointCloud(const char *n,const float *from,const float *to,const f
 CPointCloud::CPointCloud(const char *n,const float *from,const float *to,FILE *in) : CMap<CPointCloudPoint>(), CTexture3d(n,from,to) {
 
 	// Create our data areas
-	flush	=	FALSE;
-	maxdP	=	0;
+	flush			=	FALSE;
+	maxdP			=	0;
+	pages			=	NULL;
+	numPages		=	0;
+	numPagedPoints	=	0;
+	pageSize		=	0;
+	pageNodes		=	NULL;
+	pageMemory		=	0;
+	firstUnused		=	NULL;
+	lastUnused		=	NULL;
+	pointPage		=	0;
+	numPageins		=	0;
+	numPageouts		=	0;
+	pageFile		=	NULL;
 	
 	osCreateMutex(mutex);
 
@@ -129,6 +169,75 @@ CPointCloud::CPointCloud(const char *n,const float *from,const float *to,FILE *i
 	fclose(in);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	CPointCloud
+// Description			:
+/// \brief					Ctor
+// Return Value			:
+// Comments				:	for a paged point cloud, only the page directory is read here
+CPointCloud::CPointCloud(const char *n,const float *from,const float *to,FILE *in,int paged) : CTexture3d(n,from,to), CMap<CPointCloudPoint>() {
+	uint64_t	directory;
+	int			i,numNodes;
+
+	// Create our data areas
+	flush			=	FALSE;
+	maxdP			=	0;
+	numPages		=	0;
+	numPagedPoints	=	0;
+	pageSize		=	0;
+	pageMemory		=	0;
+	firstUnused		=	NULL;
+	lastUnused		=	NULL;
+	pointPage		=	0;
+	numPageins		=	0;
+	numPageouts		=	0;
+	pageFile		=	in;
+	
+	osCreateMutex(mutex);
+	osCreateMutex(pageMutex);
+
+	// Read the header
+	readChannels(in);
+
+	fread(&numPages,sizeof(int),1,in);
+	fread(&numPagedPoints,sizeof(int),1,in);
+	fread(&maxdP,sizeof(float),1,in);
+	fread(bmin,sizeof(float),3,in);
+	fread(bmax,sizeof(float),3,in);
+	fread(&directory,sizeof(uint64_t),1,in);
+
+	// Read the page directory, the pages themselves are read on demand
+	pages	=	new CPointCloudPage[numPages];
+	osFseek(in,(int64_t) directory,SEEK_SET);
+	for (i=0;i<numPages;i++) {
+		CPointCloudPage	*cPage	=	pages + i;
+
+		fread(cPage->bmin,sizeof(float),3,in);
+		fread(cPage->bmax,sizeof(float),3,in);
+		fread(&cPage->maxdP,sizeof(float),1,in);
+		fread(&cPage->numPoints,sizeof(int),1,in);
+		fread(&cPage->fileOffset,sizeof(uint64_t),1,in);
+
+		cPage->data				=	NULL;
+		cPage->firstPoint		=	(i == 0) ? 0 : cPage[-1].firstPoint + cPage[-1].numPoints;
+		cPage->numUsers			=	0;
+		cPage->prevUnused		=	NULL;
+		cPage->nextUnused		=	NULL;
+	}
+
+	// Build the bounding hierarchy over the pages
+	pageNodes	=	new CPointCloudPageNode[max(2*numPages-1,1)];
+	numNodes	=	1;
+	if (numPages > 0)	buildPageNodes(0,0,numPages-1,numNodes);
+	else {
+		initv(pageNodes[0].bmin,C_INFINITY);
+		initv(pageNodes[0].bmax,-C_INFINITY);
+		pageNodes[0].page	=	-1;
+		pageNodes[0].child	=	-1;
+	}
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPointCloud
 // Method				:	~CPointCloud
@@ -139,7 +248,23 @@ CPointCloud::CPointCloud(const char *n,const float *from,const float *to,FILE *i
 CPointCloud::~CPointCloud() {
 	osDeleteMutex(mutex);
 
+	stats.addShared(STAT_POINTCLOUD_PAGEINS,numPageins);
+	stats.addShared(STAT_POINTCLOUD_PAGEOUTS,numPageouts);
+
 	if (flush) write();
+
+	// Ditch the pages
+	if (pages != NULL) {
+		int	i;
+
+		for (i=0;i<numPages;i++)	if (pages[i].data != NULL)	delete [] pages[i].data;
+		for (i=0;i<pageBuffers.numItems;i++)	delete [] pageBuffers.array[i];
+
+		delete [] pages;
+		delete [] pageNodes;
+		fclose(pageFile);
+		osDeleteMutex(pageMutex);
+	}
 }
 
 
@@ -165,9 +290,16 @@ void	CPointCloud::reset() {
 // Comments				:
 void	CPointCloud::write() {
 	// Flush the photonmap
-	FILE		*out		=	ropen(name,"wb",filePointCloud);
+	FILE		*out		=	ropen(name,"wb",(pageSize > 0) ? filePagedPointCloud : filePointCloud);
+
+	if ((out != NULL) && (pageSize > 0)) {
 
-	if (out != NULL) {
+		// Write the spatially sorted pages
+		writePaged(out);
+
+		// Close the file
+		fclose(out);
+	} else if (out != NULL) {
 
 		// Balance the map
 		balance();
@@ -193,6 +325,368 @@ void	CPointCloud::write() {
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	writePaged
+// Description			:
+/// \brief					Write the point cloud as spatially coherent pages
+// Return Value			:
+// Comments				:	Every page is a balanced map of its own so that it can be
+//							paged in and looked up independently
+void	CPointCloud::writePaged(FILE *out) {
+	CArray<int>		ranges;
+	int				*indices	=	new int[numItems+1];
+	int				i,j;
+
+	// Split the points into pages
+	for (i=0;i<numItems;i++)	indices[i]	=	i+1;
+	if (numItems > 0)			paginate(indices,0,numItems,ranges);
+
+	const int		numOut		=	ranges.numItems >> 1;
+	float			*bounds		=	new float[numOut*7];
+	uint64_t		*offsets	=	new uint64_t[numOut];
+	uint64_t		directory	=	0;
+
+	// Write out the header and channels
+	writeChannels(out);
+	fwrite(&numOut,sizeof(int),1,out);
+	fwrite(&numItems,sizeof(int),1,out);
+	fwrite(&maxdP,sizeof(float),1,out);
+	fwrite(bmin,sizeof(float),3,out);
+	fwrite(bmax,sizeof(float),3,out);
+
+	// The directory offset is patched once the pages are written
+	const uint64_t	directoryPosition	=	(uint64_t) osFtell(out);
+	fwrite(&directory,sizeof(uint64_t),1,out);
+
+	// Write the pages
+	for (i=0;i<numOut;i++) {
+		const int				*cIndices	=	indices + ranges.array[i*2];
+		const int				num			=	ranges.array[i*2+1];
+		float					*pageData	=	new float[num*dataSize];
+		float					*cBound		=	bounds + i*7;
+		CMap<CPointCloudPoint>	page;
+
+		cBound[6]	=	0;
+		for (j=0;j<num;j++) {
+			const CPointCloudPoint	*src	=	items + cIndices[j];
+			CPointCloudPoint		*dest	=	page.store(src);
+
+			dest->entryNumber	=	j*dataSize;
+			memcpy(pageData + j*dataSize,data.array + src->entryNumber,dataSize*sizeof(float));
+			cBound[6]			=	max(cBound[6],src->dP);
+		}
+
+		page.balance();
+		movvv(cBound,page.bmin);
+		movvv(cBound+3,page.bmax);
+
+		offsets[i]	=	(uint64_t) osFtell(out);
+		page.write(out);
+		fwrite(pageData,sizeof(float),num*dataSize,out);
+
+		delete [] pageData;
+	}
+
+	// Write the page directory
+	directory	=	(uint64_t) osFtell(out);
+	for (i=0;i<numOut;i++) {
+		fwrite(bounds + i*7,sizeof(float),7,out);
+		fwrite(ranges.array + i*2 + 1,sizeof(int),1,out);
+		fwrite(offsets + i,sizeof(uint64_t),1,out);
+	}
+
+	osFseek(out,(int64_t) directoryPosition,SEEK_SET);
+	fwrite(&directory,sizeof(uint64_t),1,out);
+
+	delete [] offsets;
+	delete [] bounds;
+	delete [] indices;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	paginate
+// Description			:
+/// \brief					Split the points into pages by recursive median splits
+// Return Value			:
+// Comments				:	The (start,count) pairs of the pages are appended to ranges
+void	CPointCloud::paginate(int *indices,int start,int num,CArray<int> &ranges) {
+
+	if (num <= pageSize) {
+		ranges.push(start);
+		ranges.push(num);
+		return;
+	}
+
+	// Find the longest axis of the points
+	int		*cIndices	=	indices + start;
+	vector	pmin,pmax;
+	int		i,j,axis;
+
+	initv(pmin,C_INFINITY);
+	initv(pmax,-C_INFINITY);
+	for (i=0;i<num;i++)	addBox(pmin,pmax,items[cIndices[i]].P);
+
+	if ((pmax[0]-pmin[0]) > (pmax[1]-pmin[1]))	axis	=	((pmax[0]-pmin[0]) > (pmax[2]-pmin[2])) ? 0 : 2;
+	else										axis	=	((pmax[1]-pmin[1]) > (pmax[2]-pmin[2])) ? 1 : 2;
+
+	// Partition the points around the median
+	const int	median	=	num >> 1;
+	int			left	=	0;
+	int			right	=	num-1;
+	while(left < right) {
+		const float	pivot	=	items[cIndices[(left+right) >> 1]].P[axis];
+
+		for (i=left,j=right;i<=j;) {
+			while(items[cIndices[i]].P[axis] < pivot)	i++;
+			while(items[cIndices[j]].P[axis] > pivot)	j--;
+
+			if (i <= j) {
+				const int	tmp	=	cIndices[i];
+				cIndices[i++]	=	cIndices[j];
+				cIndices[j--]	=	tmp;
+			}
+		}
+
+		if (median <= j)		right	=	j;
+		else if (median >= i)	left	=	i;
+		else					break;
+	}
+
+	paginate(indices,start,median,ranges);
+	paginate(indices,start+median,num-median,ranges);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	buildPageNodes
+// Description			:
+/// \brief					Build the bounding hierarchy over a range of pages
+// Return Value			:
+// Comments				:	The pages are written in the order paginate splits them, so a range
+//							of consecutive pages is spatially coherent
+void	CPointCloud::buildPageNodes(int index,int first,int last,int &numNodes) {
+	CPointCloudPageNode	*cNode	=	pageNodes + index;
+
+	if (first == last) {
+		movvv(cNode->bmin,pages[first].bmin);
+		movvv(cNode->bmax,pages[first].bmax);
+		cNode->page		=	first;
+		cNode->child	=	-1;
+	} else {
+		const int	middle	=	(first + last) >> 1;
+		const int	child	=	numNodes;
+
+		numNodes		+=	2;
+		buildPageNodes(child,first,middle,numNodes);
+		buildPageNodes(child+1,middle+1,last,numNodes);
+
+		const CPointCloudPageNode	*cChild	=	pageNodes + child;
+
+		cNode->bmin[0]	=	min(cChild[0].bmin[0],cChild[1].bmin[0]);
+		cNode->bmin[1]	=	min(cChild[0].bmin[1],cChild[1].bmin[1]);
+		cNode->bmin[2]	=	min(cChild[0].bmin[2],cChild[1].bmin[2]);
+		cNode->bmax[0]	=	max(cChild[0].bmax[0],cChild[1].bmax[0]);
+		cNode->bmax[1]	=	max(cChild[0].bmax[1],cChild[1].bmax[1]);
+		cNode->bmax[2]	=	max(cChild[0].bmax[2],cChild[1].bmax[2]);
+		cNode->page		=	-1;
+		cNode->child	=	child;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	acquirePage
+// Description			:
+/// \brief					Make sure a page is in memory and lock it there
+// Return Value			:	The page
+// Comments				:	The least recently used pages are paged out to stay within maxPageMemory.
+//							The page is read without the cloud mutex, so lookups into the pages
+//							in memory do not wait for the disk. The reads themselves are serialized
+//							by pageMutex as they share the file
+CPointCloudPage	*CPointCloud::acquirePage(int index) {
+	CPointCloudPage	*page	=	pages + index;
+	int				inMemory;
+
+	osLock(mutex);
+
+	// Pin the page, it can not be paged out from now on
+	if ((page->numUsers++ == 0) && (page->data != NULL)) {
+		if (page->prevUnused != NULL)	page->prevUnused->nextUnused	=	page->nextUnused;
+		else							firstUnused						=	page->nextUnused;
+		if (page->nextUnused != NULL)	page->nextUnused->prevUnused	=	page->prevUnused;
+		else							lastUnused						=	page->prevUnused;
+		page->prevUnused	=	NULL;
+		page->nextUnused	=	NULL;
+	}
+	inMemory	=	(page->data != NULL);
+
+	osUnlock(mutex);
+
+	if (inMemory == FALSE) {
+		osLock(pageMutex);
+
+		// Another thread may have read the page while we were waiting
+		if (page->data == NULL) {
+			const int64_t	size	=	(int64_t) (page->numPoints+1)*sizeof(CPointCloudPoint) + (int64_t) page->numPoints*dataSize*sizeof(float);
+			float			*pageData;
+
+			// Make room for the page
+			osLock(mutex);
+			while(((pageMemory + size) > maxPageMemory) && (firstUnused != NULL)) {
+				CPointCloudPage	*victim	=	firstUnused;
+
+				firstUnused			=	victim->nextUnused;
+				if (firstUnused != NULL)	firstUnused->prevUnused	=	NULL;
+				else						lastUnused				=	NULL;
+				victim->nextUnused	=	NULL;
+
+				delete [] victim->items;
+				delete [] victim->data;
+				victim->items	=	NULL;
+				victim->data	=	NULL;
+				pageMemory		-=	(int64_t) (victim->numPoints+1)*sizeof(CPointCloudPoint) + (int64_t) victim->numPoints*dataSize*sizeof(float);
+				numPageouts++;
+			}
+			pageMemory	+=	size;
+			osUnlock(mutex);
+
+			// Read the page
+			osFseek(pageFile,(int64_t) page->fileOffset,SEEK_SET);
+			page->read(pageFile);
+			pageData	=	new float[page->numPoints*dataSize];
+			fread(pageData,sizeof(float),page->numPoints*dataSize,pageFile);
+
+			osLock(mutex);
+			page->data	=	pageData;
+			numPageins++;
+			osUnlock(mutex);
+		}
+
+		osUnlock(pageMutex);
+	}
+
+	return page;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	releasePage
+// Description			:
+/// \brief					Allow a page to be paged out again
+// Return Value			:
+// Comments				:
+void	CPointCloud::releasePage(CPointCloudPage *page) {
+	osLock(mutex);
+	assert(page->numUsers > 0);
+	if (--page->numUsers == 0) {
+		// The page becomes the most recently used one
+		page->prevUnused	=	lastUnused;
+		page->nextUnused	=	NULL;
+		if (lastUnused != NULL)	lastUnused->nextUnused	=	page;
+		else					firstUnused				=	page;
+		lastUnused			=	page;
+	}
+	osUnlock(mutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	lookupPages
+// Description			:
+/// \brief					Walk a batch of lookups through the pages they overlap
+// Return Value			:
+// Comments				:	The pages used are returned in used and must be released by the caller
+void	CPointCloud::lookupPages(CPointLookup **active,int numActive,CPointCloudPage **used,int &numUsed) {
+	CPointLookup	**subset	=	(CPointLookup **) alloca(numActive*sizeof(CPointLookup *));
+	int				stack[64];
+	int				stackSize;
+	vector			lmin,lmax;
+	int				j;
+
+	// The bound of the batch
+	initv(lmin,C_INFINITY);
+	initv(lmax,-C_INFINITY);
+	for (j=0;j<numActive;j++) {
+		const float	r	=	sqrtf(active[j]->distances[0]);
+
+		lmin[0]	=	min(lmin[0],active[j]->P[0] - r);	lmax[0]	=	max(lmax[0],active[j]->P[0] + r);
+		lmin[1]	=	min(lmin[1],active[j]->P[1] - r);	lmax[1]	=	max(lmax[1],active[j]->P[1] + r);
+		lmin[2]	=	min(lmin[2],active[j]->P[2] - r);	lmax[2]	=	max(lmax[2],active[j]->P[2] + r);
+	}
+
+	// Walk the page hierarchy (it is balanced, so the stack can not overflow)
+	numUsed		=	0;
+	stack[0]	=	0;
+	stackSize	=	1;
+	while(stackSize > 0) {
+		const CPointCloudPageNode	*cNode	=	pageNodes + stack[--stackSize];
+		int							numSubset;
+
+		// Does the node overlap the batch at all?
+		if (intersectBox(lmin,lmax,cNode->bmin,cNode->bmax) == FALSE)	continue;
+
+		if (cNode->page == -1) {
+			stack[stackSize++]	=	cNode->child;
+			stack[stackSize++]	=	cNode->child+1;
+			continue;
+		}
+
+		// Find the lookups whose search sphere overlaps the page
+		for (numSubset=0,j=0;j<numActive;j++) {
+			const float	*P	=	active[j]->P;
+			float		d	=	0;
+			float		t;
+
+			if ((t = cNode->bmin[0] - P[0]) > 0)	d	+=	t*t;	else if ((t = P[0] - cNode->bmax[0]) > 0)	d	+=	t*t;
+			if ((t = cNode->bmin[1] - P[1]) > 0)	d	+=	t*t;	else if ((t = P[1] - cNode->bmax[1]) > 0)	d	+=	t*t;
+			if ((t = cNode->bmin[2] - P[2]) > 0)	d	+=	t*t;	else if ((t = P[2] - cNode->bmax[2]) > 0)	d	+=	t*t;
+
+			if (d <= active[j]->distances[0])	subset[numSubset++]	=	active[j];
+		}
+
+		if (numSubset == 0)	continue;
+
+		// Page in and search
+		CPointCloudPage	*page	=	acquirePage(cNode->page);
+		used[numUsed++]			=	page;
+		page->lookupBatch(subset,numSubset);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	pointData
+// Description			:
+/// \brief					Find the data of a point found in one of the pages
+// Return Value			:	The data
+// Comments				:
+const float	*CPointCloud::pointData(const CPointCloudPoint *point,CPointCloudPage **used,int numUsed) {
+	int	i;
+
+	for (i=0;i<numUsed;i++) {
+		const CPointCloudPage	*cPage	=	used[i];
+
+		if ((point > cPage->items) && (point <= cPage->items + cPage->numPoints))	return cPage->data + point->entryNumber;
+	}
+
+	assert(FALSE);
+	return NULL;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	initPointClouds
+// Description			:
+/// \brief					Set the memory limit of the paged point clouds
+// Return Value			:
+// Comments				:	The limit applies to every paged point cloud separately
+void	CPointCloud::initPointClouds(int maxMemory) {
+	maxPageMemory	=	maxMemory;
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPointCloud
 // Method				:	lookup
@@ -203,59 +697,115 @@ void	CPointCloud::write() {
 /// \note					Nl	must be normalized
 //							Il	must be normalized
 void	CPointCloud::lookup(float *Cl,const float *Pl,const float *Nl,float radius) {
+	lookup(1,Cl,Pl,Nl,&radius);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	lookup
+// Description			:
+/// \brief					Locate the nearest points for a number of lookups
+// Return Value			:
+// Comments				:	The lookups are walked through the tree in groups
+void	CPointCloud::lookup(int numLookups,float *Cl,const float *Pl,const float *Nl,const float *radius) {
 	const int 				maxFound	=	16;
-	const CPointCloudPoint	**indices	=	(const CPointCloudPoint **)	alloca((maxFound+1)*sizeof(CPointCloudPoint *)); 
-	float					*distances	=	(float	*)					alloca((maxFound+1)*sizeof(float)); 
-	CPointLookup			l;
-	int						i,j;
+	const CPointCloudPoint	**indices	=	(const CPointCloudPoint **)	alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(CPointCloudPoint *)); 
+	float					*distances	=	(float	*)					alloca(MAP_BATCH_SIZE*(maxFound+1)*sizeof(float)); 
+	CPointLookup			lookups[MAP_BATCH_SIZE];
+	CPointLookup			*active[MAP_BATCH_SIZE];
+	CPointCloudPage			**usedPages	=	NULL;
+	int						numUsed		=	0;
+	int						i,j,k;
 	const float				scale		=	2.5f;	// By controlling this, we 
 
-	distances[0]		=	maxdP*maxdP*scale*scale;
-	l.maxFound			=	maxFound;
-	l.numFound			=	0;
-	l.ignoreNormal		=	dotvv(Nl,Nl) < C_EPSILON;
-
-	// Perform lookup in the world coordinate system
-	mulmp(l.P,to,Pl);
-	mulmn(l.N,from,Nl);
-	mulvf(l.N,-1);				// Photonmaps have N reversed, we must reverse
-								// N when looking up it it
-	if (dotvv(Nl,Nl) > C_EPSILON) normalizevf(l.N);
-	
-	l.gotHeap			=	FALSE;
-	l.indices			=	indices;
-	l.distances			=	distances;
+	// Grab a spare buffer for the pages we use, each concurrent lookup holds on to its own
+	if (pages != NULL) {
+		osLock(mutex);
+		if (pageBuffers.numItems > 0)	usedPages	=	pageBuffers.pop();
+		else							usedPages	=	new CPointCloudPage*[numPages+1];
+		osUnlock(mutex);
+	}
 
-	// No need to lock the mutex here, CMap::lookup is thread safe
-	lookup(&l,1,scale);
+	while(numLookups > 0) {
+		const int	numBatch	=	min(numLookups,MAP_BATCH_SIZE);
 
-	for (i=0;i<dataSize;i++) Cl[i] = 0.0f;	//GSHTODO: channel fill values
+		for (k=0;k<numBatch;k++) {
+			CPointLookup	*l	=	lookups + k;
+			const float		*N	=	Nl + k*3;
 
-	if (l.numFound < 2)	return;
+			l->distances		=	distances + k*(maxFound+1);
+			l->indices			=	indices + k*(maxFound+1);
+			l->distances[0]		=	maxdP*maxdP*scale*scale;
+			l->maxFound			=	maxFound;
+			l->numFound			=	0;
+			l->gotHeap			=	FALSE;
+			l->scale			=	scale;
+			l->ignoreNormal		=	dotvv(N,N) < C_EPSILON;
 
-	int		numFound		=	l.numFound;
-	float	totalWeight		=	0;
-	
-	for (i=1;i<=numFound;i++) {
-		const	CPointCloudPoint	*p	=	indices[i];
+			// Perform lookup in the world coordinate system
+			mulmp(l->P,to,Pl + k*3);
+			mulmn(l->N,from,N);
+			mulvf(l->N,-1);				// Photonmaps have N reversed, we must reverse
+										// N when looking up it it
+			if (dotvv(N,N) > C_EPSILON) normalizevf(l->N);
 
-		assert(distances[i] <= distances[0]);
+			active[k]			=	l;
+		}
 
-		const float	t		=	sqrtf(distances[i]) / (p->dP*scale);
-		const float	weight	=	l.ignoreNormal ? (1-t) : (1-t)*(-dotvv(l.N,p->N));
-		
-		float		*dest	=	Cl;
-		const float	*src	=	data.array + p->entryNumber;
-		for (j=0;j<dataSize;j++) {
-			*dest++			+=	(*src++)*weight;
+		// No need to lock the mutex here, CMap::lookupBatch is thread safe
+		if (pages == NULL)	lookupBatch(active,numBatch);
+		else				lookupPages(active,numBatch,usedPages,numUsed);
+
+		for (k=0;k<numBatch;k++) {
+			const CPointLookup	*l		=	lookups + k;
+			float				*C		=	Cl + k*dataSize;
+
+			for (i=0;i<dataSize;i++) C[i] = 0.0f;	//GSHTODO: channel fill values
+
+			if (l->numFound < 2)	continue;
+
+			int		numFound		=	l->numFound;
+			float	totalWeight		=	0;
+			
+			for (i=1;i<=numFound;i++) {
+				const	CPointCloudPoint	*p	=	l->indices[i];
+
+				assert(l->distances[i] <= l->distances[0]);
+
+				const float	t		=	sqrtf(l->distances[i]) / (p->dP*scale);
+				const float	weight	=	l->ignoreNormal ? (1-t) : (1-t)*(-dotvv(l->N,p->N));
+				
+				float		*dest	=	C;
+				const float	*src	=	(pages == NULL) ? data.array + p->entryNumber : pointData(p,usedPages,numUsed);
+				for (j=0;j<dataSize;j++) {
+					*dest++			+=	(*src++)*weight;
+				}
+				totalWeight += weight;
+			}
+			
+			if (totalWeight > 0) {
+				// Divide the contribution
+				const float weight	= 1.0f/totalWeight;
+				for (i=0;i<dataSize;i++) C[i]	*=	weight;
+			}
 		}
-		totalWeight += weight;
+
+		// The found points are no longer referenced, so the pages can go
+		for (k=0;k<numUsed;k++)	releasePage(usedPages[k]);
+		numUsed		=	0;
+
+		Cl			+=	numBatch*dataSize;
+		Pl			+=	numBatch*3;
+		Nl			+=	numBatch*3;
+		radius		+=	numBatch;
+		numLookups	-=	numBatch;
 	}
-	
-	if (totalWeight > 0) {
-		// Divide the contribution
-		const float weight	= 1.0f/totalWeight;
-		for (i=0;i<dataSize;i++) Cl[i]	*=	weight;
+
+	// Give the buffer back for the next lookup
+	if (usedPages != NULL) {
+		osLock(mutex);
+		pageBuffers.push(usedPages);
+		osUnlock(mutex);
 	}
 }
 
@@ -319,8 +869,43 @@ void	CPointCloud::store(const float *C,const float *cP,const float *cN,float dP)
 // Description			:
 /// \brief					Retrieve an indexed point
 // Return Value			:
-// Comments				:
+// Comments				:	For a paged point cloud, the page of the point is only acquired for the
+//							copy. The page of the last point is remembered as a hint for sequential readers
 void	CPointCloud::getPoint(int i,float *C,float *P,float *N,float *dP) {
+
+	if (pages != NULL) {
+		int	index	=	pointPage;
+
+		// Find the page that holds the point if it is not the last one used
+		if ((i <= pages[index].firstPoint) || (i > pages[index].firstPoint + pages[index].numPoints)) {
+			int	first	=	0;
+			int	last	=	numPages-1;
+
+			while(first < last) {
+				const int	middle	=	(first + last + 1) >> 1;
+
+				if (pages[middle].firstPoint < i)	first	=	middle;
+				else								last	=	middle-1;
+			}
+
+			index		=	first;
+			pointPage	=	index;
+		}
+
+		CPointCloudPage				*page	=	acquirePage(index);
+		const	CPointCloudPoint	*p		=	page->items + (i - page->firstPoint);
+		const float					*src	=	page->data + p->entryNumber;
+
+		for (int j=0;j<dataSize;j++)	C[j]	=	src[j];
+
+		movvv(P,p->P);
+		movvv(N,p->N);
+		dP[0] = p->dP;
+
+		releasePage(page);
+		return;
+	}
+
 	const	CPointCloudPoint	*p		=	items + i;
 	const float 				*src	=	data.array + p->entryNumber;
 	float						*dest	=	C;
@@ -343,6 +928,27 @@ void	CPointCloud::getPoint(int i,float *C,float *P,float *N,float *dP) {
 // Return Value			:
 // Comments				:
 void	CPointCloud::draw() {
+
+	if (pages != NULL) {
+		// Draw the pages one by one
+		for (int i=0;i<numPages;i++) {
+			CPointCloudPage	*page	=	acquirePage(i);
+			drawItems(page->items+1,page->numPoints,page->data);
+			releasePage(page);
+		}
+	} else {
+		drawItems(items+1,numItems,data.array);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloud
+// Method				:	drawItems
+// Description			:
+/// \brief					Draw a number of points
+// Return Value			:
+// Comments				:
+void	CPointCloud::drawItems(const CPointCloudPoint *cT,int numPoints,const float *pData) {
 	float		P[chunkSize*3];
 	float		C[chunkSize*3];
 	float		N[chunkSize*3];
@@ -354,10 +960,9 @@ void	CPointCloud::draw() {
 	float		*cC				=	C;
 	float		*cN				=	N;
 	float		*cdP			=	dP;
-	CPointCloudPoint	*cT		=	items+1;
 
 	// Collect and dispatch the photons
-	for (i=numItems,j=chunkSize;i>0;i--,cT++,cP+=3,cdP++,cN+=3,cC+=3,j--) {
+	for (i=numPoints,j=chunkSize;i>0;i--,cT++,cP+=3,cdP++,cN+=3,cC+=3,j--) {
 		if (j == 0)	{
 			if (drawDiscs)		drawDisks(chunkSize,P,dP,N,C);
 			else			 	drawPoints(chunkSize,P,C);
@@ -372,7 +977,7 @@ void	CPointCloud::draw() {
 		movvv(cN,cT->N);
 		*cdP	=	cT->dP;		// was /dPscale;	but should already be in world
 		
-		float *DDs = data.array + cT->entryNumber + sampleStart;
+		const float *DDs = pData + cT->entryNumber + sampleStart;
 		if (numSamples == 1) {
 			initv(cC,DDs[0]);
 		} else if (numSamples == 2) {
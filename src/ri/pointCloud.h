@@ -49,6 +49,37 @@ public:
 	int						entryNumber;	// The index to find the associated data in the "data" array
 };
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloudPage
+// Description			:
+/// \brief					A spatially coherent page of a paged point cloud
+// Comments				:	The points and the data are loaded on demand
+class	CPointCloudPage : public CMap<CPointCloudPoint> {
+public:
+	float					*data;			// The point data (NULL if the page is not in memory)
+	float					maxdP;			// The maximum radius in the page
+	int						numPoints;		// The number of points in the page
+	int						firstPoint;		// The number of points in the preceding pages
+	uint64_t				fileOffset;		// Where the page lives in the file
+	int						numUsers;		// The number of lookups using the page (can not be paged out if > 0)
+	CPointCloudPage			*prevUnused;	// The unused pages in memory, least recently used first
+	CPointCloudPage			*nextUnused;
+
+	friend class CPointCloud;
+};
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointCloudPageNode
+// Description			:
+/// \brief					A node of the bounding hierarchy over the pages
+// Comments				:	The bounds are kept here so that the lookups never touch a page that is being read
+class	CPointCloudPageNode {
+public:
+	vector					bmin,bmax;		// The bound of the pages below
+	int						page;			// The page of a leaf (-1 for an internal node)
+	int						child;			// The first child of an internal node, the second one follows it
+};
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPointCloud
 // Description			:
@@ -59,6 +90,7 @@ public:
 							CPointCloud(const char *name,const float *from,const float *to,const float *toNDC,const char*,int);
 							CPointCloud(const char *name,const float *from,const float *to,const float *toNDC,int,char **,char **,int);
 							CPointCloud(const char *name,const float *from,const float *to,FILE *);
+							CPointCloud(const char *name,const float *from,const float *to,FILE *,int paged);
 							~CPointCloud();
 
 							// Misc interface
@@ -69,6 +101,7 @@ public:
 							// Store/Lookup interface
 	void					store(const float *,const float *,const float *,float);
 	void					lookup(float *,const float *,const float *,float);
+	void					lookup(int,float *,const float *,const float *,const float *);
 	void					lookup(float *,const float *,const float *,const float *,const float *,CShadingContext *) {	assert(FALSE);	}
 
 							// CView interface for drawing
@@ -77,8 +110,12 @@ public:
 	void					bound(float *bmin,float *bmax);
 	
 							// ptcApi interface
-	int						getNumPoints() { return numItems; }
+	int						getNumPoints() { return (pages != NULL) ? numPagedPoints : numItems; }
 	void					getPoint(int i,float *C,float *P,float *N,float *dP);
+	void					setPageSize(int n) { pageSize = n; }
+
+							// Paging interface
+	static	void			initPointClouds(int maxMemory);
 
 private:
 
@@ -91,64 +128,53 @@ private:
 							class	CPointLookup : public CLookup {
 							public:
 								int				ignoreNormal;
+								float			scale;
+
+												///////////////////////////////////////////////////////////////////////
+												// Class				:	CPointLookup
+												// Method				:	valid
+												// Description			:
+/// \brief					Check if a point can contribute to the lookup
+												// Return Value			:	TRUE if the point is valid
+												// Comments				:	Note that we do the opposite to photonmaps
+												//							only entries coherent with N contribute
+												//							but l.N is reversed...
+								static inline int	valid(const CPointLookup *l,const CPointCloudPoint *photon,float d) {
+													return	(d < (photon->dP*photon->dP*l->scale*l->scale)) &&
+															((dotvv(photon->N,l->N) < 0) || l->ignoreNormal);
+												}
 							};
 		
-							///////////////////////////////////////////////////////////////////////
-							// Class				:	CMap
-							// Method				:	lookup
-							// Description			:
-/// \brief					Locate the nearest valid points
-							// Return Value			:	Internally used
-							// Comments				:
-					void	lookup(CPointLookup *l,int index,const float scale) {
-								const CPointCloudPoint	*photon	=	&items[index];
-								float					d;
-								vector					D;
-								int						axis	=	photon->flags;
-
-								if (index < numItemsh) {
-									d	=	l->P[axis] - photon->P[axis];
-
-									if (d > 0) {
-										lookup(l,2*index+1,scale);
-
-										if (d*d < l->distances[0]) {
-											lookup(l,2*index,scale);
-										}
-
-									} else {
-										lookup(l,2*index,scale);
-
-										if (d*d < l->distances[0]) {
-											lookup(l,2*index+1,scale);
-										}
-									}
-								}
-
-								subvv(D,photon->P,l->P);
-								d	=	dotvv(D,D);
-								const float t	=	dotvv(D,l->N);
-								d	+=	t*t*16;
-
-
-								// If the item is valid, insert it
-								if (d < l->distances[0]) {
-									if (d < (photon->dP*photon->dP*scale*scale)) {
-									
-										// Note that we do the opposite to photonmaps
-										// only entries coherent with N contribute
-										// but l.N is reversed...
-										if ((dotvv(photon->N,l->N) < 0) || l->ignoreNormal) {
-											insert(l,d,photon);
-										}
-									}
-								}
-							}
-						
 	CArray<float>			data;				// This is where we actually keep the data
 	int						flush;				// Should this be written to disk?
 	TMutex					mutex;				// To synchronize updates
 	float					maxdP;
+
+	CPointCloudPage			*pages;				// The pages of a paged point cloud (NULL if every point is in memory)
+	CPointCloudPageNode		*pageNodes;			// The bounding hierarchy over the pages (the root is the first node)
+	int						numPages;			// The number of pages
+	int						numPagedPoints;		// The total number of points in the pages
+	int						pageSize;			// The maximum number of points per page when writing (0 for a monolithic file)
+	int64_t					pageMemory;			// The memory used (or being read into) by the pages in memory
+	CPointCloudPage			*firstUnused;		// The least recently used page that can be paged out
+	CPointCloudPage			*lastUnused;		// The most recently used page that can be paged out
+	FILE					*pageFile;			// The file we're paging from
+	TMutex					pageMutex;			// Serializes the page reads (held without the cloud mutex)
+	CArray<CPointCloudPage **>	pageBuffers;	// The spare buffers for the pages used by a batch of lookups
+	int						pointPage;			// The page the last getPoint used (a hint for the next one)
+	int						numPageins;			// The pages read (counted under the mutex, added to the stats when the cloud dies)
+	int						numPageouts;		// The pages discarded (counted under the mutex)
+
+	void					writePaged(FILE *);
+	void					paginate(int *,int,int,CArray<int> &);
+	void					buildPageNodes(int,int,int,int &);
+	CPointCloudPage			*acquirePage(int);
+	void					releasePage(CPointCloudPage *);
+	void					lookupPages(CPointLookup **,int,CPointCloudPage **,int &);
+	const float				*pointData(const CPointCloudPoint *,CPointCloudPage **,int);
+	void					drawItems(const CPointCloudPoint *,int,const float *);
+
+	static	int64_t			maxPageMemory;		// The maximum amount of memory a paged point cloud may use
 	
 	static	int				drawDiscs;			// Which type to draw
 	static	int				drawChannel;		// Which channel to draw
@@ -28,15 +28,24 @@
 //  Description			:
 //
 ////////////////////////////////////////////////////////////////////////
+#include <limits.h>
+
 #include "pointHierarchy.h"
 #include "error.h"
 #include "random.h"
 #include "shading.h"
+#include "memory.h"
+#include "renderer.h"
+#include "atomic.h"
 
 // The predefined names for the area and the radiosity channels
 const	char	*areaName		=	"_area";
 const	char	*radiosityName	=	"_radiosity";
 
+// What cluster returns for a subtree that is deferred to a thread. The nodes are >= 0
+// and the leaves are -1 ... -numItems, so this can not be mistaken for either
+static	const	int	deferredSubtree	=	INT_MIN;
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	ff
 // Description			:
@@ -93,6 +102,137 @@ static	inline	float	ff(const float *rP,const float *rN,const float *oP,const flo
 	}
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	harmonicCosine
+// Description			:
+/// \brief					Accumulate the harmonic coefficients of a clamped cosine lobe
+// Return Value			:	-
+// Comments				:	The coefficients are scaled by w and added to Y
+static	inline	void	harmonicCosine(float *Y,const float *N,float w) {
+	const float	a0	=	(float) C_PI*w;
+	const float	a1	=	(float) (2*C_PI/3)*w;
+	const float	a2	=	(float) (C_PI/4)*w;
+
+	Y[0]	+=	a0*0.282095f;
+	Y[1]	+=	a1*0.488603f*N[0];
+	Y[2]	+=	a1*0.488603f*N[1];
+	Y[3]	+=	a1*0.488603f*N[2];
+	Y[4]	+=	a2*1.092548f*N[0]*N[1];
+	Y[5]	+=	a2*1.092548f*N[1]*N[2];
+	Y[6]	+=	a2*1.092548f*N[2]*N[0];
+	Y[7]	+=	a2*0.315392f*(3*N[2]*N[2]-1);
+	Y[8]	+=	a2*0.546274f*(N[0]*N[0]-N[1]*N[1]);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	harmonicScalar
+// Description			:
+/// \brief					Evaluate a single channel of spherical harmonics
+// Return Value			:	The value in the direction D
+// Comments				:
+static	inline	float	harmonicScalar(const float *Y,const float *D) {
+	return	Y[0]*0.282095f +
+			0.488603f*(Y[1]*D[0] + Y[2]*D[1] + Y[3]*D[2]) +
+			1.092548f*(Y[4]*D[0]*D[1] + Y[5]*D[1]*D[2] + Y[6]*D[2]*D[0]) +
+			Y[7]*0.315392f*(3*D[2]*D[2]-1) +
+			Y[8]*0.546274f*(D[0]*D[0]-D[1]*D[1]);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	microbufferRect
+// Description			:
+/// \brief					Compute the pixel range a sphere covers on a microbuffer face
+// Return Value			:	FALSE if the sphere does not touch the face
+// Comments				:	D is the vector to the sphere center, l is its length
+static	inline	int		microbufferRect(int *rect,int face,int res,const float *D,float l,float r) {
+	const int	a		=	face >> 1;
+	const float	s		=	(face & 1) ? -1.0f : 1.0f;
+	const float	da		=	s*D[a];
+
+	if (r >= l) {
+		// We're inside the sphere, it covers the entire face
+		rect[0]	=	0;	rect[1]	=	res-1;
+		rect[2]	=	0;	rect[3]	=	res-1;
+		return TRUE;
+	}
+
+	const float	limit	=	(float) (C_PI/4);
+	int			i;
+
+	for (i=0;i<2;i++) {
+		const int	t		=	(a + 1 + i) % 3;
+		const float	l2		=	sqrtf(D[t]*D[t] + da*da);
+		const float	center	=	atan2f(D[t],da);
+		const float	spread	=	(r >= l2) ? (float) C_PI : asinf(r / l2);
+		float		t0		=	center - spread;
+		float		t1		=	center + spread;
+
+		if ((t1 < -limit) || (t0 > limit))	return FALSE;
+
+		t0		=	max(t0,-limit);
+		t1		=	min(t1,limit);
+
+		rect[i*2+0]	=	max((int) floorf((tanf(t0)+1)*0.5f*res),0);
+		rect[i*2+1]	=	min((int) floorf((tanf(t1)+1)*0.5f*res),res-1);
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	microbufferDir
+// Description			:
+/// \brief					Compute the direction through the center of a microbuffer pixel
+// Return Value			:	The solid angle of the pixel
+// Comments				:
+static	inline	float	microbufferDir(float *dir,int face,int res,int x,int y) {
+	const int	a		=	face >> 1;
+	const float	u		=	(x + 0.5f)*2.0f/(float) res - 1;
+	const float	v		=	(y + 0.5f)*2.0f/(float) res - 1;
+	const float	r2		=	1 + u*u + v*v;
+	const float	l		=	1 / sqrtf(r2);
+	const float	du		=	2.0f / (float) res;
+
+	dir[a]				=	((face & 1) ? -l : l);
+	dir[(a+1) % 3]		=	u*l;
+	dir[(a+2) % 3]		=	v*l;
+
+	return du*du*l / r2;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	microbufferOccluded
+// Description			:
+/// \brief					Check if a sphere is hidden behind the depths already in the microbuffer
+// Return Value			:	TRUE if every pixel the sphere may touch is closer than the sphere
+// Comments				:	D is the vector to the sphere center, l is its length
+static	inline	int		microbufferOccluded(const float *depth,int res,const float *D,float l,float r) {
+	const float	zmin	=	l - r;
+	int			touched	=	FALSE;
+	int			face;
+
+	if (zmin <= 0)	return FALSE;
+
+	for (face=0;face<6;face++) {
+		int		rect[4];
+		int		x,y;
+
+		if (microbufferRect(rect,face,res,D,l,r) == FALSE)	continue;
+
+		const float	*fDepth	=	depth + face*res*res;
+
+		for (y=rect[2];y<=rect[3];y++) {
+			for (x=rect[0];x<=rect[1];x++) {
+				if (fDepth[y*res+x] >= zmin)	return FALSE;
+			}
+		}
+
+		touched	=	TRUE;
+	}
+
+	return touched;
+}
+
 
 
 
@@ -105,8 +245,8 @@ static	inline	float	ff(const float *rP,const float *rN,const float *oP,const flo
 // Description			:
 /// \brief					Ctor
 // Return Value			:
-// Comments				:
-CPointHierarchy::CPointHierarchy(const char *n,const float *from,const float *to,FILE *in) : CMap<CPointCloudPoint>(), CTexture3d(n,from,to) {
+// Comments				:	fileName is the located point cloud, the hierarchy is cached next to it
+CPointHierarchy::CPointHierarchy(const char *n,const float *from,const float *to,FILE *in,const char *fileName) : CMap<CPointCloudPoint>(), CTexture3d(n,from,to) {
 	
 	// Try to read the point cloud
 
@@ -123,6 +263,9 @@ CPointHierarchy::CPointHierarchy(const char *n,const float *from,const float *to
 	fread(data.array,sizeof(float),numItems*dataSize,in);
 	data.numItems	=	numItems*dataSize;
 
+	// Remember the size of the point cloud to validate the cache
+	const int64_t		sourceSize	=	(int64_t) osFtell(in);
+
 	// Close the file
 	fclose(in);
 
@@ -135,8 +278,24 @@ CPointHierarchy::CPointHierarchy(const char *n,const float *from,const float *to
 		else if ((strcmp(channels[i].name,radiosityName) == 0)	&& (channels[i].numSamples == 3))	radiosityIndex	=	channels[i].sampleStart;
 	}
 
-	// Compute the point hierarchy so that we can perform lookups
-	computeHierarchy();
+	// Use the cached hierarchy if there is one, otherwise compute it so that we can perform lookups
+	char	cacheName[OS_MAX_PATH_LENGTH];
+	sprintf(cacheName,"%s%s",fileName,POINTHIERARCHY_CACHE_EXTENSION);
+
+	nodes			=	NULL;
+	numNodes		=	0;
+	nodeMap			=	NULL;
+	nodeMapSize		=	0;
+	harmonics		=	NULL;
+	bounds			=	NULL;
+	osCreateMutex(mutex);
+
+	const unsigned int	key			=	checksum();
+
+	if (readCache(cacheName,sourceSize,key) == FALSE) {
+		computeHierarchy();
+		writeCache(cacheName,sourceSize,key);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -147,6 +306,13 @@ CPointHierarchy::CPointHierarchy(const char *n,const float *from,const float *to
 // Return Value			:
 // Comments				:
 CPointHierarchy::~CPointHierarchy() {
+	if (nodeMap != NULL)		osUnmapFile(nodeMap,nodeMapSize);
+	else if (nodes != NULL)		delete [] nodes;
+
+	if (harmonics != NULL)	delete [] harmonics;
+	if (bounds != NULL)		delete [] bounds;
+
+	osDeleteMutex(mutex);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -155,23 +321,219 @@ CPointHierarchy::~CPointHierarchy() {
 // Description			:
 /// \brief					Constructs a hierarchy of the stored items
 // Return Value			:	-
-// Comments				:
+// Comments				:	The top of the tree is clustered here, the subtrees below are clustered in parallel
 void		CPointHierarchy::computeHierarchy() {
+	CArray<CMapNode>		*top	=	new CArray<CMapNode>;
+	CArray<CClusterJob *>	jobs;
+	CClusterState			state;
 
 	// Get the item pointers into a temporary array
-	int	i;
+	int	i,j;
 	int	*tmp	=	new int[CMap<CPointCloudPoint>::numItems];
 	
 	for (i=1;i<=CMap<CPointCloudPoint>::numItems;i++)	tmp[i-1]	=	i;
 
-	// Compute the map hierarchy
-	const int	root	=	cluster(CMap<CPointCloudPoint>::numItems,tmp);
+	// Defer the subtrees below a certain depth if we have threads to cluster them
+	state.nodes		=	top;
+	state.jobs		=	NULL;
+	state.jobDepth	=	0;
+	state.nextJob	=	0;
+	state.hierarchy	=	this;
+	state.seed		=	1;
+	if ((CRenderer::numThreads > 1) && (CMap<CPointCloudPoint>::numItems >= POINTHIERARCHY_PARALLEL_MIN)) {
+		state.jobs		=	&jobs;
+
+		// Create about 4 subtrees per thread
+		for (i=CRenderer::numThreads*4;i>1;i>>=1)	state.jobDepth++;
+	}
 
-	// Root is always the first item in the array
-	assert(root == 0);
+	// Compute the map hierarchy, the root is always the first item in the array
+	cluster(CMap<CPointCloudPoint>::numItems,tmp,&state,0);
+	assert(top->numItems > 0);
 
 	// Ditch the temp memory
 	delete [] tmp;
+
+	// Cluster the deferred subtrees
+	if (jobs.numItems > 0) {
+		const int	numThreads	=	min(CRenderer::numThreads,jobs.numItems);
+		TThread		*threads	=	(TThread *) alloca(numThreads*sizeof(TThread));
+
+		osCreateMutex(state.mutex);
+		for (i=0;i<numThreads;i++)	threads[i]	=	osCreateThread(clusterThread,&state);
+		for (i=0;i<numThreads;i++)	osWaitThread(threads[i]);
+		osDeleteMutex(state.mutex);
+	}
+
+	// Allocate the final node array
+	numNodes	=	top->numItems;
+	for (i=0;i<jobs.numItems;i++)	numNodes	+=	jobs.array[i]->nodes->numItems;
+	nodes		=	new CMapNode[numNodes];
+	memcpy(nodes,top->array,top->numItems*sizeof(CMapNode));
+	int	offset	=	top->numItems;
+	delete top;
+
+	// Append the subtrees, relocating their internal node indices
+	for (i=0;i<jobs.numItems;i++) {
+		CClusterJob	*job	=	jobs.array[i];
+		CMapNode	*dest	=	nodes + offset;
+
+		memcpy(dest,job->nodes->array,job->nodes->numItems*sizeof(CMapNode));
+		for (j=0;j<job->nodes->numItems;j++,dest++) {
+			if (dest->child0 >= 0)	dest->child0	+=	offset;
+			if (dest->child1 >= 0)	dest->child1	+=	offset;
+		}
+
+		// Link the subtree to its parent
+		if (job->which == 0)	nodes[job->parent].child0	=	offset;
+		else					nodes[job->parent].child1	=	offset;
+
+		offset	+=	job->nodes->numItems;
+
+		delete job->nodes;
+		delete [] job->indices;
+		delete job;
+	}
+
+	assert(offset == numNodes);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	clusterThread
+// Description			:
+/// \brief					The thread that clusters the deferred subtrees
+// Return Value			:	-
+// Comments				:
+TFunPrefix	CPointHierarchy::clusterThread(void *w) {
+	CClusterState	*shared	=	(CClusterState *) w;
+
+	while(TRUE) {
+		osLock(shared->mutex);
+		const int	currentJob	=	shared->nextJob++;
+		osUnlock(shared->mutex);
+
+		if (currentJob >= shared->jobs->numItems)	break;
+
+		// Cluster the subtree into its own node array
+		CClusterJob		*job	=	shared->jobs->array[currentJob];
+		CClusterState	state;
+
+		job->nodes		=	new CArray<CMapNode>;
+		state.nodes		=	job->nodes;
+		state.jobs		=	NULL;
+		state.jobDepth	=	0;
+		state.nextJob	=	0;
+		state.hierarchy	=	shared->hierarchy;
+		state.seed		=	currentJob + 2;
+
+		// The subtree root is always the first item in its array
+		shared->hierarchy->cluster(job->numItems,job->indices,&state,0);
+		assert(job->nodes->numItems > 0);
+	}
+
+	TFunReturn;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	checksum
+// Description			:
+/// \brief					Compute a key that identifies the point data
+// Return Value			:	The key
+// Comments				:	Only a strided subset of the points is hashed so that loading a
+//							cached hierarchy stays cheap, the size of the point cloud file
+//							is checked separately
+unsigned int	CPointHierarchy::checksum() const {
+	const int		numPoints	=	CMap<CPointCloudPoint>::numItems;
+	const int		stride		=	max(numPoints / POINTHIERARCHY_CHECKSUM_SAMPLES,1);
+	unsigned int	key			=	2166136261u;
+	int				i;
+
+	key	=	hashBytes(key,&numPoints,sizeof(int));
+	key	=	hashBytes(key,&dataSize,sizeof(int));
+
+	for (i=1;i<=numPoints;i+=stride) {
+		const CPointCloudPoint	*item	=	CMap<CPointCloudPoint>::items + i;
+
+		key	=	hashBytes(key,item,sizeof(CPointCloudPoint));
+		key	=	hashBytes(key,data.array + item->entryNumber,dataSize*sizeof(float));
+	}
+
+	// Always include the last point
+	if (numPoints > 0) {
+		const CPointCloudPoint	*item	=	CMap<CPointCloudPoint>::items + numPoints;
+
+		key	=	hashBytes(key,item,sizeof(CPointCloudPoint));
+		key	=	hashBytes(key,data.array + item->entryNumber,dataSize*sizeof(float));
+	}
+
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	readCache
+// Description			:
+/// \brief					Map a previously computed hierarchy
+// Return Value			:	TRUE on success
+// Comments				:	The cache is rejected unless it was computed from the same point data.
+//							The header is [version,source size,points,node size,checksum,nodes]
+int			CPointHierarchy::readCache(const char *cacheName,int64_t sourceSize,unsigned int checksum) {
+	size_t		size;
+	int64_t		*header;
+
+	if ((header = (int64_t *) osMapFile(cacheName,size)) == NULL)	return FALSE;
+
+	// Make sure the cache belongs to this point cloud
+	if (	(size < 6*sizeof(int64_t)) ||
+			(header[0] != POINTHIERARCHY_CACHE_VERSION) ||
+			(header[1] != sourceSize) ||
+			(header[2] != CMap<CPointCloudPoint>::numItems) ||
+			(header[3] != (int64_t) sizeof(CMapNode)) ||
+			(header[4] != (int64_t) checksum) ||
+			(header[5] < 0) || (header[5] > INT_MAX) ||
+			((uint64_t) size != 6*sizeof(int64_t) + (uint64_t) header[5]*sizeof(CMapNode))) {
+		osUnmapFile(header,size);
+		return FALSE;
+	}
+
+	numNodes	=	(int) header[5];
+	nodes		=	(CMapNode *) (header + 6);
+	nodeMap		=	header;
+	nodeMapSize	=	size;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	writeCache
+// Description			:
+/// \brief					Save the computed hierarchy next to the point cloud
+// Return Value			:	-
+// Comments				:	The file is written under a temporary name and renamed so that
+//							concurrent renders never see a partial cache. The temporary name
+//							is unique across the processes and the threads writing it
+void		CPointHierarchy::writeCache(const char *cacheName,int64_t sourceSize,unsigned int checksum) {
+	char	tmpName[OS_MAX_PATH_LENGTH];
+	FILE	*out;
+	int64_t	header[6];
+
+	sprintf(tmpName,"%s.%d.%x",cacheName,osProcessId(),(unsigned int) (uintptr_t) this);
+	if ((out = fopen(tmpName,"wb")) == NULL)	return;
+
+	header[0]	=	POINTHIERARCHY_CACHE_VERSION;
+	header[1]	=	sourceSize;
+	header[2]	=	CMap<CPointCloudPoint>::numItems;
+	header[3]	=	(int64_t) sizeof(CMapNode);
+	header[4]	=	(int64_t) checksum;
+	header[5]	=	numNodes;
+
+	const int	success	=	(fwrite(header,sizeof(int64_t),6,out) == 6) && (fwrite(nodes,sizeof(CMapNode),numNodes,out) == (size_t) numNodes);
+	fclose(out);
+
+	if ((success == FALSE) || (rename(tmpName,cacheName) != 0))	osDeleteFile(tmpName);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -181,7 +543,7 @@ void		CPointHierarchy::computeHierarchy() {
 /// \brief					Create an internal node by averaging the point data
 // Return Value			:	-
 // Comments				:
-int			CPointHierarchy::average(int numItems,int *indices) {
+int			CPointHierarchy::average(int numItems,int *indices,CClusterState *state) {
 	CMapNode	node;
 
 	// PASS 1:	Average the position/normal
@@ -230,8 +592,8 @@ int			CPointHierarchy::average(int numItems,int *indices) {
 	node.dP		=	sqrtf(node.dP / (float) C_PI);	// Convert to effective radius
 
 	// Create the node
-	nodes.push(node);
-	return nodes.numItems - 1;
+	state->nodes->push(node);
+	return state->nodes->numItems - 1;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -240,8 +602,8 @@ int			CPointHierarchy::average(int numItems,int *indices) {
 // Description			:
 /// \brief					Cluster the items
 // Return Value			:	-
-// Comments				:
-int			CPointHierarchy::cluster(int numItems,int *indices) {
+// Comments				:	Returns deferredSubtree if the subtree has been deferred to a thread
+int			CPointHierarchy::cluster(int numItems,int *indices,CClusterState *state,int depth) {
 
 	// Sanity check
 	assert(numItems > 0);
@@ -252,12 +614,24 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 
 	} else if (numItems == 2) {
 		// Easy case
-		int			nodeIndex	=	average(numItems,indices);
-		CMapNode	*node		=	nodes.array + nodeIndex;
+		int			nodeIndex	=	average(numItems,indices,state);
+		CMapNode	*node		=	state->nodes->array + nodeIndex;
 		node->child0			=	-indices[0];
 		node->child1			=	-indices[1];
 		return nodeIndex;
 
+	} else if ((state->jobs != NULL) && (depth >= state->jobDepth)) {
+		// Defer this subtree to a thread, the caller will record the parent
+		CClusterJob	*job	=	new CClusterJob;
+		job->numItems		=	numItems;
+		job->indices		=	new int[numItems];
+		job->parent			=	-1;
+		job->which			=	-1;
+		job->nodes			=	NULL;
+		memcpy(job->indices,indices,numItems*sizeof(int));
+		state->jobs->push(job);
+		return deferredSubtree;
+
 	} else {
 		// Allocate temp memory
 		int	*membership,*subItems;
@@ -283,16 +657,16 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 		vector	N0,N1;		// The cluster normals
 
 		// Create random cluster centers
-		initv(C0,	_urand()*(bmax[0]-bmin[0]) + bmin[0],
-					_urand()*(bmax[1]-bmin[1]) + bmin[1],
-					_urand()*(bmax[2]-bmin[2]) + bmin[2]);
-		initv(C1,	_urand()*(bmax[0]-bmin[0]) + bmin[0],
-					_urand()*(bmax[1]-bmin[1]) + bmin[1],
-					_urand()*(bmax[2]-bmin[2]) + bmin[2]);
+		initv(C0,	state->urand()*(bmax[0]-bmin[0]) + bmin[0],
+					state->urand()*(bmax[1]-bmin[1]) + bmin[1],
+					state->urand()*(bmax[2]-bmin[2]) + bmin[2]);
+		initv(C1,	state->urand()*(bmax[0]-bmin[0]) + bmin[0],
+					state->urand()*(bmax[1]-bmin[1]) + bmin[1],
+					state->urand()*(bmax[2]-bmin[2]) + bmin[2]);
 
 		// Create random cluster normals
-		initv(N0,	_urand()*2-1,	_urand()*2-1,	_urand()*2-1);
-		initv(N1,	_urand()*2-1,	_urand()*2-1,	_urand()*2-1);
+		initv(N0,	state->urand()*2-1,	state->urand()*2-1,	state->urand()*2-1);
+		initv(N1,	state->urand()*2-1,	state->urand()*2-1,	state->urand()*2-1);
 		normalizevf(N0);
 		normalizevf(N1);
 
@@ -348,15 +722,15 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 			
 			// Check for degenerate cases
 			if ((num0 == 0) || (num1 == 0)) {
-				initv(C0,	_urand()*(bmax[0]-bmin[0]) + bmin[0],
-							_urand()*(bmax[1]-bmin[1]) + bmin[1],
-							_urand()*(bmax[2]-bmin[2]) + bmin[2]);
-				initv(C1,	_urand()*(bmax[0]-bmin[0]) + bmin[0],
-							_urand()*(bmax[1]-bmin[1]) + bmin[1],
-							_urand()*(bmax[2]-bmin[2]) + bmin[2]);
-
-				initv(N0,	_urand()*2-1,	_urand()*2-1,	_urand()*2-1);
-				initv(N1,	_urand()*2-1,	_urand()*2-1,	_urand()*2-1);
+				initv(C0,	state->urand()*(bmax[0]-bmin[0]) + bmin[0],
+							state->urand()*(bmax[1]-bmin[1]) + bmin[1],
+							state->urand()*(bmax[2]-bmin[2]) + bmin[2]);
+				initv(C1,	state->urand()*(bmax[0]-bmin[0]) + bmin[0],
+							state->urand()*(bmax[1]-bmin[1]) + bmin[1],
+							state->urand()*(bmax[2]-bmin[2]) + bmin[2]);
+
+				initv(N0,	state->urand()*2-1,	state->urand()*2-1,	state->urand()*2-1);
+				initv(N1,	state->urand()*2-1,	state->urand()*2-1,	state->urand()*2-1);
 				normalizevf(N0);
 				normalizevf(N1);
 			} else {
@@ -389,7 +763,7 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 		assert((num0 + num1) == numItems);
 
 		// Average the items and create an internal node
-		const int	nodeIndex	=	average(numItems,indices);
+		const int	nodeIndex	=	average(numItems,indices,state);
 		
 		// OK, split the items into two
 		int	i,j;
@@ -397,17 +771,31 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 		// Collect the items in the first child
 		for (i=0,j=0;i<numItems;i++)	if (membership[i] == 0)	subItems[j++]	=	indices[i];
 		assert(j == num0);
-		const int	child0	=	cluster(num0,subItems);
+		const int	child0	=	cluster(num0,subItems,state,depth+1);
+
+		// If the child was deferred, it was the last job created
+		if (child0 == deferredSubtree) {
+			CClusterJob	*job	=	state->jobs->array[state->jobs->numItems-1];
+			job->parent			=	nodeIndex;
+			job->which			=	0;
+		}
 		
 		// Collect the items in the second child
 		for (i=0,j=0;i<numItems;i++)	if (membership[i] == 1)	subItems[j++]	=	indices[i];
 		assert(j == num1);
-		const int	child1	=	cluster(num1,subItems);
+		const int	child1	=	cluster(num1,subItems,state,depth+1);
+
+		// If the child was deferred, it was the last job created
+		if (child1 == deferredSubtree) {
+			CClusterJob	*job	=	state->jobs->array[state->jobs->numItems-1];
+			job->parent			=	nodeIndex;
+			job->which			=	1;
+		}
 		
 		// NOTE: There's an important subtlety here...
 		// We can not access cNode before the child nodes are created because the creation of children
-		// may change the nodes.array field
-		CMapNode *cNode	=	nodes.array + nodeIndex;
+		// may change the state->nodes->array field
+		CMapNode *cNode	=	state->nodes->array + nodeIndex;
 		cNode->child0	=	child0;
 		cNode->child1	=	child1;
 
@@ -419,6 +807,64 @@ int			CPointHierarchy::cluster(int numItems,int *indices) {
 	}
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	computeHarmonics
+// Description			:
+/// \brief					Compute the directional area/radiosity distribution of every node
+// Return Value			:	-
+// Comments				:	Every node gets 4 sets of 9 coefficients (area, red, green, blue)
+//							and the radius of its bounding sphere for the occlusion test.
+//							The caller must hold the mutex, the harmonics are published last
+void		CPointHierarchy::computeHarmonics() {
+	float	*Y	=	new float[numNodes*36];
+	float	*R	=	new float[numNodes];
+	int		i,j;
+
+	for (i=numNodes*36-1;i>=0;i--)	Y[i]	=	0;
+	for (i=numNodes-1;i>=0;i--)		R[i]	=	0;
+
+	// The children are always created after their parents, so a reverse sweep works bottom-up
+	for (i=numNodes-1;i>=0;i--) {
+		const CMapNode	*node	=	nodes + i;
+		float			*dest	=	Y + i*36;
+		const int		children[2]	=	{	node->child0,	node->child1	};
+
+		for (j=0;j<2;j++) {
+			if (children[j] < 0) {
+				const CPointCloudPoint	*item	=	CMap<CPointCloudPoint>::items - children[j];
+				const float				*src	=	data.array + item->entryNumber;
+				const float				area	=	(areaIndex == -1) ? (float) C_PI*item->dP*item->dP : src[areaIndex];
+				vector					D;
+
+				subvv(D,item->P,node->P);
+				R[i]	=	max(R[i],lengthv(D) + item->dP);
+
+				harmonicCosine(dest,item->N,area);
+				if (radiosityIndex != -1) {
+					harmonicCosine(dest+9,item->N,area*src[radiosityIndex+0]);
+					harmonicCosine(dest+18,item->N,area*src[radiosityIndex+1]);
+					harmonicCosine(dest+27,item->N,area*src[radiosityIndex+2]);
+				}
+			} else {
+				const float	*src	=	Y + children[j]*36;
+				int			k;
+				vector		D;
+
+				assert(children[j] > i);
+				for (k=0;k<36;k++)	dest[k]	+=	src[k];
+
+				subvv(D,nodes[children[j]].P,node->P);
+				R[i]	=	max(R[i],lengthv(D) + R[children[j]]);
+			}
+		}
+	}
+
+	bounds		=	R;
+	memoryBarrier();
+	harmonics	=	Y;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPointHierarchy
 // Method				:	lookup
@@ -441,6 +887,14 @@ void		CPointHierarchy::lookup(float *Cl,const float *Pl,const float *dPdul,const
 	// Clear the data
 	for (i=0;i<dataSize;i++)	Cl[i]	=	0;
 
+	// Should we resolve the visibility with a microbuffer?
+	if (scratch->occlusionParams.microbuffer >= 1) {
+		const int	res	=	min((int) scratch->occlusionParams.microbuffer,POINTHIERARCHY_MAX_MICROBUFFER);
+
+		lookupMicrobuffer(Cl,P,N,res,maxsolidangle,context);
+		return;
+	}
+
 	// Do the recursive stuff
 	*stack++	=	0;
 	while(stack > stackBase) {
@@ -469,7 +923,7 @@ void		CPointHierarchy::lookup(float *Cl,const float *Pl,const float *dPdul,const
 			Cl[3]	+=	form;
 
 		} else {
-			const CMapNode			*node	=	nodes.array + currentNode;
+			const CMapNode			*node	=	nodes + currentNode;
 			
 			// Are we behind the node?
 			//if ((node->dN > 0.999999) && (dotvv(P,node->N) <= dotvv(node->P,node->N))) {
@@ -506,6 +960,212 @@ void		CPointHierarchy::lookup(float *Cl,const float *Pl,const float *dPdul,const
 	}
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPointHierarchy
+// Method				:	lookupMicrobuffer
+// Description			:
+/// \brief					Lookup by rasterizing the clusters into a cube microbuffer
+// Return Value			:
+// Comments				:	P and N must be in the coordinate system of the hierarchy
+void		CPointHierarchy::lookupMicrobuffer(float *Cl,const float *P,const float *N,int res,float maxsolidangle,CShadingContext *context) {
+	const int		faceSize	=	res*res;
+	int				*stack		=	(int *) alloca(POINTHIERARCHY_STACK_SIZE*sizeof(int));
+	int				*stackBase	=	stack;
+	int				numCovered	=	0;
+	int				i;
+
+	// Compute the harmonics the first time they are needed
+	if (harmonics == NULL) {
+		osLock(mutex);
+		if (harmonics == NULL)	computeHarmonics();
+		osUnlock(mutex);
+	}
+
+	// Pairs with the barrier in computeHarmonics so we see the filled arrays
+	memoryBarrier();
+
+	memBegin(context->threadMemory);
+
+	// The depth and the color for every pixel on the 6 faces of the cube
+	float			*depth		=	(float *) ralloc(faceSize*6*4*sizeof(float),context->threadMemory);
+	float			*color		=	depth + faceSize*6;
+
+	for (i=0;i<faceSize*6;i++)		depth[i]	=	C_INFINITY;
+	for (i=0;i<faceSize*6*3;i++)	color[i]	=	0;
+
+	// Traverse the hierarchy front to back
+	*stack++	=	0;
+	while(stack > stackBase) {
+		const int	currentNode	=	*(--stack);
+		const float	*cP,*cN;
+		float		area,r;
+		vector		D,Dn,C;
+
+		if (currentNode < 0) {
+			const CPointCloudPoint	*item	=	CMap<CPointCloudPoint>::items - currentNode;
+			const float				*src	=	data.array + item->entryNumber;
+
+			cP		=	item->P;
+			cN		=	item->N;
+			subvv(D,cP,P);
+
+			// Are we behind the item?
+			if (dotvv(D,cN) >= 0)	continue;
+
+			const float	l	=	lengthv(D);
+
+			// Is the item hidden behind the clusters we already rasterized?
+			if (microbufferOccluded(depth,res,D,l,item->dP))	continue;
+
+			area	=	(areaIndex == -1) ? (float) C_PI*item->dP*item->dP : src[areaIndex];
+			area	*=	-dotvv(D,cN) / (l + C_EPSILON);
+			if (radiosityIndex != -1)	movvv(C,src + radiosityIndex);
+			else						initv(C,0);
+		} else {
+			const CMapNode	*node	=	nodes + currentNode;
+
+			cP		=	node->P;
+			cN		=	node->N;
+			subvv(D,cP,P);
+
+			const float	distSq	=	dotvv(D,D) + C_EPSILON;
+			const float	dParea	=	(float) C_PI*node->dP*node->dP;
+
+			// Is the entire cluster hidden behind the clusters we already rasterized?
+			if (microbufferOccluded(depth,res,D,sqrtf(distSq),bounds[currentNode]))	continue;
+
+			// Should we split this node?
+			if ((distSq <= node->dP*node->dP) || ((dParea / distSq) >= maxsolidangle)) {
+				const int	child0	=	node->child0;
+				const int	child1	=	node->child1;
+				const float	*P0		=	(child0 < 0) ? CMap<CPointCloudPoint>::items[-child0].P : nodes[child0].P;
+				const float	*P1		=	(child1 < 0) ? CMap<CPointCloudPoint>::items[-child1].P : nodes[child1].P;
+				vector		D0,D1;
+
+				assert((stack-stackBase) < (POINTHIERARCHY_STACK_SIZE-2));
+
+				// Push the farther child first so that the nearer one is processed first
+				subvv(D0,P0,P);
+				subvv(D1,P1,P);
+				if (dotvv(D0,D0) < dotvv(D1,D1)) {
+					*stack++	=	child1;
+					*stack++	=	child0;
+				} else {
+					*stack++	=	child0;
+					*stack++	=	child1;
+				}
+				continue;
+			}
+
+			// Evaluate the projected area and the emitted radiosity towards the lookup point
+			const float	*Y	=	harmonics + currentNode*36;
+			vector		E;
+
+			mulvf(E,D,-1 / sqrtf(distSq));
+			area	=	harmonicScalar(Y,E);
+			if (area <= 0)	continue;
+
+			if (radiosityIndex != -1) {
+				C[0]	=	max(harmonicScalar(Y+9,E),0) / area;
+				C[1]	=	max(harmonicScalar(Y+18,E),0) / area;
+				C[2]	=	max(harmonicScalar(Y+27,E),0) / area;
+			} else {
+				initv(C,0);
+			}
+		}
+
+		if (area <= 0)	continue;
+
+		// The radius of the sphere that subtends the same solid angle as the projected area
+		r		=	sqrtf(area / (float) C_PI);
+
+		const float	l		=	lengthv(D);
+		const float	cosA	=	(r >= l) ? -1 : sqrtf(1 - (r*r) / (l*l));
+		mulvf(Dn,D,1 / (l + C_EPSILON));
+
+		// Is the cluster below the horizon?
+		if (dotvv(Dn,N) < -(r / (l + C_EPSILON)))	continue;
+
+		// Rasterize the cluster into every face it touches
+		int	face;
+		for (face=0;face<6;face++) {
+			int		rect[4];
+
+			if (microbufferRect(rect,face,res,D,l,r) == FALSE)	continue;
+
+			float	*fDepth	=	depth + face*faceSize;
+			float	*fColor	=	color + face*faceSize*3;
+			int		x,y;
+
+			for (y=rect[2];y<=rect[3];y++) {
+				for (x=rect[0];x<=rect[1];x++) {
+					vector	dir;
+
+					microbufferDir(dir,face,res,x,y);
+
+					if (dotvv(dir,Dn) < cosA)		continue;
+					if (dotvv(dir,N) <= 0)			continue;
+
+					numCovered++;
+					if (l < fDepth[y*res+x]) {
+						fDepth[y*res+x]	=	l;
+						movvv(fColor + (y*res+x)*3,C);
+					}
+				}
+			}
+		}
+
+		// If the cluster is smaller than a pixel, splat it into the pixel that contains its center
+		if (numCovered == 0) {
+			int		a	=	0;
+
+			if (fabsf(Dn[1]) > fabsf(Dn[a]))	a	=	1;
+			if (fabsf(Dn[2]) > fabsf(Dn[a]))	a	=	2;
+
+			const int	face	=	a*2 + ((Dn[a] < 0) ? 1 : 0);
+			const float	s		=	1 / fabsf(Dn[a]);
+			const int	x		=	min(max((int) floorf((Dn[(a+1)%3]*s+1)*0.5f*res),0),res-1);
+			const int	y		=	min(max((int) floorf((Dn[(a+2)%3]*s+1)*0.5f*res),0),res-1);
+			const int	pixel	=	face*faceSize + y*res + x;
+
+			if (l < depth[pixel]) {
+				depth[pixel]	=	l;
+				movvv(color + pixel*3,C);
+			}
+		}
+		numCovered	=	0;
+	}
+
+	// Integrate the microbuffer over the hemisphere
+	int	face;
+	for (face=0;face<6;face++) {
+		const float	*fDepth	=	depth + face*faceSize;
+		const float	*fColor	=	color + face*faceSize*3;
+		int			x,y;
+
+		for (y=0;y<res;y++) {
+			for (x=0;x<res;x++,fDepth++,fColor+=3) {
+				vector	dir;
+
+				if (*fDepth == C_INFINITY)	continue;
+
+				const float	dw		=	microbufferDir(dir,face,res,x,y);
+				const float	cosT	=	dotvv(dir,N);
+
+				if (cosT <= 0)	continue;
+
+				const float	w		=	cosT*dw*(float) (1 / C_PI);
+				Cl[0]	+=	w*fColor[0];
+				Cl[1]	+=	w*fColor[1];
+				Cl[2]	+=	w*fColor[2];
+				Cl[3]	+=	w;
+			}
+		}
+	}
+
+	memEnd(context->threadMemory);
+}
+
 
 void RiPtFilter() {
 
@@ -58,9 +58,43 @@ class	CPointHierarchy : public CTexture3d, public CMap<CPointCloudPoint> {
 		int			child0,child1;		// The children indices (>=0 if internal nodes < if leaf)
 	};
 
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CClusterJob
+	// Description			:
+/// \brief					A subtree that is clustered by a worker thread
+	// Comments				:
+	class	CClusterJob {
+	public:
+		int					numItems;			// The number of items in the subtree
+		int					*indices;			// The item indices
+		int					parent,which;		// The node and the child slot that points to this subtree
+		CArray<CMapNode>	*nodes;				// The nodes of the subtree
+	};
+
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CClusterState
+	// Description			:
+/// \brief					The state of a hierarchy construction
+	// Comments				:
+	class	CClusterState {
+	public:
+		CArray<CMapNode>		*nodes;			// Where we create the nodes
+		CArray<CClusterJob *>	*jobs;			// The deferred subtrees (NULL if we're not deferring)
+		int						jobDepth;		// The depth at which we defer the subtrees
+		int						nextJob;		// The next job to be picked up by a thread
+		TMutex					mutex;			// Protects nextJob
+		CPointHierarchy			*hierarchy;		// The hierarchy being built
+		unsigned int			seed;			// The random number state
+
+		float					urand() {
+									seed	=	seed*1664525 + 1013904223;
+									return (seed >> 8) * (1.0f / 16777216.0f);
+								}
+	};
+
 
 public:
-							CPointHierarchy(const char *,const float *from,const float *to,FILE *);
+							CPointHierarchy(const char *,const float *from,const float *to,FILE *,const char *);
 							~CPointHierarchy();
 
 	void					lookup(float *,const float *,const float *,const float *,const float *,CShadingContext *);
@@ -68,15 +102,31 @@ public:
 	void					lookup(float *,const float *,const float *,float)		{	assert(FALSE);	}
 
 protected:
-	CArray<CMapNode>		nodes;					// This is where we keep the internal nodes
+	CMapNode				*nodes;					// This is where we keep the internal nodes
+	int						numNodes;				// The number of internal nodes
+	void					*nodeMap;				// The mapped cache file the nodes live in (NULL if we built them)
+	size_t					nodeMapSize;			// The size of the mapped cache file
 	CArray<float>			data;					// This is where we actually keep the data
 	int						areaIndex;				// Index of the area variable
 	int						radiosityIndex;			// Index of the radiosity variable
+	float * volatile		harmonics;				// Spherical harmonics of the area/radiosity of every node (NULL until a microbuffer lookup needs them)
+	float					*bounds;				// The radius of the sphere that bounds every node
+	TMutex					mutex;					// Protects the computation of the harmonics
 
 							// Functions used to construct the hierarchy
 	void					computeHierarchy();
-	int						average(int numItems,int *indices);
-	int						cluster(int numItems,int *indices);
+	int						average(int numItems,int *indices,CClusterState *);
+	int						cluster(int numItems,int *indices,CClusterState *,int depth);
+	static	TFunPrefix		clusterThread(void *);
+
+							// Functions used to cache the hierarchy on disk
+	unsigned int			checksum() const;
+	int						readCache(const char *,int64_t,unsigned int);
+	void					writeCache(const char *,int64_t,unsigned int);
+	void					computeHarmonics();
+
+							// Lookup by rasterizing the clusters into a microbuffer
+	void					lookupMicrobuffer(float *,const float *,const float *,int,float,CShadingContext *);
 
 							// CView interface
 	void					draw() { }
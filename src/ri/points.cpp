@@ -36,6 +36,8 @@
 #include "stats.h"
 #include "renderer.h"
 #include "rendererContext.h"
+#include "atomic.h"
+#include "ri_config.h"
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -50,13 +52,17 @@ CPoints::CPoints(CAttributes *a,CXform *x,CPl *pl,int np) : CSurface(a,x) {
 
 	atomicIncrement(&stats.numGprims);
 
+	flags						|=	OBJECT_EXPAND_INSTANCE;		// We shade the rays ourselves
+
 	this->numPoints				=	np;
 	this->pl					=	pl;
 	this->points				=	NULL;
+	this->nodes					=	NULL;
+	this->indices				=	NULL;
 
 	// Find the maximum size we'll have
 	const float	expansion		=	(float) pow((double) fabs(determinantm(xform->from)),1.0 / 3.0);
-	float		maxSize			=	0;
+	float		maxSize			=	-C_INFINITY;
 
 	// Compute the maximum point size (for bounding volume computation)
 	for (i=0;i<pl->numParameters;i++) {
@@ -127,6 +133,8 @@ CPoints::CPoints(CAttributes *a,CXform *x,CPl *pl,int np) : CSurface(a,x) {
 	base				=	new CPointBase;
 	base->attach();
 	base->maxSize		=	maxSize;
+	base->widthOffset	=	-1;
+	base->constantWidth	=	1;
 	base->variables		=	pl->vertexData();
 	base->variables->attach();
 
@@ -154,6 +162,8 @@ CPoints::CPoints(CAttributes *a,CXform *x,CPointBase *b,int np,const float **pi)
 
 	numPoints				=	np;
 	points					=	new const float*[numPoints];
+	nodes					=	NULL;
+	indices					=	NULL;
 
 	initv(bmin,C_INFINITY,C_INFINITY,C_INFINITY);
 	initv(bmax,-C_INFINITY,-C_INFINITY,-C_INFINITY);
@@ -184,6 +194,9 @@ CPoints::~CPoints() {
 	if (points != NULL) {
 		delete [] points;
 	}
+
+	if (nodes != NULL)		delete [] nodes;
+	if (indices != NULL)	delete [] indices;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -306,6 +319,174 @@ void	CPoints::dice(CShadingContext *rasterizer)	{
 }
 
 
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPoints
+// Method				:	intersect
+// Description			:
+/// \brief					Intersect a ray with the points
+// Return Value			:	-
+// Comments				:	Every point is a disc facing the ray (or a sphere if
+//							the points are round) whose diameter is the width
+void	CPoints::intersect(CShadingContext *context,CRay *cRay) {
+
+	if (! (cRay->flags & attributes->flags) )	return;
+
+	if (attributes->flags & ATTRIBUTES_FLAGS_LOD) {
+		const float importance = attributes->lodImportance;
+		if (importance >= 0) {
+			if (cRay->jimp > importance)			return;
+		} else {
+			if ((1-cRay->jimp) >= -importance)		return;
+		}
+	}
+
+	if (pl != NULL)		prep();
+	if (nodes == NULL)	build();
+	memoryBarrier();
+
+	const CVertexData	*variables	=	base->variables;
+	const int			vertexSize	=	variables->vertexSize;
+	const int			moving		=	variables->moving;
+	const int			round		=	(attributes->flags & ATTRIBUTES_FLAGS_ROUND_POINTS) != 0;
+	const float			time		=	cRay->time;
+	int					stack[POINTS_BVH_STACK_SIZE];
+	float				stackT[POINTS_BVH_STACK_SIZE];
+	int					stackSize	=	0;
+	int					i;
+
+	stackT[stackSize]	=	nearestBox(nodes[0].bmin,nodes[0].bmax,cRay->from,cRay->invDir,cRay->tmin,cRay->t);
+	stack[stackSize++]	=	0;
+
+	while (stackSize > 0) {
+		stackSize--;
+
+		// The ray may have been shortened since we pushed this node
+		if (!(stackT[stackSize] < cRay->t))	continue;
+
+		const CPointNode	*cNode	=	nodes + stack[stackSize];
+
+		if (cNode->numPoints > 0) {
+			const int	*cIndex	=	indices + cNode->child;
+
+			for (i=cNode->numPoints;i>0;i--) {
+				const int	index	=	*cIndex++;
+				const float	*v0		=	points[index];
+				vector		P,D;
+				float		r;
+
+				// Find the point at the ray time
+				if (moving) {
+					const float	*v1	=	v0 + vertexSize;
+
+					interpolatev(P,v0,v1,time);
+					r	=	base->radius(v0)*(1-time) + base->radius(v1)*time;
+				} else {
+					movvv(P,v0);
+					r	=	base->radius(v0);
+				}
+
+				// The distance between the ray and the point
+				subvv(D,P,cRay->from);
+				const float	z	=	dotvv(D,cRay->dir);
+				const float	d2	=	dotvv(D,D) - z*z;
+
+				if (d2 >= r*r)	continue;
+
+				// Spheres are hit in the front (or in the back if the ray starts inside), discs face the ray
+				float	t	=	z;
+				if (round) {
+					const float	s	=	sqrtf(r*r - d2);
+
+					t	=	z - s;
+					if (t <= cRay->tmin)	t	=	z + s;
+				}
+
+				if ((t <= cRay->tmin) || (t >= cRay->t))	continue;
+
+				cRay->object	=	this;
+				cRay->t			=	t;
+				cRay->u			=	(float) (index & 0xFFFF);		// Save the point index exactly, shade() needs it
+				cRay->v			=	(float) (index >> 16);
+
+				if (round) {
+					mulvf(cRay->N,cRay->dir,t);
+					addvv(cRay->N,cRay->from);
+					subvv(cRay->N,P);
+				} else {
+					mulvf(cRay->N,cRay->dir,-1);
+				}
+			}
+		} else {
+			// Visit the nearer child first
+			const CPointNode	*c0	=	nodes + cNode->child;
+			const CPointNode	*c1	=	c0 + 1;
+			const float			t0	=	nearestBox(c0->bmin,c0->bmax,cRay->from,cRay->invDir,cRay->tmin,cRay->t);
+			const float			t1	=	nearestBox(c1->bmin,c1->bmax,cRay->from,cRay->invDir,cRay->tmin,cRay->t);
+
+			assert((stackSize+2) <= POINTS_BVH_STACK_SIZE);
+
+			if (t0 < t1) {
+				if (t1 < cRay->t)	{	stackT[stackSize]	=	t1;	stack[stackSize++]	=	cNode->child+1;	}
+				if (t0 < cRay->t)	{	stackT[stackSize]	=	t0;	stack[stackSize++]	=	cNode->child;	}
+			} else {
+				if (t0 < cRay->t)	{	stackT[stackSize]	=	t0;	stack[stackSize++]	=	cNode->child;	}
+				if (t1 < cRay->t)	{	stackT[stackSize]	=	t1;	stack[stackSize++]	=	cNode->child+1;	}
+			}
+		}
+	}
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPoints
+// Method				:	shade
+// Description			:
+/// \brief					Shade the points hit by rays
+// Return Value			:	-
+// Comments				:	We create a temporary points primitive that holds the
+//							hit points so that sample() can be used as is
+void	CPoints::shade(CShadingContext *context,int numRays,CRay **rays) {
+	float	**varying	=	context->currentShadingState->varying;
+	float	*u			=	varying[VARIABLE_U];
+	float	*v			=	varying[VARIABLE_V];
+	float	*time		=	varying[VARIABLE_TIME];
+	float	*I			=	varying[VARIABLE_I];
+	float	*N			=	varying[VARIABLE_NG];
+	float	*du			=	varying[VARIABLE_DU];
+	int		i;
+
+	memBegin(context->threadMemory);
+
+	const float	**hits	=	(const float **) ralloc(numRays*sizeof(float *),context->threadMemory);
+
+	for (i=0;i<numRays;i++) {
+		const CRay	*cRay	=	rays[i];
+
+		hits[i]		=	points[(int) cRay->u + ((int) cRay->v << 16)];
+
+		*u++		=	0;
+		*v++		=	0;
+		*time++		=	cRay->time;
+		*du++		=	cRay->da*cRay->t + cRay->db;
+		mulvf(I,cRay->dir,cRay->t);
+		movvv(N,cRay->N);
+		I			+=	3;
+		N			+=	3;
+	}
+
+	CPoints	*hit	=	new CPoints(attributes,xform,base,numRays,hits);
+	hit->attach();
+
+	context->shade(hit,numRays,1,SHADING_0D,0);
+
+	hit->detach();
+
+	memEnd(context->threadMemory);
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPoints
 // Method				:	dispatch
@@ -328,6 +509,17 @@ void	CPoints::sample(int start,int numVertices,float **varying,float ***locals,u
 			memcpy(vertexData,cP,vertexSize*sizeof(float));
 			vertexData			+=	vertexSize;
 		}
+	} else if ((variables->moving) && !(usedParameters & PARAMETER_BEGIN_SAMPLE)) {
+		// Raytraced points are sampled at the ray time
+		const float	*time	=	varying[VARIABLE_TIME];
+
+		for (int i=0;i<numPoints;++i) {
+			const float	*cP0	=	points[i];
+			const float	*cP1	=	cP0 + vertexSize;
+			const float	ctime	=	time[i];
+
+			for (int j=0;j<vertexSize;++j)	*vertexData++	=	cP0[j]*(1-ctime) + cP1[j]*ctime;
+		}
 	} else {
 		for (int i=0;i<numPoints;++i) {
 			const float	*cP		=	points[i];
@@ -336,8 +528,8 @@ void	CPoints::sample(int start,int numVertices,float **varying,float ***locals,u
 		}
 	}
 
-	// Compute the normal vector
-	if (usedParameters & PARAMETER_NG) {
+	// Compute the normal vector (shade() sets it for raytraced points)
+	if ((usedParameters & PARAMETER_NG) && (usedParameters & (PARAMETER_BEGIN_SAMPLE | PARAMETER_END_SAMPLE))) {
 		float	*N	=	varying[VARIABLE_NG];
 
 		for (int i=numPoints;i>0;--i,N+=3)	initv(N,0,0,-1);
@@ -352,10 +544,11 @@ void	CPoints::sample(int start,int numVertices,float **varying,float ***locals,u
 			for (int i=0;i<numPoints;++i) {
 				subvv(dest,points[i]+vertexSize,points[i]);
 				mulvf(dest,CRenderer::invShutterTime);
+				dest	+=	3;
 			}
 		} else {
 			// We have no motion, so dPdtime is {0,0,0}
-			for (int i=0;i<numPoints;++i)	initv(dest,0,0,0);
+			for (int i=0;i<numPoints;++i,dest+=3)	initv(dest,0,0,0);
 		}
 	}
 
@@ -411,12 +604,15 @@ void	CPoints::prep() {
 	assert(base != NULL);
 
 	osLock(base->mutex);
-	if (children != NULL) {
+
+	// Another thread may have prepped us while we were waiting
+	if (pl == NULL) {
 		osUnlock(base->mutex);
 		return;
 	}
 
-	int					i;
+	int					i,j;
+	int					offset;
 	const CVertexData	*variables;
 	variables					=	base->variables;
 
@@ -424,31 +620,34 @@ void	CPoints::prep() {
 
 	pl->transform(xform);
 
-	// Transform the size variable
+	// Transform the size variable and remember where it is for the raytracer
 	const float	expansion		=	(float) pow((double) fabs(determinantm(xform->from)),1.0 / 3.0);
-	for (i=0;i<pl->numParameters;i++) {
+	for (offset=0,i=0;i<pl->numParameters;i++) {
 		const CVariable	*cVar	=	pl->parameters[i].variable;
 
 		if (cVar->entry == VARIABLE_WIDTH) {
 			float		*vertex	=	pl->data0 + pl->parameters[i].index;
 			
-			for (i=0;i<numPoints;i++) {
-				vertex[i]		*=	expansion;
+			for (j=0;j<numPoints;j++) {
+				vertex[j]		*=	expansion;
 			}
 
 			if (pl->data1 != NULL) {
 				vertex	=	pl->data1 + pl->parameters[i].index;
 
-				for (i=0;i<numPoints;i++) {
-					vertex[i]		*=	expansion;
+				for (j=0;j<numPoints;j++) {
+					vertex[j]		*=	expansion;
 				}
 			}
 
+			if (pl->parameters[i].container == CONTAINER_VERTEX)	base->widthOffset	=	offset;
+
 			break;
 		} else if (cVar->entry == VARIABLE_CONSTANTWIDTH) {
 			float		*vertex	=	pl->data0 + pl->parameters[i].index;
 			
 			vertex[0]			*=	expansion;
+			base->constantWidth	=	vertex[0];
 
 			if (pl->data1 != NULL) {
 				vertex	=	pl->data1 + pl->parameters[i].index;
@@ -458,6 +657,8 @@ void	CPoints::prep() {
 
 			break;
 		}
+
+		if (pl->parameters[i].container == CONTAINER_VERTEX)	offset	+=	cVar->numFloats;
 	}
 
 	base->vertex				=	new float[vertexSize*numPoints];
@@ -484,3 +685,159 @@ void	CPoints::prep() {
 	osUnlock(base->mutex);
 }
 
+
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	pointsSelect
+// Description			:
+/// \brief					Partially sort the point indices so that the k'th one is in place
+// Return Value			:	-
+// Comments				:	centers holds the center of every point, we sort along axis
+static	void	pointsSelect(int *indices,const float *centers,int axis,int num,int k) {
+	int	left	=	0;
+	int	right	=	num-1;
+
+	while (right > left) {
+		const float	pivot	=	centers[indices[(left + right) >> 1]*3 + axis];
+		int			i		=	left;
+		int			j		=	right;
+
+		while (i <= j) {
+			while (centers[indices[i]*3 + axis] < pivot)	i++;
+			while (centers[indices[j]*3 + axis] > pivot)	j--;
+
+			if (i <= j) {
+				const int	tmp	=	indices[i];
+				indices[i]		=	indices[j];
+				indices[j]		=	tmp;
+				i++;
+				j--;
+			}
+		}
+
+		if (k <= j)			right	=	j;
+		else if (k >= i)	left	=	i;
+		else				break;
+	}
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPoints
+// Method				:	build
+// Description			:
+/// \brief					Build the raytracing hierarchy
+// Return Value			:	-
+// Comments				:	Thread safe
+void	CPoints::build() {
+
+	osLock(base->mutex);
+
+	// Another thread may have built the hierarchy while we were waiting
+	if (nodes != NULL) {
+		osUnlock(base->mutex);
+		return;
+	}
+
+	const CVertexData	*variables	=	base->variables;
+	const int			vertexSize	=	variables->vertexSize;
+	float				*bounds		=	new float[numPoints*9];
+	float				*centers	=	bounds + numPoints*6;
+	int					i;
+
+	// Find the bound of every point over the shutter
+	for (i=0;i<numPoints;i++) {
+		const float	*v0		=	points[i];
+		float		*bmin	=	bounds + i*6;
+		float		*bmax	=	bmin + 3;
+		float		r		=	base->radius(v0);
+
+		subvf(bmin,v0,r);
+		addvf(bmax,v0,r);
+
+		if (variables->moving) {
+			const float	*v1	=	v0 + vertexSize;
+			vector		tmp;
+
+			r	=	base->radius(v1);
+			subvf(tmp,v1,r);	addBox(bmin,bmax,tmp);
+			addvf(tmp,v1,r);	addBox(bmin,bmax,tmp);
+		}
+
+		addvv(centers + i*3,bmin,bmax);
+		mulvf(centers + i*3,0.5f);
+	}
+
+	// Every leaf holds at least half of the leaf size, so this is plenty
+	const int	maxNodes	=	2*(numPoints / ((POINTS_BVH_LEAF_SIZE+1) >> 1)) + 1;
+	int			numNodes	=	1;
+
+	indices	=	new int[numPoints];
+	for (i=0;i<numPoints;i++)	indices[i]	=	i;
+
+	// Build into a temporary array so that nodes != NULL means we're ready
+	CPointNode	*newNodes	=	new CPointNode[maxNodes];
+	build(newNodes,0,0,numPoints,bounds,numNodes);
+	assert(numNodes <= maxNodes);
+
+	delete [] bounds;
+
+	// The readers don't lock, so the nodes and the indices must be complete before we link them
+	memoryBarrier();
+	nodes	=	newNodes;
+
+	osUnlock(base->mutex);
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CPoints
+// Method				:	build
+// Description			:
+/// \brief					Build a node of the raytracing hierarchy
+// Return Value			:	-
+// Comments				:	bounds holds the bound of every point followed by the centers
+void	CPoints::build(CPointNode *newNodes,int node,int first,int num,const float *bounds,int &numNodes) {
+	CPointNode	*cNode		=	newNodes + node;
+	const float	*centers	=	bounds + numPoints*6;
+	int			i;
+
+	// Compute the bound of the node
+	initv(cNode->bmin,C_INFINITY,C_INFINITY,C_INFINITY);
+	initv(cNode->bmax,-C_INFINITY,-C_INFINITY,-C_INFINITY);
+	for (i=0;i<num;i++) {
+		const float	*cBound	=	bounds + indices[first+i]*6;
+
+		addBox(cNode->bmin,cNode->bmax,cBound);
+		addBox(cNode->bmin,cNode->bmax,cBound+3);
+	}
+
+	if (num <= POINTS_BVH_LEAF_SIZE) {
+		cNode->child		=	first;
+		cNode->numPoints	=	num;
+		return;
+	}
+
+	// Split at the median along the longest axis
+	vector	D;
+	int		axis;
+	subvv(D,cNode->bmax,cNode->bmin);
+	if ((D[0] > D[1]) && (D[0] > D[2]))	axis	=	0;
+	else if (D[1] > D[2])				axis	=	1;
+	else								axis	=	2;
+
+	const int	half	=	num >> 1;
+	pointsSelect(indices + first,centers,axis,num,half);
+
+	const int	child	=	numNodes;
+	numNodes			+=	2;
+
+	cNode->child		=	child;
+	cNode->numPoints	=	0;
+
+	build(newNodes,child,first,half,bounds,numNodes);
+	build(newNodes,child+1,first+half,num-half,bounds,numNodes);
+}
+
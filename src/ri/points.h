@@ -60,7 +60,24 @@ class	CPoints : public CSurface {
 			CParameter		*parameters;			// The parameters for the points
 			CVertexData		*variables;				// The vertex data
 			float			maxSize;				// The maximum size of the point in camera space
+			int				widthOffset;			// The offset of the width in the vertex data (-1 if not varying)
+			float			constantWidth;			// The width of every point if there's no varying width
 			TMutex			mutex;					// Holds the synchronization object
+
+							// Return the radius of a point in camera space
+			inline float	radius(const float *v) const	{	return (widthOffset >= 0 ? v[widthOffset] : constantWidth)*0.5f;	}
+		};
+
+		///////////////////////////////////////////////////////////////////////
+		// Class				:	CPointNode
+		// Description			:
+/// \brief					A node in the point raytracing hierarchy
+		// Comments				:	For leaves, child is the first entry in the index array
+		class CPointNode {
+		public:
+			vector			bmin,bmax;				// The bounding box of the node
+			int				child;					// The index of the first child (or the first point)
+			int				numPoints;				// The number of points in a leaf (0 for internal nodes)
 		};
 public:
 						CPoints(CAttributes *,CXform *,CPl *,int);
@@ -68,7 +85,8 @@ public:
 						~CPoints();
 
 						// Object interface
-		void			intersect(CShadingContext *,CRay *)	{	}
+		void			intersect(CShadingContext *,CRay *);
+		void			shade(CShadingContext *,int,CRay **);
 		void			dice(CShadingContext *);
 		void			instantiate(CAttributes *,CXform *,CRendererContext *) const;
 
@@ -80,6 +98,8 @@ public:
 
 private:
 		void			prep();
+		void			build();
+		void			build(CPointNode *,int,int,int,const float *,int &);
 
 		int				numPoints;				// The number of points
 		CPl				*pl;					// The parameter list
@@ -89,6 +109,9 @@ private:
 		const float		**points;				// Entry points to points
 
 		CPointBase		*base;					// The point base
+
+		CPointNode		* volatile nodes;		// The raytracing hierarchy (built on demand)
+		int				*indices;				// The points referenced by the leaves of the hierarchy
 };
 
 #endif
@@ -33,6 +33,7 @@
 #include "polygons.h"
 #include "object.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "shading.h"
 #include "error.h"
@@ -139,17 +140,23 @@ CPolygonTriangle::CPolygonTriangle(CAttributes *a,CXform *x,CPolygonMesh *mesh,i
 	addBox(bmin,bmax,v2);
 
 	if ((vertices=pl->data1) != NULL) {
+		vector	bmin1,bmax1;
+
+		// Bound the shutter close separately so that the rays can interpolate the bound
 		vertices	=	pl->data1;
 		v0			=	vertices + this->v0*3;
 		v1			=	vertices + this->v1*3;
 		v2			=	vertices + this->v2*3;
 
-		addBox(bmin,bmax,v0);
-		addBox(bmin,bmax,v1);
-		addBox(bmin,bmax,v2);
-	}
+		movvv(bmin1,v0);
+		movvv(bmax1,v0);
+		addBox(bmin1,bmax1,v1);
+		addBox(bmin1,bmax1,v2);
 
-	makeBound(bmin,bmax);
+		makeMotionBound(bmin,bmax,bmin1,bmax1);
+	} else {
+		makeBound(bmin,bmax);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -189,7 +196,7 @@ void		CPolygonTriangle::intersect(CShadingContext *context,CRay *cRay) {
 	if ((attributes->displacement != NULL) && (attributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS) || FORCE_TESSELATED_TRACE) {
 		// Do we have a grid ?
 		if (children == NULL) {
-			osLock(CRenderer::tesselateMutex);
+			profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");
 	
 			if (children == NULL) {
 				CTesselationPatch	*tesselation	=	new CTesselationPatch(attributes,xform,this,0,1,0,1,0,0,-1);
@@ -719,15 +726,21 @@ CPolygonQuad::CPolygonQuad(CAttributes *a,CXform *x,CPolygonMesh *mesh,int iv0,i
 	addBox(bmin,bmax,vertices + this->v3*3);
 
 	if ((vertices=pl->data1) != NULL) {
+		vector	bmin1,bmax1;
+
+		// Bound the shutter close separately so that the rays can interpolate the bound
 		vertices	=	pl->data1;
 
-		addBox(bmin,bmax,vertices + this->v0*3);
-		addBox(bmin,bmax,vertices + this->v1*3);
-		addBox(bmin,bmax,vertices + this->v2*3);
-		addBox(bmin,bmax,vertices + this->v3*3);
-	}
+		movvv(bmin1,vertices + this->v0*3);
+		movvv(bmax1,vertices + this->v0*3);
+		addBox(bmin1,bmax1,vertices + this->v1*3);
+		addBox(bmin1,bmax1,vertices + this->v2*3);
+		addBox(bmin1,bmax1,vertices + this->v3*3);
 
-	makeBound(bmin,bmax);
+		makeMotionBound(bmin,bmax,bmin1,bmax1);
+	} else {
+		makeBound(bmin,bmax);
+	}
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -767,7 +780,7 @@ void		CPolygonQuad::intersect(CShadingContext *context,CRay *cRay) {
 	if ((attributes->displacement != NULL) && (attributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS) || FORCE_TESSELATED_TRACE) {
 		// Do we have a grid ?
 		if (children == NULL) {
-			osLock(CRenderer::tesselateMutex);
+			profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");
 	
 			if (children == NULL) {
 				CTesselationPatch	*tesselation	=	new CTesselationPatch(attributes,xform,this,0,1,0,1,0,0,-1);
@@ -1334,15 +1347,24 @@ CPolygonMesh::CPolygonMesh(CAttributes *a,CXform *x,CPl *pl,int npoly,int *nhole
 		addBox(bmin,bmax,P);
 	}
 
+	xform->transformBound(bmin,bmax);
+
 	if (pl->data1 != NULL) {
+		vector	bmin1,bmax1;
+
+		// Keep the shutter close bound separate
+		initv(bmin1,C_INFINITY,C_INFINITY,C_INFINITY);
+		initv(bmax1,-C_INFINITY,-C_INFINITY,-C_INFINITY);
 		P					=	pl->data1;
 		for (i=mVertex;i>0;i--,P+=3) {
-			addBox(bmin,bmax,P);
+			addBox(bmin1,bmax1,P);
 		}
-	}
 
-	xform->transformBound(bmin,bmax);
-	makeBound(bmin,bmax);
+		xform->transformBound(bmin1,bmax1);
+		makeMotionBound(bmin,bmax,bmin1,bmax1);
+	} else {
+		makeBound(bmin,bmax);
+	}
 
 	children			=	NULL;
 
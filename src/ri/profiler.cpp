@@ -0,0 +1,131 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	profiler.cpp
+//  Classes				:	-
+//  Description			:	The timeline profiler
+//
+////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <string.h>
+
+#include "profiler.h"
+#include "error.h"
+
+// The per thread event rings
+TProfilerThread			**profilerThreads		=	NULL;
+
+// The file to write into
+static	char			*profilerFile			=	NULL;
+static	int				profilerNumThreads		=	0;
+
+// The names of the categories in the output
+static	const char		*profilerCategories[PROFILER_NUM_CATEGORIES]	=	{	"bucket",
+																			"dice",
+																			"shade",
+																			"trace",
+																			"texture",
+																			"procedural",
+																			"display",
+																			"wait"	};
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	profilerBegin
+// Description			:
+/// \brief					Start recording the events of a frame
+// Return Value			:
+// Comments				:	Called before the threads are started
+void	profilerBegin(const char *fileName,int numThreads) {
+	int	i;
+
+	assert(profilerThreads == NULL);
+
+	profilerFile		=	strdup(fileName);
+	profilerNumThreads	=	numThreads;
+	profilerThreads		=	new TProfilerThread*[numThreads];
+	for (i=0;i<numThreads;i++) {
+		profilerThreads[i]				=	new TProfilerThread;
+		profilerThreads[i]->events		=	new TProfilerEvent[PROFILER_BUFFER_SIZE];
+		profilerThreads[i]->numEvents	=	0;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	profilerEnd
+// Description			:
+/// \brief					Write the recorded events into the trace file
+// Return Value			:
+// Comments				:	Called after the threads are done
+void	profilerEnd(int frame) {
+	FILE	*out;
+	int		i,j;
+
+	if (profilerThreads == NULL)	return;
+
+	if ((out = fopen(profilerFile,"w")) == NULL) {
+		error(CODE_BADFILE,"Failed to open \"%s\" for writing\n",profilerFile);
+	} else {
+		int	numDropped	=	0;
+
+		fprintf(out,"{\"traceEvents\":[\n");
+		fprintf(out,"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,\"args\":{\"name\":\"frame %d\"}}",frame,frame);
+
+		for (i=0;i<profilerNumThreads;i++) {
+			TProfilerThread	*cThread	=	profilerThreads[i];
+			const int		first		=	max(cThread->numEvents - PROFILER_BUFFER_SIZE,0);
+
+			fprintf(out,",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",frame,i,i);
+
+			// The oldest events have been overwritten
+			numDropped	+=	first;
+
+			for (j=first;j<cThread->numEvents;j++) {
+				const TProfilerEvent	*cEvent	=	cThread->events + (j & (PROFILER_BUFFER_SIZE-1));
+
+				fprintf(out,",\n{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d",
+					cEvent->name,profilerCategories[cEvent->category],cEvent->start,cEvent->end - cEvent->start,frame,i);
+
+				if (cEvent->arg0 >= 0)	fprintf(out,",\"args\":{\"x\":%d,\"y\":%d}}",cEvent->arg0,cEvent->arg1);
+				else					fprintf(out,"}");
+			}
+		}
+
+		fprintf(out,"\n],\n\"displayTimeUnit\":\"ms\",\n\"otherData\":{\"droppedEvents\":%d}}\n",numDropped);
+		fclose(out);
+	}
+
+	// Ditch the rings
+	for (i=0;i<profilerNumThreads;i++) {
+		delete [] profilerThreads[i]->events;
+		delete profilerThreads[i];
+	}
+	delete [] profilerThreads;
+	free(profilerFile);
+
+	profilerThreads		=	NULL;
+	profilerFile		=	NULL;
+	profilerNumThreads	=	0;
+}
+
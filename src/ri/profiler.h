@@ -0,0 +1,147 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	profiler.h
+//  Classes				:	CProfilerSpan
+//  Description			:	The timeline profiler
+//
+////////////////////////////////////////////////////////////////////////
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "common/global.h"
+#include "common/os.h"
+#include "ri_config.h"
+
+///////////////////////////////////////////////////////////////////////
+// The event categories
+typedef enum {
+	PROFILER_BUCKET,						// Rendering a bucket
+	PROFILER_DICE,							// Splitting / dicing a primitive
+	PROFILER_SHADE,							// Shading a grid
+	PROFILER_TRACE,							// Raytracing a bundle of rays
+	PROFILER_TEXTURE,						// Reading a texture block from disk
+	PROFILER_PROCEDURAL,					// Expanding a procedural primitive
+	PROFILER_DISPLAY,						// Sending pixels to the display drivers
+	PROFILER_WAIT,							// Waiting for a lock
+	PROFILER_NUM_CATEGORIES
+} EProfilerCategory;
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	TProfilerEvent
+// Description			:	Holds a completed span
+// Comments				:
+typedef struct {
+	double				start;				// The start time (in microseconds)
+	double				end;				// The end time (in microseconds)
+	const char			*name;				// The name of the span (must be a static string)
+	int					category;			// One of EProfilerCategory
+	int					arg0,arg1;			// Optional arguments (-1 if not used)
+} TProfilerEvent;
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	TProfilerThread
+// Description			:	The event ring of a thread
+// Comments				:	Only the owner thread writes into the ring, so there's no locking
+typedef struct {
+	TProfilerEvent		*events;			// PROFILER_BUFFER_SIZE events
+	int					numEvents;			// The number of events recorded so far (the ring keeps the last ones)
+} TProfilerThread;
+
+// The per thread event rings (NULL if profiling is off)
+extern	TProfilerThread	**profilerThreads;
+
+void					profilerBegin(const char *fileName,int numThreads);
+void					profilerEnd(int frame);
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	profilerRecord
+// Description			:
+/// \brief					Record a finished span
+// Return Value			:
+// Comments				:	The profiler must be active
+inline	void			profilerRecord(int thread,int category,const char *name,double start,double end,int arg0 = -1,int arg1 = -1) {
+	TProfilerThread	*cThread	=	profilerThreads[thread];
+	TProfilerEvent	*cEvent		=	cThread->events + (cThread->numEvents & (PROFILER_BUFFER_SIZE-1));
+
+	cEvent->start		=	start;
+	cEvent->end			=	end;
+	cEvent->name		=	name;
+	cEvent->category	=	category;
+	cEvent->arg0		=	arg0;
+	cEvent->arg1		=	arg1;
+	cThread->numEvents++;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	profilerLock
+// Description			:
+/// \brief					Lock a mutex, recording the time we had to wait for it
+// Return Value			:
+// Comments				:	Uncontended locks are not recorded
+inline	void			profilerLock(TMutex &mutex,int thread,const char *name) {
+	if (profilerThreads == NULL) {
+		osLock(mutex);
+	} else if (osTryLock(mutex) == FALSE) {
+		const double	start	=	osClock();
+
+		osLock(mutex);
+		profilerRecord(thread,PROFILER_WAIT,name,start,osClock());
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CProfilerSpan
+// Description			:	Records the lifetime of the object as a span
+// Comments				:	This costs a single compare if the profiler is off
+class	CProfilerSpan {
+public:
+						CProfilerSpan(int thread,EProfilerCategory category,const char *name,int arg0 = -1,int arg1 = -1) {
+							if (profilerThreads != NULL) {
+								this->thread	=	thread;
+								this->category	=	category;
+								this->name		=	name;
+								this->arg0		=	arg0;
+								this->arg1		=	arg1;
+								start			=	osClock();
+							} else {
+								this->name		=	NULL;
+							}
+						}
+
+						~CProfilerSpan() {
+							if (name != NULL)	profilerRecord(thread,category,name,start,osClock(),arg0,arg1);
+						}
+
+private:
+	double				start;
+	const char			*name;
+	int					thread;
+	int					category;
+	int					arg0,arg1;
+};
+
+#endif
+
@@ -79,6 +79,18 @@ void PtcWriteDataPoint(PtcPointCloud pointcloud, float *point, float *normal, fl
 	ptcInternal->curPoint++;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	PtcSetPointCloudPageSize
+// Description			:
+/// \brief					Write the point cloud as pages that can be read on demand
+// Return Value			:
+// Comments				:	Must be called before PtcFinishPointCloudFile, 0 writes a monolithic file
+void PtcSetPointCloudPageSize(PtcPointCloud pointcloud, int pagesize) {
+	PtcPointCloudInternal *ptcInternal = (PtcPointCloudInternal *) pointcloud;
+
+	ptcInternal->ptc->setPageSize(pagesize);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	PtcFinishPointCloudFile
 // Description			:
@@ -118,6 +130,18 @@ PtcPointCloud PtcOpenPointCloudFile(char *fileName, int *nvars, const char **var
 		
 		ptcInternal->ptc->queryChannels(nvars,vartypes,varnames);
 		
+		ptcInternal->numPoints		=	ptcInternal->ptc->getNumPoints()-1;
+		ptcInternal->curPoint		=	1;	// First point is dummy
+	} else if ((in	=	ropen(fileName,"rb",filePagedPointCloud,TRUE)) != NULL) {
+		matrix from,to;
+		identitym(from);
+		identitym(to);
+		
+		// The pages are read on demand as the points are read
+		ptcInternal->ptc			=	new CPointCloud(fileName,from,to,in,TRUE);
+		
+		ptcInternal->ptc->queryChannels(nvars,vartypes,varnames);
+		
 		ptcInternal->numPoints		=	ptcInternal->ptc->getNumPoints()-1;
 		ptcInternal->curPoint		=	1;	// First point is dummy
 	} else {
@@ -54,6 +54,9 @@ extern "C" {
 	// Write a point to the file
 	LIB_EXPORT	void PtcWriteDataPoint(PtcPointCloud pointcloud, float *point, float *normal, float radius, float *data);
 
+	// Write the file as pages of at most pagesize points that can be read on demand (Pixie extension)
+	LIB_EXPORT	void PtcSetPointCloudPageSize(PtcPointCloud pointcloud, int pagesize);
+
 	// Finish an close the file
 	LIB_EXPORT	void PtcFinishPointCloudFile(PtcPointCloud pointcloud);
 
@@ -39,6 +39,7 @@
 #include "common/os.h"
 #include "object.h"
 #include "stats.h"
+#include "profiler.h"
 #include "surface.h"
 #include "memory.h"
 #include "shading.h"
@@ -64,7 +65,7 @@
 	if ((attributes->displacement != NULL) && (attributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS)) {						\
 		/* Do we have a grid ? */								\
 		if (children == NULL) {									\
-			osLock(CRenderer::tesselateMutex);					\
+			profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");	\
 																\
 			if (children == NULL) {								\
 				CTesselationPatch	*tesselation	=	new CTesselationPatch(attributes,xform,this,0,1,0,1,0,0,-1);	\
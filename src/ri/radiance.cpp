@@ -290,9 +290,9 @@ public:
 
 							// No, perform a photonmap lookup
 							if ((globalMap = cTriangle->attributes->globalMap) != NULL) {
-								stats.numIndirectDiffusePhotonmapLookups++;
+								stats.addShared(STAT_INDIRECTDIFFUSE_PHOTONMAP_LOOKUPS,1);
 
-								globalMap->lookup(cTriangle->C,cTriangle->P,cTriangle->N,cTriangle->attributes->photonEstimator);
+								globalMap->lookup(cTriangle->C,cTriangle->P,cTriangle->N,cTriangle->attributes->photonEstimator,cTriangle->attributes->photonMaxError);
 								mulvv(cTriangle->C,cTriangle->attributes->surfaceColor);
 							} else {
 								movvv(cTriangle->C,cTriangle->attributes->surfaceColor);
@@ -1084,7 +1084,7 @@ void			CRadianceCache::compute(int numSamples,CShadingPoint **points,CTextureLoo
 
 			// Trace the ray
 			CRenderer::trace(&ray,NULL);
-			stats.numIndirectDiffuseRays++;
+			stats.addShared(STAT_INDIRECTDIFFUSE_RAYS,1);
 
 			// Do we have an intersection that's too close ?
 			if ((dP > alpha) && (ray.t < dP)) {
@@ -1107,9 +1107,9 @@ void			CRadianceCache::compute(int numSamples,CShadingPoint **points,CTextureLoo
 					if(dotvv(ray.dir,N) > 0)
 						mulvf(N,-1);
 
-					stats.numIndirectDiffusePhotonmapLookups++;
+					stats.addShared(STAT_INDIRECTDIFFUSE_PHOTONMAP_LOOKUPS,1);
 
-					globalMap->lookup(C,P,N,attributes->photonEstimator);
+					globalMap->lookup(C,P,N,attributes->photonEstimator,attributes->photonMaxError);
 					mulvv(C,attributes->surfaceColor);
 				}
 			} else {
@@ -1161,7 +1161,7 @@ void			CRadianceCache::compute(int numSamples,CShadingPoint **points,CTextureLoo
 			linSolve(X,Y,9,3);
 			memcpy(cHarmonic->Y,Y,27*sizeof(float));
 
-			stats.numIndirectDiffuseSamples++;
+			stats.addShared(STAT_INDIRECTDIFFUSE_SAMPLES,1);
 
 			// Save the harmonic
 			cNode		=	root;
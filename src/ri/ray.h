@@ -35,6 +35,8 @@
 #include "common/algebra.h"
 
 class	CSurface;
+class	CDelayedInstance;
+class	CTesselationPatch;
 
 ////////////////////////////////////////////////////////////////////////////////////
 // Ray class ---
@@ -53,6 +55,8 @@ public:
 
 						// ------------------> O U T P U T
 	CSurface			*object;					// The intersection object (NULL if no intersection)
+	CDelayedInstance	*instance;					// The shared instance the intersection object is in (NULL if none)
+	CTesselationPatch	*patch;						// The tesselation patch that was hit (NULL if none)
 	float				u,v;						// The parametric intersection coordinates on the object
 	vector				N;							// The normal vector at the intersection
 
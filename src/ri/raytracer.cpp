@@ -36,6 +36,7 @@
 #include "memory.h"
 #include "error.h"
 #include "renderer.h"
+#include "profiler.h"
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CPrimaryBundle
@@ -348,8 +349,10 @@ void	CRaytracer::renderingLoop() {
 			assert(x < CRenderer::xBuckets);
 			assert(y < CRenderer::yBuckets);
 
-			currentXBucket	=	x;
-			currentYBucket	=	y;
+			// Record the time we spend on this bucket
+			CProfilerSpan	bucketSpan(thread,PROFILER_BUCKET,"bucket",x,y);
+
+			gotoBucket(CRenderer::bucketRank[y*CRenderer::xBuckets + x]);
 
 			left			=	x*CRenderer::bucketWidth;
 			top				=	y*CRenderer::bucketHeight;
@@ -360,19 +363,14 @@ void	CRaytracer::renderingLoop() {
 			sample(left,top,width,height);
 
 			// Flush the data to the out devices
-			CRenderer::commit(left,top,width,height,fbPixels);
-			
-			// Send bucket data if we're a netrender
-			if (CRenderer::netClient != INVALID_SOCKET) {
-				CRenderer::sendBucketDataChannels(currentXBucket,currentYBucket);
-			}
+			{
+				CProfilerSpan	displaySpan(thread,PROFILER_DISPLAY,"commit");
 
-			currentXBucket++;
-			if (currentXBucket == CRenderer::xBuckets) {
-				currentXBucket	=	0;
-				currentYBucket++;
+				CRenderer::commit(left,top,width,height,fbPixels);
 			}
 
+			gotoBucket(currentBucket+1);
+
 		} else {
 			error(CODE_BUG,"Invalid job for the hider\n");
 		}
@@ -31,6 +31,7 @@
 ////////////////////////////////////////////////////////////////////////
 
 #include	<string.h>
+#include	<stddef.h>
 #include	<math.h>
 
 #include	"common/global.h"
@@ -41,6 +42,7 @@
 #include	"error.h"
 #include	"irradiance.h"
 #include	"pointCloud.h"
+#include	"atomic.h"
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -243,7 +245,7 @@ int		CRenderer::processChannelRequest(int index,SOCKET s){
 // Method				:	sendBucketDataChannels
 // Description			:	Send all bucket-data channels
 // Return Value			:
-// Comments				:	called from render loop (reyes.cpp or raytracer.cpp)
+// Comments				:	called from commit with the networkMutex held
 void CRenderer::sendBucketDataChannels(int x,int y) {
 	unsigned int	numChannelsToSend	= remoteChannels->numItems;
 	CRemoteChannel	**channels			= remoteChannels->array;
@@ -517,136 +519,320 @@ int		CRemoteTSMChannel::recvRemoteBucket(SOCKET s,int x,int y) {
 
 
 ///////////////////////////////////////////////////////////////////////
-// Class				:	CRemoteTSMChannel
+// Class				:	CRemoteICacheChannel
 // Method				:	ctor
 // Description			:	-
 // Comments				:
 /// \note					The cache is opened elsewhere and closed elsewhere
-CRemoteICacheChannel::CRemoteICacheChannel(CIrradianceCache *c) : CRemoteChannel(c->name,REMOTECHANNEL_PERFRAME,CHANNELTYPE_ICACHE) {
-	cache = c;
+CRemoteICacheChannel::CRemoteICacheChannel(CIrradianceCache *c) : CRemoteChannel(c->name,REMOTECHANNEL_PERFRAME | REMOTECHANNEL_PERBUCKET,CHANNELTYPE_ICACHE) {
+	cache		=	c;
+	numSent		=	0;
+	log			=	NULL;
+	logOrigin	=	NULL;
+	cursors		=	NULL;
+
+	// Start recording the samples we own so we can send them incrementally
+	osLock(cache->mutex);
+	if (cache->journal == NULL) {
+		CIrradianceCache::CCacheNode	**stackBase	=	(CIrradianceCache::CCacheNode **) alloca(cache->maxDepth*sizeof(CIrradianceCache::CCacheNode *)*8);
+		CIrradianceCache::CCacheNode	**stack;
+		CIrradianceCache::CCacheNode	*cNode;
+		CIrradianceCache::CCacheSample	*cSample;
+		int								i;
+
+		cache->journal	=	new CArray<CIrradianceCache::CCacheSample *>;
+
+		// The samples that were read from a file are ours too
+		stack		=	stackBase;
+		*stack++	=	cache->root;
+		while(stack > stackBase) {
+			cNode	=	*(--stack);
+
+			for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next)	cache->journal->push(cSample);
+
+			for (i=0;i<8;i++) {
+				if (cNode->children[i] != NULL)	*stack++	=	cNode->children[i];
+			}
+		}
+
+		// So are the ones in a mapped cache file
+		for (i=0;i<cache->numFlatSamples;i++) {
+			cSample		=	(CIrradianceCache::CCacheSample *) cache->memory->alloc(sizeof(CIrradianceCache::CCacheSample));
+			cache->flatSample(cSample,i);
+			cache->journal->push(cSample);
+		}
+	}
+	osUnlock(cache->mutex);
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	dtor
+// Description			:	-
+// Comments				:
+CRemoteICacheChannel::~CRemoteICacheChannel() {
+	if (log != NULL)		delete log;
+	if (logOrigin != NULL)	delete logOrigin;
+	if (cursors != NULL)	delete[] cursors;
+}
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CRemoteICacheChannel
 // Method				:	sendRemoteBucket
-// Description			:	send all the cache's data
+// Description			:	send the samples created since the last bucket
 // Return Value			:	success or failure
-// Comments				:	
-int		CRemoteICacheChannel::sendRemoteFrame(SOCKET s) {
-	CIrradianceCache::CCacheNode			**stackBase;
-	CIrradianceCache::CCacheNode			**stack;
-	CIrradianceCache::CCacheNode			*cNode;
-	CIrradianceCache::CCacheSample			*cSample;
-	int i,numSamples;
-	
-	stackBase		=	(CIrradianceCache::CCacheNode **)
-							alloca(cache->maxDepth*sizeof(CIrradianceCache::CCacheNode *)*8);
-	
-	stack		=	stackBase;
-	*stack++	=	cache->root;
-	while(stack > stackBase) {
-		cNode	=	*(--stack);
-
-		// Send the values in this level (if any)
-		for (numSamples=0,cSample=cNode->samples;cSample!=NULL;cSample=cSample->next)
-			numSamples++;
-		
-		if (numSamples != 0) {
-			rcSend(s,&numSamples,sizeof(int),FALSE);
-			
-			for (cSample=cNode->samples;cSample!=NULL;cSample=cSample->next) {
-				rcSend(s,cSample,sizeof(CIrradianceCache::CCacheSample),FALSE);
-			}
-		}
-		
-		// Send the children
-		for (i=0;i<8;i++) {
-			CIrradianceCache::CCacheNode	*tNode;
+// Comments				:	the client answers with the samples the other
+//							servers created in the meantime
+int		CRemoteICacheChannel::sendRemoteBucket(SOCKET s,int x,int y) {
+	if (sendSamples(s) == FALSE)	return FALSE;
 
-			if ((tNode = cNode->children[i]) != NULL) {
-				*stack++	=	tNode;
-			}
-		}
+	return recvSamples(s,-1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	recvRemoteBucket
+// Description			:	receive the samples a server created since its
+//							last bucket and relay it the rest
+// Return Value			:	success or failure
+// Comments				:	called with the commitMutex held. The server always
+//							waits for a reply, so failures answer with a
+//							negative sample count
+int		CRemoteICacheChannel::recvRemoteBucket(SOCKET s,int x,int y) {
+	CIrradianceCache::CCacheSample	**samples;
+	int								index,i,numSamples;
+
+	// Figure out which server this is
+	for (index=0;index<CRenderer::netNumServers;index++) {
+		if (CRenderer::netServers[index] == s)	break;
 	}
-	
-	numSamples = 0;
-	rcSend(s,&numSamples,sizeof(int),FALSE);
-	
+
+	if (index == CRenderer::netNumServers) {
+		// Drain the samples without inserting or relaying them
+		skipSamples(s);
+		sendSamples(s,NULL,-1);
+		return FALSE;
+	}
+
+	if (recvSamples(s,index) == FALSE) {
+		sendSamples(s,NULL,-1);
+		return FALSE;
+	}
+
+	// Collect the samples this server has not seen yet
+	samples		=	new CIrradianceCache::CCacheSample*[log->numItems - cursors[index] + 1];
+	numSamples	=	0;
+	for (i=cursors[index];i<log->numItems;i++) {
+		if (logOrigin->array[i] != index)	samples[numSamples++]	=	log->array[i];
+	}
+	cursors[index]	=	log->numItems;
+
+	sendSamples(s,samples,numSamples);
+
+	delete[] samples;
+
 	return TRUE;
 }
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CRemoteICacheChannel
-// Method				:	recvRemoteBucket
-// Description			:	receive all the server's cache data
+// Method				:	sendRemoteFrame
+// Description			:	send the samples we have not sent yet
+// Return Value			:	success or failure
+// Comments				:	
+int		CRemoteICacheChannel::sendRemoteFrame(SOCKET s) {
+	return sendSamples(s);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	recvRemoteFrame
+// Description			:	receive the server's remaining samples
 // Return Value			:	success or failure
 // Comments				:	
 int		CRemoteICacheChannel::recvRemoteFrame(SOCKET s) {
-	CIrradianceCache::CCacheNode			*cNode;
-	CIrradianceCache::CCacheSample			*cSample;
-	CIrradianceCache::CCacheSample			*sampleMem;
-	int		i,j,t,numSamples,depth;
-	float	rMean,P[3];
+	int		index;
+
+	for (index=0;index<CRenderer::netNumServers;index++) {
+		if (CRenderer::netServers[index] == s)	break;
+	}
+
+	if (index == CRenderer::netNumServers)	return FALSE;
+
+	return recvSamples(s,index);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	sendSamples
+// Description			:	send the journal entries we haven't sent yet
+// Return Value			:	success or failure
+// Comments				:	
+int		CRemoteICacheChannel::sendSamples(SOCKET s) {
+	CIrradianceCache::CCacheSample	**samples;
+	int								numSamples;
+
+	// Grab the new part of the journal, the samples themselves never change
+	osLock(cache->mutex);
+	numSamples	=	cache->journal->numItems - numSent;
+	samples		=	new CIrradianceCache::CCacheSample*[numSamples + 1];
+	memcpy(samples,cache->journal->array + numSent,numSamples*sizeof(CIrradianceCache::CCacheSample *));
+	numSent		=	cache->journal->numItems;
+	osUnlock(cache->mutex);
+
+	sendSamples(s,samples,numSamples);
+
+	delete[] samples;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	sendSamples
+// Description			:	send a batch of samples
+// Return Value			:	-
+// Comments				:	the samples are packed without their list pointers
+//							and sent in one piece. A negative count signals an error
+void	CRemoteICacheChannel::sendSamples(SOCKET s,CIrradianceCache::CCacheSample **samples,int numSamples) {
+	const int	sampleSize	=	(int) offsetof(CIrradianceCache::CCacheSample,next);
+	char		*buffer,*dest;
+	int			i;
+
+	rcSend(s,&numSamples,sizeof(int),FALSE);
+
+	if (numSamples <= 0)	return;
+
+	buffer	=	new char[numSamples*sampleSize];
+	for (i=0,dest=buffer;i<numSamples;i++,dest+=sampleSize)	memcpy(dest,samples[i],sampleSize);
+
+	rcSend(s,buffer,numSamples*sampleSize,FALSE);
+
+	delete[] buffer;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	recvSamples
+// Description			:	receive a batch of samples into the cache
+// Return Value			:	success or failure
+// Comments				:	on the client, origin is the index of the sending
+//							server and the samples are logged to be relayed
+int		CRemoteICacheChannel::recvSamples(SOCKET s,int origin) {
+	const int						sampleSize	=	(int) offsetof(CIrradianceCache::CCacheSample,next);
+	CIrradianceCache::CCacheSample	*sampleMem;
+	char							*buffer,*src;
+	int								t,numSamples;
+
+	// Create the relay log the first time we hear from a server
+	if ((origin >= 0) && (log == NULL)) {
+		log			=	new CArray<CIrradianceCache::CCacheSample *>;
+		logOrigin	=	new CArray<int>;
+		cursors		=	new int[CRenderer::netNumServers];
+		for (t=0;t<CRenderer::netNumServers;t++)	cursors[t]	=	0;
+	}
 
 	rcRecv(s,&numSamples,sizeof(int),FALSE);
-	
-	while (numSamples > 0) {
-		sampleMem = (CIrradianceCache::CCacheSample *)
-					cache->memory->alloc(numSamples * sizeof(CIrradianceCache::CCacheSample));
-		
-		rcRecv(s,sampleMem,numSamples * sizeof(CIrradianceCache::CCacheSample),FALSE);
-		for (t=0,cSample=sampleMem;t<numSamples;cSample++,t++) {
-			cSample->next =  NULL;
+
+	if (numSamples < 0)		return FALSE;
+	if (numSamples == 0)	return TRUE;
+
+	buffer	=	new char[numSamples*sampleSize];
+	rcRecv(s,buffer,numSamples*sampleSize,FALSE);
+
+	// The render threads may be using the cache
+	osLock(cache->mutex);
+
+	sampleMem	=	(CIrradianceCache::CCacheSample *) cache->memory->alloc(numSamples*sizeof(CIrradianceCache::CCacheSample));
+	for (t=0,src=buffer;t<numSamples;t++,src+=sampleSize) {
+		memcpy(sampleMem + t,src,sampleSize);
+		insert(sampleMem + t);
+
+		if (origin >= 0) {
+			log->push(sampleMem + t);
+			logOrigin->push(origin);
 		}
-		
-		for (t=0,cSample=sampleMem;t<numSamples;cSample++,t++) {
-			rMean				=	cSample->dP;	// error adjustment!!
-			movvv(P,cSample->P);
-			
-			cNode				=	cache->root;
-			depth				=	0;
-			while(cNode->side > (2*rMean)) {
-				depth++;
-		
-				for (j=0,i=0;i<3;i++) {
-					if (P[i] > cNode->center[i]) {
-						j			|=	1 << i;
-					}
-				}
-		
-				if (cNode->children[j] == NULL)	{
-					CIrradianceCache::CCacheNode	*nNode	=	(CIrradianceCache::CCacheNode *) 
-																cache->memory->alloc(sizeof(CIrradianceCache::CCacheNode));
-		
-					for (i=0;i<3;i++) {
-						if (P[i] > cNode->center[i]) {
-							nNode->center[i]	=	cNode->center[i] + cNode->side / (float) 4;
-						} else {
-							nNode->center[i]	=	cNode->center[i] - cNode->side / (float) 4;
-						}
-					}
-		
-					cNode->children[j]	=	nNode;
-					nNode->side			=	cNode->side*0.5f;
-					nNode->samples		=	NULL;
-					for (i=0;i<8;i++)	nNode->children[i]	=	NULL;
+	}
+
+	osUnlock(cache->mutex);
+
+	delete[] buffer;
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	skipSamples
+// Description			:	read a batch of samples and throw it away
+// Return Value			:	-
+// Comments				:	keeps the stream in sync when the sender is unknown
+void	CRemoteICacheChannel::skipSamples(SOCKET s) {
+	const int	sampleSize	=	(int) offsetof(CIrradianceCache::CCacheSample,next);
+	char		*buffer;
+	int			numSamples;
+
+	rcRecv(s,&numSamples,sizeof(int),FALSE);
+
+	if (numSamples <= 0)	return;
+
+	buffer	=	new char[numSamples*sampleSize];
+	rcRecv(s,buffer,numSamples*sampleSize,FALSE);
+	delete[] buffer;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRemoteICacheChannel
+// Method				:	insert
+// Description			:	insert a received sample into the octree
+// Return Value			:	-
+// Comments				:	the cache mutex must be held. The nodes and samples
+//							are filled in and fenced before they're linked as
+//							the lookups do not lock
+void	CRemoteICacheChannel::insert(CIrradianceCache::CCacheSample *cSample) {
+	CIrradianceCache::CCacheNode	*cNode;
+	int								i,j,depth;
+	const float						rMean	=	cSample->dP;	// error adjustment!!
+
+	cNode				=	cache->root;
+	depth				=	0;
+	while(cNode->side > (2*rMean)) {
+		depth++;
+
+		for (j=0,i=0;i<3;i++) {
+			if (cSample->P[i] > cNode->center[i]) {
+				j			|=	1 << i;
+			}
+		}
+
+		if (cNode->children[j] == NULL)	{
+			CIrradianceCache::CCacheNode	*nNode	=	(CIrradianceCache::CCacheNode *) 
+														cache->memory->alloc(sizeof(CIrradianceCache::CCacheNode));
+
+			for (i=0;i<3;i++) {
+				if (cSample->P[i] > cNode->center[i]) {
+					nNode->center[i]	=	cNode->center[i] + cNode->side / (float) 4;
+				} else {
+					nNode->center[i]	=	cNode->center[i] - cNode->side / (float) 4;
 				}
-		
-				cNode			=	cNode->children[j];
 			}
-		
-			// GSHTODO filter thru samples and discard this one iff within eps of another
-			
-			cSample->next		=	cNode->samples;
-			cNode->samples		=	cSample;
-			cache->maxDepth		=	max(depth,cache->maxDepth);
+
+			nNode->side			=	cNode->side*0.5f;
+			nNode->samples		=	NULL;
+			for (i=0;i<8;i++)	nNode->children[i]	=	NULL;
+			memoryBarrier();
+			cNode->children[j]	=	nNode;
 		}
-		
-		rcRecv(s,&numSamples,sizeof(int),FALSE);
+
+		cNode			=	cNode->children[j];
 	}
-	
-	return TRUE;
+
+	// GSHTODO filter thru samples and discard this one iff within eps of another
+
+	cSample->next		=	cNode->samples;
+	memoryBarrier();
+	cNode->samples		=	cSample;
+	cache->maxDepth		=	max(depth,cache->maxDepth);
 }
 
 // Help us set up the client cache (it's worldBound will be wrong)
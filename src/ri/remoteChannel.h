@@ -34,10 +34,11 @@
 
 #include "common/global.h"
 #include "common/os.h"
+#include "common/containers.h"
+#include "irradiance.h"
 
 
 // Forward declarations:
-class CIrradianceCache;
 class CPointCloud;
 
 // Types and flags
@@ -104,19 +105,34 @@ private:
 // Class				:	CRemoteICacheChannel
 // Description			:
 /// \brief					remote channel for irradiance caches
-// Comments				:	
+// Comments				:	The samples are exchanged incrementally after every bucket:
+//							a server sends the samples it computed since the last bucket
+//							and receives the ones the other servers sent to the client in
+//							the meantime, so the servers can share the work mid-frame
 class	CRemoteICacheChannel : public CRemoteChannel {
 public:
 	CRemoteICacheChannel(CIrradianceCache *);
-	~CRemoteICacheChannel() { }
+	~CRemoteICacheChannel();
 	
 	int	sendSetupData(SOCKET s);
 	int	setup(SOCKET s);
+	int sendRemoteBucket(SOCKET s,int x,int y);
+	int recvRemoteBucket(SOCKET s,int x,int y);
 	int sendRemoteFrame(SOCKET s);
 	int recvRemoteFrame(SOCKET s);
 
 private:
-	CIrradianceCache	*cache;
+	int		sendSamples(SOCKET s);
+	void	sendSamples(SOCKET s,CIrradianceCache::CCacheSample **,int);
+	int		recvSamples(SOCKET s,int origin);
+	void	skipSamples(SOCKET s);
+	void	insert(CIrradianceCache::CCacheSample *);
+
+	CIrradianceCache							*cache;
+	int											numSent;		// Server: number of journal entries sent to the client
+	CArray<CIrradianceCache::CCacheSample *>	*log;			// Client: the samples received from the servers in order
+	CArray<int>									*logOrigin;		// Client: the server each logged sample came from
+	int											*cursors;		// Client: number of log entries each server has seen
 };
 
 ///////////////////////////////////////////////////////////////////////
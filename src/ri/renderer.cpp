@@ -46,6 +46,7 @@
 #include "rib.h"
 #include "noise.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "photonMap.h"
 #include "photon.h"
@@ -67,6 +68,7 @@
 #include "implicitSurface.h"
 #include "dlobject.h"
 #include "brickmap.h"
+#include "pointCloud.h"
 #include "show.h"
 #include "remoteChannel.h"
 #include "rendererContext.h"
@@ -172,15 +174,21 @@ unsigned int					CRenderer::flags;
 // Pixie dependent options
 int								CRenderer::endofframe;
 char							*CRenderer::filelog;
+char							*CRenderer::tracefile;
+char							*CRenderer::statsfile;
 int								CRenderer::numThreads;
 int								CRenderer::maxTextureSize;
 int								CRenderer::maxBrickSize;
+int								CRenderer::maxPtcSize;
+int								CRenderer::ptcPageSize;
 int								CRenderer::maxGridSize;
 int								CRenderer::maxRayDepth;
 int								CRenderer::maxPhotonDepth;
 int								CRenderer::bucketWidth,CRenderer::bucketHeight;
 int								CRenderer::netXBuckets,CRenderer::netYBuckets;
 int								CRenderer::threadStride;
+EBucketOrder					CRenderer::bucketOrder;
+int								CRenderer::maxGridMemory;
 int								CRenderer::geoCacheSize;
 int								CRenderer::maxEyeSplits;
 float							CRenderer::tsmThreshold;
@@ -248,6 +256,9 @@ int								CRenderer::currentXBucket;											// initialized in beginFrame
 int								CRenderer::currentYBucket;											// initialized in beginFrame
 int								CRenderer::currentPhoton;											// initialized in beginFrame
 int								*CRenderer::jobAssignment;											// initialized in beginFrame
+int								*CRenderer::bucketSequence;											// initialized in beginFrame
+int								*CRenderer::bucketRank;												// initialized in beginFrame
+float							*CRenderer::bucketCost				=	NULL;						// initialized in beginFrame, cleared in renderFrame
 FILE							*CRenderer::deepShadowFile			=	NULL;						// initialized in beginDisplays
 int								*CRenderer::deepShadowIndex			=	NULL;						// initialized in beginDisplays
 int								CRenderer::deepShadowIndexStart;									// initialized in beginDisplays
@@ -437,9 +448,13 @@ static void	copyOptions(const COptions *o) {
 
 	CRenderer::endofframe				=	o->endofframe;
 	CRenderer::filelog					=	o->filelog;
+	CRenderer::tracefile				=	o->tracefile;
+	CRenderer::statsfile				=	o->statsfile;
 	CRenderer::numThreads				=	o->numThreads;
 	CRenderer::maxTextureSize			=	o->maxTextureSize;
 	CRenderer::maxBrickSize				=	o->maxBrickSize;
+	CRenderer::maxPtcSize				=	o->maxPtcSize;
+	CRenderer::ptcPageSize				=	o->ptcPageSize;
 	CRenderer::maxGridSize				=	o->maxGridSize;
 	CRenderer::maxRayDepth				=	o->maxRayDepth;
 	CRenderer::maxPhotonDepth			=	o->maxPhotonDepth;
@@ -448,6 +463,8 @@ static void	copyOptions(const COptions *o) {
 	CRenderer::netXBuckets				=	o->netXBuckets;
 	CRenderer::netYBuckets				=	o->netYBuckets;
 	CRenderer::threadStride				=	o->threadStride;
+	CRenderer::bucketOrder				=	o->bucketOrder;
+	CRenderer::maxGridMemory			=	o->maxGridMemory;
 	CRenderer::geoCacheSize				=	o->geoCacheMemory;
 	CRenderer::maxEyeSplits				=	o->maxEyeSplits;
 	CRenderer::tsmThreshold				=	o->tsmThreshold;
@@ -583,6 +600,17 @@ void		CRenderer::beginFrame(const COptions *o,CAttributes *a,CXform *x) {
 	// Create the job assignment
 	for (i=0;i<xBuckets*yBuckets;i++)	jobAssignment[i]	=	-1;
 
+	// Compute the order we will render the buckets in
+	beginBucketOrder();
+
+	// The grid stats are per frame
+	stats.numPeakRasterGrids	=	0;
+	stats.peakGridMemory		=	0;
+	stats.peakRasterCacheMemory	=	0;
+	stats.numRetainedGrids		=	0;
+	stats.numBucketsRendered	=	0;
+	stats.numDispatchStalls		=	0;
+
 	// Compute depth of field related stuff
 	aperture			=	focallength / (2*fstop);
 	if ((aperture <= C_EPSILON) || (projection == OPTIONS_PROJECTION_ORTHOGRAPHIC)) {
@@ -857,6 +885,17 @@ void		CRenderer::beginFrame(const COptions *o,CAttributes *a,CXform *x) {
 		numThreads = 1;
 	}
 	
+	// Give every thread its own statistics counters
+	stats.reserveThreads(numThreads);
+
+	// Start the timeline profiler (the file name may contain the frame number)
+	if (tracefile != NULL) {
+		char	traceName[OS_MAX_PATH_LENGTH];
+
+		getDisplayName(traceName,tracefile,"trace");
+		profilerBegin(traceName,numThreads);
+	}
+
 	// All of these must be after we determine the number of threads
 	
 	// Initialize tesselations
@@ -865,6 +904,9 @@ void		CRenderer::beginFrame(const COptions *o,CAttributes *a,CXform *x) {
 	// Initialize the brickmaps
 	CBrickMap::initBrickMap(maxBrickSize);
 
+	// Initialize the paged point clouds
+	CPointCloud::initPointClouds(maxPtcSize);
+
 	// Initialize the texturing (after we worked out how many threads)
 	initTextures(maxTextureSize);
 
@@ -947,6 +989,9 @@ void		CRenderer::endFrame() {
 	// Terminate the displays
 	endDisplays();
 
+	// Write the timeline (after all the threads are done)
+	profilerEnd(frame);
+
 	// Ditch the remote channels
 	for (int i=0;i<remoteChannels->numItems;i++) {
 		if (remoteChannels->array[i] != NULL) delete remoteChannels->array[i];
@@ -1025,7 +1070,8 @@ void		CRenderer::endFrame() {
 	stats.frameTime		=	osCPUTime()		-	stats.frameStartTime;
 
 	// Display the stats if applicable
-	if (endofframe > 0)	stats.printStats(endofframe);
+	if (endofframe > 0)		stats.printStats(endofframe);
+	if (statsfile != NULL)	stats.writeStats(statsfile,frame);
 }
 
 
@@ -1130,6 +1176,9 @@ void		CRenderer::renderFrame() {
 	movvv(root->bmax,worldBmax);
 	root->setChildren(contexts[0],root->children);
 	numRenderedBuckets = 0;
+
+	// Fix the bucket order now that the scene is known
+	endBucketOrder();
 	
 	// Render the frame
 	if (netNumServers != 0) {
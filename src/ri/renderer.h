@@ -103,6 +103,7 @@ class	CRay;
 class	CTextureBlock;
 class	CTextureInfoBase;
 class	CTexture3d;
+class	CVolume;
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -260,6 +261,8 @@ public:
 		static void				beginDisplays();									// Init the displays
 		static void				commit(int,int,int,int,float *);					// Send a chunk of computed framebuffer to the display drivers
 		static int				advanceBucket(int,int &,int &);						// Find the next bucket to render for network rendering
+		static void				beginBucketOrder();									// Compute the bucket order for the frame
+		static void				endBucketOrder();									// Finalize the bucket order before the rendering starts
 		static void				clear(int,int,int,int);								// Clear a window
 		static void				dispatch(int,int,int,int,float *);					// Dispatch a window to out devices
 		static void				getDisplayName(char *,const char *,const char *);	// Retrieve the display name
@@ -300,6 +303,7 @@ public:
 		static	CTexture3d		*getCache(const char *,const char *,const float *,const float *);							// Load a cache
 		static	CTextureInfoBase *getTextureInfo(const char *);							// Load a textureinfo
 		static	CTexture3d		*getTexture3d(const char*,int,const char*,const float*,const float *,int hierarchy=FALSE);	// Load a point cloud or brickmap
+		static	CVolume			*getVolume(const char *,const char *,const float *,const float *);						// Load a brickmap for ray marching
 		static	CShader			*getShader(const char *,TSearchpath *search=NULL);		// Load a shader
 		static	int				getAOVFilter(const char *name);							// Get an AOV filter name
 		static	const char		*getFilter(RtFilterFunc);								// The other way around
@@ -379,15 +383,21 @@ public:
 		static	unsigned int			flags;											// Flags	
 		static	int						endofframe;										// The end of frame statstics number
 		static	char					*filelog;										// The name of the log file
+		static	char					*tracefile;										// The name of the timeline trace file
+		static	char					*statsfile;										// The name of the JSON statistics file
 		static	int						numThreads;										// The number of threads working
 		static	int						maxTextureSize;									// Maximum amount of texture data to keep in memory (in bytes)
 		static	int						maxBrickSize;									// Maximum amount of brick data to keep in memory (in bytes)
+		static	int						maxPtcSize;										// Maximum amount of point cloud pages to keep in memory per point cloud (in bytes)
+		static	int						ptcPageSize;									// The number of points per page when writing point clouds (0 = not paged)
 		static	int						maxGridSize;									// Maximum number of points to shade at a time
 		static	int						maxRayDepth;									// Maximum raytracing recursion depth
 		static	int						maxPhotonDepth;									// The maximum number of photon bounces
 		static	int						bucketWidth,bucketHeight;						// Bucket dimentions in samples
 		static	int						netXBuckets,netYBuckets;						// The meta bucket size
 		static	int						threadStride;									// The number of buckets per thread at a time
+		static	EBucketOrder			bucketOrder;									// The order the buckets are rendered in
+		static	int						maxGridMemory;									// The grid memory above which bucket dispatch is throttled (in bytes)
 		static	int						geoCacheSize;									// The ammount of memory to dedicate to tesselation caches
 		static	int						maxEyeSplits;									// Maximum number of eye splits
 		static	float					tsmThreshold;									// Transparency shadow map threshold
@@ -454,6 +464,9 @@ public:
 		static	int						currentYBucket;
 		static	int						currentPhoton;				// The current photon counter for the photon mapping
 		static	int						*jobAssignment;				// The job assignment for the buckets
+		static	int						*bucketSequence;			// The buckets in the order they're rendered
+		static	int						*bucketRank;				// The position of every bucket in bucketSequence
+		static	float					*bucketCost;				// The estimated cost of every bucket (only while the scene is being inserted for the cost order)
 		static	FILE					*deepShadowFile;			// Deep shadow map stuff
 		static	int						*deepShadowIndex;
 		static	int						deepShadowIndexStart;		// The offset in the file for the indices
@@ -468,8 +481,8 @@ public:
 		// Comments				:
 		class CDisplayData {
 		public:
-      CDisplayData(): module(NULL), handle(NULL), start(NULL), data(NULL),
-                      rawData(NULL), finish(NULL), display(NULL), abort(false)
+      CDisplayData(): module(NULL), handle(NULL), abort(false), start(NULL),
+                      data(NULL), rawData(NULL), finish(NULL), display(NULL)
       {}
 
 				void						*module;				// The module handle for the out device
@@ -597,12 +610,12 @@ inline void		camera2screen(int n,float *P) {
 // Comments				:	(inline for speed)
 inline void		distance2pixels(int n,float *dist,float *P) {
 	if(CRenderer::projection == OPTIONS_PROJECTION_PERSPECTIVE) {
-		for (;n>0;n--,P+=3) {
-			*dist++		=	CRenderer::dPixeldx*CRenderer::imagePlane*dist[0]/P[COMP_Z];
+		for (;n>0;n--,P+=3,dist++) {
+			dist[0]		=	CRenderer::dPixeldx*CRenderer::imagePlane*dist[0]/P[COMP_Z];
 		}
 	} else {
-		for (;n>0;n--,P+=3) {
-			*dist++		=	CRenderer::dPixeldx*dist[0];
+		for (;n>0;n--,dist++) {
+			dist[0]		=	CRenderer::dPixeldx*dist[0];
 		}
 	}
 }
@@ -672,6 +685,7 @@ public:
 	void				*handle;		// The handle to the module that implements the DSO shader
 	dsoInitFunction		init;			// Init function
 	dsoExecFunction		exec;			// Execute function
+	dsoBatchFunction	batch;			// Batch execute function (NULL if the shadeop does not have one)
 	dsoCleanupFunction	cleanup;		// Cleanup function
 	char				*name;			// Name of the DSO shader
 	char				*prototype;		// Prototype of the DSO shader
@@ -53,6 +53,7 @@
 #include "shadeop.h"
 #include "noise.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "photonMap.h"
 #include "photon.h"
@@ -125,6 +126,12 @@ CRendererContext::CRendererContext(const char *ribFile,const char *riNetString)
 	currentXform->attach();
 	currentAttributes->attach();
 
+	// Identical states are shared between the primitives
+	internedXforms					=	new CInternHash<CXform>;
+	internedAttributes				=	new CInternHash<CAttributes>;
+	lastInternedXform				=	NULL;
+	lastInternedAttributes			=	NULL;
+
 	// Some misc data used in the RI interface
 	numExpectedMotions				=	1;
 	numMotions						=	0;
@@ -153,6 +160,7 @@ CRendererContext::~CRendererContext() {
 
 	// Ditch the instance objects created
 	CInstance	*cInstance;
+	releaseInstanceMasters();
 	for (cInstance=allocatedInstances->pop();cInstance!=NULL;cInstance=allocatedInstances->pop()) {
 		CObject	*cObject;
 
@@ -181,6 +189,9 @@ CRendererContext::~CRendererContext() {
 	delete currentOptions;
 	currentXform->detach();
 	currentAttributes->detach();
+	releaseInternedStates();
+	delete internedXforms;
+	delete internedAttributes;
 
 	assert(savedXforms					!=	NULL);	
 	assert(savedAttributes				!=	NULL);	
@@ -209,13 +220,30 @@ CRendererContext::~CRendererContext() {
 CXform		*CRendererContext::getXform(int modify) {
 	assert(currentXform	!=	NULL);
 
-	if ((modify) && (currentXform->refCount > 1)) {
-		CXform	*nXform	=	new CXform(currentXform);
+	if (modify) {
+		if (currentXform->refCount > 1) {
+			CXform	*nXform	=	new CXform(currentXform);
 
-		currentXform->detach();
-		currentXform	=	nXform;
+			currentXform->detach();
+			currentXform	=	nXform;
 
-		nXform->attach();
+			nXform->attach();
+		}
+	} else if (currentXform != lastInternedXform) {
+		// The state is about to be shared, so swap it with an identical one if we have it
+		const int	numUnique	=	internedXforms->numItems;
+		CXform		*nXform		=	internedXforms->intern(currentXform);
+
+		stats.numXformStates++;
+		if (internedXforms->numItems != numUnique)	stats.numUniqueXforms++;
+
+		if (nXform != currentXform) {
+			nXform->attach();
+			currentXform->detach();
+			currentXform	=	nXform;
+		}
+
+		lastInternedXform	=	currentXform;
 	}
 
 	return currentXform;
@@ -231,18 +259,49 @@ CXform		*CRendererContext::getXform(int modify) {
 CAttributes	*CRendererContext::getAttributes(int modify) {
 	assert(currentAttributes	!=	NULL);
 
-	if ((modify) && (currentAttributes->refCount > 1)) {
-		CAttributes	*nAttributes	=	new CAttributes(currentAttributes);
+	if (modify) {
+		if (currentAttributes->refCount > 1) {
+			CAttributes	*nAttributes	=	new CAttributes(currentAttributes);
+
+			currentAttributes->detach();
+			currentAttributes	=	nAttributes;
 
-		currentAttributes->detach();
-		currentAttributes	=	nAttributes;
+			nAttributes->attach();
+		}
+	} else if (currentAttributes != lastInternedAttributes) {
+		// The state is about to be shared, so swap it with an identical one if we have it
+		const int	numUnique		=	internedAttributes->numItems;
+		CAttributes	*nAttributes	=	internedAttributes->intern(currentAttributes);
+
+		stats.numAttributeStates++;
+		if (internedAttributes->numItems != numUnique)	stats.numUniqueAttributes++;
+
+		if (nAttributes != currentAttributes) {
+			nAttributes->attach();
+			currentAttributes->detach();
+			currentAttributes	=	nAttributes;
+		}
 
-		nAttributes->attach();
+		lastInternedAttributes	=	currentAttributes;
 	}
 
 	return currentAttributes;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRendererContext
+// Method				:	releaseInternedStates
+// Description			:
+/// \brief					Forget the shared attribute/xform states
+// Return Value			:
+// Comments				:	The states stay alive as long as somebody references them
+void	CRendererContext::releaseInternedStates() {
+	internedXforms->release();
+	internedAttributes->release();
+	lastInternedXform		=	NULL;
+	lastInternedAttributes	=	NULL;
+}
+
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CRendererContext
@@ -404,7 +463,11 @@ void		CRendererContext::processDelayedObject(CShadingContext *context,CDelayedOb
 	currentXform->attach();
 
 	// Execute the subdivision
-	subdivisionFunction(data,screenArea(cDelayed->xform,bmin,bmax));
+	{
+		CProfilerSpan	proceduralSpan(context->thread,PROFILER_PROCEDURAL,"procedural");
+
+		subdivisionFunction(data,screenArea(cDelayed->xform,bmin,bmax));
+	}
 
 	// Restore the graphics state back
 	currentAttributes->detach();									// Restore the graphics state of the delayed object
@@ -438,7 +501,8 @@ void		CRendererContext::processDelayedInstance(CShadingContext *context,CDelayed
 	}
 
 	// Instantiate the objects
-	CObject	*cObject;
+	CProfilerSpan	proceduralSpan(context->thread,PROFILER_PROCEDURAL,"instance");
+	CObject			*cObject;
 	for (cObject=cDelayed->instance;cObject!=NULL;cObject=cObject->sibling)	cObject->instantiate(cAttributes,cDelayed->xform,this);
 
 	// We're not processing a delayed object anymore
@@ -449,6 +513,78 @@ void		CRendererContext::processDelayedInstance(CShadingContext *context,CDelayed
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRendererContext
+// Method				:	processInstanceMaster
+// Description			:
+/// \brief					Create the object space hierarchy shared by instances
+// Return Value			:
+// Comments				:
+void		CRendererContext::processInstanceMaster(CShadingContext *context,CInstanceMaster *cMaster) {
+	CProfilerSpan	proceduralSpan(context->thread,PROFILER_PROCEDURAL,"instanceMaster");
+	CXform			*cXform			=	new CXform;
+	CAttributes		*cAttributes	=	cMaster->attributes;
+	if (currentOptions->flags & OPTIONS_FLAGS_INHERIT_ATTRIBUTES) {
+		cAttributes		=	getAttributes(FALSE);
+	}
+
+	cXform->attach();
+
+	CObject			*cRoot			=	new CDummyObject(cAttributes,cXform);
+
+	// Instantiate the objects in their own space
+	delayed	=	cRoot;
+
+	CObject	*cObject;
+	for (cObject=cMaster->objects;cObject!=NULL;cObject=cObject->sibling)	cObject->instantiate(cAttributes,cXform,this);
+
+	delayed	=	NULL;
+
+	// Create the hierarchy
+	initv(cRoot->bmin,C_INFINITY);
+	initv(cRoot->bmax,-C_INFINITY);
+	for (cObject=cRoot->children;cObject!=NULL;cObject=cObject->sibling) {
+		addBox(cRoot->bmin,cRoot->bmax,cObject->bmin);
+		addBox(cRoot->bmin,cRoot->bmax,cObject->bmax);
+	}
+
+	cRoot->setChildren(context,cRoot->children);
+
+	cXform->detach();
+
+	cMaster->root	=	cRoot;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRendererContext
+// Method				:	expandDelayedInstance
+// Description			:
+/// \brief					Instantiate the objects of an instance without adding them to the hierarchy
+// Return Value			:	The list of objects
+// Comments				:	This is used to rasterize the instances that are raytraced through a master
+CObject		*CRendererContext::expandDelayedInstance(CDelayedInstance *cDelayed) {
+	CInstance		*savedInstance	=	instance;
+	CInstance		expanded;
+
+	CAttributes		*cAttributes	=	cDelayed->attributes;
+	if (currentOptions->flags & OPTIONS_FLAGS_INHERIT_ATTRIBUTES) {
+		cAttributes		=	getAttributes(FALSE);
+	}
+
+	// Collect the objects as if we were inside objectBegin/objectEnd
+	expanded.objects	=	NULL;
+	instance			=	&expanded;
+
+	CObject	*cObject;
+	for (cObject=cDelayed->instance;cObject!=NULL;cObject=cObject->sibling)	cObject->instantiate(cAttributes,cDelayed->xform,this);
+
+	instance			=	savedInstance;
+
+	return expanded.objects;
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CRendererContext
 // Method				:	addObject
@@ -503,13 +639,53 @@ void	CRendererContext::addObject(CObject *o) {
 // Return Value			:
 // Comments				:
 void	CRendererContext::addInstance(const void *d) {
-	const CInstance		*cInstance		=	(const CInstance *) d;
+	CInstance			*cInstance		=	(CInstance *) d;
 	if (cInstance->objects != NULL) {
 		CXform			*cXform			=	getXform(FALSE);
 		CAttributes		*cAttributes	=	getAttributes(FALSE);
+		CInstanceMaster	*cMaster		=	NULL;
+
+		// Instances with the same attributes share the raytracing hierarchy unless they're moving.
+		// The master is displaced in its own space, so displaced instances are expanded as well
+		const int		displaced		=	(cAttributes->displacement != NULL) && (cAttributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS);
+
+		if ((cInstance->expand == FALSE) && (displaced == FALSE) && (cXform->next == NULL) && (instance == NULL)) {
+			for (cMaster=cInstance->masters;cMaster!=NULL;cMaster=cMaster->next) {
+				if (cMaster->attributes == cAttributes)	break;
+			}
+
+			if (cMaster == NULL) {
+				cMaster				=	new CInstanceMaster(cAttributes,cInstance->objects);
+				cMaster->attach();
+				cMaster->next		=	cInstance->masters;
+				cInstance->masters	=	cMaster;
+			}
+		}
 
 		// Instanciate the instance
-		addObject(new CDelayedInstance(cAttributes,cXform,cInstance->objects));
+		addObject(new CDelayedInstance(cAttributes,cXform,cInstance->objects,cMaster));
+	}
+}
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRendererContext
+// Method				:	releaseInstanceMasters
+// Description			:
+/// \brief					Release the shared instance hierarchies at the end of a frame
+// Return Value			:
+// Comments				:
+void	CRendererContext::releaseInstanceMasters() {
+	int	i;
+
+	for (i=0;i<allocatedInstances->numItems;i++) {
+		CInstance		*cInstance	=	allocatedInstances->array[i];
+		CInstanceMaster	*cMaster;
+
+		while((cMaster = cInstance->masters) != NULL) {
+			cInstance->masters	=	cMaster->next;
+			cMaster->detach();
+		}
 	}
 }
 
@@ -728,6 +904,10 @@ void	CRendererContext::RiWorldEnd(void) {
 
 	// Cleanup the frame
 	CRenderer::endFrame();
+
+	// The shared instance hierarchies belong to the frame
+	releaseInstanceMasters();
+	releaseInternedStates();
 	
 	// Restore the graphics state
 	xformEnd();
@@ -1344,14 +1524,29 @@ void	CRendererContext::RiOptionV(const char *name,int n,const char *tokens[],con
 					options->netYBuckets	=	val[1];
 				}
 			optionCheckFlag(RI_INHERITATTRIBUTES,options->flags,					OPTIONS_FLAGS_INHERIT_ATTRIBUTES)
+			optionCheckFlag(RI_TEXTURECOMPRESSION,options->flags,				OPTIONS_FLAGS_COMPRESS_TEXTURES)
+			optionCheckFlag(RI_CACHECOMPRESSION,options->flags,					OPTIONS_FLAGS_COMPRESS_CACHES)
 			optionCheck(RI_GRIDSIZE,			options->maxGridSize,				128,100000,int)
 			optionCheck(RI_EYESPLITS,			options->maxEyeSplits,				1,100000,int)
 			optionCheck(RI_TEXTUREMEMORY,		options->maxTextureSize,			0,(2*1024*1024),int)
 				options->maxTextureSize	*=	1000;								// Convert into bytes
 			optionCheck(RI_BRICKMEMORY,			options->maxBrickSize,				0,100000,int)
 				options->maxBrickSize	*=	1000;								// Convert into bytes
+			optionCheck(RI_PTCMEMORY,			options->maxPtcSize,				0,2000000,int)
+				options->maxPtcSize		*=	1000;								// Convert into bytes
+			optionCheck(RI_PTCPAGESIZE,			options->ptcPageSize,				0,100000000,int)
 			optionCheck(RI_NUMTHREADS,			options->numThreads,				1,32,int)
 			optionCheck(RI_THREADSTRIDE,		options->threadStride,				1,32,int)
+			optionCheck(RI_GRIDMEMORY,			options->maxGridMemory,				0,(2*1024*1024),int)
+				options->maxGridMemory	*=	1000;								// Convert into bytes
+			} else if (strcmp(tokens[i],RI_BUCKETORDER) == 0) {
+				char	*val	=	((char **) params[i])[0];
+				if		(strcmp(val,"horizontal") == 0)	options->bucketOrder	=	BUCKET_ORDER_HORIZONTAL;
+				else if (strcmp(val,"vertical") == 0)	options->bucketOrder	=	BUCKET_ORDER_VERTICAL;
+				else if (strcmp(val,"spiral") == 0)		options->bucketOrder	=	BUCKET_ORDER_SPIRAL;
+				else if (strcmp(val,"hilbert") == 0)	options->bucketOrder	=	BUCKET_ORDER_HILBERT;
+				else if (strcmp(val,"cost") == 0)		options->bucketOrder	=	BUCKET_ORDER_COST;
+				else error(CODE_BADTOKEN,"Unknown bucket order: \"%s\"\n",val);
 			optionCheck(RI_GEOCACHEMEMORY,		options->geoCacheMemory,			0,500000,int)
 				options->geoCacheMemory	*=	1000;								// Convert into bytes
 			optionCheckColor(RI_OTHRESHOLD,		options->opacityThreshold,			0,1)
@@ -1394,6 +1589,8 @@ void	CRendererContext::RiOptionV(const char *name,int n,const char *tokens[],con
 			if (FALSE) {
 			optionCheck(RI_ENDOFFRAME,			options->endofframe,				0,3,int)
 			optionCheckString(RI_FILELOG,		options->filelog)
+			optionCheckString(RI_TRACEFILE,		options->tracefile)
+			optionCheckString(RI_STATSFILE,		options->statsfile)
 			optionCheckFlag(RI_PROGRESS,		options->flags,						OPTIONS_FLAGS_PROGRESS)
 			optionEndCheck
 		}
@@ -2668,6 +2865,9 @@ void	CRendererContext::RiAttributeV(const char *name,int n,const char *tokens[],
 				attributeCheck(RI_MAXDIFFUSEDEPTH,		attributes->maxDiffuseDepth,				0,C_INFINITY,int)
 				attributeCheck(RI_MAXSPECULARDEPTH,		attributes->maxSpecularDepth,				0,C_INFINITY,int)
 				attributeCheckFlag(RI_SAMPLEMOTION,		attributes->flags,							ATTRIBUTES_FLAGS_SAMPLEMOTION)
+				attributeCheckFlag(RI_ROUNDCURVES,		attributes->flags,							ATTRIBUTES_FLAGS_ROUND_CURVES)
+				attributeCheckFlag(RI_ROUNDPOINTS,		attributes->flags,							ATTRIBUTES_FLAGS_ROUND_POINTS)
+				attributeCheck(RI_RADIANCECACHEERROR,	attributes->radianceCacheError,				0,C_INFINITY,float)
 				attributeEndCheck
 			}
 		// Check the irradiance cache options
@@ -2706,6 +2906,7 @@ void	CRendererContext::RiAttributeV(const char *name,int n,const char *tokens[],
 						attributes->photonIor[1]	=	val[1];
 					}
 				attributeCheck(RI_ESTIMATOR,			attributes->photonEstimator,					1,C_INFINITY,int)
+				attributeCheck(RI_MAXERROR,				attributes->photonMaxError,						0,C_INFINITY,float)
 				attributeCheckFlag(RI_ILLUMINATEFRONT,	attributes->flags,								ATTRIBUTES_FLAGS_ILLUMINATE_FRONT_ONLY)
 				attributeEndCheck
 			}
@@ -4366,6 +4567,8 @@ void	*CRendererContext::RiObjectBegin (void) {
 	instanceStack->push(instance);
 	instance			=	new CInstance;
 	instance->objects	=	NULL;
+	instance->masters	=	NULL;
+	instance->expand	=	FALSE;
 	return	instance;
 }
 
@@ -4376,7 +4579,14 @@ void	CRendererContext::RiObjectEnd(void) {
 	CObject	*cObject;
 
 	// Attach to the instanciated objects so that we don't loose them later
-	for (cObject=instance->objects;cObject!=NULL;cObject=cObject->sibling)	cObject->attach();
+	// Some objects can not be shaded through a shared instance, nor displaced in its space
+	for (cObject=instance->objects;cObject!=NULL;cObject=cObject->sibling) {
+		const CAttributes	*cAttributes	=	cObject->attributes;
+
+		cObject->attach();
+		if (cObject->flags & OBJECT_EXPAND_INSTANCE)	instance->expand	=	TRUE;
+		if ((cAttributes->displacement != NULL) && (cAttributes->flags & ATTRIBUTES_FLAGS_DISPLACEMENTS))	instance->expand	=	TRUE;
+	}
 
 	allocatedInstances->push(instance);
 	instance	=	instanceStack->pop();
@@ -4620,14 +4830,14 @@ void	CRendererContext::RiResourceV(const char *handle,const char *type,int n,con
 			if (shading | geometrymodification | geometrydefinition | hiding) {
 				CAttributes	*cAttributes;
 
-				cAttributes	=	getAttributes(FALSE);
+				cAttributes	=	getAttributes(TRUE);
 				cAttributes->restore(cResource->attributes,shading,geometrymodification,geometrydefinition,hiding);
 			}
 
 			if (transform) {
 				CXform		*cXform;
 
-				cXform		=	getXform(FALSE);
+				cXform		=	getXform(TRUE);
 				cXform->restore(cResource->xform);
 			}
 		}
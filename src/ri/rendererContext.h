@@ -52,6 +52,7 @@ class	CPhotonMap;
 class	CParticipatingMedium;
 class	CDelayedObject;
 class	CDelayedInstance;
+class	CInstanceMaster;
 class	CNetFileMapping;
 
 ///////////////////////////////////////////////////////////////////////
@@ -214,9 +215,13 @@ public:
 																			// Delayed object junk
 	void				processDelayedObject(CShadingContext *context,CDelayedObject *,void	(*subdivisionFunction)(void *,float),void *,const float *,const float *);
 	void				processDelayedInstance(CShadingContext *context,CDelayedInstance *instance);
+	void				processInstanceMaster(CShadingContext *context,CInstanceMaster *master);
+	CObject				*expandDelayedInstance(CDelayedInstance *instance);
 
 	void				addObject(CObject *);								// Add an object into the scene
 	void				addInstance(const void *);								// Add an instance into the scene
+	void				releaseInstanceMasters();								// Release the shared instance hierarchies
+	void				releaseInternedStates();								// Release the shared attribute/xform states
 	void				rendererThread(const void *);
 
 private:
@@ -230,6 +235,8 @@ private:
 	class	CInstance {
 	public:
 			CObject			*objects;
+			CInstanceMaster	*masters;			// The shared raytracing hierarchies for the current frame
+			int				expand;				// TRUE if the instances must be expanded for raytracing
 	};
 
 	CArray<CXform *>			*savedXforms;				// Used to save/restore the graphics state
@@ -243,6 +250,10 @@ private:
 	CXform						*currentXform;				// The current graphics state
 	CAttributes					*currentAttributes;
 	COptions					*currentOptions;
+	CInternHash<CXform>			*internedXforms;			// The distinct transformations handed out so far
+	CInternHash<CAttributes>	*internedAttributes;		// The distinct attribute states handed out so far
+	CXform						*lastInternedXform;			// The last state that went through the tables
+	CAttributes					*lastInternedAttributes;
 	CResource					*currentResource;
 															// Some RenderMan Interface related variables
 	int							numExpectedMotions;			// The number of expected motions in a motion block
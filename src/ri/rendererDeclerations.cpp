@@ -107,12 +107,18 @@ void			CRenderer::initDeclarations() {
 	declareVariable(RI_BUCKETSIZE,			"int[2]");
 	declareVariable(RI_METABUCKETS,			"int[2]");
 	declareVariable(RI_INHERITATTRIBUTES,	"int");
+	declareVariable(RI_TEXTURECOMPRESSION,	"int");
+	declareVariable(RI_CACHECOMPRESSION,	"int");
 	declareVariable(RI_GRIDSIZE,			"int");
 	declareVariable(RI_EYESPLITS,			"int");
 	declareVariable(RI_TEXTUREMEMORY,		"int");
 	declareVariable(RI_BRICKMEMORY,			"int");
+	declareVariable(RI_PTCMEMORY,			"int");
+	declareVariable(RI_PTCPAGESIZE,			"int");
 	declareVariable(RI_NUMTHREADS,			"int");
 	declareVariable(RI_THREADSTRIDE,		"int");
+	declareVariable(RI_BUCKETORDER,			"string");
+	declareVariable(RI_GRIDMEMORY,			"int");
 	declareVariable(RI_GEOCACHEMEMORY,		"int");
 	declareVariable(RI_OTHRESHOLD,			"color");
 	declareVariable(RI_ZTHRESHOLD,			"color");
@@ -128,6 +134,8 @@ void			CRenderer::initDeclarations() {
 
 	declareVariable(RI_ENDOFFRAME,			"int");
 	declareVariable(RI_FILELOG,				"string");
+	declareVariable(RI_TRACEFILE,			"string");
+	declareVariable(RI_STATSFILE,			"string");
 	declareVariable(RI_PROGRESS,			"int");
 
 	// File display variables
@@ -160,6 +168,9 @@ void			CRenderer::initDeclarations() {
 	declareVariable(RI_MAXDIFFUSEDEPTH,		"int");
 	declareVariable(RI_MAXSPECULARDEPTH,	"int");
 	declareVariable(RI_SAMPLEMOTION,		"int");
+	declareVariable(RI_ROUNDCURVES,			"int");
+	declareVariable(RI_ROUNDPOINTS,			"int");
+	declareVariable(RI_RADIANCECACHEERROR,	"float");
 
 	declareVariable(RI_HANDLE,				"string");
 	declareVariable(RI_FILEMODE,			"string");
@@ -381,6 +381,9 @@ void	CRenderer::commit(int left,int top,int xpixels,int ypixels,float *pixels) {
 		rcRecv(netClient,&a,		1*sizeof(T32));
 		rcSend(netClient,pixels,xpixels*ypixels*numSamples*sizeof(T32));
 
+		// Send the bucket data before anybody else gets to talk to the client
+		sendBucketDataChannels(left / bucketWidth,top / bucketHeight);
+
 		// Unlock network
 		osUnlock(networkMutex);
 
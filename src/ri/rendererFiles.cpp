@@ -46,6 +46,7 @@
 #include "options.h"
 #include "netFileMapping.h"
 #include "pointHierarchy.h"
+#include "volume.h"
 
 
 // This one is defined in sdr.y
@@ -361,7 +362,7 @@ CTexture3d		*CRenderer::getCache(const char *name,const char *mode,const float *
 					
 					// Create the cache
 					if (strcmp(type,fileIrradianceCache) == 0) {
-						cache	=	new CIrradianceCache(name,flags,in,from,to,NULL);
+						cache	=	new CIrradianceCache(name,flags,in,from,to,NULL,fileName);
 					} else {
 						error(CODE_BUG,"Unable to recognize the file format of \"%s\"\n",name);
 						fclose(in);
@@ -464,7 +465,9 @@ CTexture3d			*CRenderer::getTexture3d(const char *name,int write,const char* cha
 				requestRemoteChannel(new CRemotePtCloudChannel(cloud));
 			} else {
 				// alloate a point cloud which will be written to disk
-				texture3d	=	new CPointCloud(name,from,to,CRenderer::toNDC,channels,TRUE);
+				CPointCloud	*cloud	=	new CPointCloud(name,from,to,CRenderer::toNDC,channels,TRUE);
+				cloud->setPageSize(ptcPageSize);
+				texture3d			=	cloud;
 			}
 			
 		} else {
@@ -473,10 +476,19 @@ CTexture3d			*CRenderer::getTexture3d(const char *name,int write,const char* cha
 				// Try to open the file
 				if ((in	=	ropen(fileName,"rb",filePointCloud,TRUE)) != NULL) {
 					if (hierarchy == TRUE) {
-						texture3d	=	new CPointHierarchy(name,from,to,in);
+						texture3d	=	new CPointHierarchy(name,from,to,in,fileName);
 					} else {
 						texture3d	=	new CPointCloud(name,from,to,in);
 					}
+				} else if ((in	=	ropen(fileName,"rb",filePagedPointCloud,TRUE)) != NULL) {
+					if (hierarchy == TRUE) {
+						// The hierarchy needs every point in memory
+						error(CODE_BADFILE,"Paged point cloud \"%s\" can not be used for point based lookups\n",name);
+						fclose(in);
+						in	=	NULL;
+					} else {
+						texture3d	=	new CPointCloud(name,from,to,in,TRUE);
+					}
 				} else {
 					if ((in	=	ropen(fileName,"rb",fileBrickMap,TRUE)) != NULL) {
 						texture3d	=	new CBrickMap(in,name,from,to);
@@ -501,6 +513,52 @@ CTexture3d			*CRenderer::getTexture3d(const char *name,int write,const char* cha
 	return (CPointCloud *) texture3d;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRenderer
+// Method				:	getVolume
+// Description			:
+/// \brief					Get a brickmap prepared for ray marching
+// Return Value			:
+// Comments				:	The volumes are kept apart from the 3d textures since
+//							they own a separate copy of the brickmap
+CVolume				*CRenderer::getVolume(const char *name,const char *channel,const float *from,const float *to) {
+	CFileResource	*volume;
+	char			volumeName[OS_MAX_PATH_LENGTH];
+	char			fileName[OS_MAX_PATH_LENGTH];
+	FILE			*in;
+
+	assert(name != NULL);
+	assert(frameFiles != NULL);
+
+	sprintf(volumeName,"volume3d:%s:%s",channel,name);
+
+	if (frameFiles->find(volumeName,volume) == FALSE) {
+		CBrickMap	*map	=	NULL;
+
+		if (from == NULL) {
+			from	=	world->from;
+			to		=	world->to;
+		}
+
+		// Locate the file
+		if (locateFile(fileName,name,texturePath)) {
+			if ((in	=	ropen(fileName,"rb",fileBrickMap,TRUE)) != NULL) {
+				map		=	new CBrickMap(in,name,from,to);
+			} else {
+				error(CODE_BADFILE,"\"%s\" is not a brickmap\n",name);
+			}
+		} else {
+			error(CODE_BADTOKEN,"Cannot find or open Texture3D file \"%s\"\n",name);
+		}
+
+		// We keep the volume even if we failed so that we don't try again
+		volume	=	new CVolume(volumeName,map,channel);
+		frameFiles->insert(volume->name,volume);
+	}
+
+	return (CVolume *) volume;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CRendererContext
 // Method				:	getShader
@@ -662,12 +720,18 @@ static	int	dsoLoadCallback(const char *file,void *ud) {
 						dsoInitFunction		*init		=	(dsoInitFunction *) userData[2];
 						dsoExecFunction		*exec		=	(dsoExecFunction *) userData[3];
 						dsoCleanupFunction	*cleanup	=	(dsoCleanupFunction *) userData[4];
+						dsoBatchFunction	*batch		=	(dsoBatchFunction *) userData[5];
+						char				batchName[OS_MAX_PATH_LENGTH];
 
 						// Bingo
 						init[0]		=	(dsoInitFunction)		osResolve(module,shadeops[i].init);
 						exec[0]		=	(dsoExecFunction)		osResolve(module,dsoName);
 						cleanup[0]	=	(dsoCleanupFunction)	osResolve(module,shadeops[i].cleanup);
 
+						// The batch entry point is optional
+						sprintf(batchName,"%s_batch",dsoName);
+						batch[0]	=	(dsoBatchFunction)		osResolve(module,batchName);
+
 						if (exec != NULL) {
 							free(dsoName);
 							free(dsoPrototype);
@@ -719,18 +783,21 @@ CDSO				*CRenderer::getDSO(const char *name,const char *prototype) {
 	
 	dsoInitFunction		init;
 	dsoExecFunction		exec;
+	dsoBatchFunction	batch;
 	dsoCleanupFunction	cleanup;
 
 	init		=	NULL;
 	exec		=	NULL;
+	batch		=	NULL;
 	cleanup		=	NULL;
 
-	void	*userData[5];
+	void	*userData[6];
 	userData[0]	=	(void *) name;
 	userData[1]	=	(void *) prototype;
 	userData[2]	=	&init;
 	userData[3]	=	&exec;
 	userData[4]	=	&cleanup;
+	userData[5]	=	&batch;
 
 	// Go over the directories
 	TSearchpath			*inPath	=	proceduralPath;
@@ -740,7 +807,7 @@ CDSO				*CRenderer::getDSO(const char *name,const char *prototype) {
 		osEnumerate(searchPath,dsoLoadCallback,userData);
 	}
 
-	if (exec != NULL) {
+	if ((exec != NULL) || (batch != NULL)) {
 		void	*handle;
 
 		// OK, we found the shader
@@ -751,6 +818,7 @@ CDSO				*CRenderer::getDSO(const char *name,const char *prototype) {
 		cDso			=	new CDSO;
 		cDso->init		=	init;
 		cDso->exec		=	exec;
+		cDso->batch		=	batch;
 		cDso->cleanup	=	cleanup;
 		cDso->handle	=	handle;
 		cDso->name		=	strdup(name);
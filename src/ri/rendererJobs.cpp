@@ -32,12 +32,224 @@
 #include "renderer.h"
 #include "shading.h"
 #include "stats.h"
+#include "profiler.h"
 #include "error.h"
 
 void			(*CRenderer::dispatchJob)(int thread,CJob &job)	=	NULL;
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	hilbertPoint
+// Description			:
+/// \brief					Map a distance along the Hilbert curve into a point
+// Return Value			:	-
+// Comments				:	n must be a power of 2
+static	void	hilbertPoint(int n,int d,int &x,int &y) {
+	int	s,rx,ry,t;
+
+	x	=	0;
+	y	=	0;
+	for (s=1;s<n;s*=2) {
+		rx	=	1 & (d / 2);
+		ry	=	1 & (d ^ rx);
+
+		// Rotate the quadrant
+		if (ry == 0) {
+			if (rx == 1) {
+				x	=	s-1-x;
+				y	=	s-1-y;
+			}
+
+			t	=	x;
+			x	=	y;
+			y	=	t;
+		}
+
+		x	+=	s*rx;
+		y	+=	s*ry;
+		d	/=	4;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	costGreater
+// Description			:
+/// \brief					Compare two buckets for the cost order heap
+// Return Value			:	TRUE if a should be rendered before b
+// Comments				:	Ties go to the bucket that comes first in the scanline order
+static	inline	int	costGreater(const float *cost,int a,int b) {
+	return (cost[a] > cost[b]) || ((cost[a] == cost[b]) && (a < b));
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	costOrder
+// Description			:
+/// \brief					Compute the cost driven bucket order
+// Return Value			:	-
+// Comments				:	We start from the most expensive bucket and keep growing
+//							the rendered region towards its most expensive neighbour.
+//							This gets the expensive buckets going early while keeping
+//							the rendered region connected so that the deferred grids
+//							do not need to wait for distant buckets
+static	void	costOrder(int *sequence,const float *cost,int xBuckets,int yBuckets) {
+	const int	numBuckets	=	xBuckets*yBuckets;
+	int			*heap		=	new int[numBuckets*4 + 2];
+	char		*visited	=	new char[numBuckets];
+	int			numItems	=	1;
+	int			numVisited	=	0;
+	int			i,first;
+
+	memset(visited,0,numBuckets*sizeof(char));
+
+	// Seed with the most expensive bucket
+	for (first=0,i=1;i<numBuckets;i++) {
+		if (costGreater(cost,i,first))	first	=	i;
+	}
+
+	heap[numItems++]	=	first;
+
+	while(numItems > 1) {
+		const int	bucket	=	heap[1];
+		int			parent,child;
+
+		// Remove the top of the heap
+		heap[1]	=	heap[--numItems];
+		for (parent=1;(child = parent*2) < numItems;parent=child) {
+			if ((child+1 < numItems) && costGreater(cost,heap[child+1],heap[child]))	child++;
+			if (costGreater(cost,heap[parent],heap[child]))	break;
+
+			const int	tmp	=	heap[parent];
+			heap[parent]	=	heap[child];
+			heap[child]		=	tmp;
+		}
+
+		if (visited[bucket])	continue;
+
+		visited[bucket]				=	TRUE;
+		sequence[numVisited++]		=	bucket;
+
+		// Push the neighbours
+		const int	x			=	bucket % xBuckets;
+		const int	y			=	bucket / xBuckets;
+		const int	neighbours[4]	=	{	(x > 0)				? bucket - 1		: -1,
+											(x < xBuckets-1)	? bucket + 1		: -1,
+											(y > 0)				? bucket - xBuckets	: -1,
+											(y < yBuckets-1)	? bucket + xBuckets	: -1	};
+
+		for (i=0;i<4;i++) {
+			if ((neighbours[i] < 0) || visited[neighbours[i]])	continue;
+
+			for (child=numItems++;child > 1;child=parent) {
+				parent	=	child / 2;
+				if (costGreater(cost,heap[parent],neighbours[i]))	break;
+				heap[child]	=	heap[parent];
+			}
+			heap[child]	=	neighbours[i];
+		}
+	}
+
+	assert(numVisited == numBuckets);
+
+	delete [] visited;
+	delete [] heap;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRenderer
+// Method				:	beginBucketOrder
+// Description			:
+/// \brief					Compute the order the buckets will be rendered in
+// Return Value			:	-
+// Comments				:	The cost driven order needs the scene, so until endBucketOrder
+//							the buckets are in the scanline order and the costs are collected
+//							as the objects are inserted
+void			CRenderer::beginBucketOrder() {
+	const int	numBuckets	=	xBuckets*yBuckets;
+	int			i,x,y;
+
+	bucketSequence	=	(int *) ralloc(numBuckets*sizeof(int),CRenderer::globalMemory);
+	bucketRank		=	(int *) ralloc(numBuckets*sizeof(int),CRenderer::globalMemory);
+	bucketCost		=	NULL;
+
+	switch(bucketOrder) {
+	case BUCKET_ORDER_VERTICAL:
+		for (i=0,x=0;x<xBuckets;x++) {
+			for (y=0;y<yBuckets;y++)	bucketSequence[i++]	=	y*xBuckets + x;
+		}
+		break;
+	case BUCKET_ORDER_SPIRAL:
+		{
+			// Walk a square spiral from the center outwards, skipping the buckets outside the image
+			const int	dx[4]	=	{1,0,-1,0};
+			const int	dy[4]	=	{0,1,0,-1};
+			int			length,direction,j;
+
+			x	=	(xBuckets-1) / 2;
+			y	=	(yBuckets-1) / 2;
+			i	=	0;
+			bucketSequence[i++]	=	y*xBuckets + x;
+			for (length=1,direction=0;i<numBuckets;direction=(direction+1) & 3) {
+				for (j=0;j<length;j++) {
+					x	+=	dx[direction];
+					y	+=	dy[direction];
+					if ((x >= 0) && (x < xBuckets) && (y >= 0) && (y < yBuckets))	bucketSequence[i++]	=	y*xBuckets + x;
+				}
+
+				// The run length grows every second turn
+				if (direction & 1)	length++;
+			}
+		}
+		break;
+	case BUCKET_ORDER_HILBERT:
+		{
+			int	n,d;
+
+			for (n=1;(n < xBuckets) || (n < yBuckets);n*=2);
+
+			for (i=0,d=0;d<n*n;d++) {
+				hilbertPoint(n,d,x,y);
+				if ((x < xBuckets) && (y < yBuckets))	bucketSequence[i++]	=	y*xBuckets + x;
+			}
+		}
+		break;
+	case BUCKET_ORDER_COST:
+		bucketCost	=	(float *) ralloc(numBuckets*sizeof(float),CRenderer::globalMemory);
+		for (i=0;i<numBuckets;i++)	bucketCost[i]	=	0;
+
+		// Scanline order until endBucketOrder sorts the buckets by cost
+		for (i=0;i<numBuckets;i++)	bucketSequence[i]	=	i;
+		break;
+	default:
+		for (i=0;i<numBuckets;i++)	bucketSequence[i]	=	i;
+		break;
+	}
+
+	for (i=0;i<numBuckets;i++)	bucketRank[bucketSequence[i]]	=	i;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CRenderer
+// Method				:	endBucketOrder
+// Description			:
+/// \brief					Compute the cost driven order once the scene is inserted
+// Return Value			:	-
+// Comments				:	Called right before the rendering threads are started
+void			CRenderer::endBucketOrder() {
+	const int	numBuckets	=	xBuckets*yBuckets;
+	int			i;
+
+	if (bucketCost == NULL)	return;
+
+	costOrder(bucketSequence,bucketCost,xBuckets,yBuckets);
+	for (i=0;i<numBuckets;i++)	bucketRank[bucketSequence[i]]	=	i;
+
+	bucketCost	=	NULL;
+
+	// The objects need to move into their new first buckets
+	for (i=0;i<numThreads;i++)	contexts[i]->reorderBuckets();
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -87,51 +299,81 @@ void			CRenderer::dispatchReyes(int thread,CJob &job) {
 
 
 	// Lock the bucket info
-	osLock(jobMutex);
+	profilerLock(jobMutex,thread,"jobMutex");
 
-	// If we're done, tell the hider to terminate
-	if (hiderFlags & (HIDER_DONE | HIDER_BREAK)) {
-		job.type	=	CJob::TERMINATE;
-	} else {
-		int	x,y;
+	while(TRUE) {
+
+		// If we're done, tell the hider to terminate
+		if (hiderFlags & (HIDER_DONE | HIDER_BREAK)) {
+			job.type	=	CJob::TERMINATE;
+			break;
+		}
+
+		const int	numBuckets	=	xBuckets*yBuckets;
+		const int	overBudget	=	(maxGridMemory > 0) && (stats.gridMemory > maxGridMemory);
+		int			rank		=	contexts[thread]->currentBucket;
+		int			wait		=	FALSE;
 
 		// Find the bucket for this thread to render
-		x	=	contexts[thread]->currentXBucket;
-		y	=	contexts[thread]->currentYBucket;
-		while(TRUE) {
+		for (;rank<numBuckets;rank++) {
+			const int	owner	=	jobAssignment[bucketSequence[rank]];
 
 			// Has this bucket been assigned to soneone ?
-			if (jobAssignment[y*xBuckets+x]	== -1) {
-				int	i;
+			if (owner == -1) {
+				int	i,stride;
+
+				// If the grids are over the budget, keep the threads close to the slowest
+				// one so that the grids it is holding on to can be released
+				if (overBudget) {
+					int	slowest	=	numBuckets;
+
+					for (i=0;i<numThreads;i++) {
+						if (i != thread)	slowest	=	min(slowest,contexts[i]->currentBucket);
+					}
+
+					if ((contexts[thread]->currentBucket > slowest) && (rank > slowest + numThreads)) {
+						wait	=	TRUE;
+						break;
+					}
+
+					stride	=	1;
+				} else {
+					stride	=	threadStride;
+				}
 
 				// Nop, allocate the next stride of buckets to this thread
-				for (i=0;i<threadStride;i++) {
-					if ((y*xBuckets+x+i) < (xBuckets*yBuckets))	jobAssignment[y*xBuckets+x+i] = thread;
+				for (i=0;(i<stride) && (rank+i < numBuckets);i++) {
+					if (jobAssignment[bucketSequence[rank+i]] == -1)	jobAssignment[bucketSequence[rank+i]] = thread;
 				}
 
 				break;
 
 			// Has it been assigned to me?
-			} else if (jobAssignment[y*xBuckets+x]	== thread) {
+			} else if (owner == thread) {
 				break;
+			}
 
 			// OK, it has been assigned to someone else ... Skip this bucket
-			} else {
-				x++;
-				if (x >= xBuckets) {
-					x = 0;
-					y++;
-					if (y >= yBuckets) break;
-				}
-			}
 		}
 
+		// Give the slower threads a chance to catch up
+		if (wait) {
+			stats.numDispatchStalls++;
+			osUnlock(jobMutex);
+			{
+				CProfilerSpan	stallSpan(thread,PROFILER_WAIT,"gridMemory");
+
+				osSleep(1);
+			}
+			profilerLock(jobMutex,thread,"jobMutex");
+			continue;
+		}
 
 		// Did we find the bucket ?
-		if (y < yBuckets) {
+		if (rank < numBuckets) {
 			job.type	=	CJob::BUCKET;
-			job.xBucket	=	x;
-			job.yBucket	=	y;
+			job.xBucket	=	bucketSequence[rank] % xBuckets;
+			job.yBucket	=	bucketSequence[rank] / xBuckets;
 		} else {
 			job.type	=	CJob::TERMINATE;
 			numActiveThreads--;
@@ -141,6 +383,8 @@ void			CRenderer::dispatchReyes(int thread,CJob &job) {
 		if (numActiveThreads == 0) {
 			CRenderer::hiderFlags |=	HIDER_DONE | HIDER_BREAK;
 		}
+
+		break;
 	}
 
 	// Release the bucket info
@@ -159,7 +403,7 @@ void			CRenderer::dispatchReyes(int thread,CJob &job) {
 void			CRenderer::dispatchPhoton(int thread,CJob &job) {
 
 	// Lock
-	osLock(jobMutex);
+	profilerLock(jobMutex,thread,"jobMutex");
 
 	if (currentPhoton < numEmitPhotons) {
 
@@ -198,32 +442,23 @@ void			CRenderer::dispatchPhoton(int thread,CJob &job) {
 // Return Value			:	TRUE if we're still rendering, FALSE otherwise
 // Comments				:
 int				CRenderer::advanceBucket(int index,int &x,int &y) {
-
-
-// Advance bucket indices
-#define	advance(__x,__y)									\
-		__x++;												\
-		if (__x == xBuckets) {								\
-			__x	=	0;										\
-			__y++;											\
-			if (__y == yBuckets)	{						\
-				return FALSE;								\
-			}												\
-		}
+	const int	numBuckets	=	xBuckets*yBuckets;
+	int			rank;
 
 // Find the server index assigned to this job
 #define	bucket(__x,__y)		jobAssignment[__y*xBuckets + __x]
 
 	// Are we just starting ?
 	if ((x == -1) || (y == -1)) {
-		x	=	0;			// Begin from the start
-		y	=	0;
+		rank	=	0;								// Begin from the start
 	} else {
-		advance(x,y);		// Advance the bucket by one
+		rank	=	bucketRank[y*xBuckets + x] + 1;	// Advance the bucket by one
 	}
 	
-	// Scan forward from (cx,cy) to find the first bucket to render
-	while(TRUE) {
+	// Scan forward in the bucket order to find the first bucket to render
+	for (;rank<numBuckets;rank++) {
+		x	=	bucketSequence[rank] % xBuckets;
+		y	=	bucketSequence[rank] / xBuckets;
 
 		// Has the bucket been assigned before ?
 		if (bucket(x,y) == -1) {
@@ -237,7 +472,7 @@ int				CRenderer::advanceBucket(int index,int &x,int &y) {
 			// Assign the meta block to this processor
 			for (i=left;i<right;i++) {
 				for (j=top;j<bottom;j++) {
-					bucket(i,j)	=	index;
+					if (bucket(i,j) == -1)	bucket(i,j)	=	index;
 				}
 			}
 
@@ -245,16 +480,18 @@ int				CRenderer::advanceBucket(int index,int &x,int &y) {
 
 			// We found the job !!!
 			return TRUE;
-		} else if (bucket(x,y) != index) {
-
-			// This bucket has been pre-allocated to another server, skip over
-			advance(x,y);
-		} else {
+		} else if (bucket(x,y) == index) {
 
 			// This bucket has been pre-allocated to us, proceed
 			return TRUE;
 		}
+
+		// This bucket has been pre-allocated to another server, skip over
 	}
+
+#undef bucket
+
+	return FALSE;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -88,6 +88,8 @@ TMutex							CRenderer::networkMutex;
 //	Also used to ensure we only have one thread re-tesselating a level if 
 //	TESSELATION_LOCK_PER_ENTRY is not enabled (but it is by default)
 //
+//	Also used to publish the radiance cache of a tesselation patch
+//
 //	VERIFIED
 /////////////////////////////////////////////////////////////
 TMutex							CRenderer::tesselateMutex;
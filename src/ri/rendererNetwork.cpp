@@ -127,7 +127,7 @@ void		rcSend(SOCKET s,const void *dataToSend,int n,int toNetwork) {
 	}
 
 
-	stats.totalNetSend	+=	n;
+	stats.addShared(STAT_NET_SEND,n);
 }
 
 
@@ -169,7 +169,7 @@ void		rcRecv(SOCKET s,void *dataToReceive,int n,int toNetwork) {
 		}
 	}
 
-	stats.totalNetRecv	+=	n;
+	stats.addShared(STAT_NET_RECV,n);
 }
 
 
@@ -35,6 +35,7 @@
 #include "ri_config.h"
 #include "ri.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "points.h"
 #include "reyes.h"
@@ -46,6 +47,7 @@
 #if 0
 	#define __logPushRight(__object,__x,__y)				fprintf(stderr,"\t->object %x pushed right to %d,%d in thread %d\n",__object,__x,__y,thread);
 	#define __logPushDown(__object,__x,__y)					fprintf(stderr,"\t->object %x pushed down to %d,%d in thread %d\n",__object,__x,__y,thread);
+	#define __logPushAhead(__object,__x,__y)				fprintf(stderr,"\t->object %x pushed ahead to %d,%d in thread %d\n",__object,__x,__y,thread);
 	#define __logPushDiscard(__object,__x,__y)				fprintf(stderr,"\t->object %x discarded on push at %d,%d in thread %d\n",__object,__x,__y,thread);
 	#define	__logObjectDequeue(__object,__x,__y)			fprintf(stderr,"\t->object %x dequeued at %d,%d in thread %d\n",__object,__x,__y,thread);
 	#define __logObjectRasterizeDice(_object,__x,__y)		fprintf(stderr,"->object %x rasterized / diced at %d,%d in thread %d\n",__object,__x,__y,thread);
@@ -60,6 +62,7 @@
 #else
 	#define __logPushRight(__object,__x,__y)
 	#define __logPushDown(__object,__x,__y)
+	#define __logPushAhead(__object,__x,__y)
 	#define __logPushDiscard(__object,__x,__y)
 	#define	__logObjectDequeue(__object,__x,__y)
 	#define __logObjectRasterizeDice(_object,__x,__y)
@@ -120,8 +123,20 @@
 
 
 // Defer the object to the next bucket that'll need it (buckets must be locked)
+// For the scanline order, this is either the bucket on the right or the first bucket on the next row
 #define	objectDefer(__cObject)																					\
-	if (		(__cObject->xbound[1] >= tbucketRight)	&&	(currentXBucket < CRenderer::xBucketsMinusOne)) {	\
+	if (CRenderer::bucketOrder != BUCKET_ORDER_HORIZONTAL) {													\
+		const int	nb	=	findBucket(__cObject,currentBucket+1);												\
+																												\
+		if (nb >= 0) {																							\
+			objectExplicitInsert(__cObject,nb % CRenderer::xBuckets,nb / CRenderer::xBuckets);					\
+			__logPushAhead(__cObject,nb % CRenderer::xBuckets,nb / CRenderer::xBuckets);						\
+		} else {																								\
+			__logPushDiscard(__cObject,currentXBucket,currentYBucket);											\
+			__cObject->next[thread]	=	objectsToDelete;														\
+			objectsToDelete			=	__cObject;																\
+		}																										\
+	} else if (	(__cObject->xbound[1] >= tbucketRight)	&&	(currentXBucket < CRenderer::xBucketsMinusOne)) {	\
 		assert(buckets[currentYBucket][currentXBucket+1] != NULL);												\
 																												\
 		objectExplicitInsert(__cObject,currentXBucket+1,currentYBucket);										\
@@ -145,12 +160,12 @@
 		CRasterObject	*cObject;						\
 		while((cObject = __objects) != NULL) {			\
 			__objects	=	__objects->next[thread];	\
-			osLock(cObject->mutex);						\
+			spinLock(cObject->lock);					\
 			cObject->refCount--;						\
 			if (cObject->refCount == 0) {				\
 				deleteObject(cObject);					\
 			} else {									\
-				osUnlock(cObject->mutex);				\
+				spinUnlock(cObject->lock);				\
 			}											\
 		}												\
 	}
@@ -220,6 +235,12 @@ CReyes::CReyes(int thread) : CShadingContext(thread) {
 	numGridsShaded		=	0;
 	numGridsCreated		=	0;
 	numVerticesCreated	=	0;
+	numBlocksAllocated	=	0;
+	numBlocksRecycled	=	0;
+
+	// Nothing to recycle yet
+	for (int i=0;i<RASTER_MEMORY_NUM_BLOCKS;i++)	freeBlocks[i]	=	NULL;
+	freeBlockMemory		=	0;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -254,12 +275,25 @@ CReyes::~CReyes() {
 	osUnlock(bucketMutex);		// Unlock the mutex
 	osDeleteMutex(bucketMutex);	// Destroy the _unlocked_ mutex
 
+	// Release the recycled blocks (the objects other threads still hold go to their own lists)
+	for (int i=0;i<RASTER_MEMORY_NUM_BLOCKS;i++) {
+		void	*cBlock;
+
+		while((cBlock = freeBlocks[i]) != NULL) {
+			freeBlocks[i]	=	*((void **) cBlock);
+			free_untyped(cBlock);
+		}
+	}
+	atomicAdd64(&stats.rasterCacheMemory,-freeBlockMemory);
+
 	// Update the global stats
-	stats.numRasterGridsCreated		+=	numGridsCreated;
-	stats.numRasterVerticesCreated	+=	numVerticesCreated;
-	stats.numRasterGridsShaded		+=	numGridsShaded;
-	stats.numRasterGridsRendered	+=	numGridsRendered;
-	stats.numRasterQuadsRendered	+=	numQuadsRendered;
+	stats.add(thread,STAT_RASTER_GRIDS_CREATED,		numGridsCreated);
+	stats.add(thread,STAT_RASTER_VERTICES_CREATED,	numVerticesCreated);
+	stats.add(thread,STAT_RASTER_GRIDS_SHADED,		numGridsShaded);
+	stats.add(thread,STAT_RASTER_GRIDS_RENDERED,	numGridsRendered);
+	stats.add(thread,STAT_RASTER_QUADS_RENDERED,	numQuadsRendered);
+	stats.add(thread,STAT_RASTER_BLOCKS_ALLOCATED,	numBlocksAllocated);
+	stats.add(thread,STAT_RASTER_BLOCKS_RECYCLED,	numBlocksRecycled);
 }
 
 
@@ -337,9 +371,16 @@ void	CReyes::render() {
 
 	__logBucketStart(currentXBucket,currentYBucket);
 
+	// Record the time we spend on this bucket
+	CProfilerSpan	bucketSpan(thread,PROFILER_BUCKET,"bucket",currentXBucket,currentYBucket);
+
 	// Initialize the opaque depths
 	maxDepth					=	C_INFINITY;
 
+	// Record the grids we're holding on to
+	atomicAdd(&stats.numRetainedGrids,stats.numRasterGrids);
+	atomicIncrement(&stats.numBucketsRendered);
+
 	// Insert the objects into the queue
 	osLock(bucketMutex);
 	CBucket			*cBucket	=	buckets[currentYBucket][currentXBucket];
@@ -394,7 +435,7 @@ void	CReyes::render() {
 				continue;
 			} else {
 				// Dice the object
-				osLock(cObject->mutex);
+				spinLock(cObject->lock);
 
 				// Did we dice this object before ?
 				if (cObject->diced == FALSE) {
@@ -404,6 +445,7 @@ void	CReyes::render() {
 						tbucketLeft,
 						tbucketTop,
 						cObject->zmin)) {
+						CProfilerSpan	diceSpan(thread,PROFILER_DICE,"dice");
 
 						cObject->object->dice(this);
 						cObject->diced	=	TRUE;
@@ -411,7 +453,7 @@ void	CReyes::render() {
 						// We have discovered that the object is occluded
 						// defer it
 						CRasterObject		*objectsToDelete	=	NULL;
-						osUnlock(cObject->mutex);
+						spinUnlock(cObject->lock);
 						osLock(bucketMutex);				
 						objectDefer(cObject);
 						osUnlock(bucketMutex);
@@ -426,7 +468,7 @@ void	CReyes::render() {
 					deleteObject(cObject);
 				} else {
 					// Unlock the object
-					osUnlock(cObject->mutex);
+					spinUnlock(cObject->lock);
 				}
 
 				// Keep going
@@ -497,11 +539,10 @@ void	CReyes::render() {
 		#endif
 		
 		// Flush the data to the out devices
-		CRenderer::commit(bucketPixelLeft,bucketPixelTop,bucketPixelWidth,bucketPixelHeight,pixelBuffer);
-		
-		// Send bucket data if we're a netrender
-		if (CRenderer::netClient != INVALID_SOCKET) {
-			CRenderer::sendBucketDataChannels(currentXBucket,currentYBucket);
+		{
+			CProfilerSpan	displaySpan(thread,PROFILER_DISPLAY,"commit");
+
+			CRenderer::commit(bucketPixelLeft,bucketPixelTop,bucketPixelWidth,bucketPixelHeight,pixelBuffer);
 		}
 
 	// Restore the memory
@@ -515,11 +556,7 @@ void	CReyes::render() {
 	delete cBucket;
 
 	// Advance the bucket
-	currentXBucket++;
-	if (currentXBucket == CRenderer::xBuckets) {		
-		currentXBucket	=	0;
-		currentYBucket++;
-	}
+	gotoBucket(currentBucket+1);
 
 	// Unlock the bucket
 	osUnlock(bucketMutex);
@@ -554,11 +591,7 @@ void	CReyes::skip() {
 	buckets[currentYBucket][currentXBucket]	=	NULL;
 
 	// Advance the bucket
-	currentXBucket++;
-	if (currentXBucket == CRenderer::xBuckets) {		
-		currentXBucket	=	0;
-		currentYBucket++;
-	}
+	gotoBucket(currentBucket+1);
 	osUnlock(bucketMutex);
 
 	// Delete the objects we do not need
@@ -618,6 +651,8 @@ void		CReyes::drawObject(CObject *object) {
 			if (CRenderer::inFrustrum(bmin,bmax)) {	// Are we in the frustrum ?
 													// If we can not make the perspective divide
 													// Go ahead and process the object now
+				CProfilerSpan	diceSpan(thread,PROFILER_DICE,"dice");
+
 				object->dice(this);
 			}
 
@@ -859,10 +894,10 @@ void		CReyes::shadeGrid(CRasterGrid *grid,int Ponly) {
 
 	// Make sure we shade a grid only once
 	if (Ponly == FALSE) {
-		osLock(grid->mutex);
+		spinLock(grid->lock);
 
 		if (!(grid->flags & RASTER_UNSHADED)) {
-			osUnlock(grid->mutex);
+			spinUnlock(grid->lock);
 			return;
 		}
 	}
@@ -1116,12 +1151,12 @@ void		CReyes::shadeGrid(CRasterGrid *grid,int Ponly) {
 		}
 	}
 
-	// If we've been shading, reset the flags and unlock the mutex
+	// If we've been shading, reset the flags and unlock the grid
 	if (Ponly == FALSE)	{
 		assert(grid->flags & RASTER_UNSHADED);
 		grid->flags		&=	~(RASTER_UNSHADED | RASTER_SHADE_HIDDEN | RASTER_SHADE_BACKFACE | RASTER_UNDERCULL);
 
-		osUnlock(grid->mutex);
+		spinUnlock(grid->lock);
 	}
 }
 
@@ -1289,14 +1324,17 @@ void			CReyes::copySamples(int numVertices,float **varying,float *vertices,int s
 /// \note					Thread safe
 CReyes::CRasterObject		*CReyes::newObject(CObject *cObject) {
 	CRasterObject	*nObject;
+	int				block;
 
-	nObject				=	new CRasterObject;
-	nObject->next		=	new CRasterObject*[CRenderer::numThreads];
+	// The object and its next pointers live in the same block
+	nObject				=	(CRasterObject *) allocateBlock(sizeof(CRasterObject) + CRenderer::numThreads*sizeof(CRasterObject *),block);
+	nObject->next		=	(CRasterObject **) (nObject + 1);
 	nObject->object		=	cObject;	
 	nObject->diced		=	FALSE;	// FIXME: Can combine diced and grid into one integer
 	nObject->grid		=	FALSE;
 	nObject->refCount	=	0;
-	osCreateMutex(nObject->mutex);
+	nObject->block		=	block;
+	spinCreate(nObject->lock);
 
 	cObject->attach();
 
@@ -1316,31 +1354,41 @@ CReyes::CRasterObject		*CReyes::newObject(CObject *cObject) {
 /// \note					Thread safe
 CReyes::CRasterGrid		*CReyes::newGrid(CSurface *object,int points,int numVerticesU,int numVerticesV) {
 	CRasterGrid		*grid;
+	int				block;
+
+	const int numVertices	=	numVerticesU*numVerticesV;
+	const int numBounds		=	(points) ? numVertices : (numVerticesU-1)*(numVerticesV-1);
+	const int numSizes		=	(points) ? numVertices*2 : 0;
 
-	const int numVertices = numVerticesU*numVerticesV;
+	// The grid, its next pointers, vertices, bounds and sizes all live in the same block
+	const int headerSize	=	(int) ((sizeof(CRasterGrid) + CRenderer::numThreads*sizeof(CRasterObject *) + 15) & ~15);
+	const int dataSize		=	numVertices*numVertexSamples*sizeof(float) + numBounds*4*sizeof(int) + numSizes*sizeof(float);
+	char	*data			=	(char *) allocateBlock(headerSize + dataSize,block);
 
-	grid				=	new CRasterGrid;
-	grid->next			=	new CRasterObject*[CRenderer::numThreads];
+	grid				=	(CRasterGrid *) data;
+	grid->next			=	(CRasterObject **) (grid + 1);
 	grid->object		=	object;
 	grid->diced			=	TRUE;
 	grid->grid			=	TRUE;
 	grid->refCount		=	0;
-	osCreateMutex(grid->mutex);
+	grid->block			=	block;
+	spinCreate(grid->lock);
 
-	// Allocate grid specific fields
+	// Carve the grid specific fields
+	data				+=	headerSize;
 	grid->numVertices	=	numVertices;
-	grid->vertices		=	new float[numVertices*numVertexSamples];
-	if (points) {
-		grid->bounds	=	new int[numVertices*4];
-		grid->sizes		=	new float[numVertices*2];
-	} else {
-		grid->bounds	=	new int[(numVerticesU-1)*(numVerticesV-1)*4];
-		grid->sizes		=	NULL;
-	}
+	grid->vertices		=	(float *) data;		data	+=	numVertices*numVertexSamples*sizeof(float);
+	grid->bounds		=	(int *) data;		data	+=	numBounds*4*sizeof(int);
+	grid->sizes			=	(points) ? (float *) data : NULL;
+	grid->size			=	(block >= 0) ? (1 << (block + RASTER_MEMORY_MIN_BLOCK)) : headerSize + dataSize;
 
 	object->attach();
 
+	// Update the grid memory stats (the peaks are approximate)
 	atomicIncrement(&stats.numRasterGrids);
+	const TStatCounter	gridMemory	=	atomicAdd64(&stats.gridMemory,grid->size);
+	if (stats.numPeakRasterGrids < stats.numRasterGrids)	stats.numPeakRasterGrids	=	stats.numRasterGrids;
+	if (stats.peakGridMemory < gridMemory)					stats.peakGridMemory		=	gridMemory;
 	numGridsCreated++;
 	numVerticesCreated	+=	numVertices;
 
@@ -1354,7 +1402,7 @@ CReyes::CRasterGrid		*CReyes::newGrid(CSurface *object,int points,int numVertice
 // Description			:
 /// \brief					Delete a raster object
 // Return Value			:	-
-// Comments				:	detach is not thread safe. dObject->mutex must be locked
+// Comments				:	detach is not thread safe. dObject->lock must be held
 void				CReyes::deleteObject(CRasterObject *dObject) {
 
 	assert(dObject->refCount == 0);
@@ -1370,25 +1418,76 @@ void				CReyes::deleteObject(CRasterObject *dObject) {
 
 		// Decrement the active grid counter
 		atomicDecrement(&stats.numRasterGrids);
+		atomicAdd64(&stats.gridMemory,-grid->size);
 
-		// Delete the grid data
-		osUnlock(dObject->mutex);		// Unlock the mutex
-		osDeleteMutex(dObject->mutex);	// Destroy the _unlocked_ mutex
-		delete [] dObject->next;
-		delete [] grid->vertices;
-		delete [] grid->bounds;
-		if (grid->sizes != NULL) delete [] grid->sizes;
-		delete grid;
+		// Recycle the grid (the lock goes with it, nobody else can be waiting on it)
+		freeBlock(grid,grid->block);
 	} else {
 
 		// Decrement the active object counter
 		atomicDecrement(&stats.numRasterObjects);
 
-		// Delete the object data
-		osUnlock(dObject->mutex);		// Unlock the mutex
-		osDeleteMutex(dObject->mutex);	// Destroy the _unlocked_ mutex
-		delete [] dObject->next;
-		delete dObject;
+		// Recycle the object
+		freeBlock(dObject,dObject->block);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CReyes
+// Method				:	allocateBlock
+// Description			:
+/// \brief					Allocate memory for a raster object or grid
+// Return Value			:	The memory
+// Comments				:	block receives the size class of the memory, the sizes are
+//							rounded up to powers of two so that the blocks freed in one
+//							bucket can be reused in the next. Requests that are too large
+//							to pool are allocated directly (block = -1)
+void				*CReyes::allocateBlock(int size,int &block) {
+	int		blockSize;
+
+	for (block=0,blockSize=1 << RASTER_MEMORY_MIN_BLOCK;blockSize < size;block++,blockSize<<=1);
+
+	if (block >= RASTER_MEMORY_NUM_BLOCKS) {
+		block	=	-1;
+		numBlocksAllocated++;
+		return allocate_untyped(size);
+	}
+
+	// Do we have one of these lying around ?
+	void	*cBlock	=	freeBlocks[block];
+	if (cBlock != NULL) {
+		freeBlocks[block]	=	*((void **) cBlock);
+		freeBlockMemory		-=	blockSize;
+		atomicAdd64(&stats.rasterCacheMemory,-blockSize);
+		numBlocksRecycled++;
+		return cBlock;
+	}
+
+	numBlocksAllocated++;
+	return allocate_untyped(blockSize);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CReyes
+// Method				:	freeBlock
+// Description			:
+/// \brief					Recycle the memory of a raster object or grid
+// Return Value			:	-
+// Comments				:	The block may have been allocated by another thread, it simply
+//							moves to the free list of this one
+void				CReyes::freeBlock(void *cBlock,int block) {
+	const int	blockSize	=	1 << (block + RASTER_MEMORY_MIN_BLOCK);
+
+	if ((block < 0) || (freeBlockMemory + blockSize > RASTER_MEMORY_MAX_CACHED)) {
+		free_untyped(cBlock);
+	} else {
+		*((void **) cBlock)	=	freeBlocks[block];
+		freeBlocks[block]	=	cBlock;
+		freeBlockMemory		+=	blockSize;
+
+		// The cached blocks are still held, count them (the peak is approximate)
+		const TStatCounter	cacheMemory	=	atomicAdd64(&stats.rasterCacheMemory,blockSize);
+		if (stats.peakRasterCacheMemory < cacheMemory)	stats.peakRasterCacheMemory	=	cacheMemory;
 	}
 }
 
@@ -1677,6 +1776,17 @@ void	CReyes::insertObject(CRasterObject *object) {
 	int			i;
 	int			refCount	=	0;
 
+	// Collect the bucket costs for the cost driven bucket order
+	if (CRenderer::bucketCost != NULL) {
+		const int	cx	=	min(ex,CRenderer::xBucketsMinusOne);
+		const int	cy	=	min(ey,CRenderer::yBucketsMinusOne);
+		int			x,y;
+
+		for (y=sy;y<=cy;y++) {
+			for (x=sx;x<=cx;x++)	CRenderer::bucketCost[y*CRenderer::xBuckets + x]	+=	1;
+		}
+	}
+
 	// A fake refcount to prevent other threads from deallocating this object
 	object->refCount	=	CRenderer::numThreads + 1;
 
@@ -1686,13 +1796,19 @@ void	CReyes::insertObject(CRasterObject *object) {
 		int			bx		=	sx;
 		int			by		=	sy;
 		int			killObj	=	FALSE;
-		CBucket		*cBucket;
+		CBucket		*cBucket	=	NULL;
 
 		// Secure the area
 		osLock(hider->bucketMutex);
 
+		// For the other orders, find the first bucket that needs the object
+		if (CRenderer::bucketOrder != BUCKET_ORDER_HORIZONTAL) {
+			const int	nb	=	hider->findBucket(object,hider->currentBucket);
+
+			if (nb >= 0)	cBucket	=	hider->buckets[nb / CRenderer::xBuckets][nb % CRenderer::xBuckets];
+
 		// Determine the bucket
-		if (by <= hider->currentYBucket) {
+		} else if (by <= hider->currentYBucket) {
 			by	=	hider->currentYBucket;
 			if (ey < hider->currentYBucket) {
 				// This must have been caused by dicing an
@@ -1716,7 +1832,7 @@ void	CReyes::insertObject(CRasterObject *object) {
 		}
 
 		// We must be in bounds
-		if (!killObj && (bx < CRenderer::xBuckets) && (by < CRenderer::yBuckets)) {
+		if ((CRenderer::bucketOrder == BUCKET_ORDER_HORIZONTAL) && !killObj && (bx < CRenderer::xBuckets) && (by < CRenderer::yBuckets)) {
 
 			// Normally, this bucket must almost exist
 			// But because there is a mutex release between the time we set the bucket to NULL
@@ -1735,22 +1851,21 @@ void	CReyes::insertObject(CRasterObject *object) {
 					}
 				}
 			}
+		}
 
-
-			if (cBucket != NULL) {
-				// Insert the object	
-				refCount++;
-				
-				__logObjectInsert(cObject,cx,cy,i,cBucket->queue != NULL);
-				
-				if (cBucket->queue == NULL) {
-					// The thread has not processed this bucket yet
-					object->next[i]		=	cBucket->objects;
-					cBucket->objects	=	object;
-				} else {
-					// The thread is processing this bucket
-					cBucket->queue->insert(object);
-				}
+		if (cBucket != NULL) {
+			// Insert the object	
+			refCount++;
+			
+			__logObjectInsert(object,bx,by,i,cBucket->queue != NULL);
+			
+			if (cBucket->queue == NULL) {
+				// The thread has not processed this bucket yet
+				object->next[i]		=	cBucket->objects;
+				cBucket->objects	=	object;
+			} else {
+				// The thread is processing this bucket
+				cBucket->queue->insert(object);
 			}
 		}
 
@@ -1759,7 +1874,7 @@ void	CReyes::insertObject(CRasterObject *object) {
 	}
 
 	// Check if we need to delete this object
-	osLock(object->mutex);
+	spinLock(object->lock);
 
 	__recordObjectInsert(object,refCount);
 	
@@ -1774,6 +1889,93 @@ void	CReyes::insertObject(CRasterObject *object) {
 		deleteObject(object);
 	} else {
 		object->refCount	=	refCount;
-		osUnlock(object->mutex);
+		spinUnlock(object->lock);
+	}
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CReyes
+// Method				:	findBucket
+// Description			:
+/// \brief					Find the first bucket in the bucket order that overlaps an object
+// Return Value			:	The bucket index (y*xBuckets + x) or -1 if there's none
+// Comments				:	Only the buckets at or after the given position in the
+//							bucket order are considered (buckets must be locked)
+int		CReyes::findBucket(const CRasterObject *object,int first) const {
+	int			sx			=	xbucket(object->xbound[0]);
+	int			sy			=	ybucket(object->ybound[0]);
+	const int	ex			=	min((int) floor((object->xbound[1] + CRenderer::xSampleOffset)*CRenderer::invBucketSampleWidth),CRenderer::xBucketsMinusOne);
+	const int	ey			=	min((int) floor((object->ybound[1] + CRenderer::ySampleOffset)*CRenderer::invBucketSampleHeight),CRenderer::yBucketsMinusOne);
+	int			bestBucket	=	-1;
+	int			bestRank	=	CRenderer::xBuckets*CRenderer::yBuckets;
+	int			x,y;
+
+	sx	=	max(sx,0);
+	sy	=	max(sy,0);
+
+	for (y=sy;y<=ey;y++) {
+		for (x=sx;x<=ex;x++) {
+			const int	bucket	=	y*CRenderer::xBuckets + x;
+			const int	rank	=	CRenderer::bucketRank[bucket];
+
+			if ((rank >= first) && (rank < bestRank) && (buckets[y][x] != NULL)) {
+				bestBucket	=	bucket;
+				bestRank	=	rank;
+			}
+		}
+	}
+
+	return bestBucket;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CReyes
+// Method				:	reorderBuckets
+// Description			:
+/// \brief					Move the objects into their first buckets in the new bucket order
+// Return Value			:
+// Comments				:	Called before the rendering starts
+void	CReyes::reorderBuckets() {
+	CRasterObject	*allObjects			=	NULL;
+	CRasterObject	*objectsToDelete	=	NULL;
+	CRasterObject	*cObject;
+	int				x,y;
+
+	osLock(bucketMutex);
+
+	gotoBucket(0);
+
+	// Collect the objects
+	for (y=0;y<CRenderer::yBuckets;y++) {
+		for (x=0;x<CRenderer::xBuckets;x++) {
+			CBucket	*cBucket	=	buckets[y][x];
+
+			while((cObject = cBucket->objects) != NULL) {
+				cBucket->objects		=	cObject->next[thread];
+				cObject->next[thread]	=	allObjects;
+				allObjects				=	cObject;
+			}
+		}
 	}
+
+	// Insert them back
+	while((cObject = allObjects) != NULL) {
+		const int	nb	=	findBucket(cObject,0);
+
+		allObjects	=	cObject->next[thread];
+
+		if (nb >= 0) {
+			objectExplicitInsert(cObject,nb % CRenderer::xBuckets,nb / CRenderer::xBuckets);
+		} else {
+			cObject->next[thread]	=	objectsToDelete;
+			objectsToDelete			=	cObject;
+		}
+	}
+
+	osUnlock(bucketMutex);
+
+	// Delete the objects we do not need
+	flushObjects(objectsToDelete);
 }
@@ -85,7 +85,8 @@ protected:
 
 			int					xbound[2],ybound[2];	// The bound of the object on the screen, in samples
 			float				zmin;					// The minimum z coordinate of the object (used for occlusion culling)
-			TMutex				mutex;					// To secure the object
+			int					block;					// The size class of the memory block holding the object (-1 if too big to recycle)
+			TSpinLock			lock;					// To secure the object
 			
 	};	
 
@@ -104,6 +105,7 @@ protected:
 			int					udiv,vdiv;				// The number of division
 			int					numVertices;			// The number of vertices
 			int					flags;					// The primitive flags
+			int					size;					// The memory used by the grid in bytes (the allocated block)
 	};
 
 
@@ -223,12 +225,17 @@ public:
 	void						drawGrid(CSurface *,int,int,float,float,float,float);	// Draw a grid
 	void						drawPoints(CSurface *,int);								// Draw points (RiPoints)
 
+								// Move the objects into their first buckets in the new bucket order
+	void						reorderBuckets();
+
 								// Some stats
-	int							numGridsRendered;
-	int							numQuadsRendered;
-	int							numGridsShaded;
-	int							numGridsCreated;
-	int							numVerticesCreated;
+	TStatCounter				numGridsRendered;
+	TStatCounter				numQuadsRendered;
+	TStatCounter				numGridsShaded;
+	TStatCounter				numGridsCreated;
+	TStatCounter				numVerticesCreated;
+	TStatCounter				numBlocksAllocated;
+	TStatCounter				numBlocksRecycled;
 protected:
 	float						maxDepth;										// The maximum opaque depth in the current bucket
 
@@ -247,10 +254,17 @@ private:
 
 	void						insertObject(CRasterObject *object);			// Add an object into the system
 	void						insertGrid(CRasterGrid *,int);					// Insert a grid into the correct bucket
+	int							findBucket(const CRasterObject *,int) const;	// Find the first bucket in the bucket order that overlaps an object
 
 	CRasterObject				*newObject(CObject *);							// Create a new object
 	CRasterGrid					*newGrid(CSurface *,int,int,int);				// Create a new grid
 	void						deleteObject(CRasterObject *);					// Delete an object (the object can also be a grid)
+
+	void						*allocateBlock(int,int &);						// Allocate the memory for a raster object
+	void						freeBlock(void *,int);							// Recycle the memory of a raster object
+
+	void						*freeBlocks[RASTER_MEMORY_NUM_BLOCKS];			// The recycled blocks of each size class (linked through their first word)
+	int							freeBlockMemory;								// The number of bytes in the recycled blocks
 	
 	void						render();										// Render the current bucket
 	void						skip();											// Skip the current bucket
@@ -264,6 +264,9 @@ RtToken		RI_DISPLACEMENTS		=	"displacements";
 RtToken		RI_MAXDIFFUSEDEPTH		=	"maxdiffusedepth";
 RtToken		RI_MAXSPECULARDEPTH		=	"maxspeculardepth";
 RtToken		RI_SAMPLEMOTION			=	"samplemotion";
+RtToken		RI_ROUNDCURVES			=	"roundcurves";
+RtToken		RI_ROUNDPOINTS			=	"roundpoints";
+RtToken		RI_RADIANCECACHEERROR	=	"radiancecacheerror";
 
 // Photon attributes
 RtToken		RI_GLOBALMAP			=	"globalmap";
@@ -303,6 +306,8 @@ RtToken		RI_GRIDSIZE				=	"gridsize";
 RtToken		RI_MAXRECURSION			=	"raydepth";
 RtToken		RI_TEXTUREMEMORY		=	"texturememory";
 RtToken		RI_BRICKMEMORY			=	"brickmemory";
+RtToken		RI_PTCMEMORY			=	"ptcmemory";
+RtToken		RI_PTCPAGESIZE			=	"ptcpagesize";
 RtToken		RI_EYESPLITS			=	"eyesplits";
 RtToken		RI_NUMTHREADS			=	"numthreads";
 RtToken		RI_THREADSTRIDE			=	"threadstride";
@@ -316,6 +321,8 @@ RtToken		RI_MAXDEPTH				=	"maxdepth";
 // Statstics options
 RtToken		RI_ENDOFFRAME			=	"endofframe";
 RtToken		RI_FILELOG				=	"filelog";
+RtToken		RI_TRACEFILE			=	"tracefile";
+RtToken		RI_STATSFILE			=	"statsfile";
 RtToken		RI_PROGRESS				=	"progress";
 
 // Irradiance options
@@ -341,6 +348,10 @@ RtToken		RI_MASKLOG				=	"masklog";
 RtToken		RI_MASKPROGRESS			=	"maskprogress";
 RtToken		RI_MASKSTATS			=	"maskstats";
 RtToken		RI_INHERITATTRIBUTES	=	"inheritattributes";
+RtToken		RI_TEXTURECOMPRESSION	=	"texturecompression";
+RtToken		RI_CACHECOMPRESSION		=	"cachecompression";
+RtToken		RI_BUCKETORDER			=	"bucketorder";
+RtToken		RI_GRIDMEMORY			=	"gridmemory";
 
 // Shutter options
 RtToken		RI_OFFSET				=	"offset";
@@ -230,6 +230,9 @@ EXTERN(RtToken)		RI_DISPLACEMENTS;
 EXTERN(RtToken)		RI_MAXDIFFUSEDEPTH;
 EXTERN(RtToken)		RI_MAXSPECULARDEPTH;
 EXTERN(RtToken)		RI_SAMPLEMOTION;
+EXTERN(RtToken)		RI_ROUNDCURVES;
+EXTERN(RtToken)		RI_ROUNDPOINTS;
+EXTERN(RtToken)		RI_RADIANCECACHEERROR;
 
 // Motionfactor attribute
 EXTERN(RtToken)		RI_MOTIONFACTOR;
@@ -257,6 +260,8 @@ EXTERN(RtToken)		RI_GRIDSIZE;
 EXTERN(RtToken)		RI_MAXRECURSION;
 EXTERN(RtToken)		RI_TEXTUREMEMORY;
 EXTERN(RtToken)		RI_BRICKMEMORY;
+EXTERN(RtToken)		RI_PTCMEMORY;
+EXTERN(RtToken)		RI_PTCPAGESIZE;
 EXTERN(RtToken)		RI_EYESPLITS;
 EXTERN(RtToken)		RI_NUMTHREADS;
 EXTERN(RtToken)		RI_THREADSTRIDE;
@@ -270,6 +275,8 @@ EXTERN(RtToken)		RI_MAXDEPTH;
 // Statistics options
 EXTERN(RtToken)		RI_ENDOFFRAME;
 EXTERN(RtToken)		RI_FILELOG;
+EXTERN(RtToken)		RI_TRACEFILE;
+EXTERN(RtToken)		RI_STATSFILE;
 EXTERN(RtToken)		RI_PROGRESS;
 
 // Irradiance options
@@ -295,6 +302,10 @@ EXTERN(RtToken)		RI_MASKLOG;
 EXTERN(RtToken)		RI_MASKPROGRESS;
 EXTERN(RtToken)		RI_MASKSTATS;
 EXTERN(RtToken)		RI_INHERITATTRIBUTES;
+EXTERN(RtToken)		RI_TEXTURECOMPRESSION;
+EXTERN(RtToken)		RI_CACHECOMPRESSION;
+EXTERN(RtToken)		RI_BUCKETORDER;
+EXTERN(RtToken)		RI_GRIDMEMORY;
 
 // Shutter options
 EXTERN(RtToken)		RI_OFFSET;
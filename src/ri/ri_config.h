@@ -49,7 +49,9 @@
 #define DEFAULT_NUM_THREADS		2
 #define DEFAULT_MAX_TEXTURESIZE	20000000
 #define DEFAULT_MAX_BRICKSIZE	10000000
+#define DEFAULT_MAX_PTCMEMORY	100000000
 #define DEFAULT_THREAD_STRIDE	3
+#define	DEFAULT_MAX_GRIDMEMORY	0
 #define	DEFAULT_GEO_CACHE_SIZE	30720*1024
 
 // The default network port
@@ -59,6 +61,16 @@
 // Per block is faster, but requires (fractionally) more memory
 #define	TEXTURE_PERBLOCK_LOCK
 
+// The maximum error of a block compressed texel (relative to the texel for texels over 1)
+// Tiles that can not be compressed within this error are kept uncompressed
+#define	TEXTURE_BLOCK_MAX_ERROR			0.001f
+
+// The zlib compression level used for the texture tiles
+#define	TEXMAKE_COMPRESSION_LEVEL		6
+
+// The number of rows a thread reduces in one go while building the mip levels
+#define	TEXMAKE_REDUCE_ROWS				16
+
 // Per entry or global locking for tesselations
 // Per entry is faster, but requires (fractionally) more memory
 #define TESSELATION_PERENTRY_LOCK
@@ -66,6 +78,23 @@
 // The number of levels before we split
 #define TESSELATION_NUM_LEVELS			3
 
+// The number of vertices along each side of the radiance cache grid of a tesselation patch
+#define RADIANCE_CACHE_RESOLUTION		5
+
+// The maximum optical depth of a single ray marching step through a volume
+#define	VOLUME_MAX_OPTICAL_DEPTH		0.25f
+
+// We stop marching through a volume when the transmittance drops below this
+#define	VOLUME_MIN_TRANSMITTANCE		0.001f
+
+// The raster objects and grids are recycled through per thread lists of power of two blocks,
+// these are the log2 of the smallest block size and the number of block sizes
+#define	RASTER_MEMORY_MIN_BLOCK			6
+#define	RASTER_MEMORY_NUM_BLOCKS		18
+
+// The maximum number of bytes a thread keeps in its raster block lists
+#define	RASTER_MEMORY_MAX_CACHED		(1 << 26)
+
 // The size of the buffer to be used during the network file transfers
 #define	NETWORK_BUFFER_LENGTH			(1 << 12)
 
@@ -96,6 +125,42 @@
 // The stack size for the point hierarchy lookup
 #define	POINTHIERARCHY_STACK_SIZE		256
 
+// The maximum resolution of a point hierarchy microbuffer face
+#define	POINTHIERARCHY_MAX_MICROBUFFER	32
+
+// The minimum number of points before we build the point hierarchy in parallel
+#define	POINTHIERARCHY_PARALLEL_MIN		10000
+
+// The extension of the point hierarchy cache that is written next to the point cloud
+#define	POINTHIERARCHY_CACHE_EXTENSION	".phc"
+
+// The version of the point hierarchy cache
+#define	POINTHIERARCHY_CACHE_VERSION	3
+
+// The number of points that are hashed to check that a point hierarchy cache belongs to a point cloud
+#define	POINTHIERARCHY_CHECKSUM_SAMPLES	4096
+
+// The default radius of a cached photon map estimate (as a fraction of the lookup radius)
+#define	PHOTON_CACHE_MAX_ERROR			0.2f
+
+// The number of pre-built photon lookup cache levels, every node at this depth is a separately locked shard
+#define	PHOTON_CACHE_SHARD_DEPTH		2
+
+// The maximum depth of the photon lookup cache octree
+#define	PHOTON_CACHE_MAX_DEPTH			32
+
+// The maximum number of times a curve segment is split in half during the ray intersection
+#define	CURVE_MAX_SPLIT_DEPTH			10
+
+// The curve segments are split until they are flat within this fraction of their width
+#define	CURVE_SPLIT_TOLERANCE			0.05f
+
+// The maximum number of points in a leaf of the point raytracing hierarchy
+#define	POINTS_BVH_LEAF_SIZE			8
+
+// The maximum depth of the point raytracing hierarchy traversal stack
+#define	POINTS_BVH_STACK_SIZE			64
+
 // The maximum number of channels in a 3d texture
 #define	TEXTURE3D_MAX_CHANNELS			32
 
@@ -105,6 +170,21 @@
 // The initial size of the raytracing heap
 #define TRACE_HEAP_SIZE					100
 
+// The maximum number of hemisphere rays an irradiance cache traces in one batch
+#define	IRRADIANCE_BATCH_SIZE			16384
+
+// The version of the flat irradiance cache files, bump this when the layout changes
+#define	IRRADIANCE_CACHE_VERSION		1
+
+// The deepest octree a flat irradiance cache file may have, the lookups keep a stack this deep
+#define	IRRADIANCE_MAX_FLAT_DEPTH		64
+
+// The size of a cache line, the per thread statistics counters are padded to this
+#define	STATS_CACHE_LINE				64
+
+// The number of events every thread keeps for the timeline profiler (must be a power of 2)
+#define	PROFILER_BUFFER_SIZE			65536
+
 // The number of bins to use for filterstep function
 #define	FILTERSTEP_NUMSTEPS				10
 
@@ -393,10 +393,16 @@ void		CRibOut::RiOptionV(const char *name,int n,const char *tokens[],const void
 			optionCheckInt(RI_BUCKETSIZE,2)
 			optionCheckInt(RI_METABUCKETS,2)
 			optionCheckInt(RI_INHERITATTRIBUTES,1)
+			optionCheckInt(RI_TEXTURECOMPRESSION,1)
+			optionCheckInt(RI_CACHECOMPRESSION,1)
 			optionCheckInt(RI_GRIDSIZE,1)
 			optionCheckInt(RI_EYESPLITS,1)
 			optionCheckInt(RI_TEXTUREMEMORY,1)
 			optionCheckInt(RI_BRICKMEMORY,1)
+			optionCheckInt(RI_PTCMEMORY,1)
+			optionCheckInt(RI_PTCPAGESIZE,1)
+			optionCheckString(RI_BUCKETORDER)
+			optionCheckInt(RI_GRIDMEMORY,1)
 			optionEndCheck
 		}
 	// Check the hider options
@@ -424,6 +430,8 @@ void		CRibOut::RiOptionV(const char *name,int n,const char *tokens[],const void
 			if (FALSE) {
 			optionCheckInt(RI_ENDOFFRAME,1)
 			optionCheckString(RI_FILELOG)
+			optionCheckString(RI_TRACEFILE)
+			optionCheckString(RI_STATSFILE)
 			optionCheckInt(RI_PROGRESS,1)
 			optionEndCheck
 		}
@@ -700,6 +708,9 @@ void		CRibOut::RiAttributeV(const char *name,int n,const char *tokens[],const vo
 			attributeCheckFloat(RI_BIAS,1)
 			attributeCheckInt(RI_MAXDIFFUSEDEPTH,1)
 			attributeCheckInt(RI_MAXSPECULARDEPTH,1)
+			attributeCheckInt(RI_ROUNDCURVES,1)
+			attributeCheckInt(RI_ROUNDPOINTS,1)
+			attributeCheckFloat(RI_RADIANCECACHEERROR,1)
 			attributeEndCheck
 		}
 	// Check the irradiance cache options
@@ -719,6 +730,7 @@ void		CRibOut::RiAttributeV(const char *name,int n,const char *tokens[],const vo
 			attributeCheckString(RI_SHADINGMODEL)
 			attributeCheckFloat(RI_IOR,1)
 			attributeCheckInt(RI_ESTIMATOR,1)
+			attributeCheckFloat(RI_MAXERROR,1)
 			attributeCheckInt(RI_ILLUMINATEFRONT,1)
 			attributeEndCheck
 		}
@@ -1613,10 +1625,16 @@ void		CRibOut::declareDefaultVariables() {
 	declareVariable(RI_BUCKETSIZE,			"int[2]");
 	declareVariable(RI_METABUCKETS,			"int[2]");
 	declareVariable(RI_INHERITATTRIBUTES,	"int");
+	declareVariable(RI_TEXTURECOMPRESSION,	"int");
+	declareVariable(RI_CACHECOMPRESSION,	"int");
 	declareVariable(RI_GRIDSIZE,			"int");
 	declareVariable(RI_EYESPLITS,			"int");
 	declareVariable(RI_TEXTUREMEMORY,		"int");
 	declareVariable(RI_BRICKMEMORY,			"int");
+	declareVariable(RI_PTCMEMORY,			"int");
+	declareVariable(RI_PTCPAGESIZE,			"int");
+	declareVariable(RI_BUCKETORDER,			"string");
+	declareVariable(RI_GRIDMEMORY,			"int");
 
 	declareVariable(RI_RADIANCECACHE,		"int");
 	declareVariable(RI_JITTER,				"float");
@@ -1628,6 +1646,8 @@ void		CRibOut::declareDefaultVariables() {
 
 	declareVariable(RI_ENDOFFRAME,			"int");
 	declareVariable(RI_FILELOG,				"string");
+	declareVariable(RI_TRACEFILE,			"string");
+	declareVariable(RI_STATSFILE,			"string");
 	declareVariable(RI_PROGRESS,			"int");
 
 
@@ -1648,6 +1668,9 @@ void		CRibOut::declareDefaultVariables() {
 	declareVariable(RI_MAXDIFFUSEDEPTH,		"int");
 	declareVariable(RI_MAXSPECULARDEPTH,	"int");
 	declareVariable(RI_SAMPLEMOTION,		"int");
+	declareVariable(RI_ROUNDCURVES,			"int");
+	declareVariable(RI_ROUNDPOINTS,			"int");
+	declareVariable(RI_RADIANCECACHEERROR,	"float");
 
 	declareVariable(RI_HANDLE,				"string");
 	declareVariable(RI_FILEMODE,			"string");
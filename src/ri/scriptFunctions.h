@@ -1038,6 +1038,12 @@ DEFLINKFUNC(Splinean		,"spline"		,"n=fN", 0)
 DEFFUNC(Splineap			,"spline"		,"p=fP"		,SPLINEAPEXPR_PRE,SPLINEAPEXPR,SPLINEAPEXPR_UPDATE,NULL_EXPR,0)
 
 
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// Batched DSO dispatch: run the whole grid in one call and skip the per vertex loop
+#define	DSOBATCHEXEC(__argc)	code->dso->batch(handle,code->uniform ? 1 : numVertices,(code->uniform || (numPassive == 0)) ? NULL : tags,__argc,(void **) op,opSteps);	\
+								code++;																									\
+								goto execStart;
+
 ///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 // DSO dispatcher
 #define	DSOEXEC_PRE			int					numArguments;								\
@@ -1055,7 +1061,11 @@ DEFFUNC(Splineap			,"spline"		,"p=fP"		,SPLINEAPEXPR_PRE,SPLINEAPEXPR,SPLINEAPEX
 							}																\
 																							\
 							void			*handle	=	code->dso->handle;					\
-							dsoExecFunction exec	=	code->dso->exec;
+							dsoExecFunction exec	=	code->dso->exec;					\
+																							\
+							if (code->dso->batch != NULL) {									\
+								DSOBATCHEXEC(numArguments-1);								\
+							}
 						
 
 #define	DSOEXEC				exec(handle,numArguments-1,(void **) op);
@@ -1085,7 +1095,13 @@ DEFFUNC(DSO				,"XXX",			"XXX",	DSOEXEC_PRE,DSOEXEC,DSOEXEC_UPDATE,DSOEXEC_POST,
 							}																\
 																							\
 							void			*handle	=	code->dso->handle;					\
-							dsoExecFunction exec	=	code->dso->exec;
+							dsoExecFunction exec	=	code->dso->exec;					\
+																							\
+							if (code->dso->batch != NULL) {									\
+								op[0]		=	NULL;										\
+								opSteps[0]	=	0;											\
+								DSOBATCHEXEC(numArguments);									\
+							}
 
 #define	DSOVOIDEXEC			exec(handle,numArguments,(void **) op);
 
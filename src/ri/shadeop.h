@@ -48,6 +48,8 @@ typedef struct {
 
 #define	SHADEOP(__shadeopname)			extern "C" void __declspec(dllexport) __shadeopname(void *initdata,int argc,char *argv[])
 
+#define	SHADEOP_BATCH(__shadeopname)	extern "C" void __declspec(dllexport) __shadeopname##_batch(void *initdata,int numVertices,const int *tags,int argc,char *argv[],const int *argSteps)
+
 #define	SHADEOP_CLEANUP(__shadeopname)	extern "C" void __declspec(dllexport) __shadeopname(void *initdata)
 
 #else
@@ -58,13 +60,26 @@ typedef struct {
 
 #define	SHADEOP(__shadeopname)			extern "C" void __shadeopname(void *initdata,int argc,char *argv[])
 
+#define	SHADEOP_BATCH(__shadeopname)	extern "C" void __shadeopname##_batch(void *initdata,int numVertices,const int *tags,int argc,char *argv[],const int *argSteps)
+
 #define	SHADEOP_CLEANUP(__shadeopname)	extern "C" void __shadeopname(void *initdata)
 
 #endif
 
+// SHADEOP_BATCH is an optional entry point next to SHADEOP that is called once per grid
+// instead of once per vertex. If a shadeop defines both, the batch version is used.
+//
+//	numVertices	:	The number of vertices in the grid (1 if the call is uniform)
+//	tags		:	NULL if all the vertices are active, otherwise vertex i is active if tags[i] == 0
+//	argc,argv	:	Same as SHADEOP, every argv[j] points to the argument of the first vertex
+//	argSteps	:	The number of bytes between the arguments of consecutive vertices (0 if uniform)
+//
+// So argument j of vertex i is at argv[j] + i*argSteps[j]
+
 // The function prototypes for the DSO shaders
 typedef void	*(*dsoInitFunction)(int,void *);
 typedef void	(*dsoExecFunction)(void *,int,void *[]);
+typedef void	(*dsoBatchFunction)(void *,int,const int *,int,void *[],const int *);
 typedef void	(*dsoCleanupFunction)(void *);
 
 
@@ -195,6 +195,28 @@ CShaderInstance::~CShaderInstance() {
 	// The children class must clear the parameter list here
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShaderInstance
+// Method				:	equals
+// Description			:
+/// \brief					Check if two instances shade identically
+// Return Value			:	TRUE if they do
+// Comments				:	By default, instances are only equal to themselves
+int		CShaderInstance::equals(const CShaderInstance *other) const {
+	return (other == this);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShaderInstance
+// Method				:	instanceOf
+// Description			:
+/// \brief					Check if this is an instance of a shader
+// Return Value			:	TRUE if it is
+// Comments				:
+int		CShaderInstance::instanceOf(const CShader *) const {
+	return FALSE;
+}
+
 
 
 ///////////////////////////////////////////////////////////////////////
@@ -643,6 +665,57 @@ const char		*CProgrammableShaderInstance::getName() {
 	return parent->name;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CProgrammableShaderInstance
+// Method				:	instanceOf
+// Description			:
+/// \brief					Check if this is an instance of a shader
+// Return Value			:	TRUE if it is
+// Comments				:
+int		CProgrammableShaderInstance::instanceOf(const CShader *shader) const {
+	return (parent == shader);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CProgrammableShaderInstance
+// Method				:	equals
+// Description			:
+/// \brief					Check if two instances shade identically
+// Return Value			:	TRUE if they do
+// Comments				:	Two instances of the same shader are identical if they were created
+//							in the same space with the same parameter values
+int		CProgrammableShaderInstance::equals(const CShaderInstance *other) const {
+	const CVariable	*cParameter,*oParameter;
+	int				i;
+
+	if (other == this)								return TRUE;
+	if (other == NULL)								return FALSE;
+	if (other->instanceOf(parent) == FALSE)			return FALSE;
+	if (other->flags != flags)						return FALSE;
+	if ((other->xform != xform) && (xform->equals(other->xform) == FALSE))	return FALSE;
+
+	// The parameters are cloned from the same shader, so they're in the same order
+	for (cParameter=parameters,oParameter=other->parameters;(cParameter!=NULL) && (oParameter!=NULL);cParameter=cParameter->next,oParameter=oParameter->next) {
+		if (cParameter->defaultValue == oParameter->defaultValue)	continue;
+		if ((cParameter->defaultValue == NULL) || (oParameter->defaultValue == NULL))	return FALSE;
+
+		if (cParameter->type == TYPE_STRING) {
+			const char	**cString	=	(const char **) cParameter->defaultValue;
+			const char	**oString	=	(const char **) oParameter->defaultValue;
+
+			for (i=0;i<cParameter->numFloats;i++) {
+				if (cString[i] == oString[i])						continue;
+				if ((cString[i] == NULL) || (oString[i] == NULL))	return FALSE;
+				if (strcmp(cString[i],oString[i]) != 0)				return FALSE;
+			}
+		} else {
+			if (memcmp(cParameter->defaultValue,oParameter->defaultValue,cParameter->numFloats*sizeof(float)) != 0)	return FALSE;
+		}
+	}
+
+	return (cParameter == NULL) && (oParameter == NULL);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CProgrammableShaderInstance
 // Method				:	illuminate
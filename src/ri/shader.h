@@ -183,6 +183,8 @@ public:
 		virtual	unsigned int	requiredParameters()									=	0;
 		virtual	const char		*getName()												=	0;
 		virtual	float			**prepare(CMemPage*&,float **,int)						=	0;
+		virtual	int				equals(const CShaderInstance *) const;						// Check if two instances shade identically
+		virtual	int				instanceOf(const CShader *) const;							// Check if this is an instance of a shader
 		
 		void					createCategories();
 
@@ -222,6 +224,8 @@ public:
 		unsigned int				requiredParameters();
 		const char					*getName();
 		float						**prepare(CMemPage*&,float **,int);
+		int							equals(const CShaderInstance *) const;
+		int							instanceOf(const CShader *) const;
 
 
 		CAllocatedString			*strings;					// The strings we allocated for parameters
@@ -2141,17 +2141,23 @@ DEFSHORTFUNC(Bake3d			,"bake3d"					,"f=SSpn!"		,BAKE3DEXPR_PRE,BAKE3DEXPR,BAKE3
 								operand(0,res,float *);															\
 								operand(2,op2,const float *);													\
 								operand(3,op3,const float *);													\
-								float			*dest		=	(float *) ralloc(tex->dataSize*sizeof(float),threadMemory);	\
 								float			**channelValues = (float **) ralloc(lookup->numChannels*sizeof(float*),threadMemory);	\
+								float			**channelBase = (float **) ralloc(lookup->numChannels*sizeof(float*),threadMemory);	\
 								float			*dPdu		=	(float *) ralloc(numVertices*6*sizeof(float),threadMemory);	\
 								float			*dPdv		=	dPdu + numVertices*3;							\
+								float			*lookupP	=	(float *) ralloc(numVertices*7*sizeof(float),threadMemory);	\
+								float			*lookupN	=	lookupP + numVertices*3;						\
+								float			*lookupR	=	lookupN + numVertices*3;						\
+								int				*lookupV	=	(int *) ralloc(numVertices*sizeof(int),threadMemory);	\
+								int				numLookups	=	0;												\
+								int				vertex		=	0;												\
 								duVector(dPdu,op2);																\
 								dvVector(dPdv,op2);																\
 								const float		*du			=	varying[VARIABLE_DU];							\
 								const float		*dv			=	varying[VARIABLE_DV];							\
 																												\
 								for (int channel=0;channel<lookup->numChannels;++channel) {						\
-									operand(lookup->channelIndex[channel],channelValues[channel],float *);		\
+									operand(lookup->channelIndex[channel],channelBase[channel],float *);		\
 								} 
 
 #define	TEXTURE3DEXPR			plReady();																		\
@@ -2163,8 +2169,10 @@ DEFSHORTFUNC(Bake3d			,"bake3d"					,"f=SSpn!"		,BAKE3DEXPR_PRE,BAKE3DEXPR,BAKE3
 								} else {																		\
 									radius	=	(lengthv(dPdu) + lengthv(dPdv))*0.5f*scratch->texture3dParams.radiusScale;			\
 								}																				\
-								tex->lookup(dest,op2,op3,radius);												\
-								texture3Dunpack(dest,lookup->numChannels,channelValues,lookup->channelEntry,lookup->channelSize);	\
+								movvv(lookupP + numLookups*3,op2);												\
+								movvv(lookupN + numLookups*3,op3);												\
+								lookupR[numLookups]		=	radius;												\
+								lookupV[numLookups++]	=	vertex;												\
 								*res		=	1;
 
 #define	TEXTURE3DEXPR_UPDATE	++res;																			\
@@ -2173,12 +2181,21 @@ DEFSHORTFUNC(Bake3d			,"bake3d"					,"f=SSpn!"		,BAKE3DEXPR_PRE,BAKE3DEXPR,BAKE3
 								dPdu	+=	3;																	\
 								dPdv	+=	3;																	\
 								++du;	++dv;																	\
-								plStep();																		\
-								for (int channel=0;channel<lookup->numChannels;++channel) {						\
-									channelValues[channel]	+=	lookup->channelSize[channel];					\
-								}
+								++vertex;																		\
+								plStep();
 
-#define	TEXTURE3DEXPR_POST		plEnd();
+// Lookup all the points together and unpack the results
+#define	TEXTURE3DEXPR_POST		if (numLookups > 0) {															\
+									float	*dest	=	(float *) ralloc(numLookups*tex->dataSize*sizeof(float),threadMemory);	\
+									tex->lookup(numLookups,dest,lookupP,lookupN,lookupR);						\
+									for (int i=0;i<numLookups;i++,dest+=tex->dataSize) {						\
+										for (int channel=0;channel<lookup->numChannels;++channel) {				\
+											channelValues[channel]	=	channelBase[channel] + lookupV[i]*lookup->channelSize[channel];	\
+										}																		\
+										texture3Dunpack(dest,lookup->numChannels,channelValues,lookup->channelEntry,lookup->channelSize);	\
+									}																			\
+								}																				\
+								plEnd();
 #else
 #define	TEXTURE3DEXPR_PRE
 #define	TEXTURE3DEXPR
@@ -2194,6 +2211,89 @@ DEFFUNC(Texture3d			,"texture3d"					,"f=Spn!"		,TEXTURE3DEXPR_PRE,TEXTURE3DEXPR
 #undef	TEXTURE3DEXPR_POST
 
 
+
+///////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+// volume3d	"f=Spp!"
+#ifndef INIT_SHADING
+#define	VOLUME3DEXPR_PRE		plBegin(CVolumeLookup,4);														\
+								CVolume		*volume;															\
+								if ((volume = lookup->volume) == NULL) {										\
+									const float			*from,*to;												\
+									findCoordinateSystem(scratch->volumeParams.coordsys,from,to);				\
+									const char			**op1;													\
+									operand(1,op1,const char **);												\
+									osLock(CRenderer::shaderMutex);												\
+									lookup->volume	=	volume	=	CRenderer::getVolume(*op1,scratch->volumeParams.channel,from,to);	\
+									osUnlock(CRenderer::shaderMutex);											\
+									if (volume->map != NULL) {													\
+										volume->map->resolve(lookup->numChannels,lookup->channelName,lookup->channelEntry,lookup->channelSize);	\
+									} else {																	\
+										for (int channel=0;channel<lookup->numChannels;++channel)	lookup->channelSize[channel]	=	0;	\
+									}																			\
+								}																				\
+								float				*res;														\
+								const float			*op2,*op3;													\
+								operand(0,res,float *);															\
+								operand(2,op2,const float *);													\
+								operand(3,op3,const float *);													\
+								float			**channelValues = (float **) ralloc(lookup->numChannels*sizeof(float*),threadMemory);	\
+								float			**channelBase = (float **) ralloc(lookup->numChannels*sizeof(float*),threadMemory);	\
+								float			*marchFrom	=	(float *) ralloc(numVertices*8*sizeof(float),threadMemory);	\
+								float			*marchTo	=	marchFrom + numVertices*3;						\
+								float			*marchStep	=	marchTo + numVertices*3;						\
+								float			*marchScale	=	marchStep + numVertices;						\
+								int				*marchV		=	(int *) ralloc(numVertices*sizeof(int),threadMemory);	\
+								float			*resBase	=	res;											\
+								int				numMarches	=	0;												\
+								int				vertex		=	0;												\
+																												\
+								for (int channel=0;channel<lookup->numChannels;++channel) {						\
+									operand(lookup->channelIndex[channel],channelBase[channel],float *);		\
+								} 
+
+#define	VOLUME3DEXPR			plReady();																		\
+								movvv(marchFrom + numMarches*3,op2);											\
+								movvv(marchTo + numMarches*3,op3);												\
+								marchStep[numMarches]	=	scratch->volumeParams.stepSize;						\
+								marchScale[numMarches]	=	scratch->volumeParams.densityScale;					\
+								marchV[numMarches++]	=	vertex;
+
+#define	VOLUME3DEXPR_UPDATE		++res;																			\
+								op2		+=	3;																	\
+								op3		+=	3;																	\
+								++vertex;																		\
+								plStep();
+
+// March all the segments together and unpack the results
+#define	VOLUME3DEXPR_POST		if (numMarches > 0) {															\
+									const int	dataSize	=	(volume->map != NULL) ? volume->map->dataSize : 0;	\
+									float		*opacity	=	(float *) ralloc(numMarches*(1 + dataSize)*sizeof(float),threadMemory);	\
+									float		*dest		=	opacity + numMarches;							\
+									volume->march(numMarches,opacity,dest,marchFrom,marchTo,marchStep,marchScale,this);	\
+									for (int i=0;i<numMarches;i++,dest+=dataSize) {								\
+										resBase[marchV[i]]	=	opacity[i];										\
+										for (int channel=0;channel<lookup->numChannels;++channel) {				\
+											channelValues[channel]	=	channelBase[channel] + marchV[i]*lookup->channelSize[channel];	\
+										}																		\
+										texture3Dunpack(dest,lookup->numChannels,channelValues,lookup->channelEntry,lookup->channelSize);	\
+									}																			\
+								}																				\
+								plEnd();
+#else
+#define	VOLUME3DEXPR_PRE
+#define	VOLUME3DEXPR
+#define	VOLUME3DEXPR_UPDATE
+#define	VOLUME3DEXPR_POST
+#endif
+
+DEFFUNC(Volume3d			,"volume3d"						,"f=Spp!"		,VOLUME3DEXPR_PRE,VOLUME3DEXPR,VOLUME3DEXPR_UPDATE,VOLUME3DEXPR_POST,0)
+
+#undef	VOLUME3DEXPR_PRE
+#undef	VOLUME3DEXPR
+#undef	VOLUME3DEXPR_UPDATE
+#undef	VOLUME3DEXPR_POST
+
+
 ///////////////////////////////////////////////////
 //
 //	FIXME : missing functions :
@@ -519,6 +519,94 @@ void		CTexture3dLookup::postBind(CShadingScratch *scratch) {
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Method				:	CVolumeLookup
+// Description			:
+/// \brief					Ctor
+// Return Value			:	-
+// Comments				:
+CVolumeLookup::CVolumeLookup() {
+	volume			=	NULL;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Method				:	~CVolumeLookup
+// Description			:
+/// \brief					Dtor
+// Return Value			:	-
+// Comments				:
+CVolumeLookup::~CVolumeLookup() {
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Method				:	bind
+// Description			:	Bind the volume3d parameters
+// Return Value			:	-
+// Comments				:	Anything we don't know about is a channel output
+void		CVolumeLookup::bind(const char *name,int &opIndex,int step,void *data,CShaderInstance *shader) {
+
+	// Find the parameter and bind it
+	if (strcmp(name,"coordsystem") == 0) {
+		expectUniform(name);
+		add(name,opIndex,step,data,offsetof(CShadingScratch,volumeParams.coordsys));
+	} else if (strcmp(name,"densitychannel") == 0) {
+		expectUniform(name);
+		add(name,opIndex,step,data,offsetof(CShadingScratch,volumeParams.channel));
+	} else if (strcmp(name,"stepsize") == 0) {
+		add(name,opIndex,step,data,offsetof(CShadingScratch,volumeParams.stepSize));
+	} else if (strcmp(name,"densityscale") == 0) {
+		add(name,opIndex,step,data,offsetof(CShadingScratch,volumeParams.densityScale));
+	} else {
+		if (data == NULL) {
+			// The data has to be varying
+
+			channelIndex[numChannels]	= opIndex;
+			channelSize[numChannels]	= step;
+			channelName[numChannels]	= name;
+			numChannels++;
+		} else {
+			warning(CODE_BADTOKEN,"warning, uniform volume3d parameter \"%s\" ignored\n",name);
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Method				:	init
+// Description			:
+/// \brief					Initialize the scratch for this lookup
+// Return Value			:	-
+// Comments				:
+void		CVolumeLookup::init(CShadingScratch *scratch,const CAttributes *attributes) {
+	scratch->volumeParams.coordsys		=	"";
+	scratch->volumeParams.channel		=	"";
+	scratch->volumeParams.stepSize		=	0;
+	scratch->volumeParams.densityScale	=	1;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Method				:	postBind
+// Description			:
+/// \brief					Fill in the defaults that depend on the values
+// Return Value			:	-
+// Comments				:
+void		CVolumeLookup::postBind(CShadingScratch *scratch) {
+	if (scratch->volumeParams.coordsys[0] == '\0') {
+		scratch->volumeParams.coordsys = "world";
+	}
+
+	if (scratch->volumeParams.channel[0] == '\0') {
+		scratch->volumeParams.channel = "density";
+	}
+}
+
+
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	COcclusionLookup
 // Method				:	COcclusionLookup
@@ -580,6 +668,9 @@ void		COcclusionLookup::bind(const char *name,int &opIndex,int step,void *data,C
 		add(name,opIndex,step,data,offsetof(CShadingScratch,occlusionParams.maxPixelDist));
 	} else if (strcmp(name,"maxsolidangle") == 0) {
 		add(name,opIndex,step,data,offsetof(CShadingScratch,occlusionParams.maxSolidAngle));
+	} else if (strcmp(name,"microbuffer") == 0) {
+		expectUniform(name);
+		add(name,opIndex,step,data,offsetof(CShadingScratch,occlusionParams.microbuffer));
 	} else if (strcmp(name,"environmentcolor") == 0) {
 		add(name,opIndex,step,data,offsetof(CShadingScratch,occlusionParams.environmentColor));
 	} else if (strcmp(name,"maxBrightness") == 0) {
@@ -623,6 +714,7 @@ void		COcclusionLookup::init(CShadingScratch *scratch,const CAttributes *attribu
 	scratch->occlusionParams.pointHierarchyName	=	NULL;					// No point hierarchy
 	scratch->occlusionParams.maxPixelDist		=	attributes->irradianceMaxPixelDistance;		// The maximum distance between samples
 	scratch->occlusionParams.maxSolidAngle		=	0.05f;					// The maximum solid angle
+	scratch->occlusionParams.microbuffer		=	0;						// No microbuffer by default
 	scratch->occlusionParams.occlusion			=	FALSE;					// Overwritten on the fly
 	initv(scratch->occlusionParams.environmentColor,0);						// The background color for irradiance
 	scratch->occlusionParams.pointHierarchy		=	NULL;					// Overwritten on the fly
@@ -730,6 +822,10 @@ public:
 						}
 					}
 
+			int		cacheable() {
+						return (entry == VARIABLE_CI) || (entry == VARIABLE_OI);
+					}
+
 			int		entry;		// Variable index
 };
 
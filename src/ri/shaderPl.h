@@ -92,6 +92,7 @@ class	CPhotonMap;
 class	CTextureInfoBase;
 class	CTexture3d;
 class	CPointHierarchy;
+class	CVolume;
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CTextureLookup
@@ -200,6 +201,24 @@ public:
 };
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolumeLookup
+// Description			:
+/// \brief					Lookup parameters for the volume3d
+// Comments				:	We are derived from texture3D for the channel outputs
+class	CVolumeLookup : public CTexture3dLookup {
+public:
+							CVolumeLookup();
+							~CVolumeLookup();
+
+		void				bind(const char *name,int &opIndex,int step,void *data,CShaderInstance *shader);
+		void				init(CShadingScratch *scratch,const CAttributes *attributes);
+		void				postBind(CShadingScratch *scratch);
+
+		CVolume				*volume;								// The volume we're marching through
+};
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CGlobalIllumLookup
 // Description			:
@@ -256,6 +275,7 @@ class	CGatherVariable {
 public:
 	virtual			~CGatherVariable() { }
 	virtual	void	record(float *,int,CGatherRay **,float **varying)	=	0;
+	virtual	int		cacheable()											{	return FALSE;	}	// TRUE if the radiance caches can provide this
 
 	CGatherVariable	*next;		// The next item in the linked list
 	int				shade;		// TRUE if this variable requires shading
@@ -41,6 +41,7 @@
 #include	"texture3d.h"
 #include	"irradiance.h"
 #include	"stats.h"
+#include	"profiler.h"
 #include	"memory.h"
 #include	"random.h"
 #include	"points.h"
@@ -404,8 +405,7 @@ CShadingContext::CShadingContext(int t) : thread(t) {
 	memoryInit(threadMemory);
 
 	// Init the bucket we're rendering
-	currentXBucket			=	0;
-	currentYBucket			=	0;
+	gotoBucket(0);
 
 	// Init the conditionals
 	conditionals			=	NULL;
@@ -413,6 +413,7 @@ CShadingContext::CShadingContext(int t) : thread(t) {
 	currentRayLabel			=	rayLabelPrimary;
 	freeStates				=	NULL;
 	inShadow				=	FALSE;
+	traceAnyHit				=	FALSE;
 
 	// (globalMemory is checkpointed)
 	traceObjectHash			=	(TObjectHash *) ralloc(sizeof(TObjectHash)*SHADING_OBJECT_CACHE_SIZE,CRenderer::globalMemory);
@@ -438,11 +439,42 @@ CShadingContext::CShadingContext(int t) : thread(t) {
 	vertexMemory						=	0;
 	peakVertexMemory					=	0;
 	numTracedRays						=	0;
+	numAnyHitRays						=	0;
 	numReflectionRays					=	0;
 	numTransmissionRays					=	0;
 	numGatherRays						=	0;
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	gotoBucket
+// Description			:
+/// \brief					Make the bucket at the given position in the bucket order current
+// Return Value			:	-
+// Comments				:	Past the last bucket, the current bucket is below the image
+void		CShadingContext::gotoBucket(int rank) {
+	currentBucket	=	rank;
+
+	if (rank < CRenderer::xBuckets*CRenderer::yBuckets) {
+		currentXBucket	=	CRenderer::bucketSequence[rank] % CRenderer::xBuckets;
+		currentYBucket	=	CRenderer::bucketSequence[rank] / CRenderer::xBuckets;
+	} else {
+		currentXBucket	=	0;
+		currentYBucket	=	CRenderer::yBuckets;
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	reorderBuckets
+// Description			:
+/// \brief					The bucket order changed before the rendering started
+// Return Value			:	-
+// Comments				:
+void		CShadingContext::reorderBuckets() {
+	gotoBucket(0);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CShadingContext
 // Method				:	~CShadingContext
@@ -492,18 +524,19 @@ CShadingContext::~CShadingContext() {
 	assert(vertexMemory == 0);
 
 	// Update the global statistics
-	stats.numIndirectDiffuseRays				+=	numIndirectDiffuseRays;
-	stats.numIndirectDiffuseSamples				+=	numIndirectDiffuseSamples;
-	stats.numOcclusionRays						+=	numOcclusionRays;
-	stats.numOcclusionSamples					+=	numOcclusionSamples;
-	stats.numIndirectDiffusePhotonmapLookups	+=	numIndirectDiffusePhotonmapLookups;
-	stats.numShade								+=	numShade;
-	stats.numSampled							+=	numSampled;
-	stats.numShaded								+=	numShaded;
-	stats.numTracedRays							+=	numTracedRays;
-	stats.numReflectionRays						+=	numReflectionRays;
-	stats.numTransmissionRays					+=	numTransmissionRays;
-	stats.numGatherRays							+=	numGatherRays;
+	stats.add(thread,STAT_INDIRECTDIFFUSE_RAYS,					numIndirectDiffuseRays);
+	stats.add(thread,STAT_INDIRECTDIFFUSE_SAMPLES,				numIndirectDiffuseSamples);
+	stats.add(thread,STAT_OCCLUSION_RAYS,						numOcclusionRays);
+	stats.add(thread,STAT_OCCLUSION_SAMPLES,					numOcclusionSamples);
+	stats.add(thread,STAT_INDIRECTDIFFUSE_PHOTONMAP_LOOKUPS,	numIndirectDiffusePhotonmapLookups);
+	stats.add(thread,STAT_SHADE,								numShade);
+	stats.add(thread,STAT_SAMPLED,								numSampled);
+	stats.add(thread,STAT_SHADED,								numShaded);
+	stats.add(thread,STAT_TRACED_RAYS,							numTracedRays);
+	stats.add(thread,STAT_ANYHIT_RAYS,							numAnyHitRays);
+	stats.add(thread,STAT_REFLECTION_RAYS,						numReflectionRays);
+	stats.add(thread,STAT_TRANSMISSION_RAYS,					numTransmissionRays);
+	stats.add(thread,STAT_GATHER_RAYS,							numGatherRays);
 }
 
 
@@ -559,6 +592,9 @@ void	CShadingContext::shade(CSurface *object,int uVertices,int vVertices,EShadin
 	numShade++;
 	numSampled			+=	numVertices;
 
+	// Record the time we spend on this grid
+	CProfilerSpan	shadeSpan(thread,PROFILER_SHADE,displaceOnly ? "displace" : "shade");
+
 	// Are we just displacing the surface ?
 	if (displaceOnly == FALSE) {
 
@@ -36,6 +36,7 @@
 #include "common/containers.h"
 #include "shader.h"
 #include "random.h"
+#include "stats.h"
 
 // Some forward definitions
 class	CShaderInstance;
@@ -47,6 +48,7 @@ class	CRay;
 class	CObject;
 class	CRemoteChannel;
 class	CSurface;
+class	CDelayedInstance;
 class	CTracable;
 class	CQuadVertex;
 class	CQuadTriangle;
@@ -144,6 +146,13 @@ public:
 		float			radius;
 		float			radiusScale;	}			texture3dParams;
 
+	// volume3d parameters
+	struct {
+		const char		*coordsys;
+		const char		*channel;
+		float			stepSize;
+		float			densityScale;	}			volumeParams;
+
 	// Trace/Transmission parameters
 	struct {
 		float			samples;
@@ -162,6 +171,7 @@ public:
 		const char		*pointHierarchyName;
 		float			maxPixelDist;
 		float			maxSolidAngle;
+		float			microbuffer;
 		int				occlusion;
 		const char		*cacheHandle;
 		const char		*cacheMode;
@@ -233,6 +243,7 @@ public:
 		virtual	void			postShade(int,CRay **,float **)	=	0;		// The function that's called with the shade results
 		virtual	void			postShade(int,CRay **)			=	0;		// The function that's called with the rays that don't intersect anything
 		virtual	void			post()							=	0;		// The function that's called after each pass
+		virtual	int				cacheable()						{	return FALSE;	}	// TRUE if the hits only need Ci/Oi, so they can come from the radiance caches
 };
 
 ///////////////////////////////////////////////////////////////////////
@@ -242,6 +253,7 @@ public:
 // Comments				:
 typedef struct TObjectHash {
 		CSurface				*object;
+		CDelayedInstance		*instance;
 		CRay					*rays;
 		int						numRays;
 		TObjectHash				*next;
@@ -264,6 +276,9 @@ public:
 		// Delayed rendering functions
 		virtual	void			drawObject(CObject *)									=	0;
 
+		// Called when the bucket order changes before the rendering starts
+		virtual	void			reorderBuckets();
+
 		// Primitive creation functions
 		virtual	void			drawGrid(CSurface *,int,int,float,float,float,float)	=	0;
 		virtual	void			drawPoints(CSurface *,int)								=	0;
@@ -280,7 +295,9 @@ public:
 		void					trace(CRayBundle *);									// Trace and maybe shade bunch of rays
 		void					traceEx(CRayBundle *);									// Trace and maybe shade a bundle of rays. This version increments the shading depth
 		void					trace(CRay *);											// Trace a ray (no shading)
-		void					traceAny(CRay *);										// Trace any ray (no shading)
+		void					trace(CRay *,CObject *);								// Trace a ray through a hierarchy (no shading)
+		void					traceAny(CRay *);										// Trace a ray until the first hit (no shading)
+		void					traceAny(CRay *,CObject *);								// Trace a ray through a hierarchy until the first hit (no shading)
 
 		// Shading state management functions
 		void					updateState();											// Add a variable into the shading state
@@ -295,6 +312,8 @@ public:
 
 		// The current bucket we're processing in this thread
 		int						currentXBucket,currentYBucket;
+		int						currentBucket;									// The index of the current bucket in CRenderer::bucketSequence
+		void					gotoBucket(int);								// Set the current bucket from the bucket order
 
 		// Thread safe random number generator for integers
 		inline	uint32_t	irand() {
@@ -332,16 +351,17 @@ public:
 								}
 
 		const int				thread;												// The thread number for this context
+		int						traceAnyHit;										// TRUE if the ray being traced can stop at the first hit
 
 		CSobol<2>				random2d;											// 2D random number generator
 		CSobol<3>				random3d;											// 3D random number generator
 		CSobol<4>				random4d;											// 4D random number generator
 
-		int						numIndirectDiffuseRays;
-		int						numIndirectDiffuseSamples;
-		int						numOcclusionRays;
-		int						numOcclusionSamples;
-		int						numIndirectDiffusePhotonmapLookups;
+		TStatCounter			numIndirectDiffuseRays;
+		TStatCounter			numIndirectDiffuseSamples;
+		TStatCounter			numOcclusionRays;
+		TStatCounter			numOcclusionSamples;
+		TStatCounter			numIndirectDiffusePhotonmapLookups;
 protected:
 		// Hiders can hook into the following functions
 		virtual	void			solarBegin(const float *,const float *) { }
@@ -349,15 +369,16 @@ protected:
 		virtual	void			illuminateBegin(const float *,const float *,const float *) { }
 		virtual	void			illuminateEnd() { }
 
-		int						numShade;											// Number of times shade is called
-		int						numSampled;											// Number of points sampled
-		int						numShaded;											// Number of points shaded
+		TStatCounter			numShade;											// Number of times shade is called
+		TStatCounter			numSampled;											// Number of points sampled
+		TStatCounter			numShaded;											// Number of points shaded
 		int						vertexMemory;										// The amount of vertex memory allocated by this context
 		int						peakVertexMemory;									// The maximum peak vertex memory
-		int						numTracedRays;										// The number of rays traced
-		int						numReflectionRays;
-		int						numTransmissionRays;
-		int						numGatherRays;
+		TStatCounter			numTracedRays;										// The number of rays traced
+		TStatCounter			numAnyHitRays;										// The number of those that were traced for any hit
+		TStatCounter			numReflectionRays;
+		TStatCounter			numTransmissionRays;
+		TStatCounter			numGatherRays;
 private:
 		CMemPage				*shaderStateMemory;									// Memory from which we allocate shader instance variables
 
@@ -368,6 +389,8 @@ private:
 		int						inShadow;											// TRUE if we're in a shadow
 
 		TObjectHash				*traceObjectHash;									// An object hash array for raytraced objects
+
+		int						shadeCached(CRayBundle *,int,CRay **);				// Shade the rays that can use the radiance caches
 	
 		void					execute(CProgrammableShaderInstance *,float **);	// Execute a shader
 
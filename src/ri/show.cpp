@@ -125,6 +125,8 @@ CShow::CShow(int thread) : CShadingContext(thread) {
 									view	=	CRenderer::getCache(fileName,"R",from,to);
 								} else if (strcmp(t,filePointCloud) == 0) {
 									view	=	CRenderer::getTexture3d(fileName,FALSE,NULL,from,to);
+								} else if (strcmp(t,filePagedPointCloud) == 0) {
+									view	=	CRenderer::getTexture3d(fileName,FALSE,NULL,from,to);
 								} else if (strcmp(t,fileBrickMap) == 0) {
 									view	=	CRenderer::getTexture3d(fileName,FALSE,NULL,from,to);
 								}
@@ -30,6 +30,7 @@
 //
 ////////////////////////////////////////////////////////////////////////
 #include <stdio.h>
+#include <string.h>
 
 #include "stats.h"
 #include "common/os.h"
@@ -37,6 +38,53 @@
 
 CStats	stats;
 
+// The names of the counters in the JSON output
+static	const char	*statCounterNames[STAT_NUM_COUNTERS]	=	{
+	"shade",
+	"sampled",
+	"shaded",
+	"tracedRays",
+	"anyHitRays",
+	"reflectionRays",
+	"transmissionRays",
+	"gatherRays",
+	"photonRays",
+	"rasterGridsCreated",
+	"rasterVerticesCreated",
+	"rasterGridsShaded",
+	"rasterGridsRendered",
+	"rasterQuadsRendered",
+	"rasterBlocksAllocated",
+	"rasterBlocksRecycled",
+	"splits",
+	"usplits",
+	"vsplits",
+	"uvsplits",
+	"textureMisses",
+	"transferredTextureData",
+	"transferredTexels",
+	"indirectDiffuseSamples",
+	"occlusionSamples",
+	"indirectDiffuseRays",
+	"occlusionRays",
+	"indirectDiffusePhotonmapLookups",
+	"photonCacheSamples",
+	"brickmapLookups",
+	"brickmapCacheHits",
+	"brickmapCachePageouts",
+	"brickmapCachePageins",
+	"pointCloudPageins",
+	"pointCloudPageouts",
+	"volumeLookups",
+	"volumeSkipped",
+	"tesselationCacheMisses",
+	"tesselationCacheHits",
+	"radianceCacheHits",
+	"radianceCacheGrids",
+	"netRecv",
+	"netSend"
+};
+
 // Signal handler
 extern "C" {
 	void printStatsHandler(int){
@@ -44,6 +92,93 @@ extern "C" {
 	}
 }
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	CStats
+// Description			:
+/// \brief					Ctor
+// Return Value			:
+// Comments				:	Only the shared shard exists until reserveThreads is called
+CStats::CStats() {
+	osCreateMutex(sharedMutex);
+
+	shards		=	NULL;
+	shardMemory	=	NULL;
+	numThreads	=	-1;
+	reserveThreads(0);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	~CStats
+// Description			:
+/// \brief					Dtor
+// Return Value			:
+// Comments				:
+CStats::~CStats() {
+	delete [] shardMemory;
+
+	osDeleteMutex(sharedMutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	reserveThreads
+// Description			:
+/// \brief					Make sure every thread has its own shard
+// Return Value			:
+// Comments				:	The counts of the old shards are kept in the shared shard
+void	CStats::reserveThreads(int n) {
+	int	i,j;
+
+	if (n <= numThreads)	return;
+
+	// Allocate the new shards aligned to a cache line
+	char			*newMemory	=	new char[(n+1)*STAT_SHARD_SIZE*sizeof(TStatCounter) + STATS_CACHE_LINE];
+	TStatCounter	*newShards	=	(TStatCounter *) (((size_t) newMemory + STATS_CACHE_LINE - 1) & ~((size_t) STATS_CACHE_LINE - 1));
+
+	memset(newShards,0,(n+1)*STAT_SHARD_SIZE*sizeof(TStatCounter));
+
+	// Fold the old shards into the shared one
+	for (i=0;i<=numThreads;i++) {
+		for (j=0;j<STAT_NUM_COUNTERS;j++)	newShards[j]	+=	shards[i*STAT_SHARD_SIZE + j];
+	}
+
+	delete [] shardMemory;
+	shardMemory	=	newMemory;
+	shards		=	newShards;
+	numThreads	=	n;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	addShared
+// Description			:
+/// \brief					Increment a counter in the shared shard
+// Return Value			:
+// Comments				:	This takes a lock, so it should not be used on the hot paths
+void	CStats::addShared(EStatCounter counter,TStatCounter n) {
+	osLock(sharedMutex);
+	shards[counter]	+=	n;
+	osUnlock(sharedMutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	counter
+// Description			:
+/// \brief					Sum a counter over the shards
+// Return Value			:	The counter value
+// Comments				:	The threads may still be counting, so this is a snapshot
+TStatCounter	CStats::counter(EStatCounter counter) const {
+	TStatCounter	sum	=	0;
+	int				i;
+
+	for (i=0;i<=numThreads;i++)	sum	+=	shards[i*STAT_SHARD_SIZE + counter];
+
+	return sum;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CStats
 // Method				:	reset
@@ -58,6 +193,10 @@ void	CStats::reset() {
 	rendererStartOverhead				=	0;
 	numAttributes						=	0;
 	numXforms							=	0;
+	numXformStates						=	0;
+	numUniqueXforms						=	0;
+	numAttributeStates					=	0;
+	numUniqueAttributes					=	0;
 	numOptions							=	0;
 	numShaders							=	0;
 	numShaderInstances					=	0;
@@ -74,51 +213,30 @@ void	CStats::reset() {
 	textureMemory						=	0;
 	sequenceNumber						=	0;
 	runningSequenceNumber				=	0;
-	totalNetRecv						=	0;
-	totalNetSend						=	0;
 	frameStartTime						=	0;
 	frameTime							=	0;
 	progress							=	0;
-	numShade							=	0;
-	numSampled							=	0;
-	numShaded							=	0;
-	numTracedRays						=	0;
-	numReflectionRays					=	0;
-	numTransmissionRays					=	0;
-	numGatherRays						=	0;
-	numPhotonRays						=	0;
 	numRasterGrids						=	0;
 	numRasterObjects					=	0;
-	numRasterGridsCreated				=	0;
-	numRasterVerticesCreated			=	0;
-	numRasterGridsShaded				=	0;
-	numRasterGridsRendered				=	0;
-	numRasterQuadsRendered				=	0;
-	numSplits							=	0;
-	numVsplits							=	0;
-	numUsplits							=	0;
-	numUVsplits							=	0;
-	numTextureMisses					=	0;
-	transferredTextureData				=	0;
+	numPeakRasterGrids					=	0;
+	gridMemory							=	0;
+	peakGridMemory						=	0;
+	rasterCacheMemory					=	0;
+	peakRasterCacheMemory				=	0;
+	numRetainedGrids					=	0;
+	numBucketsRendered					=	0;
+	numDispatchStalls					=	0;
+	textureBudget						=	0;
 	textureSize							=	0;
 	numPeakTextures						=	0;
 	numPeakEnvironments					=	0;
 	peakTextureSize						=	0;
-	numIndirectDiffuseSamples			=	0;
-	numOcclusionSamples					=	0;
-	numIndirectDiffuseRays				=	0;
-	numOcclusionRays					=	0;
-	numIndirectDiffusePhotonmapLookups	=	0;
-	numBrickmapLookups					=	0;
-	numBrickmapCacheHits				=	0;
-	numBrickmapCachePageouts			=	0;
-	numBrickmapCachePageins				=	0;
 	brickmapPeakMem						=	0;
 	tesselationPeakMemory				=	0;
 	tesselationMemory					=	0;
-	tesselationCacheHits				=	0;
-	tesselationCacheMisses				=	0;
 	tesselationOverhead					=	0;
+
+	memset(shards,0,(numThreads+1)*STAT_SHARD_SIZE*sizeof(TStatCounter));
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -129,11 +247,17 @@ void	CStats::reset() {
 // Return Value			:
 // Comments				:
 void	CStats::printStats(int level) {
+	TStatCounter	c[STAT_NUM_COUNTERS];
+	int				i;
+
+	// Sum the per thread counters once
+	for (i=0;i<STAT_NUM_COUNTERS;i++)	c[i]	=	counter((EStatCounter) i);
+
 	info(CODE_STATS,"---> Renderer current:\n");
 
-	info(CODE_STATS,"       Zone memory: %d/%d (Current/Peak bytes)\n",zoneMemory,peakZoneMemory);
+	info(CODE_STATS,"       Zone memory: %lld/%lld (Current/Peak bytes)\n",zoneMemory,peakZoneMemory);
 	info(CODE_STATS,"              Time: %.2f seconds\n",osTime() - rendererStartTime);
-	info(CODE_STATS,"           Network: %d KB received, %d KB sent\n",totalNetRecv >> 10,totalNetSend >> 10);
+	info(CODE_STATS,"           Network: %lld KB received, %lld KB sent\n",c[STAT_NET_RECV] >> 10,c[STAT_NET_SEND] >> 10);
 
 	info(CODE_STATS,"---> End of frame stats:\n");
 	info(CODE_STATS,"              Time:  %.2f seconds\n",frameTime);
@@ -141,73 +265,140 @@ void	CStats::printStats(int level) {
 	info(CODE_STATS,"->Memory\n");
 	info(CODE_STATS,"             Xform: %d (instances)\n",numXforms);
 	info(CODE_STATS,"        Attributes: %d (instances)\n",numAttributes);
+	info(CODE_STATS,"     Shared Xforms: %d of %d (unique of total)\n",numUniqueXforms,numXformStates);
+	info(CODE_STATS," Shared Attributes: %d of %d (unique of total)\n",numUniqueAttributes,numAttributeStates);
 	info(CODE_STATS,"             Gprim: %d (instances)\n",numGprims);
 	info(CODE_STATS,"           Options: %d (instances)\n",numOptions);
-	info(CODE_STATS,"          Textures: %d(%d) (bytes(instances))\n",textureMemory,numTextures);
-	info(CODE_STATS,"         Zone Peak: %d (bytes)\n",peakZoneMemory);
+	info(CODE_STATS,"          Textures: %lld(%d) (bytes(instances))\n",textureMemory,numTextures);
+	info(CODE_STATS,"         Zone Peak: %lld (bytes)\n",peakZoneMemory);
 
 	if (level >= 2) {
 		info(CODE_STATS,"->Rasterizer\n");
 
-		if (numRasterGridsCreated > 0) {
-			info(CODE_STATS,"      Grid Culling: %.2f (percent)\n",100*(numRasterGridsCreated-numRasterGridsShaded) / (float) numRasterGridsCreated);
-			info(CODE_STATS,"       Vertex/Grid: %.2f (%d/%d)\n",numRasterVerticesCreated / (float) numRasterGridsCreated,numRasterVerticesCreated,numRasterGridsCreated);
-			info(CODE_STATS,"          Overdraw: %.2f (times)\n",numRasterGridsRendered / (float) numRasterGridsCreated);
+		if (c[STAT_RASTER_GRIDS_CREATED] > 0) {
+			info(CODE_STATS,"      Grid Culling: %.2f (percent)\n",100*(c[STAT_RASTER_GRIDS_CREATED]-c[STAT_RASTER_GRIDS_SHADED]) / (double) c[STAT_RASTER_GRIDS_CREATED]);
+			info(CODE_STATS,"       Vertex/Grid: %.2f (%lld/%lld)\n",c[STAT_RASTER_VERTICES_CREATED] / (double) c[STAT_RASTER_GRIDS_CREATED],c[STAT_RASTER_VERTICES_CREATED],c[STAT_RASTER_GRIDS_CREATED]);
+			info(CODE_STATS,"          Overdraw: %.2f (times)\n",c[STAT_RASTER_GRIDS_RENDERED] / (double) c[STAT_RASTER_GRIDS_CREATED]);
+			info(CODE_STATS,"        Peak Grids: %d (grids) %lld (bytes)\n",numPeakRasterGrids,peakGridMemory);
+		}
+
+		if ((c[STAT_RASTER_BLOCKS_ALLOCATED] + c[STAT_RASTER_BLOCKS_RECYCLED]) > 0) {
+			info(CODE_STATS,"     Blocks Reused: %.2f (percent) %lld (allocated)\n",100*c[STAT_RASTER_BLOCKS_RECYCLED] / (double) (c[STAT_RASTER_BLOCKS_ALLOCATED] + c[STAT_RASTER_BLOCKS_RECYCLED]),c[STAT_RASTER_BLOCKS_ALLOCATED]);
+			info(CODE_STATS,"  Peak Block Cache: %lld (bytes)\n",peakRasterCacheMemory);
+		}
+
+		if (numBucketsRendered > 0) {
+			info(CODE_STATS,"    Retained Grids: %.2f (per bucket)\n",numRetainedGrids / (float) numBucketsRendered);
+		}
+
+		if (numDispatchStalls > 0) {
+			info(CODE_STATS,"   Dispatch Stalls: %d (times)\n",numDispatchStalls);
 		}
 
 		info(CODE_STATS,"          Surfaces: %d       (peak)\n",numPeakSurfaces);
 
-		if (numSplits > 0) {
-			info(CODE_STATS,"          U splits: %4.2f %%\n",100*numUsplits / (float) numSplits);
-			info(CODE_STATS,"          V splits: %4.2f %%\n",100*numVsplits / (float) numSplits);
-			info(CODE_STATS,"         UV splits: %4.2f %%\n",100*numUVsplits / (float) numSplits);
+		if (c[STAT_SPLITS] > 0) {
+			info(CODE_STATS,"          U splits: %4.2f %%\n",100*c[STAT_USPLITS] / (double) c[STAT_SPLITS]);
+			info(CODE_STATS,"          V splits: %4.2f %%\n",100*c[STAT_VSPLITS] / (double) c[STAT_SPLITS]);
+			info(CODE_STATS,"         UV splits: %4.2f %%\n",100*c[STAT_UVSPLITS] / (double) c[STAT_SPLITS]);
 		}
 
 		info(CODE_STATS,"->Raytracer\n");
-		info(CODE_STATS,"      Total Traced: %d\n",numTracedRays);
-		info(CODE_STATS,"        Reflection: %d\n",numReflectionRays);
-		info(CODE_STATS,"      Transmission: %d\n",numTransmissionRays);
-		info(CODE_STATS,"            Gather: %d\n",numGatherRays);
-		info(CODE_STATS,"  Indirect Diffuse: %d\n",numIndirectDiffuseRays);
-		info(CODE_STATS,"         Occlusion: %d\n",numOcclusionRays);
-		info(CODE_STATS,"           Photons: %d\n",numPhotonRays);
+		info(CODE_STATS,"      Total Traced: %lld\n",c[STAT_TRACED_RAYS]);
+		info(CODE_STATS,"           Any hit: %lld\n",c[STAT_ANYHIT_RAYS]);
+		info(CODE_STATS,"       Closest hit: %lld\n",c[STAT_TRACED_RAYS] - c[STAT_ANYHIT_RAYS]);
+		info(CODE_STATS,"        Reflection: %lld\n",c[STAT_REFLECTION_RAYS]);
+		info(CODE_STATS,"      Transmission: %lld\n",c[STAT_TRANSMISSION_RAYS]);
+		info(CODE_STATS,"            Gather: %lld\n",c[STAT_GATHER_RAYS]);
+		info(CODE_STATS,"  Indirect Diffuse: %lld\n",c[STAT_INDIRECTDIFFUSE_RAYS]);
+		info(CODE_STATS,"         Occlusion: %lld\n",c[STAT_OCCLUSION_RAYS]);
+		info(CODE_STATS,"           Photons: %lld\n",c[STAT_PHOTON_RAYS]);
 	}
 
 	if (level >= 3) {
 		info(CODE_STATS,"->Textures\n");
 		info(CODE_STATS,"              Peak: %d (texture instances) %d (environment instances)\n",numPeakTextures,numPeakEnvironments);
-		info(CODE_STATS,"       Peak memory: %d (bytes)\n",peakTextureSize);
-		info(CODE_STATS,"      Cache Misses: %d (times)\n",numTextureMisses);
+		info(CODE_STATS,"       Peak memory: %lld (bytes)\n",peakTextureSize);
+		info(CODE_STATS,"      Cache Misses: %lld (times)\n",c[STAT_TEXTURE_MISSES]);
 
-		if (numTextureMisses > 0) {
-			info(CODE_STATS,"     Avg. Transfer: %.2f (bytes per miss %d bytes total)\n",transferredTextureData / (float) numTextureMisses,transferredTextureData);
+		if (c[STAT_TEXTURE_MISSES] > 0) {
+			info(CODE_STATS,"     Avg. Transfer: %.2f (bytes per miss %lld bytes total)\n",c[STAT_TRANSFERRED_TEXTURE_DATA] / (double) c[STAT_TEXTURE_MISSES],c[STAT_TRANSFERRED_TEXTURE_DATA]);
+		}
+
+		if (c[STAT_TRANSFERRED_TEXELS] > 0) {
+			const double	bytesPerTexel	=	c[STAT_TRANSFERRED_TEXTURE_DATA] / (double) c[STAT_TRANSFERRED_TEXELS];
+
+			info(CODE_STATS,"    Texel Capacity: %.0f (texels in the budget at %.2f bytes per texel)\n",textureBudget / bytesPerTexel,bytesPerTexel);
 		}
 
 		info(CODE_STATS,"->Shader\n");
-		if (numSampled > 0) {
-			info(CODE_STATS,"     Avg. Sampling: %.2f (points)\n",numSampled / (float) numShade);
-			info(CODE_STATS,"      Avg. Shading: %.2f (points)\n",numShaded / (float) numShade);
+		if (c[STAT_SAMPLED] > 0) {
+			info(CODE_STATS,"     Avg. Sampling: %.2f (points)\n",c[STAT_SAMPLED] / (double) c[STAT_SHADE]);
+			info(CODE_STATS,"      Avg. Shading: %.2f (points)\n",c[STAT_SHADED] / (double) c[STAT_SHADE]);
 		}
 
 		info(CODE_STATS,"->Global Illumination\n");
-		info(CODE_STATS,"       Num Samples: %d (indirectdiffuse), %d (occlusion)\n",numIndirectDiffuseSamples,numOcclusionSamples);
-		info(CODE_STATS,"          Num Rays: %d (indirectdiffuse), %d (occlusion)\n",numIndirectDiffuseRays,numOcclusionRays);
-		info(CODE_STATS," Photonmap Lookups: %d\n",numIndirectDiffusePhotonmapLookups);
+		info(CODE_STATS,"       Num Samples: %lld (indirectdiffuse), %lld (occlusion)\n",c[STAT_INDIRECTDIFFUSE_SAMPLES],c[STAT_OCCLUSION_SAMPLES]);
+		info(CODE_STATS,"          Num Rays: %lld (indirectdiffuse), %lld (occlusion)\n",c[STAT_INDIRECTDIFFUSE_RAYS],c[STAT_OCCLUSION_RAYS]);
+		info(CODE_STATS," Photonmap Lookups: %lld\n",c[STAT_INDIRECTDIFFUSE_PHOTONMAP_LOOKUPS]);
+		info(CODE_STATS,"     Cache Samples: %lld (photonmap)\n",c[STAT_PHOTON_CACHE_SAMPLES]);
 		
 		info(CODE_STATS,"->3D Textures\n");
-		info(CODE_STATS,"       Peak memory: %d (bytes)\n",brickmapPeakMem);
-		info(CODE_STATS,"           lookups: %d (times)\n",numBrickmapLookups);
-		info(CODE_STATS,"        Cache Hits: %d (times)\n",numBrickmapCacheHits);
-		info(CODE_STATS,"   Bricks paged in: %d (bricks)\n",numBrickmapCachePageins);
-		info(CODE_STATS,"  Bricks paged out: %d (bricks)\n",numBrickmapCachePageouts);
+		info(CODE_STATS,"       Peak memory: %lld (bytes)\n",brickmapPeakMem);
+		info(CODE_STATS,"           lookups: %lld (times)\n",c[STAT_BRICKMAP_LOOKUPS]);
+		info(CODE_STATS,"        Cache Hits: %lld (times)\n",c[STAT_BRICKMAP_CACHE_HITS]);
+		info(CODE_STATS,"   Bricks paged in: %lld (bricks)\n",c[STAT_BRICKMAP_CACHE_PAGEINS]);
+		info(CODE_STATS,"  Bricks paged out: %lld (bricks)\n",c[STAT_BRICKMAP_CACHE_PAGEOUTS]);
+		info(CODE_STATS,"    Pages paged in: %lld (point cloud pages)\n",c[STAT_POINTCLOUD_PAGEINS]);
+		info(CODE_STATS,"   Pages paged out: %lld (point cloud pages)\n",c[STAT_POINTCLOUD_PAGEOUTS]);
+		info(CODE_STATS,"    Volume lookups: %lld (times)\n",c[STAT_VOLUME_LOOKUPS]);
+		info(CODE_STATS,"    Volume skipped: %lld (regions)\n",c[STAT_VOLUME_SKIPPED]);
 		
 		info(CODE_STATS,"->Tessellation Cache\n");
-		info(CODE_STATS,"       Peak memory: %d (bytes)\n",tesselationPeakMemory);
-		info(CODE_STATS,"            memory: %d (bytes)\n",tesselationMemory);
-		info(CODE_STATS,"        Cache hits: %d (times)\n",tesselationCacheHits);
-		info(CODE_STATS,"      Cache misses: %d (times)\n",tesselationCacheMisses);
-		info(CODE_STATS,"    Tess. Overhead: %d (bytes)\n",tesselationOverhead);
+		info(CODE_STATS,"       Peak memory: %lld (bytes)\n",tesselationPeakMemory);
+		info(CODE_STATS,"            memory: %lld (bytes)\n",tesselationMemory);
+		info(CODE_STATS,"        Cache hits: %lld (times)\n",c[STAT_TESSELATION_CACHE_HITS]);
+		info(CODE_STATS,"      Cache misses: %lld (times)\n",c[STAT_TESSELATION_CACHE_MISSES]);
+		info(CODE_STATS,"    Tess. Overhead: %lld (bytes)\n",tesselationOverhead);
+		info(CODE_STATS,"  Radiance entries: %lld (grids)\n",c[STAT_RADIANCE_CACHE_GRIDS]);
+		info(CODE_STATS,"     Radiance hits: %lld (times)\n",c[STAT_RADIANCE_CACHE_HITS]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CStats
+// Method				:	writeStats
+// Description			:
+/// \brief					Append the statistics of a frame to a file as a single line of JSON
+// Return Value			:
+// Comments				:
+void	CStats::writeStats(const char *fileName,int frame) {
+	FILE	*out;
+	int		i;
+
+	if ((out = fopen(fileName,"a")) == NULL) {
+		error(CODE_BADFILE,"Failed to open \"%s\" for writing\n",fileName);
+		return;
 	}
+
+	fprintf(out,"{\"frame\":%d,\"frameTime\":%.3f,\"rendererTime\":%.3f",frame,frameTime,osTime() - rendererStartTime);
+	fprintf(out,",\"zoneMemory\":%lld,\"peakZoneMemory\":%lld",zoneMemory,peakZoneMemory);
+	fprintf(out,",\"textureMemory\":%lld,\"peakTextureSize\":%lld,\"textureBudget\":%lld",textureMemory,peakTextureSize,textureBudget);
+	fprintf(out,",\"numPeakTextures\":%d,\"numPeakEnvironments\":%d",numPeakTextures,numPeakEnvironments);
+	fprintf(out,",\"brickmapPeakMemory\":%lld",brickmapPeakMem);
+	fprintf(out,",\"tesselationMemory\":%lld,\"tesselationPeakMemory\":%lld,\"tesselationOverhead\":%lld",tesselationMemory,tesselationPeakMemory,tesselationOverhead);
+	fprintf(out,",\"numXforms\":%d,\"numAttributes\":%d,\"numGprims\":%d,\"numOptions\":%d,\"numTextures\":%d",numXforms,numAttributes,numGprims,numOptions,numTextures);
+	fprintf(out,",\"numUniqueXforms\":%d,\"numXformStates\":%d,\"numUniqueAttributes\":%d,\"numAttributeStates\":%d",numUniqueXforms,numXformStates,numUniqueAttributes,numAttributeStates);
+	fprintf(out,",\"numPeakSurfaces\":%d,\"numPeakRasterGrids\":%d,\"peakGridMemory\":%lld,\"peakRasterCacheMemory\":%lld",numPeakSurfaces,numPeakRasterGrids,peakGridMemory,peakRasterCacheMemory);
+	fprintf(out,",\"numRetainedGrids\":%d,\"numBucketsRendered\":%d,\"numDispatchStalls\":%d",numRetainedGrids,numBucketsRendered,numDispatchStalls);
+
+	fprintf(out,",\"counters\":{");
+	for (i=0;i<STAT_NUM_COUNTERS;i++) {
+		fprintf(out,"%s\"%s\":%lld",(i > 0 ? "," : ""),statCounterNames[i],counter((EStatCounter) i));
+	}
+	fprintf(out,"}}\n");
+
+	fclose(out);
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -32,18 +32,92 @@
 #define STATS_H
 
 #include "common/global.h"		// The global header file
+#include "common/os.h"
+#include "ri_config.h"
+
+// A 64 bit statistics counter
+typedef long long		TStatCounter;
+
+///////////////////////////////////////////////////////////////////////
+// The event counters that are kept per thread and summed when reported
+typedef enum {
+	STAT_SHADE,								// Number of times shade is called
+	STAT_SAMPLED,							// The number of vertices that passed thru shade
+	STAT_SHADED,							// The number of vertices that ended up being shaded
+	STAT_TRACED_RAYS,
+	STAT_ANYHIT_RAYS,						// The number of rays traced for any hit (occlusion queries)
+	STAT_REFLECTION_RAYS,
+	STAT_TRANSMISSION_RAYS,
+	STAT_GATHER_RAYS,
+	STAT_PHOTON_RAYS,
+	STAT_RASTER_GRIDS_CREATED,				// The following stats come from the CReyes
+	STAT_RASTER_VERTICES_CREATED,
+	STAT_RASTER_GRIDS_SHADED,
+	STAT_RASTER_GRIDS_RENDERED,
+	STAT_RASTER_QUADS_RENDERED,
+	STAT_RASTER_BLOCKS_ALLOCATED,			// The number of raster object/grid blocks we had to allocate
+	STAT_RASTER_BLOCKS_RECYCLED,			// The number of raster object/grid blocks reused from the free lists
+	STAT_SPLITS,							// The stats that come from CPatch
+	STAT_USPLITS,
+	STAT_VSPLITS,
+	STAT_UVSPLITS,
+	STAT_TEXTURE_MISSES,					// The number of texture misses
+	STAT_TRANSFERRED_TEXTURE_DATA,			// The amount the texture data transmitted
+	STAT_TRANSFERRED_TEXELS,				// The number of texels transmitted
+	STAT_INDIRECTDIFFUSE_SAMPLES,			// The number of final gather samples taken
+	STAT_OCCLUSION_SAMPLES,
+	STAT_INDIRECTDIFFUSE_RAYS,				// The number of final gather rays traced
+	STAT_OCCLUSION_RAYS,
+	STAT_INDIRECTDIFFUSE_PHOTONMAP_LOOKUPS,	// The number of final gather photonmap lookups
+	STAT_PHOTON_CACHE_SAMPLES,				// The number of estimates inserted into the photon lookup caches
+	STAT_BRICKMAP_LOOKUPS,					// The number of brickmap lookups
+	STAT_BRICKMAP_CACHE_HITS,				// The number of brickmap cache hits
+	STAT_BRICKMAP_CACHE_PAGEOUTS,			// The number of bricks paged out
+	STAT_BRICKMAP_CACHE_PAGEINS,			// The number of bricks paged in
+	STAT_POINTCLOUD_PAGEINS,				// The number of point cloud pages paged in
+	STAT_POINTCLOUD_PAGEOUTS,				// The number of point cloud pages paged out
+	STAT_VOLUME_LOOKUPS,					// The number of density lookups while marching volumes
+	STAT_VOLUME_SKIPPED,					// The number of empty volume regions skipped
+	STAT_TESSELATION_CACHE_MISSES,			// The number of tesselation cache misses
+	STAT_TESSELATION_CACHE_HITS,			// The number of tesselation cache hits
+	STAT_RADIANCE_CACHE_HITS,				// The number of ray hits shaded from the patch radiance caches
+	STAT_RADIANCE_CACHE_GRIDS,				// The number of patch radiance caches shaded
+	STAT_NET_RECV,							// The total number of bytes received over the net
+	STAT_NET_SEND,							// The total number of bytes send over the net
+	STAT_NUM_COUNTERS
+} EStatCounter;
+
+// The number of counters in a shard, rounded up to full cache lines so that threads never share a line
+#define	STAT_SHARD_SIZE		((((STAT_NUM_COUNTERS*sizeof(TStatCounter)) + STATS_CACHE_LINE - 1) / STATS_CACHE_LINE) * (STATS_CACHE_LINE / sizeof(TStatCounter)))
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CStats
 // Description			:	Holds statistics
-// Comments				:
+// Comments				:	The event counters are sharded, shard 0 is shared by the code
+//							that doesn't know which thread it's running in and is updated
+//							under a lock, thread i owns the shard i+1
 class CStats {
 public:
-
+					CStats();
+					~CStats();
 
 	void			reset();						// Reset all the stats
 	void			printStats(int);				// Print the frame statistics
+	void			writeStats(const char *,int);	// Append the frame statistics to a JSON file
 	void			check();						// Check we have clean shutdown
+	void			reserveThreads(int);			// Make room for the counters of the threads (must be called before they start)
+
+					// Increment a counter of the calling thread
+	inline	void	add(int thread,EStatCounter counter,TStatCounter n) {
+						assert(thread < numThreads);
+						shards[(thread+1)*STAT_SHARD_SIZE + counter]	+=	n;
+					}
+
+					// Increment a counter from a thread that doesn't have a shard
+	void			addShared(EStatCounter,TStatCounter);
+
+					// Sum the shards of a counter
+	TStatCounter	counter(EStatCounter) const;
 
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -51,12 +125,16 @@ public:
 	//	Global stats
 	//
 	///////////////////////////////////////////////////////////////////////////////
-	int				zoneMemory;						// The current zone memory size
-	int				peakZoneMemory;					// The peak zone memeory size
+	TStatCounter	zoneMemory;						// The current zone memory size
+	TStatCounter	peakZoneMemory;					// The peak zone memeory size
 	float			rendererStartTime;				// The time when the renderer was started
 	float			rendererStartOverhead;			// The time it took to initialize the renderer
 	int				numAttributes;					// The number of objects allocated of each type
 	int				numXforms;
+	int				numXformStates;					// The number of transformations handed to the primitives
+	int				numUniqueXforms;				// The number of distinct ones among them
+	int				numAttributeStates;				// The number of attribute states handed to the primitives
+	int				numUniqueAttributes;			// The number of distinct ones among them
 	int				numOptions;
 	int				numShaders;
 	int				numShaderInstances;
@@ -70,11 +148,9 @@ public:
 	int				numDelayeds;
 	int				numTextures;
 	int				numEnvironments;
-	int				textureMemory;
+	TStatCounter	textureMemory;
 	int				sequenceNumber;					// The sequence number
 	int				runningSequenceNumber;			// The running sequence number
-	int				totalNetRecv;					// The total number of bytes received over the net
-	int				totalNetSend;					// The total number of bytes send over the net
 
 
 	///////////////////////////////////////////////////////////////////////////////
@@ -86,49 +162,32 @@ public:
 	float			frameTime;						// The current frame time
 	float			progress;						// The progress in the current frame
 
-	int				numShade;						// Number of times shade is called
-	int				numSampled;						// The number of vertices that passed thru shade
-	int				numShaded;						// The number of vertices that ended up being shaded
-	int				numTracedRays;
-	int				numReflectionRays;
-	int				numTransmissionRays;
-	int				numGatherRays;
-	int				numPhotonRays;
-
 	int				numRasterGrids;					// The following stats come from the CReyes
 	int				numRasterObjects;
-	int				numRasterGridsCreated;
-	int				numRasterVerticesCreated;
-	int				numRasterGridsShaded;
-	int				numRasterGridsRendered;
-	int				numRasterQuadsRendered;
-
-	int				numSplits;						// The stats that come from CPatch
-	int				numVsplits,numUsplits,numUVsplits;
-
-	
-
-	int				numTextureMisses;				// The number of texture misses
-	int				transferredTextureData;			// The amount the texture data transmitted
-	int				textureSize;					// The current amount of textures in the memory
+	int				numPeakRasterGrids;				// The peak number of grids alive at a time
+	TStatCounter	gridMemory;						// The memory used by the grids alive (in bytes)
+	TStatCounter	peakGridMemory;					// The peak grid memory
+	TStatCounter	rasterCacheMemory;				// The memory in the raster blocks the threads keep for reuse
+	TStatCounter	peakRasterCacheMemory;			// The peak raster block cache memory
+	int				numRetainedGrids;				// The sum of the grids alive at the start of every bucket
+	int				numBucketsRendered;				// The number of buckets rendered
+	int				numDispatchStalls;				// The number of times a bucket dispatch was held back for memory
+
+	TStatCounter	textureBudget;					// The texture memory limit in bytes
+	TStatCounter	textureSize;					// The current amount of textures in the memory
 	int				numPeakTextures;				// The peak number of textures
 	int				numPeakEnvironments;			// The peak number of environments
-	int				peakTextureSize;				// The amount of memory at the peak denoted to textures
-	int				numIndirectDiffuseSamples;		// The number of final gather samples taken
-	int				numOcclusionSamples;			// The number of final gather samples taken
-	int				numIndirectDiffuseRays;			// The number of final gather samples taken
-	int				numOcclusionRays;				// The number of final gather samples taken
-	int				numIndirectDiffusePhotonmapLookups;			// The number of final gather photonmap lookups
-	int				numBrickmapLookups;				// The number of brickmap lookups
-	int				numBrickmapCacheHits;			// The number of brickmap cache hits
-	int				numBrickmapCachePageouts;		// The number of bricks paged out
-	int				numBrickmapCachePageins;		// The number of bricks paged in
-	int				brickmapPeakMem;				// The peak memory usage for brickmaps
-	int				tesselationMemory;				// The total memory usage for tesselations
-	int				tesselationPeakMemory;			// The peak total memory usage for tesselations
-	int				tesselationCacheMisses;			// The number of tesselation cache misses
-	int				tesselationCacheHits;			// The number of tesselation cache hits
-	int				tesselationOverhead;			// The memory overhead of tesselation patches
+	TStatCounter	peakTextureSize;				// The amount of memory at the peak denoted to textures
+	TStatCounter	brickmapPeakMem;				// The peak memory usage for brickmaps
+	TStatCounter	tesselationMemory;				// The total memory usage for tesselations
+	TStatCounter	tesselationPeakMemory;			// The peak total memory usage for tesselations
+	TStatCounter	tesselationOverhead;			// The memory overhead of tesselation patches
+
+private:
+	TStatCounter	*shards;						// The event counters (numThreads+1 shards of STAT_SHARD_SIZE)
+	char			*shardMemory;					// The memory the shards live in (unaligned)
+	int				numThreads;						// The number of threads that have a shard
+	TMutex			sharedMutex;					// Protects the shared shard
 };
 
 
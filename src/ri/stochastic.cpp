@@ -74,6 +74,16 @@ CStochastic::CStochastic(int thread) : CReyes(thread), COcclusionCuller(), apert
 	if (CRenderer::numExtraSamples > 0)	extraSampleMemory	=	(float *) ralloc(totalWidth*totalHeight*CRenderer::numExtraSamples*sizeof(float),CRenderer::globalMemory);
 	else								extraSampleMemory	=	NULL;
 
+	// Allocate the per sample arrays (checkpointed)
+	const int	numSamples	=	totalWidth*totalHeight;
+	sampleX			=	(float *) ralloc(numSamples*7*sizeof(float),CRenderer::globalMemory);
+	sampleY			=	sampleX + numSamples;
+	sampleZ			=	sampleY + numSamples;
+	sampleTime		=	sampleZ + numSamples;
+	sampleDx		=	sampleTime + numSamples;
+	sampleDy		=	sampleDx + numSamples;
+	sampleImportance	=	sampleDy + numSamples;
+
 	// Allocate the pixels (checkpointed)
 	cExtraSample	=	extraSampleMemory;
 	fb				=	(CPixel **) ralloc(totalHeight*sizeof(CPixel *),CRenderer::globalMemory);
@@ -150,10 +160,11 @@ void		CStochastic::rasterBegin(int w,int h,int l,int t,int nullBucket) {
 	initToZero();
 	for (i=0,pxi=CRenderer::pixelYsamples-CRenderer::ySampleOffset;i<sampleHeight;i++,pxi++) {
 		CPixel	*pixel	=	fb[i];
+		int		sample	=	i*totalWidth;
 		
 		if (pxi >= CRenderer::pixelYsamples)	pxi = 0;
 		
-		for (j=0,pxj=CRenderer::pixelXsamples-CRenderer::xSampleOffset;j<sampleWidth;j++,pxj++,pixel++) {
+		for (j=0,pxj=CRenderer::pixelXsamples-CRenderer::xSampleOffset;j<sampleWidth;j++,pxj++,pixel++,sample++) {
 			float	aperture[2];
 
 			// The stratified sample
@@ -162,10 +173,10 @@ void		CStochastic::rasterBegin(int w,int h,int l,int t,int nullBucket) {
 
 			// Time of the sample for motion blur
 			if (pxj >= CRenderer::pixelXsamples)	pxj = 0;
-			pixel->jt					=	( pxi*CRenderer::pixelXsamples + pxj + CRenderer::jitter*(urand()-0.5f) + 0.5001011f)/(float)(CRenderer::pixelXsamples*CRenderer::pixelYsamples);
+			sampleTime[sample]			=	( pxi*CRenderer::pixelXsamples + pxj + CRenderer::jitter*(urand()-0.5f) + 0.5001011f)/(float)(CRenderer::pixelXsamples*CRenderer::pixelYsamples);
 			
 			// Importance blend / jitter
-			pixel->jimp					=	1.0f - ( pxj*CRenderer::pixelYsamples + pxi + CRenderer::jitter*(urand()-0.5f) + 0.5001011f)/(float)(CRenderer::pixelXsamples*CRenderer::pixelYsamples);
+			sampleImportance[sample]	=	1.0f - ( pxj*CRenderer::pixelYsamples + pxi + CRenderer::jitter*(urand()-0.5f) + 0.5001011f)/(float)(CRenderer::pixelXsamples*CRenderer::pixelYsamples);
 
 			if (CRenderer::flags & OPTIONS_FLAGS_FOCALBLUR) {
 
@@ -177,18 +188,18 @@ void		CStochastic::rasterBegin(int w,int h,int l,int t,int nullBucket) {
 					if ((aperture[0]*aperture[0] + aperture[1]*aperture[1]) < 1.0f) break;
 				}
 
-				pixel->jdx					=	aperture[0];
-				pixel->jdy					=	aperture[1];
+				sampleDx[sample]			=	aperture[0];
+				sampleDy[sample]			=	aperture[1];
 			} else {
-				pixel->jdx					=	0;
-				pixel->jdy					=	0;
+				sampleDx[sample]			=	0;
+				sampleDy[sample]			=	0;
 			}
 			
 			// Center location of the sample
-			pixel->xcent				=	(j+pixel->jx) + left;
-			pixel->ycent				=	(i+pixel->jy) + top;
+			sampleX[sample]				=	(j+pixel->jx) + left;
+			sampleY[sample]				=	(i+pixel->jy) + top;
 
-			pixel->z					=	CRenderer::clipMax;
+			sampleZ[sample]				=	CRenderer::clipMax;
 			pixel->zold					=	zoldStart;
 			pixel->numSplats			=	0;
 			pixel->node					=	getNode(j,i);
@@ -246,8 +257,8 @@ void		CStochastic::rasterDrawPrimitives(CRasterGrid *grid) {
 #define depthFilterElseZMin()
 #define depthFilterTouchNodeZMin()	touchNode(pixel->node,z);
 
-#define depthFilterIfZMid()			pixel->zold		=	pixel->z;
-#define depthFilterElseZMid()		else {	pixel->zold	=	min(pixel->zold,z);	}
+#define depthFilterIfZMid()			pixel->zold		=	sampleZ[sample];
+#define depthFilterElseZMid()		else {	fb[y][x].zold	=	min(fb[y][x].zold,z);	}
 #define depthFilterTouchNodeZMid()	touchNode(pixel->node,pixel->zold);
 
 
@@ -366,9 +377,9 @@ void		CStochastic::rasterDrawPrimitives(CRasterGrid *grid) {
 				/*initv(cSample->accumulatedOpacity,1);		*/	\
 			}																						\
 			const float z			=	cSample->z;													\
-			if (z < pixel->z) {																		\
+			if (z < sampleZ[sample]) {																\
 				dfIf();																				\
-				pixel->z			=	z;															\
+				sampleZ[sample]		=	z;															\
 				depthFilterTouchNode();																\
 			} dfElse();																				\
 			break;																					\
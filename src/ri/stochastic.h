@@ -79,17 +79,14 @@ private:
 	// Class				:	CPixel
 	// Description			:
 /// \brief					This class holds a pixel
-	// Comments				:
+	// Comments				:	The fields every primitive tests against (the sample center, the
+	//							jitters and the opaque depth) are kept in separate arrays in the
+	//							CStochastic, the pixel is only touched when a sample is drawn
 	class	CPixel {
 	public:
 		float			jx,jy;					// The sampling jitter
-		float			jt;						// The time jitter
-		float			jdx,jdy;				// The aperture jitter	(Gaussian)
-		float			jimp;					// The relative important // GSHHACK
-		float			z;						// The farthest opaque z value
 		float			zold;					// This is the old Z value (for depth filtering)
 		int				numSplats;				// The number of splats to this pixel (used by the avg. depth filter);
-		float			xcent,ycent;			// The center of the sampling window
 		CFragment		first,last;				// The first and last fragments always exist
 		CFragment		*update;				// The last fragment to be saved
 		COcclusionNode	*node;					// The occlusion sample
@@ -101,6 +98,13 @@ private:
 	int			totalWidth,totalHeight;
 	CPixel		**fb;
 
+	// The per sample arrays (totalWidth entries per row)
+	float		*sampleX,*sampleY;				// The center of the sampling window
+	float		*sampleZ;						// The farthest opaque z value
+	float		*sampleTime;					// The time jitter
+	float		*sampleDx,*sampleDy;			// The aperture jitter (Gaussian)
+	float		*sampleImportance;				// The relative importance (for LOD)
+
 	CFragment	*freeFragments;
 	int			numFragments;
 	float		*extraSampleMemory;
@@ -69,9 +69,9 @@ const	int	yres		=	sampleHeight - 1;
 
 	#define lodCheck()																			\
 		if (importance >= 0) {																	\
-			if (pixel->jimp > importance)		continue;										\
+			if (sampleImportance[sample] > importance)		continue;										\
 		} else {																				\
-			if ((1-pixel->jimp) >= -importance)	continue;										\
+			if ((1-sampleImportance[sample]) >= -importance)	continue;										\
 		}
 #else
 	#define lodCheck()
@@ -190,14 +190,14 @@ const	int	yres		=	sampleHeight - 1;
 #ifndef STOCHASTIC_MOVING
 //	  Non Moving
 #define	drawPixel() 																\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		updateOpaque();																\
 		nSample							=	&pixel->last;							\
 		nSample->z						=	z;										\
 		colorOpacityUpdate();														\
 		drawExtraSamples();															\
 		depthFilterIf();															\
-		pixel->z						=	z;										\
+		sampleZ[sample]						=	z;										\
 		depthFilterTouchNode();														\
 	} depthFilterElse();
 
@@ -205,14 +205,14 @@ const	int	yres		=	sampleHeight - 1;
 #else
 //	  Moving
 #define	drawPixel() 																\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		updateOpaque();																\
 		nSample							=	&pixel->last;							\
 		nSample->z						=	z;										\
 		colorOpacityUpdate();														\
 		drawExtraSamples();															\
 		depthFilterIf();															\
-		pixel->z						=	z;										\
+		sampleZ[sample]						=	z;										\
 		depthFilterTouchNode();														\
 	} depthFilterElse();
 
@@ -224,7 +224,7 @@ const	int	yres		=	sampleHeight - 1;
 #ifndef STOCHASTIC_MOVING
 //	  Non Moving
 #define	drawPixel() 																\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		findSample(nSample,z);														\
 		nSample->z						=	z;										\
 		colorOpacityUpdate();														\
@@ -236,7 +236,7 @@ const	int	yres		=	sampleHeight - 1;
 #else
 //	  Moving
 #define	drawPixel() 																\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		findSample(nSample,z);														\
 		nSample->z						=	z;										\
 		colorOpacityUpdate();														\
@@ -256,14 +256,15 @@ const	int	yres		=	sampleHeight - 1;
 // We're not shaded yet, so if we pass the depth test, we need to back and shade the grid
 // Note: we dealt with RASTER_SHADE_HIDDEN very early, no need to do so here
 #define drawPixelCheck()															\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		shadeGrid(grid,FALSE);														\
 		rasterDrawPrimitives(grid);													\
 		return;																		\
 	} depthFilterElse();
 #else
 #define drawPixelCheck()															\
-	CFragment *nSample;																\
+	CPixel		*pixel	=	fb[y] + x;												\
+	CFragment	*nSample;															\
 	drawPixel();
 #endif
 
@@ -297,16 +298,16 @@ for (i=grid->numVertices;i>0;i--,vertices+=numVertexSamples,bounds+=4,sizes+=2)
 	int			x,y;
 	for (y=ymin;y<=ymax;y++) {
 		for (x=xmin;x<=xmax;x++) {
-			CPixel			*pixel	=	fb[y]+x;
+			const int		sample	=	y*totalWidth+x;
 
 			lodCheck();
 	
-			const float		xcent	=	pixel->xcent;
-			const float		ycent	=	pixel->ycent;
+			const float		xcent	=	sampleX[sample];
+			const float		ycent	=	sampleY[sample];
 		
 		
 #ifdef STOCHASTIC_MOVING
-			const	float	jt		=	pixel->jt;
+			const	float	jt		=	sampleTime[sample];
 			vector	v0movTmp;
 			interpolatev(v0movTmp,v0,(v0+displacement),jt);
 			v0						=	v0movTmp;
@@ -317,8 +318,8 @@ for (i=grid->numVertices;i>0;i--,vertices+=numVertexSamples,bounds+=4,sizes+=2)
 
 #ifdef STOCHASTIC_FOCAL_BLUR
 			vector	v0focTmp;
-			v0focTmp[COMP_X]		=	v0[COMP_X] + pixel->jdx*vertices[9];
-			v0focTmp[COMP_Y]		=	v0[COMP_Y] + pixel->jdy*vertices[9];
+			v0focTmp[COMP_X]		=	v0[COMP_X] + sampleDx[sample]*vertices[9];
+			v0focTmp[COMP_Y]		=	v0[COMP_Y] + sampleDy[sample]*vertices[9];
 			v0focTmp[COMP_Z]		=	v0[COMP_Z];
 			v0						=	v0focTmp;
 #endif
@@ -329,7 +330,7 @@ for (i=grid->numVertices;i>0;i--,vertices+=numVertexSamples,bounds+=4,sizes+=2)
 			v0	=	vertices;
 
 			if ((dx*dx + dy*dy) < (size*size)) {
-				const	float	z	=	v0[2];
+				const	float	z		=	v0[2];
 
 				drawPixelCheck();
 			}
@@ -64,9 +64,9 @@
 
 	#define lodCheck()																			\
 		if (importance >= 0) {																	\
-			if (pixel->jimp > importance)		continue;										\
+			if (sampleImportance[sample] > importance)		continue;										\
 		} else {																				\
-			if ((1-pixel->jimp) >= -importance)	continue;										\
+			if ((1-sampleImportance[sample]) >= -importance)	continue;										\
 		}
 
 #else
@@ -166,8 +166,8 @@
 #endif
 
 #define	drawPixel() 																			\
-	if (z < pixel->z) {																			\
-		const	float	jt		=	pixel->jt;													\
+	if (z < sampleZ[sample]) {																			\
+		const	float	jt		=	sampleTime[sample];													\
 		findSample(nSample,z);																	\
 		nSample->z				=	z;															\
 		colorOpacityUpdate();																	\
@@ -204,15 +204,15 @@
 #endif
 
 #define	drawPixel() 																			\
-	if (z < pixel->z) {																			\
-		const	float	jt		=	pixel->jt;													\
+	if (z < sampleZ[sample]) {																			\
+		const	float	jt		=	sampleTime[sample];													\
 		updateOpaque();																			\
 		nSample					=	&pixel->last;												\
 		nSample->z				=	z;															\
 		colorOpacityUpdate();																	\
 		drawExtraSamples();																		\
 		depthFilterIf();																		\
-		pixel->z				=	z;															\
+		sampleZ[sample]				=	z;															\
 		depthFilterTouchNode();																	\
 	} depthFilterElse();
 
@@ -254,7 +254,7 @@
 #endif
 
 #define	drawPixel() 																		\
-	if (z < pixel->z) {																		\
+	if (z < sampleZ[sample]) {																		\
 		findSample(nSample,z);																\
 		nSample->z				=	z;														\
 		colorOpacityUpdate();																\
@@ -289,14 +289,14 @@
 #endif
 
 #define	drawPixel()																			\
-	if (z < pixel->z) {																		\
+	if (z < sampleZ[sample]) {																		\
 		updateOpaque();																		\
 		nSample					=	&pixel->last;											\
 		nSample->z				=	z;														\
 		colorOpacityUpdate();																\
 		drawExtraSamples();																	\
 		depthFilterIf();																	\
-		pixel->z				=	z;														\
+		sampleZ[sample]				=	z;														\
 		depthFilterTouchNode();																\
 	} depthFilterElse();
 
@@ -326,14 +326,14 @@
 // We're not shaded yet, so if we pass the depth test, we need to back and shade the grid
 #ifdef STOCHASTIC_UNDERCULL
 #define drawPixelCheck()															\
-	if (z < pixel->z || (flags & RASTER_SHADE_HIDDEN)) {							\
+	if (z < sampleZ[sample] || (flags & RASTER_SHADE_HIDDEN)) {							\
 		shadeGrid(grid,FALSE);														\
 		rasterDrawPrimitives(grid);													\
 		return;																		\
 	} depthFilterElse();
 #else
 #define drawPixelCheck()															\
-	if (z < pixel->z) {																\
+	if (z < sampleZ[sample]) {																\
 		shadeGrid(grid,FALSE);														\
 		rasterDrawPrimitives(grid);													\
 		return;																		\
@@ -343,7 +343,8 @@
 #endif // undercull
 #else
 #define drawPixelCheck()															\
-	CFragment *nSample;																\
+	CPixel		*pixel	=	fb[y] + x;												\
+	CFragment	*nSample;															\
 	drawPixel();
 #endif
 
@@ -353,8 +354,8 @@
 //////////////////////////////////////////////////////////////////////////////////////////
 // This macro is used to check whether the sample is inside the quad or not
 #define	checkPixel(__op)																					\
-	const float		xcent	=	pixel->xcent;																\
-	const float		ycent	=	pixel->ycent;																\
+	const float		xcent	=	sampleX[sample];																\
+	const float		ycent	=	sampleY[sample];																\
 	float			aleft,atop,aright,abottom;																\
 																											\
 	if ((atop		= area(xcent,ycent,v0[COMP_X],v0[COMP_Y],v1[COMP_X],v1[COMP_Y])) __op 0)	continue;	\
@@ -396,7 +397,7 @@ ymax					=	min(ymax,yres);
 
 int	x,y;
 for (y=ymin;y<=ymax;y++) for (x=xmin;x<=xmax;x++) {
-	CPixel		*pixel		=	fb[y] + x;
+	const int	sample		=	y*totalWidth + x;
 	int			i,j;
 
 	const int	*bounds		=	grid->bounds;
@@ -434,10 +435,10 @@ for (y=ymin;y<=ymax;y++) for (x=xmin;x<=xmax;x++) {
 			vector	v1movTmp;
 			vector	v2movTmp;
 			vector	v3movTmp;
-			interpolatev(v0movTmp,v0,v0+displacement,pixel->jt);
-			interpolatev(v1movTmp,v1,v1+displacement,pixel->jt);
-			interpolatev(v2movTmp,v2,v2+displacement,pixel->jt);
-			interpolatev(v3movTmp,v3,v3+displacement,pixel->jt);
+			interpolatev(v0movTmp,v0,v0+displacement,sampleTime[sample]);
+			interpolatev(v1movTmp,v1,v1+displacement,sampleTime[sample]);
+			interpolatev(v2movTmp,v2,v2+displacement,sampleTime[sample]);
+			interpolatev(v3movTmp,v3,v3+displacement,sampleTime[sample]);
 			v0		=	v0movTmp;
 			v1		=	v1movTmp;
 			v2		=	v2movTmp;
@@ -450,15 +451,15 @@ for (y=ymin;y<=ymax;y++) for (x=xmin;x<=xmax;x++) {
 			vector	v1focTmp;
 			vector	v2focTmp;
 			vector	v3focTmp;
-			v0focTmp[COMP_X]	=	v0[COMP_X] + pixel->jdx*v0d;
-			v1focTmp[COMP_X]	=	v1[COMP_X] + pixel->jdx*v1d;
-			v2focTmp[COMP_X]	=	v2[COMP_X] + pixel->jdx*v2d;
-			v3focTmp[COMP_X]	=	v3[COMP_X] + pixel->jdx*v3d;
+			v0focTmp[COMP_X]	=	v0[COMP_X] + sampleDx[sample]*v0d;
+			v1focTmp[COMP_X]	=	v1[COMP_X] + sampleDx[sample]*v1d;
+			v2focTmp[COMP_X]	=	v2[COMP_X] + sampleDx[sample]*v2d;
+			v3focTmp[COMP_X]	=	v3[COMP_X] + sampleDx[sample]*v3d;
 
-			v0focTmp[COMP_Y]	=	v0[COMP_Y] + pixel->jdy*v0d;
-			v1focTmp[COMP_Y]	=	v1[COMP_Y] + pixel->jdy*v1d;
-			v2focTmp[COMP_Y]	=	v2[COMP_Y] + pixel->jdy*v2d;
-			v3focTmp[COMP_Y]	=	v3[COMP_Y] + pixel->jdy*v3d;
+			v0focTmp[COMP_Y]	=	v0[COMP_Y] + sampleDy[sample]*v0d;
+			v1focTmp[COMP_Y]	=	v1[COMP_Y] + sampleDy[sample]*v1d;
+			v2focTmp[COMP_Y]	=	v2[COMP_Y] + sampleDy[sample]*v2d;
+			v3focTmp[COMP_Y]	=	v3[COMP_Y] + sampleDy[sample]*v3d;
 
 			v0focTmp[COMP_Z]	=	v0[COMP_Z];
 			v1focTmp[COMP_Z]	=	v1[COMP_Z];
@@ -586,9 +587,9 @@ for (j=0;j<vdiv;j++) {
 			// For each sample
 			int		x,y;
 			for (y=ymin;y<=ymax;y++) {
-				CPixel	*pixel;
+				int		sample;
 
-				for (pixel=fb[y]+xmin,x=xmin;x<=xmax;x++,pixel++) {
+				for (sample=y*totalWidth+xmin,x=xmin;x<=xmax;x++,sample++) {
 
 					lodCheck();
 
@@ -606,9 +607,9 @@ for (j=0;j<vdiv;j++) {
 
 			int	x,y;
 			for (y=ymin;y<=ymax;y++) {
-				CPixel	*pixel;
+				int		sample;
 
-				for (pixel=fb[y]+xmin,x=xmin;x<=xmax;x++,pixel++) {
+				for (sample=y*totalWidth+xmin,x=xmin;x<=xmax;x++,sample++) {
 
 					lodCheck();
 
@@ -625,9 +626,9 @@ for (j=0;j<vdiv;j++) {
 
 		int	x,y;
 		for (y=ymin;y<=ymax;y++) {
-			CPixel		*pixel;
+			int			sample;
 
-			for (pixel=fb[y]+xmin,x=xmin;x<=xmax;x++,pixel++) {
+			for (sample=y*totalWidth+xmin,x=xmin;x<=xmax;x++,sample++) {
 	
 				lodCheck();
 
@@ -648,10 +649,10 @@ for (j=0;j<vdiv;j++) {
 				vector	v1movTmp;
 				vector	v2movTmp;
 				vector	v3movTmp;
-				interpolatev(v0movTmp,v0,v0+displacement,pixel->jt);
-				interpolatev(v1movTmp,v1,v1+displacement,pixel->jt);
-				interpolatev(v2movTmp,v2,v2+displacement,pixel->jt);
-				interpolatev(v3movTmp,v3,v3+displacement,pixel->jt);
+				interpolatev(v0movTmp,v0,v0+displacement,sampleTime[sample]);
+				interpolatev(v1movTmp,v1,v1+displacement,sampleTime[sample]);
+				interpolatev(v2movTmp,v2,v2+displacement,sampleTime[sample]);
+				interpolatev(v3movTmp,v3,v3+displacement,sampleTime[sample]);
 				v0		=	v0movTmp;
 				v1		=	v1movTmp;
 				v2		=	v2movTmp;
@@ -664,15 +665,15 @@ for (j=0;j<vdiv;j++) {
 				vector	v1focTmp;
 				vector	v2focTmp;
 				vector	v3focTmp;
-				v0focTmp[COMP_X]	=	v0[COMP_X] + pixel->jdx*v0d;
-				v1focTmp[COMP_X]	=	v1[COMP_X] + pixel->jdx*v1d;
-				v2focTmp[COMP_X]	=	v2[COMP_X] + pixel->jdx*v2d;
-				v3focTmp[COMP_X]	=	v3[COMP_X] + pixel->jdx*v3d;
-
-				v0focTmp[COMP_Y]	=	v0[COMP_Y] + pixel->jdy*v0d;
-				v1focTmp[COMP_Y]	=	v1[COMP_Y] + pixel->jdy*v1d;
-				v2focTmp[COMP_Y]	=	v2[COMP_Y] + pixel->jdy*v2d;
-				v3focTmp[COMP_Y]	=	v3[COMP_Y] + pixel->jdy*v3d;
+				v0focTmp[COMP_X]	=	v0[COMP_X] + sampleDx[sample]*v0d;
+				v1focTmp[COMP_X]	=	v1[COMP_X] + sampleDx[sample]*v1d;
+				v2focTmp[COMP_X]	=	v2[COMP_X] + sampleDx[sample]*v2d;
+				v3focTmp[COMP_X]	=	v3[COMP_X] + sampleDx[sample]*v3d;
+
+				v0focTmp[COMP_Y]	=	v0[COMP_Y] + sampleDy[sample]*v0d;
+				v1focTmp[COMP_Y]	=	v1[COMP_Y] + sampleDy[sample]*v1d;
+				v2focTmp[COMP_Y]	=	v2[COMP_Y] + sampleDy[sample]*v2d;
+				v3focTmp[COMP_Y]	=	v3[COMP_Y] + sampleDy[sample]*v3d;
 
 				v0focTmp[COMP_Z]	=	v0[COMP_Z];
 				v1focTmp[COMP_Z]	=	v1[COMP_Z];
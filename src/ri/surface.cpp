@@ -35,9 +35,11 @@
 #include "surface.h"
 #include "memory.h"
 #include "stats.h"
+#include "profiler.h"
 #include "shading.h"
 #include "renderer.h"
 #include "rendererContext.h"
+#include "atomic.h"
 #include "error.h"
 #include "debug.h"
 
@@ -104,6 +106,25 @@ CPatch::~CPatch() {
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	expandTesselationBound
+// Description			:
+/// \brief					Expand a tesselation bound by a fraction of its size
+// Return Value			:	-
+// Comments				:	The tesselation is only sampled, so the bound may miss the bulges between the samples
+static	inline void	expandTesselationBound(float *bmin,float *bmax,float boundExpander) {
+	float maxBound	=	max(bmax[COMP_X]-bmin[COMP_X],bmax[COMP_Y]-bmin[COMP_Y]);
+	maxBound		=	max(bmax[COMP_Z]-bmin[COMP_Z],maxBound);
+	maxBound		*=	boundExpander;
+
+	bmin[COMP_X]	-=	maxBound;
+	bmin[COMP_Y]	-=	maxBound;
+	bmin[COMP_Z]	-=	maxBound;
+	bmax[COMP_X]	+=	maxBound;
+	bmax[COMP_Y]	+=	maxBound;
+	bmax[COMP_Z]	+=	maxBound;
+}
+
 static	inline int	cull(float *bmin,float *bmax,const float *P,const float *N,int k,int doubleSided,int disable) {
 	int	i;
 
@@ -450,8 +471,8 @@ void	CPatch::splitToChildren(CShadingContext *r,int dir) {
 
 		p1->detach();
 		p2->detach();
-		stats.numSplits++;
-		stats.numUsplits++;
+		stats.add(r->thread,STAT_SPLITS,1);
+		stats.add(r->thread,STAT_USPLITS,1);
 		break;
 	case 1:
 		if (vmax <= vmin)	break;
@@ -468,8 +489,8 @@ void	CPatch::splitToChildren(CShadingContext *r,int dir) {
 
 		p1->detach();
 		p2->detach();
-		stats.numSplits++;
-		stats.numVsplits++;
+		stats.add(r->thread,STAT_SPLITS,1);
+		stats.add(r->thread,STAT_VSPLITS,1);
 		break;
 	case 2:
 		if (vmax <= vmin)	break;
@@ -496,8 +517,8 @@ void	CPatch::splitToChildren(CShadingContext *r,int dir) {
 		p2->detach();
 		p3->detach();
 		p4->detach();
-		stats.numSplits++;
-		stats.numUVsplits++;
+		stats.add(r->thread,STAT_SPLITS,1);
+		stats.add(r->thread,STAT_UVSPLITS,1);
 
 		break;
 	}
@@ -585,6 +606,9 @@ CTesselationPatch::CTesselationPatch(CAttributes *a,CXform *x,CSurface *o,float
 	
 	// Set the initial guess for the grid size
 	this->rmax					=	r;
+
+	// We shade the radiance cache on demand
+	radiance					=	NULL;
 	
 	#ifdef DEBUG_STATS
 	tessPerDepth[depth]++;
@@ -615,6 +639,8 @@ CTesselationPatch::~CTesselationPatch() {
 		}
 		delete[] levels[i].threadTesselation;
 	}
+
+	if (radiance != NULL)	delete[] radiance;
 	
 	// Statistics
 	// Note: it has been verified that this returns to 0, but
@@ -643,8 +669,8 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 		}
 	}
 	
-	// Intersect with our bounding box
-	float t = nearestBox(bmin,bmax,cRay->from,cRay->invDir,cRay->tmin,cRay->t);
+	// Intersect with our bounding box (at the ray time if we're moving)
+	float t = nearestBound(cRay);
 	
 	// Bail out if the hit point is already further than the ray got
 	if (!(t < cRay->t)) return;
@@ -714,7 +740,7 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 				stats.tesselationPeakMemory = stats.tesselationMemory;
 			}
 			// Update stats
-			atomicIncrement(&stats.tesselationCacheMisses);
+			stats.add(thread,STAT_TESSELATION_CACHE_MISSES,1);
 						
 			tesselationUsedMemory[level][thread] 				+=	levels[level].threadTesselation[thread]->size;
 			
@@ -725,7 +751,7 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 		} else {
 			/// FIXME make these context stats
 			// Update stats
-			atomicIncrement(&stats.tesselationCacheHits);
+			stats.add(thread,STAT_TESSELATION_CACHE_HITS,1);
 		}
 		
 		// Bump the tesselation refCount
@@ -786,19 +812,23 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 							if ((attributes->flags & ATTRIBUTES_FLAGS_INSIDE) ^ xform->flip) mulvf(N,-1);	\
 							if (attributes->flags & ATTRIBUTES_FLAGS_DOUBLE_SIDED) {						\
 								cRay->object	=	object;						\
+								cRay->patch		=	this;						\
 								cRay->u			=	umin + ((float) u + i)*urg;	\
 								cRay->v			=	vmin + ((float) v + j)*vrg;	\
 								cRay->t			=	(float) t;					\
 								movvv(cRay->N,N);								\
 								debugHit();										\
+								if (context->traceAnyHit)	return;				\
 							} else {											\
 								if (dotvv(q,N) < 0) {							\
 									cRay->object	=	object;					\
+									cRay->patch		=	this;					\
 									cRay->u			=	umin + ((float) u + i)*urg;	\
 									cRay->v			=	vmin + ((float) v + j)*vrg;	\
 									cRay->t			=	(float) t;					\
 									movvv(cRay->N,N);								\
 									debugHit();										\
+									if (context->traceAnyHit)	return;			\
 								}												\
 							}													\
 						}														\
@@ -924,6 +954,7 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 								if ((attributes->flags & ATTRIBUTES_FLAGS_INSIDE) ^ xform->flip) mulvf(NN,-1); 	\
 								if (attributes->flags & ATTRIBUTES_FLAGS_DOUBLE_SIDED) {		\
 									cRay->object	=	object;									\
+									cRay->patch		=	this;									\
 									cRay->u			=	umin + ((float) u + i)*urg;				\
 									cRay->v			=	vmin + ((float) v + j)*vrg;				\
 									cRay->t			=	(float) t;				\
@@ -931,6 +962,7 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 								} else {										\
 									if (dotvv(q,NN) < 0.0f) {					\
 										cRay->object	=	object;				\
+										cRay->patch		=	this;				\
 										cRay->u			=	umin + ((float) u + i)*urg;			\
 										cRay->v			=	vmin + ((float) v + j)*vrg;			\
 										cRay->t			=	(float) t;							\
@@ -1272,7 +1304,7 @@ void	CTesselationPatch::intersect(CShadingContext *context,CRay *cRay) {
 			// We must lock the tesselateMutex so that the list of known tesselation patches
 			// is maintained in a thread safe manner
 
-			osLock(CRenderer::tesselateMutex);
+			profilerLock(CRenderer::tesselateMutex,context->thread,"tesselateMutex");
 			
 			if (children != NULL) {
 				// Another thread already did it
@@ -1330,6 +1362,130 @@ void CTesselationPatch::initTesselation(CShadingContext *context) {
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTesselationPatch
+// Method				:	interpolateRadiance
+// Description			:
+/// \brief					Interpolate the shaded color and opacity at a ray hit
+// Return Value			:	TRUE if the ray can use the radiance cache
+// Comments				:	C receives Ci followed by Oi
+int		CTesselationPatch::interpolateRadiance(CShadingContext *context,const CRay *cRay,float *C) {
+	const int	res		=	RADIANCE_CACHE_RESOLUTION;
+	const float	error	=	attributes->radianceCacheError;
+	const float	*cache;
+	int			i,j,k;
+
+	// The ray may have hit something else after this patch
+	if ((error <= 0) || (cRay->object != object))	return FALSE;
+
+	// We can not reuse the shading of a moving patch
+	if (flags & OBJECT_MOVING_TESSELATION)			return FALSE;
+
+	// The ray must be wide enough not to notice the interpolation
+	if ((cRay->da*cRay->t + cRay->db)*error < rmax / (float) (res-1))	return FALSE;
+
+	// Shade the cache if we're the first ray here
+	if ((cache = radiance) == NULL) {
+		shadeRadiance(context,cRay);
+		cache	=	radiance;
+	}
+
+	// Pairs with the barrier in shadeRadiance so we see the shaded values
+	memoryBarrier();
+
+	// Find the cell we're in
+	float	s	=	(cRay->u - umin)*(res-1) / (umax - umin);
+	float	t	=	(cRay->v - vmin)*(res-1) / (vmax - vmin);
+
+	i	=	min(max((int) floorf(s),0),res-2);
+	j	=	min(max((int) floorf(t),0),res-2);
+	s	=	min(max(s - i,0.0f),1.0f);
+	t	=	min(max(t - j,0.0f),1.0f);
+
+	// Bilinearly interpolate the corners
+	const float	*r0	=	cache + (j*res + i)*6;
+	const float	*r1	=	r0 + res*6;
+
+	for (k=0;k<6;k++) {
+		C[k]	=	(r0[k]*(1-s) + r0[k+6]*s)*(1-t) + (r1[k]*(1-s) + r1[k+6]*s)*t;
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTesselationPatch
+// Method				:	shadeRadiance
+// Description			:
+/// \brief					Shade the radiance cache of the patch
+// Return Value			:
+// Comments				:	The grid is shaded as seen by cRay, so the cache
+//							should only be used for view independent surfaces
+void	CTesselationPatch::shadeRadiance(CShadingContext *context,const CRay *cRay) {
+	const int	res			=	RADIANCE_CACHE_RESOLUTION;
+	const int	numVertices	=	res*res;
+	float		*cache		=	new float[numVertices*6];
+	int			i,j;
+
+	assert(numVertices <= CRenderer::maxGridSize);
+
+	memBegin(context->threadMemory);
+
+	// Create rays that hit the vertices of a regular grid on the patch
+	CRay	*vertexRays	=	(CRay *) ralloc(numVertices*sizeof(CRay),context->threadMemory);
+	CRay	**rays		=	(CRay **) ralloc(numVertices*sizeof(CRay *),context->threadMemory);
+
+	for (j=0;j<res;j++) {
+		for (i=0;i<res;i++) {
+			CRay	*vRay	=	vertexRays + j*res + i;
+
+			movvv(vRay->from,cRay->from);
+			movvv(vRay->dir,cRay->dir);
+			vRay->time		=	cRay->time;
+			vRay->t			=	cRay->t;
+			vRay->da		=	0;
+			vRay->db		=	rmax / (float) (res-1);
+			vRay->object	=	object;
+			vRay->instance	=	NULL;
+			vRay->patch		=	this;
+			vRay->u			=	umin + (umax - umin)*i / (float) (res-1);
+			vRay->v			=	vmin + (vmax - vmin)*j / (float) (res-1);
+
+			rays[j*res + i]	=	vRay;
+		}
+	}
+
+	// Shade the grid
+	object->shade(context,numVertices,rays);
+
+	// Save the results
+	const float	*Ci	=	context->currentShadingState->varying[VARIABLE_CI];
+	const float	*Oi	=	context->currentShadingState->varying[VARIABLE_OI];
+
+	for (i=0;i<numVertices;i++,Ci+=3,Oi+=3) {
+		movvv(cache + i*6,Ci);
+		movvv(cache + i*6 + 3,Oi);
+	}
+
+	memEnd(context->threadMemory);
+
+	stats.add(context->thread,STAT_RADIANCE_CACHE_GRIDS,1);
+
+	// Publish the cache, another thread may have beaten us to it
+	// The readers do not lock, so the values must be visible before the pointer
+	osLock(CRenderer::tesselateMutex);
+	if (radiance == NULL) {
+		memoryBarrier();
+		radiance					=	cache;
+		cache						=	NULL;
+		stats.tesselationOverhead	+=	numVertices*6*sizeof(float);
+	}
+	osUnlock(CRenderer::tesselateMutex);
+
+	if (cache != NULL)	delete[] cache;
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CTesselationPatch
 // Method				:	sampleTesselation
@@ -1847,31 +2003,38 @@ CTesselationPatch::CPurgableTesselation*		CTesselationPatch::tesselate(CShadingC
 	
 	// If we have motion, account for it
 	if (flags & OBJECT_MOVING_TESSELATION) {
+		if (motionBound == NULL) {
+			motionBound					=	new float[12];
+			stats.tesselationOverhead	+=	12*sizeof(float);
+		}
+
 		// Displace again
 		sampleTesselation(context,div,PARAMETER_END_SAMPLE,Pstorage);
 		
-		// Bound the second sample
+		// Bound the second sample separately
+		movvv(motionBound + 0,bmin);
+		movvv(motionBound + 3,bmax);
+		initv(motionBound + 6,C_INFINITY);
+		initv(motionBound + 9,-C_INFINITY);
+
 		Pcur = Pstorage;
 		for (int i =(div+1)*(div+1);i>0;i--) {
-			addBox(bmin,bmax,Pcur);
+			addBox(motionBound + 6,motionBound + 9,Pcur);
 			Pcur			+=	3;
 		}
+
+		expandTesselationBound(motionBound + 0,motionBound + 3,boundExpander);
+		expandTesselationBound(motionBound + 6,motionBound + 9,boundExpander);
+
+		addBox(bmin,bmax,motionBound + 6);
+		addBox(bmin,bmax,motionBound + 9);
 		
 		// We will use the r estimate from the first sample
 		// Perhaps we should do better
 	}
 	
 	// Expand the bound
-	float maxBound	=	max(bmax[COMP_X]-bmin[COMP_X],bmax[COMP_Y]-bmin[COMP_Y]);
-	maxBound		=	max(bmax[COMP_Z]-bmin[COMP_Z],maxBound);
-	maxBound		*=	boundExpander;
-
-	bmin[COMP_X]	-=	maxBound;
-	bmin[COMP_Y]	-=	maxBound;
-	bmin[COMP_Z]	-=	maxBound;
-	bmax[COMP_X]	+=	maxBound;
-	bmax[COMP_Y]	+=	maxBound;
-	bmax[COMP_Z]	+=	maxBound;
+	expandTesselationBound(bmin,bmax,boundExpander);
 
 	memRestore(memCheckpoint,context->threadMemory);
 	
@@ -2047,7 +2210,7 @@ void		CTesselationPatch::purgeTesselations(CShadingContext *context,CTesselation
 	if (tesselationList == NULL)	return;
 
 	// Ensure no other thread creates new tesselations whilst we flush
-	osLock(CRenderer::tesselateMutex);
+	profilerLock(CRenderer::tesselateMutex,thread,"tesselateMutex");
 	
 	
 	// Figure out how many tesselations of this level we have in memory
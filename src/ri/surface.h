@@ -91,6 +91,7 @@ public:
 	void					instantiate(CAttributes *,CXform *,CRendererContext *) const { assert(FALSE);	}
 
 	void					initTesselation(CShadingContext *context);
+	int						interpolateRadiance(CShadingContext *context,const CRay *cRay,float *C);
 	
 	static void				initTesselations(int geoCacheMemory);
 	static void				shutdownTesselations();
@@ -100,6 +101,7 @@ private:
 	CPurgableTesselation*	tesselate(CShadingContext *context,char div,int estimateOnly);
 	void					splitToChildren(CShadingContext *context);
 	void					sampleTesselation(CShadingContext *context,int div,unsigned int sample,float *&P);
+	void					shadeRadiance(CShadingContext *context,const CRay *cRay);
 	
 	char					depth;							// Depth of the patch
 	char					minDepth;						// The minimum depth of the patch
@@ -109,6 +111,7 @@ private:
 	float					rmax;
 	
 	CTesselationEntry		levels[TESSELATION_NUM_LEVELS];	// Each tesselation level
+	float * volatile		radiance;						// The shaded Ci,Oi on a grid over the patch (NULL if not shaded yet)
 	CTesselationPatch		*next,*prev;					// To maintain the linked list
 
 
@@ -35,10 +35,13 @@
 #include "memory.h"
 #include "error.h"
 #include "renderer.h"
+#include "rendererContext.h"
 #include "tiff.h"
+#include "common/half.h"
 
 #include <stddef.h>		// ensure we have NULL defined before libtiff
 #include <tiffio.h>
+#include <zlib.h>
 #include <math.h>
 
 const char	*TIFF_TEXTURE					=	"Pixie Texture";
@@ -69,15 +72,118 @@ static	void	tiffErrorHandler(const char *module,const char *fmt,va_list ap) {
 
 
 ///////////////////////////////////////////////////////////////////////
-// Function				:	appendLayer
+// Function				:	texmakeThreads
 // Description			:
-/// \brief					Append a layer of image into an image file
+/// \brief					Find the number of threads to use while making textures
 // Return Value			:	-
 // Comments				:
-static	void	appendLayer(TIFF *out,int dstart,int numSamples,int bitsperpixel,int tileSize,int width,int height,void *data) {
-	int				x,y;
-	unsigned char	*tileData;
-	int				pixelSize;
+static	int		texmakeThreads() {
+	int	numThreads	=	CRenderer::context->getOptions()->numThreads;
+
+	return max(numThreads,1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTileJob
+// Description			:
+/// \brief					Holds the tiles of a layer that are being compressed in parallel
+// Comments				:
+class CTileJob {
+public:
+	TIFF				*out;				// The file we're writing
+	const unsigned char	*data;				// The layer being written
+	int					width,height;		// The size of the layer
+	int					pixelSize;			// The size of a pixel in bytes
+	int					tilePixelSize;		// The size of a pixel in the file
+	int					half;				// TRUE if the float samples are written as halfs
+	int					tileSize;			// The tile size
+	int					numXTiles;			// The number of tiles in a row
+	int					numTiles;			// The number of tiles in the layer
+	int					nextTile;			// The next tile to compress
+	int					success;			// FALSE if a tile could not be compressed or written
+	TMutex				mutex;				// Guards nextTile
+	TMutex				writeMutex;			// Guards out and success
+};
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	compressThread
+// Description			:
+/// \brief					Compress and write the tiles of a layer
+// Return Value			:	-
+// Comments				:	Every tile is deflated into a scratch buffer and written
+//							as soon as it is ready. The tiles may land in the file out
+//							of order, libtiff records the offset of each one in the
+//							directory it writes at the end of the layer
+static	TFunPrefix	compressThread(void *w) {
+	CTileJob			*job		=	(CTileJob *) w;
+	const int			tileBytes	=	job->tileSize*job->tileSize*job->tilePixelSize;
+	const uLongf		bufferSize	=	compressBound(tileBytes);
+	unsigned char		*tileData	=	new unsigned char[tileBytes];
+	unsigned char		*buffer		=	new unsigned char[bufferSize];
+
+	while(TRUE) {
+		osLock(job->mutex);
+		const int	tile	=	job->nextTile++;
+		osUnlock(job->mutex);
+
+		if ((tile >= job->numTiles) || (job->success == FALSE))	break;
+
+		// Gather the tile, padding the parts that fall outside the layer
+		const int	x			=	(tile % job->numXTiles)*job->tileSize;
+		const int	y			=	(tile / job->numXTiles)*job->tileSize;
+		const int	rowWidth	=	min(job->tileSize,job->width - x);
+		int			ty;
+
+		memset(tileData,0,tileBytes);
+		for (ty=0;(ty<job->tileSize) && ((y+ty)<job->height);ty++) {
+			const unsigned char	*src	=	&job->data[((y+ty)*job->width+x)*job->pixelSize];
+			unsigned char		*dest	=	&tileData[ty*job->tileSize*job->tilePixelSize];
+
+			if (job->half) {
+				const float		*fsrc	=	(const float *) src;
+				unsigned short	*hdest	=	(unsigned short *) dest;
+				const int		n		=	rowWidth*job->pixelSize / sizeof(float);
+				int				i;
+
+				for (i=0;i<n;i++)	hdest[i]	=	floatToHalf(fsrc[i]);
+			} else {
+				memcpy(dest,src,rowWidth*job->pixelSize);
+			}
+		}
+
+		uLongf		size		=	bufferSize;
+		const int	compressed	=	(compress2(buffer,&size,tileData,tileBytes,TEXMAKE_COMPRESSION_LEVEL) == Z_OK);
+
+		osLock(job->writeMutex);
+		if (job->success) {
+			if (compressed == FALSE) {
+				error(CODE_SYSTEM,"Failed to compress a texture tile\n");
+				job->success	=	FALSE;
+			} else if (TIFFWriteRawTile(job->out,tile,buffer,size) < 0) {
+				job->success	=	FALSE;
+			}
+		}
+		osUnlock(job->writeMutex);
+	}
+
+	delete [] buffer;
+	delete [] tileData;
+
+	TFunReturn;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	appendLayer
+// Description			:
+/// \brief					Append a layer of image into an image file
+// Return Value			:	FALSE if a tile could not be compressed
+// Comments				:	The tiles are deflated by a thread pool that is created
+//							once for the layer and written raw as they are done, so
+//							at most one compressed tile per thread is in memory
+//							If half is set, the float data is written as 16 bit floats
+static	int		appendLayer(TIFF *out,int dstart,int numSamples,int bitsperpixel,int tileSize,int width,int height,void *data,int half) {
+	int				pixelSize,tilePixelSize;
+	int				i;
 
 	TIFFSetField(out, TIFFTAG_IMAGEWIDTH,			(unsigned long) width);
 	TIFFSetField(out, TIFFTAG_IMAGELENGTH,			(unsigned long) height);
@@ -86,8 +192,8 @@ static	void	appendLayer(TIFF *out,int dstart,int numSamples,int bitsperpixel,int
 	TIFFSetField(out, TIFFTAG_RESOLUTIONUNIT,		RESUNIT_NONE);
 	TIFFSetField(out, TIFFTAG_XRESOLUTION,			1.0f);
 	TIFFSetField(out, TIFFTAG_YRESOLUTION,			1.0f);
-	TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_LZW);
-	//TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_ADOBE_DEFLATE);
+	TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_ADOBE_DEFLATE);
+	//TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_LZW);
 	//TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_JPEG);
 	//TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_PACKBITS);
 	//TIFFSetField(out, TIFFTAG_COMPRESSION,			COMPRESSION_THUNDERSCAN);
@@ -109,33 +215,121 @@ static	void	appendLayer(TIFF *out,int dstart,int numSamples,int bitsperpixel,int
 		TIFFSetField(out, TIFFTAG_BITSPERSAMPLE,	(unsigned long) (sizeof(unsigned short)*8));
 		TIFFSetField(out, TIFFTAG_PHOTOMETRIC,		PHOTOMETRIC_MINISBLACK);
 		pixelSize	=	numSamples*sizeof(unsigned short);
+	} else if (half) {
+		TIFFSetField(out, TIFFTAG_SAMPLEFORMAT,		SAMPLEFORMAT_IEEEFP);
+		TIFFSetField(out, TIFFTAG_BITSPERSAMPLE,	(unsigned long) (sizeof(unsigned short)*8));
+		pixelSize	=	numSamples*sizeof(float);
 	} else {
 		TIFFSetField(out, TIFFTAG_SAMPLEFORMAT,		SAMPLEFORMAT_IEEEFP);
 		TIFFSetField(out, TIFFTAG_BITSPERSAMPLE,	(unsigned long) (sizeof(float)*8));
 		pixelSize	=	numSamples*sizeof(float);
 	}
 
-	memBegin(CRenderer::globalMemory);
+	half			=	half && (bitsperpixel == 32);
+	tilePixelSize	=	(half ? numSamples*sizeof(unsigned short) : pixelSize);
+
+	assert(TIFFTileSize(out) == (tileSize*tileSize*tilePixelSize));
+
+	// Prepare the job
+	CTileJob		job;
+	const int		numXTiles	=	(width + tileSize - 1) / tileSize;
+	const int		numYTiles	=	(height + tileSize - 1) / tileSize;
+	const int		numTiles	=	numXTiles*numYTiles;
+	const int		numThreads	=	min(texmakeThreads(),numTiles);
+	TThread			*threads	=	(TThread *) alloca(numThreads*sizeof(TThread));
+	job.out			=	out;
+	job.data		=	(const unsigned char *) data;
+	job.width		=	width;
+	job.height		=	height;
+	job.pixelSize	=	pixelSize;
+	job.tilePixelSize	=	tilePixelSize;
+	job.half		=	half;
+	job.tileSize	=	tileSize;
+	job.numXTiles	=	numXTiles;
+	job.numTiles	=	numTiles;
+	job.nextTile	=	0;
+	job.success		=	TRUE;
+	osCreateMutex(job.mutex);
+	osCreateMutex(job.writeMutex);
+
+	// Compress and write the layer
+	if (numThreads > 1) {
+		for (i=0;i<numThreads;i++)	threads[i]	=	osCreateThread(compressThread,&job);
+		for (i=0;i<numThreads;i++)	osWaitThread(threads[i]);
+	} else {
+		compressThread(&job);
+	}
 
-	tileData		=	(unsigned char *) ralloc(pixelSize*tileSize*tileSize,CRenderer::globalMemory);
+	osDeleteMutex(job.mutex);
+	osDeleteMutex(job.writeMutex);
 
-	assert(TIFFTileSize(out) == (tileSize*tileSize*pixelSize));
+	// Write the offsets of the tiles
+	if (job.success)	TIFFWriteDirectory(out);
 
-	for (y=0;y<height;y+=tileSize) {
-		for (x=0;x<width;x+=tileSize) {
-			int	ty;
+	return job.success;
+}
 
-			for (ty=0;ty<tileSize;ty++) {
-				memcpy(&tileData[ty*tileSize*pixelSize],&((unsigned char *) data)[((y+ty)*width+x)*pixelSize],tileSize*pixelSize);
-			}
+///////////////////////////////////////////////////////////////////////
+// Class				:	CReduceJob
+// Description			:
+/// \brief					Holds a mip level that is being reduced in parallel
+// Comments				:
+template <class T> class CReduceJob {
+public:
+	const T				*src;				// The current level
+	T					*dest;				// The next level
+	int					srcWidth;			// The width of the current level
+	int					width,height;		// The size of the next level
+	int					numSamples;			// The number of samples per pixel
+	int					nextRow;			// The next row to reduce
+	TMutex				mutex;				// Guards nextRow
+};
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	reduceThread
+// Description			:
+/// \brief					Box filter rows of a level into the next level
+// Return Value			:	-
+// Comments				:
+template <class T> static	TFunPrefix	reduceThread(void *w) {
+	CReduceJob<T>		*job			=	(CReduceJob<T> *) w;
+	const int			numSamples		=	job->numSamples;
+	const int			rowSize			=	job->srcWidth*numSamples;
+
+	while(TRUE) {
+		osLock(job->mutex);
+		const int	y	=	job->nextRow;
+		job->nextRow	+=	TEXMAKE_REDUCE_ROWS;
+		osUnlock(job->mutex);
 
-			TIFFWriteTile(out,tileData,x,y,0,0);
+		if (y >= job->height)	break;
+
+		const int	lastRow	=	min(y + TEXMAKE_REDUCE_ROWS,job->height);
+		int			yc;
+
+		for (yc=y;yc<lastRow;yc++) {
+			const T	*src0	=	&job->src[2*yc*rowSize];
+			const T	*src1	=	src0 + rowSize;
+			T		*dest	=	&job->dest[yc*job->width*numSamples];
+			int		x,n;
+
+			for (x=0;x<job->width;x++) {
+				for (n=0;n<numSamples;n++) {
+					float	sum	=	(float) src0[n];
+					sum			+=	(float) src0[numSamples+n];
+					sum			+=	(float) src1[n];
+					sum			+=	(float) src1[numSamples+n];
+
+					dest[n]		=	(T) (sum*(1/(float) 4));
+				}
+				dest	+=	numSamples;
+				src0	+=	2*numSamples;
+				src1	+=	2*numSamples;
+			}
 		}
 	}
 
-	TIFFWriteDirectory(out);
-
-	memEnd(CRenderer::globalMemory);
+	TFunReturn;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -143,75 +337,72 @@ static	void	appendLayer(TIFF *out,int dstart,int numSamples,int bitsperpixel,int
 // Description			:
 /// \brief					Append an image pyramid into an image file
 //							the reduction gives the amount of reduction in the image size at each step
-// Return Value			:
-// Comments				:
-template <class T> static	void	appendPyramid(TIFF *out,int &dstart,int numSamples,int bitsperpixel,int tileSize,int width,int height,T *data) {
-	T		*currentLevel;
+// Return Value			:	FALSE if a layer could not be written
+// Comments				:	Each level is reduced into a buffer a quarter the size of
+//							the previous one, so the peak memory is that of the base layer
+//							plus a quarter
+template <class T> static	int		appendPyramid(TIFF *out,int &dstart,int numSamples,int bitsperpixel,int tileSize,int width,int height,T *data,int half) {
+	T		*currentLevel,*nextLevel;
 	int		currentWidth,currentHeight,nextWidth,nextHeight;
-	float	*fnextLevel;
 
 	// Append the base layer
-	appendLayer(out,dstart++,numSamples,bitsperpixel,tileSize,width,height,data);
+	if (appendLayer(out,dstart++,numSamples,bitsperpixel,tileSize,width,height,data,half) == FALSE)	return FALSE;
 
 	// Append the remaining layers
 	currentWidth	=	width;
 	currentHeight	=	height;
 	currentLevel	=	data;
 
-	fnextLevel		=	(float *)	ralloc(width*height*numSamples*sizeof(float),CRenderer::globalMemory);
+	// The levels ping pong between the second buffer and the (no longer needed) base layer
+	T		*buffers[2];
+	buffers[0]		=	data;
+	buffers[1]		=	(T *) ralloc(max((width >> 1)*(height >> 1)*numSamples,1)*sizeof(T),CRenderer::globalMemory);
 
-	int numLevels	=	tiffNumLevels(width,height);
-	int	i;
+	const int		numLevels	=	tiffNumLevels(width,height);
+	const int		numThreads	=	texmakeThreads();
+	TThread			*threads	=	(TThread *) alloca(numThreads*sizeof(TThread));
+	CReduceJob<T>	job;
+	int				success		=	TRUE;
+	int				i,j;
 
-	for (i=1;i<numLevels;i++) {
-		int			x,y,yo;
-		int			s;
-
-		nextWidth	=	currentWidth >> 1;
-		nextHeight	=	currentHeight >> 1;
-
-		for (y=0,yo=0;y<nextHeight;y++,yo+=2) {
-			T		*src	=	&currentLevel[yo*currentWidth*numSamples];
-			float	*dest	=	&fnextLevel[y*nextWidth*numSamples];
-			int		n;
-
-			for (x=0;x<nextWidth;x++) {
-				for (n=0;n<numSamples;n++) {
-					dest[n]		=	src[n];
-					dest[n]		+=	src[numSamples+n];
-				}
-				dest	+=	numSamples;
-				src		+=	2*numSamples;
-			}
-
-			src		=	&currentLevel[(yo+1)*currentWidth*numSamples];
-			dest	=	&fnextLevel[y*nextWidth*numSamples];
+	osCreateMutex(job.mutex);
 
-			for (x=0;x<nextWidth;x++) {
-				for (n=0;n<numSamples;n++) {
-					dest[n]		+=	src[n];
-					dest[n]		+=	src[numSamples+n];
-				}
-				dest	+=	numSamples;
-				src		+=	2*numSamples;
-			}
-
-			dest	=	&fnextLevel[y*nextWidth*numSamples];
-
-			for (x=0;x<nextWidth*numSamples;x++) {
-				*dest++	*=	1/(float) 4;
-			}
-		}
-			
-		for (s=0;s<nextWidth*nextHeight*numSamples;s++) {
-			currentLevel[s]	=	(T) fnextLevel[s];
+	for (i=1;i<numLevels;i++) {
+		nextWidth		=	currentWidth >> 1;
+		nextHeight		=	currentHeight >> 1;
+		nextLevel		=	buffers[i & 1];
+
+		job.src			=	currentLevel;
+		job.dest		=	nextLevel;
+		job.srcWidth	=	currentWidth;
+		job.width		=	nextWidth;
+		job.height		=	nextHeight;
+		job.numSamples	=	numSamples;
+		job.nextRow		=	0;
+
+		// Only fire up the threads if there is enough work
+		const int	numJobs	=	min(numThreads,(nextHeight + TEXMAKE_REDUCE_ROWS - 1) / TEXMAKE_REDUCE_ROWS);
+
+		if (numJobs > 1) {
+			for (j=0;j<numJobs;j++)	threads[j]	=	osCreateThread(reduceThread<T>,&job);
+			for (j=0;j<numJobs;j++)	osWaitThread(threads[j]);
+		} else {
+			reduceThread<T>(&job);
 		}
 
+		currentLevel	=	nextLevel;
 		currentWidth	=	nextWidth;
 		currentHeight	=	nextHeight;
 
-		appendLayer(out,dstart++,numSamples,bitsperpixel,tileSize,currentWidth,currentHeight,currentLevel);
+		if (appendLayer(out,dstart++,numSamples,bitsperpixel,tileSize,currentWidth,currentHeight,currentLevel,half) == FALSE) {
+			success	=	FALSE;
+			break;
+		}
 	}
+
+	osDeleteMutex(job.mutex);
+
+	return success;
 }
 
 ///////////////////////////////////////////////////////////////////////
@@ -662,9 +853,9 @@ template <class T> void	adjustSize(T **data,int *width,int *height,int *validWid
 // Function				:	appendTexture
 // Description			:
 /// \brief					Make and append a texture to the end of the TIFF file
-// Return Value			:
+// Return Value			:	FALSE if the texture could not be written
 // Comments				:	FIXME: filter only when adjusting size
-void	appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int bitspersample,RtFilterFunc filter,float filterWidth,float filterHeight,int tileSize,void *data,const char *smode,const char *tmode,const char *resizemode) {
+int		appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int bitspersample,RtFilterFunc filter,float filterWidth,float filterHeight,int tileSize,void *data,const char *smode,const char *tmode,const char *resizemode,int half) {
 	int validHeight,validWidth;
 	
 	if (bitspersample == 8) {
@@ -674,7 +865,7 @@ void	appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLWIDTH,		validWidth);
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLLENGTH,	validHeight);
 
-		appendPyramid<unsigned char>(out,dstart,numSamples,bitspersample,tileSize,width,height,(unsigned char *) data);
+		return appendPyramid<unsigned char>(out,dstart,numSamples,bitspersample,tileSize,width,height,(unsigned char *) data,FALSE);
 	} else if (bitspersample == 16) {
 		adjustSize<unsigned short>((unsigned short **) &data,&width,&height,&validWidth,&validHeight,numSamples,bitspersample,filterWidth,filterHeight,filter,smode,tmode,resizemode);
 
@@ -682,7 +873,7 @@ void	appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLWIDTH,		validWidth);
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLLENGTH,	validHeight);
 
-		appendPyramid<unsigned short>(out,dstart,numSamples,bitspersample,tileSize,width,height,(unsigned short *) data);
+		return appendPyramid<unsigned short>(out,dstart,numSamples,bitspersample,tileSize,width,height,(unsigned short *) data,FALSE);
 	} else if (bitspersample == 32) {
 		adjustSize<float>((float **) &data,&width,&height,&validWidth,&validHeight,numSamples,bitspersample,filterWidth,filterHeight,filter,smode,tmode,resizemode);
 
@@ -690,8 +881,10 @@ void	appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLWIDTH,		validWidth);
 		TIFFSetField(out, TIFFTAG_PIXAR_IMAGEFULLLENGTH,	validHeight);
 
-		appendPyramid<float>(out,dstart,numSamples,bitspersample,tileSize,width,height,(float *) data);
+		return appendPyramid<float>(out,dstart,numSamples,bitspersample,tileSize,width,height,(float *) data,half);
 	}
+
+	return TRUE;
 }
 
 
@@ -704,6 +897,15 @@ void	appendTexture(TIFF *out,int &dstart,int width,int height,int numSamples,int
 		}										\
 	}
 
+#define getTileFormat(numParams,params,vals) 	\
+	int halfTiles = FALSE;						\
+	for(int p=0;p<numParams;p++) {				\
+		if (strcmp(params[p],"format") == 0) {	\
+			halfTiles = (strcmp(* ((char**) vals[p]),"half") == 0);	\
+			break;								\
+		}										\
+	}
+
 ///////////////////////////////////////////////////////////////////////
 // Function				:	makeTexture
 // Description			:
@@ -714,6 +916,7 @@ void	makeTexture(const char *input,const char *output,TSearchpath *path,const ch
 	char	inputFileName[OS_MAX_PATH_LENGTH];
 	
 	getResizeMode(numParams,params,vals);
+	getTileFormat(numParams,params,vals);
 
 	if (CRenderer::locateFile(inputFileName,input,path) == FALSE) {
 		error(CODE_NOFILE,"Failed to find \"%s\"\n",input);
@@ -744,7 +947,7 @@ void	makeTexture(const char *input,const char *output,TSearchpath *path,const ch
 
 			// Write the made texture
 			TIFF	*outHandle	=	TIFFOpen(output,"w");
-			if (output != NULL) {
+			if (outHandle != NULL) {
 				int	dstart	=	0;
 
 				sprintf(modes,"%s,%s",smode,tmode);
@@ -752,9 +955,11 @@ void	makeTexture(const char *input,const char *output,TSearchpath *path,const ch
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_TEXTUREFORMAT,	TIFF_TEXTURE);
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_WRAPMODES,		modes);
 
-				appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode);
+				const int	success	=	appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode,halfTiles);
 
+				// Do not leave a partial texture behind
 				TIFFClose(outHandle);
+				if (success == FALSE)	osDeleteFile(output);
 			}
 
 			memEnd(CRenderer::globalMemory);
@@ -773,6 +978,7 @@ void	makeSideEnvironment(const char *input,const char *output,TSearchpath *path,
 	char	inputFileName[OS_MAX_PATH_LENGTH];
 
 	getResizeMode(numParams,params,vals);
+	getTileFormat(numParams,params,vals);
 	
 	if (CRenderer::locateFile(inputFileName,input,path) == FALSE) {
 		error(CODE_NOFILE,"Failed to find \"%s\"\n",input);
@@ -829,9 +1035,11 @@ void	makeSideEnvironment(const char *input,const char *output,TSearchpath *path,
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_MATRIX_WORLDTOCAMERA,	worldToCamera);
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_MATRIX_WORLDTOSCREEN,	worldToScreen);
 
-				appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode);
+				const int	success	=	appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode,halfTiles);
 
+				// Do not leave a partial texture behind
 				TIFFClose(outHandle);
+				if (success == FALSE)	osDeleteFile(output);
 			} else {
 				error(CODE_SYSTEM,"Failed to create \"%s\" for writing\n",output);
 			}
@@ -852,6 +1060,7 @@ void	makeCubicEnvironment(const char *px,const char *py,const char *pz,const cha
 	const char	*names[6];
 
 	getResizeMode(numParams,params,vals);
+	getTileFormat(numParams,params,vals);
 	
 	names[0]	=	px;
 	names[1]	=	nx;
@@ -881,6 +1090,7 @@ void	makeCubicEnvironment(const char *px,const char *py,const char *pz,const cha
 
 			if (outHandle != NULL) {
 				int			dstart	=	0;
+				int			success	=	TRUE;
 
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_TEXTUREFORMAT,		TIFF_CUBIC_ENVIRONMENT);
 
@@ -904,12 +1114,16 @@ void	makeCubicEnvironment(const char *px,const char *py,const char *pz,const cha
 					TIFFClose(inHandle);
 
 					// Write the data
-					appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode);
+					success			=	appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode,halfTiles);
 
 					memEnd(CRenderer::globalMemory);
+
+					if (success == FALSE)	break;
 				}
 
+				// Do not leave a partial texture behind
 				TIFFClose(outHandle);
+				if (success == FALSE)	osDeleteFile(output);
 			}
 		} else {
 			error(CODE_SYSTEM,"Failed to create \"%s\" for writing\n",output);
@@ -927,6 +1141,7 @@ void	makeSphericalEnvironment(const char *input,const char *output,TSearchpath *
 	char	inputFileName[OS_MAX_PATH_LENGTH];
 
 	getResizeMode(numParams,params,vals);
+	getTileFormat(numParams,params,vals);
 	
 	if (CRenderer::locateFile(inputFileName,input,path) == FALSE) {
 		error(CODE_NOFILE,"Failed to find \"%s\"\n",input);
@@ -966,8 +1181,11 @@ void	makeSphericalEnvironment(const char *input,const char *output,TSearchpath *
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_TEXTUREFORMAT,	TIFF_SPHERICAL_ENVIRONMENT);
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_WRAPMODES,		modes);
 
-				appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode);
+				const int	success	=	appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode,halfTiles);
+
+				// Do not leave a partial texture behind
 				TIFFClose(outHandle);
+				if (success == FALSE)	osDeleteFile(output);
 			}
 
 			memEnd(CRenderer::globalMemory);
@@ -987,6 +1205,7 @@ void	makeCylindericalEnvironment(const char *input,const char *output,TSearchpat
 	char	inputFileName[OS_MAX_PATH_LENGTH];
 	
 	getResizeMode(numParams,params,vals);
+	getTileFormat(numParams,params,vals);
 	
 	if (CRenderer::locateFile(inputFileName,input,path) == FALSE) {
 		error(CODE_NOFILE,"Failed to find \"%s\"\n",input);
@@ -1025,8 +1244,11 @@ void	makeCylindericalEnvironment(const char *input,const char *output,TSearchpat
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_TEXTUREFORMAT,	TIFF_CYLINDER_ENVIRONMENT);
 				TIFFSetField(outHandle, TIFFTAG_PIXAR_WRAPMODES,		modes);
 				
-				appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode);
+				const int	success	=	appendTexture(outHandle,dstart,width,height,numSamples,bitspersample,filter,filterWidth,filterHeight,tileSize,data,smode,tmode,resizeMode,halfTiles);
+
+				// Do not leave a partial texture behind
 				TIFFClose(outHandle);
+				if (success == FALSE)	osDeleteFile(output);
 			}
 
 			memEnd(CRenderer::globalMemory);
@@ -31,11 +31,13 @@
 #include "texture.h"
 #include "shading.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "error.h"
 #include "renderer.h"
 #include "tiff.h"
 #include "ri_config.h"
+#include "common/half.h"
 
 #include <stddef.h>		// Ensure NULL is defined before libtiff
 #include <math.h>
@@ -71,6 +73,7 @@ public:
 
 	int					refCount;			// how many threads reference this block
 	int					size;				// Size of the block in bytes
+	int					numTexels;			// The number of texels the block holds
 	CTextureBlock		*next;				// Pointer to the next used / empty block
 	CTextureBlock		*prev;				// Pointer to the previous used / empty block
 };
@@ -83,7 +86,27 @@ public:
 
 
 
+// The size of a 4x4 block per sample (a half precision range and 16 8 bit positions)
+#define	TEXTURE_BLOCK_BYTES	(2*sizeof(unsigned short) + 16)
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTileCodec
+// Description			:
+/// \brief					Describes how a tile is encoded in the memory
+// Comments				:	The tile is read from the file into a temporary buffer
+//							and encoded into the cache block. The tiles that can not
+//							be encoded accurately enough are kept as they are in the file
+class	CTileCodec {
+public:
+	int					tileWidth,tileHeight;	// The size of the tile
+	int					numSamples;				// The number of samples per texel
+	int					bytesPerSample;			// The size of a sample in the file
+	int					rawSize;				// The size of the tile in the file
+	int					encodedSize;			// The size of an encoded tile
+	double				M;						// The multiplier that brings the samples to floats
+	int					(*encode)(unsigned char *,const unsigned char *,const CTileCodec *);
+	void				(*decode)(float *,const unsigned char *,const CTileCodec *);
+};
 
 
 
@@ -150,7 +173,7 @@ static inline void	textureMemFlush(CTextureBlock *entry,CShadingContext *context
 	if (CRenderer::textureUsedBlocks == NULL)	return;
 
 	#ifdef TEXTURE_PERBLOCK_LOCK
-		osLock(CRenderer::textureMutex);
+		profilerLock(CRenderer::textureMutex,context->thread,"textureMutex");
 	#endif
 	
 	memBegin(context->threadMemory);
@@ -226,7 +249,8 @@ static inline unsigned char	*textureAllocateBlock(CTextureBlock *entry,CShadingC
 	stats.textureSize								+=	entry->size;
 	stats.peakTextureSize							=	max(stats.textureSize,stats.peakTextureSize);
 	stats.textureMemory								+=	entry->size;
-	stats.transferredTextureData					+=	entry->size;
+	stats.add(context->thread,STAT_TRANSFERRED_TEXTURE_DATA,entry->size);
+	stats.add(context->thread,STAT_TRANSFERRED_TEXELS,entry->numTexels);
 
 	const int	thread								=	context->thread;
 
@@ -247,10 +271,10 @@ static inline unsigned char	*textureAllocateBlock(CTextureBlock *entry,CShadingC
 /// \brief					Read a block of texture from disk
 // Return Value			:	Pointer to the new texture
 // Comments				:
-static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,int w,int h,int dir,CShadingContext *context) {
+static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,int w,int h,int dir,CShadingContext *context,const CTileCodec *codec = NULL) {
 	
 	#ifndef TEXTURE_PERBLOCK_LOCK
-		osLock(CRenderer::textureMutex);
+		profilerLock(CRenderer::textureMutex,context->thread,"textureMutex");
 	#else
 		osLock(entry->mutex);
 	#endif
@@ -269,7 +293,10 @@ static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,
 	}
 
 	// Update the state
-	stats.numTextureMisses++;
+	stats.add(context->thread,STAT_TEXTURE_MISSES,1);
+
+	// Record the time we spend reading the block
+	CProfilerSpan	missSpan(context->thread,PROFILER_TEXTURE,"textureMiss");
 
 	// Note: that we are thread safe because each TIFFOpen returns a fresh
 	// handle which we can operate on provided it's not used in any other thread
@@ -317,9 +344,10 @@ static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,
 			pixelSize		=	numSamples*sizeof(float);
 		}
 
-		// Allocate space for the texture
+		// Allocate space for the texture (encoded tiles are read into a temporary buffer first)
 		assert(entry->data == NULL);
-		data				=	textureAllocateBlock(entry,context);
+		unsigned char	*block	=	(codec == NULL) ? textureAllocateBlock(entry,context) : NULL;
+		data					=	(codec == NULL) ? block : new unsigned char[codec->rawSize];
 
 		// Do we need to read the entire texture ?
 		if ((x != 0) || (y != 0) || (w != (int) width) || (h != (int) height)) {
@@ -409,6 +437,26 @@ static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,
 
 
 		TIFFClose(in);
+
+		// Encode the tile into the cache block, or keep it as it is if it
+		// can not be encoded accurately enough (nobody is using the block, so we can resize it)
+		if (codec != NULL) {
+			unsigned char	*encoded	=	new unsigned char[codec->encodedSize];
+
+			if (codec->encode(encoded,(unsigned char *) data,codec)) {
+				entry->size	=	codec->encodedSize;
+				block		=	textureAllocateBlock(entry,context);
+				memcpy(block,encoded,codec->encodedSize);
+			} else {
+				entry->size	=	codec->rawSize;
+				block		=	textureAllocateBlock(entry,context);
+				memcpy(block,data,codec->rawSize);
+			}
+
+			delete [] encoded;
+			delete [] (unsigned char *) data;
+			data	=	block;
+		}
 	} else {
 		// FIXME: Is this an error ?
 	}
@@ -434,13 +482,14 @@ static inline void	textureLoadBlock(CTextureBlock *entry,char *name,int x,int y,
 /// \brief					Add a block into the list of used blocks
 // Return Value			:	Pointer to the new block
 // Comments				:
-static inline void	textureRegisterBlock(CTextureBlock *cEntry,int size) {
+static inline void	textureRegisterBlock(CTextureBlock *cEntry,int size,int numTexels) {
 
 	// Fully construct the cEntry before placing it on the list
 	cEntry->data						=	NULL;
 	cEntry->refCount					=	0;
 	cEntry->threadData					=	new CTexBlockThreadData[CRenderer::numThreads];
 	cEntry->size						=	size;
+	cEntry->numTexels					=	numTexels;
 	
 	#ifdef TEXTURE_PERBLOCK_LOCK
 		osCreateMutex(cEntry->mutex);
@@ -654,7 +703,7 @@ public:
 					// Return Value			:	-
 					// Comments				:
 					CBasicTexture(const char *name,short directory,int width,int height,short numSamples,int fileWidth,int fileHeight,TTextureMode sMode,TTextureMode tMode,double Mult) : CTextureLayer(name,directory,width,height,numSamples,fileWidth,fileHeight,sMode,tMode) {
-						textureRegisterBlock(&dataBlock,width*height*numSamples*sizeof(T));
+						textureRegisterBlock(&dataBlock,width*height*numSamples*sizeof(T),width*height);
 						M				=	Mult;
 					}
 
@@ -696,11 +745,15 @@ protected:
 
 						const T		*data;
 
+						// The missing channels replicate the first one
+						const int	c1	=	(numSamples > 1) ? 1 : 0;
+						const int	c2	=	(numSamples > 2) ? 2 : 0;
+
 #define access(__x,__y)										\
 						data	=	(T *) dataBlock.data + (__y*fileWidth+__x)*numSamples;	\
 						res[0]	=	(float) (data[0]*M);	\
-						res[1]	=	(float) (data[1]*M);	\
-						res[2]	=	(float) (data[2]*M);	\
+						res[1]	=	(float) (data[c1]*M);	\
+						res[2]	=	(float) (data[c2]*M);	\
 						res		+=	3;
 
 						access(x,y);
@@ -744,7 +797,7 @@ public:
 						dataBlocks[i]		=	new CTextureBlock[xTiles];
 
 						for (int j=0;j<xTiles;++j) {
-							textureRegisterBlock(dataBlocks[i] + j,tileLength);
+							textureRegisterBlock(dataBlocks[i] + j,tileLength,tileWidth*tileHeight);
 						}
 					}
 
@@ -793,6 +846,10 @@ protected:
 
 						const int	thread	=	context->thread;
 
+						// The missing channels replicate the first one
+						const int	c1	=	(numSamples > 1) ? 1 : 0;
+						const int	c2	=	(numSamples > 2) ? 2 : 0;
+
 #define	access(__x,__y)															\
 						xTile	=	__x >> tileWidthShift;						\
 						yTile	=	__y >> tileHeightShift;						\
@@ -807,8 +864,8 @@ protected:
 																											\
 						data	=	(T *) block->data + (((__y & yt))*tileWidth+(__x&xt))*numSamples;		\
 						res[0]	=	(float) (data[0]*M);						\
-						res[1]	=	(float) (data[1]*M);						\
-						res[2]	=	(float) (data[2]*M);						\
+						res[1]	=	(float) (data[c1]*M);						\
+						res[2]	=	(float) (data[c2]*M);						\
 						res		+=	3;
 
 						access(x,y);
@@ -837,6 +894,217 @@ protected:
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Function				:	blockEncode
+// Description			:
+/// \brief					Encode a tile into 4x4 blocks
+// Return Value			:	-
+// Return Value			:	FALSE if a texel would be off by more than TEXTURE_BLOCK_MAX_ERROR
+// Comments				:	Every block holds a half precision range per sample
+//							followed by 8 bit positions of the texels in that range
+//							The range is clamped to the finite halfs
+template <class T> static int	blockEncode(unsigned char *dest,const unsigned char *src,const CTileCodec *codec) {
+	const int		numSamples	=	codec->numSamples;
+	const int		blockSize	=	numSamples*TEXTURE_BLOCK_BYTES;
+	const T			*data		=	(const T *) src;
+	int				bx,by,c,i;
+
+	for (by=0;by<codec->tileHeight;by+=4) {
+		for (bx=0;bx<codec->tileWidth;bx+=4,dest+=blockSize) {
+			unsigned short	*range		=	(unsigned short *) dest;
+			unsigned char	*indices	=	dest + numSamples*2*sizeof(unsigned short);
+
+			for (c=0;c<numSamples;c++) {
+				float	values[16];
+				float	lo	=	C_INFINITY;
+				float	hi	=	-C_INFINITY;
+
+				for (i=0;i<16;i++) {
+					values[i]	=	(float) (data[((by + (i >> 2))*codec->tileWidth + bx + (i & 3))*numSamples + c]*codec->M);
+					lo			=	min(lo,values[i]);
+					hi			=	max(hi,values[i]);
+				}
+
+				// Out of range values would overflow to infinity and decode to NaN
+				range[c*2]		=	floatToHalf(min(max(lo,-HALF_MAX),HALF_MAX));
+				range[c*2+1]	=	floatToHalf(min(max(hi,-HALF_MAX),HALF_MAX));
+
+				const float	l	=	halfToFloat(range[c*2]);
+				const float	h	=	halfToFloat(range[c*2+1]);
+				const float	s	=	(h > l) ? 255 / (h - l) : 0;
+
+				for (i=0;i<16;i++) {
+					const int	index	=	max(min((int) ((values[i] - l)*s + 0.5f),255),0);
+					const float	error	=	absf(l + (h - l)*index*(1/(float) 255) - values[i]);
+
+					// This also catches the values that are not finite
+					if (!(error <= TEXTURE_BLOCK_MAX_ERROR*max(absf(values[i]),1.0f)))	return FALSE;
+
+					indices[i*numSamples + c]	=	(unsigned char) index;
+				}
+			}
+		}
+	}
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	rawDecode
+// Description			:
+/// \brief					Decode a texel of a tile that could not be block compressed
+// Return Value			:	-
+// Comments				:	The missing channels replicate the first one
+template <class T> static void	rawDecode(float *res,const unsigned char *src,const CTileCodec *codec) {
+	const T		*data	=	(const T *) src;
+	const int	c1		=	(codec->numSamples > 1) ? 1 : 0;
+	const int	c2		=	(codec->numSamples > 2) ? 2 : 0;
+
+	res[0]	=	(float) (data[0]*codec->M);
+	res[1]	=	(float) (data[c1]*codec->M);
+	res[2]	=	(float) (data[c2]*codec->M);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CBlockTexture
+// Description			:	This class holds a tiled texture whose tiles are kept
+//							block compressed in the cache and decoded on lookup
+// Comments				:
+class CBlockTexture : public CTextureLayer {
+public:
+				///////////////////////////////////////////////////////////////////////
+				// Class				:	CBlockTexture
+				// Method				:	CBlockTexture
+				// Description			:
+/// \brief					Ctor
+				// Return Value			:	-
+				// Comments				:
+				CBlockTexture(const char *name,short directory,int width,int height,short numSamples,int fileWidth,int fileHeight,TTextureMode sMode,TTextureMode tMode,int tileWidth,int tileWidthShift,int tileHeight, int tileHeightShift, double Mult,int bytesPerSample,int (*encode)(unsigned char *,const unsigned char *,const CTileCodec *),void (*decode)(float *,const unsigned char *,const CTileCodec *)) : CTextureLayer(name,directory,width,height,numSamples,fileWidth,fileHeight,sMode,tMode) {
+					this->tileWidth			=	tileWidth;
+					this->tileWidthShift	=	tileWidthShift;
+					this->tileHeight		=	tileHeight;
+					this->tileHeightShift	=	tileHeightShift;
+
+					xTiles					=	(int) ceil((float) width / (float) tileWidth);
+					yTiles					=	(int) ceil((float) height / (float) tileHeight);
+					xBlocks					=	tileWidth >> 2;
+					blockSize				=	numSamples*TEXTURE_BLOCK_BYTES;
+
+					codec.tileWidth			=	tileWidth;
+					codec.tileHeight		=	tileHeight;
+					codec.numSamples		=	numSamples;
+					codec.bytesPerSample	=	bytesPerSample;
+					codec.rawSize			=	tileWidth*tileHeight*numSamples*bytesPerSample;
+					codec.encodedSize		=	(tileWidth >> 2)*(tileHeight >> 2)*blockSize;
+					codec.M					=	Mult;
+					codec.encode			=	encode;
+					codec.decode			=	decode;
+
+					const int	tileLength	=	codec.encodedSize;
+
+					dataBlocks				=	new CTextureBlock*[yTiles];
+					for (int i=0;i<yTiles;++i) {
+						dataBlocks[i]		=	new CTextureBlock[xTiles];
+
+						for (int j=0;j<xTiles;++j) {
+							textureRegisterBlock(dataBlocks[i] + j,tileLength,tileWidth*tileHeight);
+						}
+					}
+				}
+
+				///////////////////////////////////////////////////////////////////////
+				// Class				:	CBlockTexture
+				// Method				:	~CBlockTexture
+				// Description			:
+/// \brief					Dtor
+				// Return Value			:	-
+				// Comments				:
+				~CBlockTexture() {
+					for (int i=0;i<yTiles;++i) {
+						for (int j=0;j<xTiles;++j) {
+							textureUnregisterBlock(&dataBlocks[i][j]);
+						}
+
+						delete [] dataBlocks[i];
+					}
+
+					delete [] dataBlocks;
+				}
+
+protected:
+
+					// Pixel lookup
+	void			lookupPixel(float *res,int x,int y,CShadingContext *context) {
+						int					xTile;
+						int					yTile;
+						CTextureBlock		*block;
+						const unsigned char	*data;
+						const unsigned short	*range;
+						const int			xt	=	tileWidth - 1;
+						const int			yt	=	tileHeight - 1;
+						const int			nc	=	min((int) numSamples,3);
+
+						int	xi		=	x+1;
+						int	yi		=	y+1;
+						
+						// these must be after the xi,yi calculation
+						// x,y are relative to this layer
+						if (x < 0)			x  = (sMode == TEXTURE_PERIODIC) ? (x + width)   : 0;
+						if (y < 0)			y  = (tMode == TEXTURE_PERIODIC) ? (y + height)  : 0;
+						if (xi >= width)	xi = (sMode == TEXTURE_PERIODIC) ? (xi - width)  : (width - 1);
+						if (yi >= height)	yi = (tMode == TEXTURE_PERIODIC) ? (yi - height) : (height - 1);
+
+						const int	thread	=	context->thread;
+
+#define	access(__x,__y)															\
+						xTile	=	__x >> tileWidthShift;						\
+						yTile	=	__y >> tileHeightShift;						\
+						block	=	dataBlocks[yTile] + xTile;					\
+																				\
+						if (block->threadData[thread].data == NULL) {			\
+							textureLoadBlock(block,name,xTile << tileWidthShift,yTile << tileHeightShift,tileWidth,tileHeight,directory,context,&codec); \
+						}																					\
+						assert(block->data != NULL);							\
+						(*CRenderer::textureRefNumber[thread])++;											\
+						block->threadData[thread].lastRefNumber	=	*CRenderer::textureRefNumber[thread];	\
+																											\
+						if (block->size == codec.rawSize) {						\
+							data	=	(const unsigned char *) block->data + (((__y & yt))*tileWidth+(__x&xt))*numSamples*codec.bytesPerSample;	\
+							codec.decode(res,data,&codec);						\
+						} else {												\
+							data	=	(const unsigned char *) block->data + ((((__y & yt) >> 2)*xBlocks + ((__x & xt) >> 2)))*blockSize;	\
+							range	=	(const unsigned short *) data;			\
+							data	+=	numSamples*2*sizeof(unsigned short) + ((((__y & 3) << 2) + (__x & 3)))*numSamples;	\
+							for (int c=0;c<nc;c++) {							\
+								const float	l	=	halfToFloat(range[c*2]);	\
+								const float	h	=	halfToFloat(range[c*2+1]);	\
+								res[c]	=	l + (h - l)*data[c]*(1/(float) 255);	\
+							}													\
+							for (int c=nc;c<3;c++)	res[c]	=	res[0];			\
+						}														\
+						res		+=	3;
+
+						access(x,y);
+						access(xi,y);
+						access(x,yi);
+						access(xi,yi);
+#undef access
+					}
+
+	CTextureBlock	**dataBlocks;
+	CTileCodec		codec;
+	int				xTiles,yTiles;
+	int				xBlocks;
+	int				blockSize;
+	int				tileWidth,tileWidthShift;
+	int				tileHeight,tileHeightShift;
+};
+
+
+
+
+
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CMadeTexture
 // Description			:
@@ -1313,7 +1581,7 @@ public:
 
 									size				=	tileSizes[k];
 
-									textureRegisterBlock(&(cTile->block),size);
+									textureRegisterBlock(&(cTile->block),size,header.tileSize*header.tileSize);
 									cTile->data			=	new float*[header.tileSize*header.tileSize];
 									cTile->lastData		=	new float*[header.tileSize*header.tileSize];
 								}
@@ -1453,7 +1721,7 @@ private:
 							CDeepTile	*cTile	=	tiles[y]+x;
 
 							#ifndef TEXTURE_PERBLOCK_LOCK
-								osLock(CRenderer::textureMutex);
+								profilerLock(CRenderer::textureMutex,context->thread,"textureMutex");
 							#else
 								osLock(cTile->block.mutex);
 							#endif
@@ -1468,6 +1736,8 @@ private:
 								return;
 							}
 
+							CProfilerSpan	missSpan(context->thread,PROFILER_TEXTURE,"deepShadowMiss");
+
 							int			index	=	y*header.xTiles+x;
 							FILE		*in		=	fopen(fileName,"rb");
 							float		**cData;
@@ -1953,7 +2223,7 @@ void		CDummyEnvironment::lookup(float *dest,const float *D0,const float *D1,cons
 /// \brief					Read the pyramid layers
 // Return Value			:	TRUE on success
 // Comments				:
-template <class T> static CTexture	*readMadeTexture(const char *name,const char *aname,TIFF *in,int &dstart,int width,int height,const char *smode,const char *tmode,T enforcer) {
+template <class T> static CTexture	*readMadeTexture(const char *name,const char *aname,TIFF *in,int &dstart,int width,int height,const char *smode,const char *tmode,int compress,T enforcer) {
 	uint32					fileWidth,fileHeight;
 	uint32					tileWidth,tileHeight;
 	uint16					numSamples;
@@ -1997,7 +2267,10 @@ template <class T> static CTexture	*readMadeTexture(const char *name,const char
 
 	CMadeTexture	*cTexture	=	new CMadeTexture(aname);
 
-	if (sizeof(T) == sizeof(float)) {
+	uint16	sampleFormat	=	SAMPLEFORMAT_UINT;
+	TIFFGetFieldDefaulted(in,TIFFTAG_SAMPLEFORMAT			,&sampleFormat);
+
+	if ((sizeof(T) == sizeof(float)) || (sampleFormat == SAMPLEFORMAT_IEEEFP)) {
 		M		=	1;
 	} else if(sizeof(T) == sizeof(unsigned short)) {
 		// This doesn't really make sense to me, but it does give correct results.
@@ -2028,12 +2301,16 @@ template <class T> static CTexture	*readMadeTexture(const char *name,const char
 		TIFFGetFieldDefaulted(in,TIFFTAG_TILEWIDTH              ,&tileWidth);
 		TIFFGetFieldDefaulted(in,TIFFTAG_TILELENGTH             ,&tileHeight);
 		int ii, jj;
-		for (ii=1,jj=0;ii != tileWidth;ii = ii << 1,jj++);
+		for (ii=1,jj=0;ii != (int) tileWidth;ii = ii << 1,jj++);
 		tileWidthShift           =       jj;
-		for (ii=1,jj=0;ii != tileHeight;ii = ii << 1,jj++);
+		for (ii=1,jj=0;ii != (int) tileHeight;ii = ii << 1,jj++);
 		tileHeightShift           =       jj;
 
-		cTexture->layers[i]	=	new CTiledTexture<T>(name,dstart,cwidth,cheight,numSamples,fileWidth,fileHeight,sMode,tMode,tileWidth,tileWidthShift,tileHeight, tileHeightShift, M);
+		// Block compression only pays off for the wider samples
+		if ((compress) && (sizeof(T) > 1) && ((tileWidth & 3) == 0) && ((tileHeight & 3) == 0))
+			cTexture->layers[i]	=	new CBlockTexture(name,dstart,cwidth,cheight,numSamples,fileWidth,fileHeight,sMode,tMode,tileWidth,tileWidthShift,tileHeight, tileHeightShift, M, sizeof(T), blockEncode<T>, rawDecode<T>);
+		else
+			cTexture->layers[i]	=	new CTiledTexture<T>(name,dstart,cwidth,cheight,numSamples,fileWidth,fileHeight,sMode,tMode,tileWidth,tileWidthShift,tileHeight, tileHeightShift, M);
 		dstart++;
 
 		cwidth				=	cwidth >> 1;
@@ -2059,8 +2336,11 @@ template <class T> static CTexture	*readTexture(const char *name,const char *ana
 	TIFFGetFieldDefaulted(in,TIFFTAG_IMAGELENGTH             ,&height);
 	TIFFGetFieldDefaulted(in,TIFFTAG_SAMPLESPERPIXEL         ,&numSamples);
 
+	uint16	sampleFormat	=	SAMPLEFORMAT_UINT;
+	TIFFGetFieldDefaulted(in,TIFFTAG_SAMPLEFORMAT			,&sampleFormat);
+
 	double		M;
-	if (sizeof(T) == sizeof(float)) {
+	if ((sizeof(T) == sizeof(float)) || (sampleFormat == SAMPLEFORMAT_IEEEFP)) {
 		M		=	1;
 	} else if(sizeof(T) == sizeof(unsigned short)) {
 		M		= 	1.0/65535.0;
@@ -2081,13 +2361,20 @@ template <class T> static CTexture	*readTexture(const char *name,const char *ana
 /// \brief					Load a texture from disk
 // Return Value			:	Pointer to the new texture
 // Comments				:
-static	CTexture	*texLoad(const char *name,const char *aname,TIFF *in,int &dstart,int unMade = FALSE) {
+static	CTexture	*texLoad(const char *name,const char *aname,TIFF *in,int &dstart,int compress,int unMade = FALSE) {
 	CTexture		*cTexture = NULL;
 	uint16			bitspersample;
+	uint16			sampleFormat	=	SAMPLEFORMAT_UINT;
 
 	// Get the bits per sample from the file
 	TIFFSetDirectory(in,dstart);
 	TIFFGetFieldDefaulted(in,TIFFTAG_BITSPERSAMPLE              ,&bitspersample);
+	TIFFGetFieldDefaulted(in,TIFFTAG_SAMPLEFORMAT               ,&sampleFormat);
+
+	// 16 bit floats are halfs
+	const int		half	=	(bitspersample == 16) && (sampleFormat == SAMPLEFORMAT_IEEEFP);
+	CHalf			halfEnforcer;
+	halfEnforcer.bits		=	0;
 
 	// Is this a made texture file ?
 	if (unMade == FALSE) {
@@ -2119,20 +2406,24 @@ static	CTexture	*texLoad(const char *name,const char *aname,TIFF *in,int &dstart
 
 
 						if (bitspersample == 8) {
-							cTexture	=	readMadeTexture<unsigned char>(name,aname,in,dstart,width,height,smode,tmode,1);
+							cTexture	=	readMadeTexture<unsigned char>(name,aname,in,dstart,width,height,smode,tmode,compress,1);
+						} else if (half) {
+							cTexture	=	readMadeTexture<CHalf>(name,aname,in,dstart,width,height,smode,tmode,compress,halfEnforcer);
 						} else if (bitspersample == 16) {
-							cTexture	=	readMadeTexture<unsigned short>(name,aname,in,dstart,width,height,smode,tmode,1);
+							cTexture	=	readMadeTexture<unsigned short>(name,aname,in,dstart,width,height,smode,tmode,compress,1);
 						} else {
-							cTexture	=	readMadeTexture<float>(name,aname,in,dstart,width,height,smode,tmode,1);
+							cTexture	=	readMadeTexture<float>(name,aname,in,dstart,width,height,smode,tmode,compress,1);
 						}
 					}
 				} else {
 					if (bitspersample == 8) {
-						cTexture	=	readMadeTexture<unsigned char>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,1);
+						cTexture	=	readMadeTexture<unsigned char>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,compress,1);
+					} else if (half) {
+						cTexture	=	readMadeTexture<CHalf>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,compress,halfEnforcer);
 					} else if (bitspersample == 16) {
-						cTexture	=	readMadeTexture<unsigned short>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,1);
+						cTexture	=	readMadeTexture<unsigned short>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,compress,1);
 					} else {
-						cTexture	=	readMadeTexture<float>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,1);
+						cTexture	=	readMadeTexture<float>(name,aname,in,dstart,width,height,RI_BLACK,RI_BLACK,compress,1);
 					}
 				}
 			}
@@ -2145,6 +2436,8 @@ static	CTexture	*texLoad(const char *name,const char *aname,TIFF *in,int &dstart
 		// This must be an un-made texture then
 		if (bitspersample == 8) {
 			cTexture	=	readTexture<unsigned char>(name,aname,in,dstart,1);
+		} else if (half) {
+			cTexture	=	readTexture<CHalf>(name,aname,in,dstart,halfEnforcer);
 		} else if (bitspersample == 16) {
 			cTexture	=	readTexture<unsigned short>(name,aname,in,dstart,1);
 		} else {
@@ -2181,6 +2474,7 @@ CTexture		*CRenderer::textureLoad(const char *name,TSearchpath *path) {
 	// Open the texture
 	TIFF		*in			=	TIFFOpen(fn,"r");
 	CTexture	*cTexture	=	NULL;
+	const int	compress	=	(CRenderer::flags & OPTIONS_FLAGS_COMPRESS_TEXTURES) != 0;
 	if (in != NULL) {
 		char	*textureFormat	= NULL;
 		int		directory		=	0;
@@ -2188,13 +2482,13 @@ CTexture		*CRenderer::textureLoad(const char *name,TSearchpath *path) {
 		if (TIFFGetField(in,TIFFTAG_PIXAR_TEXTUREFORMAT,&textureFormat) == 1) {
 			if (strcmp(textureFormat,TIFF_TEXTURE) == 0)
 				// This seems like a made texture
-				cTexture	=	texLoad(fn,name,in,directory);
+				cTexture	=	texLoad(fn,name,in,directory,compress);
 			else
 				// This seems like a texture made by another software
-				cTexture	=	texLoad(fn,name,in,directory);
+				cTexture	=	texLoad(fn,name,in,directory,compress);
 		} else {
 			// This seems like an unmade texture
-			cTexture		=	texLoad(fn,name,in,directory);
+			cTexture		=	texLoad(fn,name,in,directory,compress);
 		}
 
 		TIFFClose(in);
@@ -2230,6 +2524,7 @@ CEnvironment		*CRenderer::environmentLoad(const char *name,TSearchpath *path,flo
 	// Open the texture
 	TIFF			*in			=	TIFFOpen(fileName,"r");
 	CEnvironment	*cTexture	=	NULL;
+	const int		compress	=	(CRenderer::flags & OPTIONS_FLAGS_COMPRESS_TEXTURES) != 0;
 	if (in != NULL) {
 		char				*textureFormat = NULL;
 
@@ -2241,7 +2536,7 @@ CEnvironment		*CRenderer::environmentLoad(const char *name,TSearchpath *path,flo
 				CTexture	*sides[6];
 
 				for (int i=0;i<6;++i) {
-					sides[i]	=	texLoad(fileName,name,in,directory);
+					sides[i]	=	texLoad(fileName,name,in,directory,compress);
 				}
 
 				cTexture	=	new CCubicEnvironment(name,sides);
@@ -2249,14 +2544,14 @@ CEnvironment		*CRenderer::environmentLoad(const char *name,TSearchpath *path,flo
 				int			directory	=	0;
 				CTexture	*side;
 
-				side		=	texLoad(fileName,name,in,directory);
+				side		=	texLoad(fileName,name,in,directory,compress);
 
 				cTexture	=	new CSphericalEnvironment(name,side);
 			} else if (strcmp(textureFormat,TIFF_CYLINDER_ENVIRONMENT) == 0) {
 				int			directory	=	0;
 				CTexture	*side;
 
-				side		=	texLoad(fileName,name,in,directory);
+				side		=	texLoad(fileName,name,in,directory,compress);
 
 				cTexture	=	new CCylindericalEnvironment(name,side);
 			} else if (strcmp(textureFormat,TIFF_SHADOW) == 0)	{
@@ -2268,7 +2563,7 @@ CEnvironment		*CRenderer::environmentLoad(const char *name,TSearchpath *path,flo
 				TIFFGetField(in,TIFFTAG_PIXAR_MATRIX_WORLDTOCAMERA,	&tmp);	movmm(worldToCamera,tmp);
 				TIFFGetField(in,TIFFTAG_PIXAR_MATRIX_WORLDTOSCREEN,	&tmp);	movmm(worldToScreen,tmp);
 
-				side		=	texLoad(fileName,name,in,directory);
+				side		=	texLoad(fileName,name,in,directory,FALSE);
 
 				// Compute the transformation matrix to the light space
 				mulmm(localToNDC,worldToScreen,toWorld);
@@ -2298,6 +2593,8 @@ void			CRenderer::initTextures(int mm) {
 	CRenderer::textureMaxMemory		=	new int[CRenderer::numThreads];
 	
 	CRenderer::textureRefNumber		=	new	int*[CRenderer::numThreads];
+
+	stats.textureBudget				=	mm;
 	
 	for (int i=0;i<CRenderer::numThreads;++i) {
 		CRenderer::textureMaxMemory[i]		=	maxPerThread;
@@ -31,6 +31,7 @@
 #include "texture3d.h"
 #include "error.h"
 #include "renderer.h"
+#include "shading.h"
 #include "displayChannel.h"
 
 
@@ -75,6 +76,38 @@ CTexture3d::CTexture3d(const char *n,const float *f,const float *t,const float *
 CTexture3d::~CTexture3d() { 
 	if (channels != NULL) delete [] channels;
 }
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTexture3d
+// Method				:	lookup
+// Description			:
+/// \brief					Lookup a number of points at once
+// Return Value			:	-
+// Comments				:	Textures that can do better override this
+void CTexture3d::lookup(int numLookups,float *C,const float *P,const float *N,const float *radius) {
+	for (int i=0;i<numLookups;i++) {
+		lookup(C + i*dataSize,P + i*3,N + i*3,radius[i]);
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CTexture3d
+// Method				:	lookup
+// Description			:
+/// \brief					Lookup a number of points at once for irradiance cache type of queries
+// Return Value			:	-
+// Comments				:	Textures that can do better override this
+void CTexture3d::lookup(int numLookups,float *C,const float *P,const float *dPdu,const float *dPdv,const float *N,const float *samples,CShadingContext *context) {
+	CShadingScratch	*scratch		=	&(context->currentShadingState->scratch);
+	const float		savedSamples	=	scratch->traceParams.samples;
+
+	for (int i=0;i<numLookups;i++) {
+		scratch->traceParams.samples	=	samples[i];
+		lookup(C + i*dataSize,P + i*3,dPdu + i*3,dPdv + i*3,N + i*3,context);
+	}
+
+	scratch->traceParams.samples	=	savedSamples;
+}
 	
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CTexture3d
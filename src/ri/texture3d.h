@@ -71,9 +71,15 @@ public:
 	virtual	void			lookup(float *,const float *,const float *,float)		= 0;	
 	virtual	void			store(const float *,const float *,const float *,float)	= 0;
 
+							// Batched version of the radius lookup (dataSize results per lookup)
+	virtual	void			lookup(int,float *,const float *,const float *,const float *);
+
 							// For irradiance cache type of queries
 	virtual	void			lookup(float *,const float *,const float *,const float *,const float *,CShadingContext *)		= 0;
 
+							// Batched version of the irradiance cache query (P,dPdu,dPdv,N and the number of samples per lookup)
+	virtual	void			lookup(int,float *,const float *,const float *,const float *,const float *,const float *,CShadingContext *);
+
 							// Resolve the names to channels
 	void					resolve(int n,const char **names,int *entry,int *size);
 	
@@ -33,8 +33,11 @@
 
 #include "shading.h"
 #include "stats.h"
+#include "profiler.h"
 #include "memory.h"
 #include "points.h"
+#include "delayed.h"
+#include "surface.h"
 #include "options.h"
 #include "renderer.h"
 
@@ -88,11 +91,15 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 	float							**varying;
 
 	// Compute some of the ray junk
-	CRay		**rays	=	bundle->rays;
-	int			numRays	=	bundle->numRays;
+	CRay		**rays		=	bundle->rays;
+	int			numRays		=	bundle->numRays;
+	const int	cacheable	=	bundle->cacheable();
 
 	assert(numRays != 0);
 
+	// Record the time we spend on this bundle (including the shading of the hits)
+	CProfilerSpan	traceSpan(thread,PROFILER_TRACE,"trace");
+
 	for (i=0;i<numRays;i++) {
 		CRay	*ray	=	rays[i];
 		
@@ -119,6 +126,7 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 			// This struct holds a bunch of rays that can be shaded together
 			typedef struct TShadingGroup {
 				CSurface		*object;
+				CDelayedInstance	*instance;
 				CRay			**rays;
 				int				numRays;
 				TShadingGroup	*next;
@@ -142,8 +150,16 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 					uintptr_t	integer;
 				} object;
 
+				// Rays that hit the same object in different instances are shaded separately
+				union {
+					CDelayedInstance	*pointer;
+					uintptr_t			integer;
+				} instance;
+
 				// Compute the hash key (fast and easy)
-				object.pointer	=	cRay->object;
+				object.pointer		=	cRay->object;
+				instance.pointer	=	cRay->instance;
+				object.integer		^=	instance.integer;
 				key				=	(int) (	(object.integer >> 0) ^ 
 											(object.integer >> 4) ^ 
 											(object.integer >> 8) ^ 
@@ -151,11 +167,12 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 
 				cHash			=	traceObjectHash + key;
 
-				if (cHash->object == cRay->object) {
+				if ((cHash->object == cRay->object) && (cHash->instance == cRay->instance)) {
 					// Hash hit
 				} else if (cHash->object == (CObject *) this) {
 					// First entry
 					cHash->object		=	cRay->object;
+					cHash->instance		=	cRay->instance;
 					cHash->numRays		=	0;
 					cHash->rays			=	NULL;
 					cHash->next			=	NULL;
@@ -164,13 +181,14 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 				} else {
 					// Search the hash
 					for (;cHash!=NULL;cHash=cHash->next) {
-						if (cHash->object == cRay->object)	break;
+						if ((cHash->object == cRay->object) && (cHash->instance == cRay->instance))	break;
 					}
 
 					// Did we find it ?
 					if (cHash == NULL) {
 						cHash						=	(TObjectHash *) ralloc(sizeof(TObjectHash),threadMemory);
 						cHash->object				=	cRay->object;
+						cHash->instance				=	cRay->instance;
 						cHash->numRays				=	0;
 						cHash->rays					=	NULL;
 						cHash->next					=	traceObjectHash[key].next;
@@ -200,6 +218,7 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 				// Save the shading group
 				objects					=	cHash->shadeNext;
 				cGroup->object			=	cHash->object;
+				cGroup->instance		=	cHash->instance;
 				cGroup->rays			=	rays;
 				cGroup->numRays			=	cHash->numRays;
 				cHash->object			=	(CSurface *) this;
@@ -223,7 +242,19 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 						shadingGroups->rays[i]->object = shadingGroups->object;
 					}
 
-					if (shadingGroups->object != NULL) {
+					// Use the radiance caches for the rays that can
+					if ((cacheable) && (shadingGroups->instance == NULL) && (shadingGroups->object != NULL)) {
+						const int	numCached	=	shadeCached(bundle,numShading,shadingGroups->rays);
+
+						shadingGroups->numRays	-=	numCached;
+						shadingGroups->rays		+=	numCached;
+						if ((numShading -= numCached) == 0)	continue;
+					}
+
+					if (shadingGroups->instance != NULL) {
+						shadingGroups->instance->shade(this,shadingGroups->object,numShading,shadingGroups->rays);
+						bundle->postShade(numShading,shadingGroups->rays,varying);
+					} else if (shadingGroups->object != NULL) {
 						shadingGroups->object->shade(this,numShading,shadingGroups->rays);
 						bundle->postShade(numShading,shadingGroups->rays,varying);
 					} else {
@@ -267,6 +298,53 @@ void	CShadingContext::trace(CRayBundle *bundle) {
 
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	shadeCached
+// Description			:
+/// \brief					Shade the rays that can be interpolated from the patch radiance caches
+// Return Value			:	The number of rays shaded
+// Comments				:	The shaded rays are moved to the beginning of the array
+int		CShadingContext::shadeCached(CRayBundle *bundle,int numRays,CRay **rays) {
+	float	**varying	=	currentShadingState->varying;
+	int		numCached	=	0;
+	int		i;
+
+	memBegin(threadMemory);
+
+	float	*C			=	(float *) ralloc(numRays*6*sizeof(float),threadMemory);
+
+	// Interpolate whatever we can
+	for (i=0;i<numRays;i++) {
+		CRay	*cRay	=	rays[i];
+
+		if ((cRay->patch != NULL) && (cRay->patch->interpolateRadiance(this,cRay,C + numCached*6))) {
+			rays[i]				=	rays[numCached];
+			rays[numCached++]	=	cRay;
+		}
+	}
+
+	// Hand the cached colors to the bundle as if we shaded them
+	// Note: filling a cache runs the shaders, so we can only do this at the end
+	if (numCached > 0) {
+		float	*Ci	=	varying[VARIABLE_CI];
+		float	*Oi	=	varying[VARIABLE_OI];
+
+		for (i=0;i<numCached;i++,Ci+=3,Oi+=3) {
+			movvv(Ci,C + i*6);
+			movvv(Oi,C + i*6 + 3);
+		}
+
+		bundle->postShade(numCached,rays,varying);
+
+		stats.add(thread,STAT_RADIANCE_CACHE_HITS,numCached);
+	}
+
+	memEnd(threadMemory);
+
+	return numCached;
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CShadingContext
 // Method				:	traceEx
@@ -328,24 +406,79 @@ public:
 //							5. flags
 void	CShadingContext::trace(CRay *ray) {
 
+	// Compute the inverse of the ray direction first
+	ray->invDir[0]	= 1.0 / (double) ray->dir[0];
+	ray->invDir[1]	= 1.0 / (double) ray->dir[1];
+	ray->invDir[2]	= 1.0 / (double) ray->dir[2];
 	
-	CTraceObject		heapBase[TRACE_HEAP_SIZE + 1];
-	CTraceObject		*heap		=	heapBase;
-	int					numObjects	=	1;
-	int					maxObjects	=	TRACE_HEAP_SIZE;
-	
+	ray->jimp			=	urand();
+	ray->object			=	NULL;
+	ray->instance		=	NULL;
+	ray->patch			=	NULL;
+
+	numTracedRays++;
+
+	trace(ray,CRenderer::root);
+}
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	traceAny
+// Description			:
+/// \brief					Trace a single ray until it hits anything
+// Return Value			:	-
+// Comments				:	Same as trace(CRay *), but the ray is only tested for occlusion:
+//							the traversal stops at the first intersection which need not be
+//							the closest one, so ray->t is only meaningful as a hit/no hit flag
+void	CShadingContext::traceAny(CRay *ray) {
+
 	// Compute the inverse of the ray direction first
 	ray->invDir[0]	= 1.0 / (double) ray->dir[0];
 	ray->invDir[1]	= 1.0 / (double) ray->dir[1];
 	ray->invDir[2]	= 1.0 / (double) ray->dir[2];
 	
-	// Compute the first entry in the heap
-	heap[1].tmin		=	nearestBox(CRenderer::root->bmin,CRenderer::root->bmax,ray->from,ray->invDir,ray->tmin,ray->t);
-	heap[1].object		=	CRenderer::root;
 	ray->jimp			=	urand();
 	ray->object			=	NULL;
+	ray->instance		=	NULL;
+	ray->patch			=	NULL;
 
 	numTracedRays++;
+	numAnyHitRays++;
+
+	// Shared instances trace through their own hierarchies, so let them know
+	const int	savedAnyHit	=	traceAnyHit;
+	traceAnyHit				=	TRUE;
+	trace(ray,CRenderer::root);
+	traceAnyHit				=	savedAnyHit;
+}
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	trace
+// Description			:
+/// \brief					Trace a single ray through a hierarchy
+// Return Value			:	-
+// Comments				:	The ray must be ready for tracing (see above) and invDir must be computed,
+//							shared instances call this to trace the ray through their object space hierarchy
+void	CShadingContext::trace(CRay *ray,CObject *root) {
+
+	// Occlusion queries do not need the nearest hit
+	if (traceAnyHit) {
+		traceAny(ray,root);
+		return;
+	}
+
+	CTraceObject		heapBase[TRACE_HEAP_SIZE + 1];
+	CTraceObject		*heap		=	heapBase;
+	int					numObjects	=	1;
+	int					maxObjects	=	TRACE_HEAP_SIZE;
+	
+	// Compute the first entry in the heap
+	heap[1].tmin		=	root->nearestBound(ray);
+	heap[1].object		=	root;
 
 	// While we have objects in the heap, pop the object and process it
 	while((numObjects > 0) && (heap[1].tmin < ray->t)) {
@@ -369,7 +502,12 @@ void	CShadingContext::trace(CRay *ray) {
 
 		// If this is a real object, intersect it with the ray
 		if ((object->flags & OBJECT_DUMMY) == 0) {
+			CSurface	*hit	=	ray->object;
+
 			object->intersect(this,ray);
+
+			// Shared instances record themselves, any other hit is not in an instance
+			if ((ray->object != hit) && ((object->flags & OBJECT_INSTANCE) == 0))	ray->instance	=	NULL;
 		}
 
 		// Is the object hierarchy ready ?
@@ -401,8 +539,8 @@ void	CShadingContext::trace(CRay *ray) {
 				heap						=	newHeap;
 			}
 
-			// Insert the child into the heap
-			const float	tmin	=	nearestBox(cChild->bmin,cChild->bmax,ray->from,ray->invDir,ray->tmin,ray->t);
+			// Insert the child into the heap (moving children are bound at the ray time)
+			const float	tmin	=	cChild->nearestBound(ray);
 			
 			if (tmin < ray->t) {
 				// Maintain the heap
@@ -420,3 +558,70 @@ void	CShadingContext::trace(CRay *ray) {
 	}
 }
 
+
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShadingContext
+// Method				:	traceAny
+// Description			:
+/// \brief					Trace a single ray through a hierarchy until the first hit
+// Return Value			:	-
+// Comments				:	The objects are visited depth first from a plain stack, there's
+//							no point in ordering them since any intersection terminates the ray
+void	CShadingContext::traceAny(CRay *ray,CObject *root) {
+	CObject				*stackBase[TRACE_HEAP_SIZE];
+	CObject				**stack		=	stackBase;
+	int					numObjects	=	0;
+	int					maxObjects	=	TRACE_HEAP_SIZE;
+
+	// Is the ray even entering the root ?
+	if (!(root->nearestBound(ray) < ray->t))	return;
+
+	stack[numObjects++]	=	root;
+
+	// While we have objects in the stack, pop the object and process it
+	while(numObjects > 0) {
+		CObject	*object		=	stack[--numObjects];
+
+		// If this is a real object, intersect it with the ray
+		if ((object->flags & OBJECT_DUMMY) == 0) {
+			object->intersect(this,ray);
+
+			// Any hit will do
+			if (ray->object != NULL) {
+
+				// Shared instances record themselves, any other hit is not in an instance
+				if ((object->flags & OBJECT_INSTANCE) == 0)	ray->instance	=	NULL;
+				return;
+			}
+		}
+
+		// Is the object hierarchy ready ?
+		if ((object->flags & OBJECT_HIERARCHY_READY) == 0) {
+			osLock(CRenderer::hierarchyMutex);
+			if ((object->flags & OBJECT_HIERARCHY_READY) == 0) {
+				object->cluster(this);
+				object->flags		|=	OBJECT_HIERARCHY_READY;
+			}
+			osUnlock(CRenderer::hierarchyMutex);
+		}
+		
+		// Push the children the ray goes through
+		CObject	*cChild;
+		for (cChild=object->children;cChild!=NULL;cChild=cChild->sibling) {
+			if (cChild->nearestBound(ray) < ray->t) {
+
+				// Allocate more stack space if we need it (very unlikely)
+				if (numObjects == maxObjects) {
+					maxObjects					*=	2;
+					CObject			**newStack	=	(CObject **) ralloc(maxObjects*sizeof(CObject *),threadMemory);
+					memcpy(newStack,stack,numObjects*sizeof(CObject *));
+					stack						=	newStack;
+				}
+
+				stack[numObjects++]	=	cChild;
+			}
+		}
+	}
+}
@@ -211,6 +211,40 @@ public:
 		}
 		return FALSE;
 	}
+
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CUserAttributeDictionary
+	// Method				:	equals
+	// Description			:
+/// \brief					Check if two dictionaries hold the same values
+	// Return Value			:	TRUE if they do
+	// Comments				:	The lists are sorted by name
+	int equals(const CUserAttributeDictionary &other) const {
+		const CVariable *cAttr	=	attribs;
+		const CVariable *oAttr	=	other.attribs;
+
+		while ((cAttr != NULL) && (oAttr != NULL)) {
+			if (strcmp(cAttr->name,oAttr->name) != 0)	return FALSE;
+			if (cAttr->type != oAttr->type)				return FALSE;
+			if (cAttr->numFloats != oAttr->numFloats)	return FALSE;
+
+			if (cAttr->type == TYPE_STRING) {
+				const char **src	=	(const char**) cAttr->defaultValue;
+				const char **dst	=	(const char**) oAttr->defaultValue;
+
+				for (int i=0;i<cAttr->numFloats;i++) {
+					if (strcmp(src[i],dst[i]) != 0)		return FALSE;
+				}
+			} else {
+				if (memcmp(cAttr->defaultValue,oAttr->defaultValue,sizeof(float)*cAttr->numFloats) != 0) return FALSE;
+			}
+
+			cAttr	=	cAttr->next;
+			oAttr	=	oAttr->next;
+		}
+
+		return (cAttr == oAttr);
+	}
 };
 
 
@@ -0,0 +1,524 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	volume.cpp
+//  Classes				:	CVolume
+//  Description			:
+//
+////////////////////////////////////////////////////////////////////////
+#include <math.h>
+
+#include "volume.h"
+#include "shading.h"
+#include "memory.h"
+#include "stats.h"
+#include "error.h"
+#include "ri_config.h"
+
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	CVolume
+// Description			:
+/// \brief					Ctor
+// Return Value			:	-
+// Comments				:	We own the brickmap
+CVolume::CVolume(const char *name,CBrickMap *m,const char *channel) : CFileResource(name) {
+	int	size,i,l;
+
+	map				=	m;
+	root			=	NULL;
+	densityEntry	=	0;
+	minStep			=	0;
+
+	if (map == NULL)	return;
+
+	// Find the density
+	map->resolve(1,&channel,&densityEntry,&size);
+	if (size == 0)		return;
+
+	// The finest voxels
+	minStep			=	map->side / (float) ((1 << map->maxDepth)*BRICK_SIZE) * 0.5f;
+
+	// Build the hierarchy of the bricks we have, the bricks stay on disk
+	root			=	new CVolumeNode(NULL,0,0,0,0);
+
+	osLock(map->mutex);
+	for (i=0;i<BRICK_HASHSIZE;i++) {
+		CBrickMap::CBrickNode	*cBrickNode;
+
+		for (cBrickNode=map->activeBricks[i];cBrickNode!=NULL;cBrickNode=cBrickNode->next) {
+			CVolumeNode			*cNode	=	root;
+			const int			x		=	cBrickNode->x;
+			const int			y		=	cBrickNode->y;
+			const int			z		=	cBrickNode->z;
+			const int			d		=	cBrickNode->d;
+
+			// Walk down to the node of the brick
+			for (l=d-1;l>=0;l--) {
+				const int	c	=	((x >> l) & 1) | (((y >> l) & 1) << 1) | (((z >> l) & 1) << 2);
+
+				if (cNode->children[c] == NULL)	cNode->children[c]	=	new CVolumeNode(cNode,x >> l,y >> l,z >> l,d - l);
+				cNode	=	cNode->children[c];
+			}
+		}
+	}
+	osUnlock(map->mutex);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	~CVolume
+// Description			:
+/// \brief					Dtor
+// Return Value			:	-
+// Comments				:
+CVolume::~CVolume() {
+	if (root != NULL)	destroy(root);
+	if (map != NULL)	delete map;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	findNode
+// Description			:
+/// \brief					Find the node of a brick
+// Return Value			:	The node (NULL if the brick doesn't exist)
+// Comments				:
+CVolume::CVolumeNode	*CVolume::findNode(int x,int y,int z,int d) const {
+	CVolumeNode	*cNode	=	root;
+	int			l;
+
+	if ((x < 0) || (y < 0) || (z < 0))								return NULL;
+	if ((x >= (1 << d)) || (y >= (1 << d)) || (z >= (1 << d)))		return NULL;
+
+	for (l=d-1;(l>=0) && (cNode!=NULL);l--) {
+		cNode	=	cNode->children[((x >> l) & 1) | (((y >> l) & 1) << 1) | (((z >> l) & 1) << 2)];
+	}
+
+	return cNode;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	computeLocalMax
+// Description			:
+/// \brief					Find the densest voxel in the brick of a node
+// Return Value			:	The maximum density
+// Comments				:	The caller must hold the brickmap mutex, this may page the brick in
+float	CVolume::computeLocalMax(CVolumeNode *cNode) {
+	if (cNode->localMax < 0) {
+		CBrickMap::CBrick	*cBrick		=	map->findBrick(cNode->x,cNode->y,cNode->z,cNode->d,FALSE,NULL);
+		float				localMax	=	0;
+
+		if (cBrick != NULL) {
+			const int	voxelSize	=	sizeof(CBrickMap::CVoxel) + map->dataSize*sizeof(float);
+			const char	*cData		=	(const char *) cBrick->voxels;
+			int			l;
+
+			for (l=BRICK_SIZE*BRICK_SIZE*BRICK_SIZE;l>0;l--,cData+=voxelSize) {
+				const CBrickMap::CVoxel	*cVoxel;
+
+				for (cVoxel=(const CBrickMap::CVoxel *) cData;cVoxel!=NULL;cVoxel=cVoxel->next) {
+					if (cVoxel->weight > 0) {
+						const float	density	=	((const float *) (cVoxel+1))[densityEntry];
+
+						if (density > localMax)	localMax	=	density;
+					}
+				}
+			}
+		}
+
+		cNode->localMax	=	localMax;
+	}
+
+	return cNode->localMax;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	computeDilatedMax
+// Description			:
+/// \brief					Find the maximum density of a brick and its neighbours
+// Return Value			:	The maximum density
+// Comments				:	The caller must hold the brickmap mutex.
+//							A lookup at the depth of the brick filters the voxels
+//							within a voxel of the point, so it can reach into the
+//							neighbouring bricks
+float	CVolume::computeDilatedMax(CVolumeNode *cNode) {
+	if (cNode->dilatedMax < 0) {
+		float	dilatedMax	=	computeLocalMax(cNode);
+		int		i,j,k;
+
+		for (i=-1;i<=1;i++) {
+			for (j=-1;j<=1;j++) {
+				for (k=-1;k<=1;k++) {
+					CVolumeNode	*nNode	=	findNode(cNode->x + i,cNode->y + j,cNode->z + k,cNode->d);
+
+					if ((nNode != NULL) && (nNode != cNode))	dilatedMax	=	max(dilatedMax,computeLocalMax(nNode));
+				}
+			}
+		}
+
+		cNode->dilatedMax	=	dilatedMax;
+	}
+
+	return cNode->dilatedMax;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	computeNearMax
+// Description			:
+/// \brief					Find the maximum density of the bricks in a subtree a cell can reach
+// Return Value			:	The maximum density
+// Comments				:	The caller must hold the brickmap mutex.
+//							A lookup can only reach a brick within a voxel (of the
+//							depth of the brick) of the cell, so the rest of the
+//							subtree is not paged in
+float	CVolume::computeNearMax(CVolumeNode *cNode,const float *cellMin,float cellSide) {
+	const float	nodeSide	=	map->side / (float) (1 << cNode->d);
+	const float	dVoxel		=	nodeSide / (float) BRICK_SIZE;
+	const int	index[3]	=	{ cNode->x, cNode->y, cNode->z };
+	float		nearMax;
+	int			i;
+
+	for (i=0;i<3;i++) {
+		const float	nodeMin	=	index[i]*nodeSide;
+
+		if ((nodeMin - (cellMin[i] + cellSide)) > dVoxel)	return 0;
+		if ((cellMin[i] - (nodeMin + nodeSide)) > dVoxel)	return 0;
+	}
+
+	nearMax	=	computeLocalMax(cNode);
+
+	for (i=0;i<8;i++) {
+		if (cNode->children[i] != NULL)	nearMax	=	max(nearMax,computeNearMax(cNode->children[i],cellMin,cellSide));
+	}
+
+	return nearMax;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	computeCellMax
+// Description			:
+/// \brief					Find the majorant of a missing child of a node
+// Return Value			:	The majorant of the cell
+// Comments				:	The caller must hold the brickmap mutex.
+//							The coarser lookups in the cell use the bricks above it
+//							and their neighbours, the finer ones can only reach into
+//							the subtrees of the neighbouring cells
+float	CVolume::computeCellMax(CVolumeNode *cNode,int child) {
+	if (cNode->cellMax[child] < 0) {
+		const int		x			=	cNode->x*2 + (child & 1);
+		const int		y			=	cNode->y*2 + ((child >> 1) & 1);
+		const int		z			=	cNode->z*2 + (child >> 2);
+		const int		d			=	cNode->d + 1;
+		const float		cellSide	=	map->side / (float) (1 << d);
+		CVolumeNode		*tNode;
+		float			cellMax		=	0;
+		vector			cellMin;
+		int				i,j,k;
+
+		initv(cellMin,x*cellSide,y*cellSide,z*cellSide);
+
+		for (tNode=cNode;tNode!=NULL;tNode=tNode->parent)	cellMax	=	max(cellMax,computeDilatedMax(tNode));
+
+		for (i=-1;i<=1;i++) {
+			for (j=-1;j<=1;j++) {
+				for (k=-1;k<=1;k++) {
+					CVolumeNode	*nNode	=	findNode(x + i,y + j,z + k,d);
+
+					if (nNode != NULL)	cellMax	=	max(cellMax,computeNearMax(nNode,cellMin,cellSide));
+				}
+			}
+		}
+
+		cNode->cellMax[child]	=	cellMax;
+	}
+
+	return cNode->cellMax[child];
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	destroy
+// Description			:
+/// \brief					Delete a node and its children
+// Return Value			:	-
+// Comments				:
+void	CVolume::destroy(CVolumeNode *cNode) {
+	int	i;
+
+	for (i=0;i<8;i++) {
+		if (cNode->children[i] != NULL)	destroy(cNode->children[i]);
+	}
+
+	delete cNode;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	region
+// Description			:
+/// \brief					Find the largest region around a point that has a single majorant
+// Return Value			:	The majorant of the region
+// Comments				:	P, from and dir are in the brickmap space, tExit receives
+//							where the segment (from + t*dir) leaves the region.
+//							The region is the missing child of the deepest node that
+//							contains the point
+float	CVolume::region(const float *P,const float *from,const float *dir,float &tExit) {
+	CVolumeNode		*cNode		=	root;
+	float			majorant;
+	float			side		=	map->side;
+	vector			bmin;
+	int				i;
+
+	initv(bmin,0);
+
+	while(TRUE) {
+
+		// Find the child that contains the point
+		side	*=	0.5f;
+
+		const int	x	=	(P[0] >= bmin[0] + side);
+		const int	y	=	(P[1] >= bmin[1] + side);
+		const int	z	=	(P[2] >= bmin[2] + side);
+
+		bmin[0]	+=	x*side;
+		bmin[1]	+=	y*side;
+		bmin[2]	+=	z*side;
+
+		const int		child	=	x | (y << 1) | (z << 2);
+
+		// There is no brick here, so the lookups will use the bricks around
+		if (cNode->children[child] == NULL) {
+
+			// The majorant is only written once, so we can check it without the lock
+			if ((majorant = cNode->cellMax[child]) < 0) {
+				osLock(map->mutex);
+				majorant	=	computeCellMax(cNode,child);
+				osUnlock(map->mutex);
+			}
+			break;
+		}
+
+		cNode	=	cNode->children[child];
+	}
+
+	// Find where the segment leaves the region
+	tExit	=	C_INFINITY;
+	for (i=0;i<3;i++) {
+		if (dir[i] > 0)			tExit	=	min(tExit,(bmin[i] + side - from[i]) / dir[i]);
+		else if (dir[i] < 0)	tExit	=	min(tExit,(bmin[i] - from[i]) / dir[i]);
+	}
+
+	return majorant;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Method				:	march
+// Description			:
+/// \brief					Integrate the volume along a number of segments
+// Return Value			:	-
+// Comments				:	opacity receives 1 - transmittance and data receives the
+//							brickmap channels weighted by the light they absorb.
+//							from and to are in the camera space, the density is per
+//							unit length in the brickmap space.
+//							All segments are marched together and the density lookups
+//							of each step are done in one batch.
+void	CVolume::march(int numRays,float *opacity,float *data,const float *from,const float *to,const float *stepSize,const float *densityScale,CShadingContext *context) {
+	const int	dataSize	=	(map != NULL) ? map->dataSize : 0;
+	int			numLookups	=	0;
+	int			numSkipped	=	0;
+	int			numActive	=	0;
+	int			i,j,k;
+
+	// Clear the results
+	for (i=0;i<numRays;i++)				opacity[i]	=	0;
+	for (i=0;i<numRays*dataSize;i++)	data[i]		=	0;
+
+	// Is there anything to march through ?
+	if (root == NULL)	return;
+
+	memBegin(context->threadMemory);
+
+	float	*P			=	(float *) ralloc(numRays*9*sizeof(float),context->threadMemory);
+	float	*D			=	P + numRays*3;						// The segment in the brickmap space
+	float	*Z			=	D + numRays*3;						// The normals for the lookups
+	float	*t			=	(float *) ralloc(numRays*5*sizeof(float),context->threadMemory);
+	float	*tEnd		=	t + numRays;						// Where we are and where we stop
+	float	*T			=	tEnd + numRays;						// The transmittance so far
+	float	*lengthV	=	T + numRays;						// The length of the segment in the brickmap space
+	float	*lengthC	=	lengthV + numRays;					// The length of the segment in the camera space
+	int		*active		=	(int *) ralloc(numRays*2*sizeof(int),context->threadMemory);
+	int		*sampleRay	=	active + numRays;
+	float	*sampleP	=	(float *) ralloc(numRays*(5 + dataSize)*sizeof(float),context->threadMemory);
+	float	*sampleR	=	sampleP + numRays*3;				// The lookup radius
+	float	*sampleL	=	sampleR + numRays;					// The length of the step in the brickmap space
+	float	*sampleData	=	sampleL + numRays;
+
+	// Clip the segments against the brickmap
+	for (i=0;i<numRays;i++) {
+		float	*cP		=	P + i*3;
+		float	*cD		=	D + i*3;
+		float	tmin	=	0;
+		float	tmax	=	1;
+		vector	tmp;
+
+		mulmp(cP,map->to,from + i*3);
+		subvv(cP,map->bmin);
+		mulmp(tmp,map->to,to + i*3);
+		subvv(tmp,map->bmin);
+		subvv(cD,tmp,cP);
+		subvv(tmp,to + i*3,from + i*3);
+		initv(Z + i*3,0);
+
+		lengthV[i]	=	lengthv(cD);
+		lengthC[i]	=	lengthv(tmp);
+		T[i]		=	1;
+
+		if (lengthV[i] < C_EPSILON)	continue;
+
+		for (j=0;j<3;j++) {
+			if (cD[j] != 0) {
+				float	t0	=	-cP[j] / cD[j];
+				float	t1	=	(map->side - cP[j]) / cD[j];
+
+				if (t0 > t1) {
+					const float	ttmp	=	t0;
+					t0	=	t1;
+					t1	=	ttmp;
+				}
+
+				tmin	=	max(tmin,t0);
+				tmax	=	min(tmax,t1);
+			} else if ((cP[j] < 0) || (cP[j] > map->side)) {
+				tmax	=	-1;
+			}
+		}
+
+		if (tmin < tmax) {
+			t[i]				=	tmin;
+			tEnd[i]				=	tmax;
+			active[numActive++]	=	i;
+		}
+	}
+
+	// March all the segments one step at a time
+	while(numActive > 0) {
+		int	numSamples	=	0;
+
+		// Find the next sample of every segment
+		for (j=0;j<numActive;j++) {
+			const int	r			=	active[j];
+			const float	*cP			=	P + r*3;
+			const float	*cD			=	D + r*3;
+			const float	invLength	=	1 / lengthV[r];
+			float		ct			=	t[r];
+
+			while(ct < tEnd[r]) {
+				vector	Pt;
+				float	tExit;
+
+				mulvf(Pt,cD,ct);
+				addvv(Pt,cP);
+
+				const float	majorant	=	region(Pt,cP,cD,tExit)*densityScale[r];
+
+				if (tExit > tEnd[r])	tExit	=	tEnd[r];
+				if (tExit <= ct)		tExit	=	ct + C_EPSILON;
+
+				// Skip the empty space
+				if (majorant <= 0) {
+					ct	=	tExit;
+					numSkipped++;
+					continue;
+				}
+
+				// Keep the optical depth of the step bounded
+				float	step	=	VOLUME_MAX_OPTICAL_DEPTH / majorant;
+				if ((stepSize[r] > 0) && (step > stepSize[r]))	step	=	stepSize[r];
+				if (step < minStep)								step	=	minStep;
+
+				const float	dt	=	min(step*invLength,tExit - ct);
+
+				// Sample the middle of the step
+				const float	ts	=	ct + dt*0.5f;
+				float		*cS	=	sampleP + numSamples*3;
+
+				subvv(cS,to + r*3,from + r*3);
+				mulvf(cS,ts);
+				addvv(cS,from + r*3);
+				sampleR[numSamples]		=	dt*lengthC[r]*0.5f;
+				sampleL[numSamples]		=	dt*lengthV[r];
+				sampleRay[numSamples++]	=	r;
+
+				ct	+=	dt;
+				break;
+			}
+
+			t[r]	=	ct;
+		}
+
+		if (numSamples > 0) {
+
+			// Lookup the densities together
+			map->lookup(numSamples,sampleData,sampleP,Z,sampleR);
+			numLookups	+=	numSamples;
+
+			// Accumulate the absorption
+			for (j=0;j<numSamples;j++) {
+				const int	r		=	sampleRay[j];
+				const float	*src	=	sampleData + j*dataSize;
+				float		*dest	=	data + r*dataSize;
+				const float	density	=	max(src[densityEntry],0.0f)*densityScale[r];
+				const float	alpha	=	1 - expf(-density*sampleL[j]);
+				const float	w		=	T[r]*alpha;
+
+				for (k=0;k<dataSize;k++)	dest[k]	+=	src[k]*w;
+				T[r]	*=	1 - alpha;
+			}
+		}
+
+		// Retire the segments that are done
+		for (i=0,j=0;j<numActive;j++) {
+			const int	r	=	active[j];
+
+			if ((t[r] < tEnd[r]) && (T[r] > VOLUME_MIN_TRANSMITTANCE))	active[i++]	=	r;
+		}
+		numActive	=	i;
+	}
+
+	for (i=0;i<numRays;i++)	opacity[i]	=	1 - T[i];
+
+	memEnd(context->threadMemory);
+
+	stats.add(context->thread,STAT_VOLUME_LOOKUPS,numLookups);
+	stats.add(context->thread,STAT_VOLUME_SKIPPED,numSkipped);
+}
+
@@ -0,0 +1,104 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	volume.h
+//  Classes				:	CVolume
+//  Description			:	A sparse voxel density field for ray marching
+//
+////////////////////////////////////////////////////////////////////////
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#include "common/global.h"
+#include "fileResource.h"
+#include "brickmap.h"
+
+class	CShadingContext;
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CVolume
+// Description			:
+/// \brief					A density field stored in a brickmap
+// Comments				:	We keep a sparse octree that mirrors the bricks so that the
+//							empty space can be skipped and the step size can follow
+//							the density. The maximum densities (the majorants) are
+//							computed the first time a ray gets near a brick, so
+//							only the bricks around the rays are paged in
+class	CVolume : public CFileResource {
+
+	///////////////////////////////////////////////////////////////////////
+	// Class				:	CVolumeNode
+	// Description			:
+	/// \brief					A node of the majorant hierarchy
+	// Comments				:	The maxima are -1 until they are computed
+	class	CVolumeNode {
+	public:
+							CVolumeNode(CVolumeNode *p,int cx,int cy,int cz,int cd) {
+								parent		=	p;
+								x			=	(short) cx;
+								y			=	(short) cy;
+								z			=	(short) cz;
+								d			=	(short) cd;
+								localMax	=	-1;
+								dilatedMax	=	-1;
+								for (int i=0;i<8;i++) {
+									children[i]	=	NULL;
+									cellMax[i]	=	-1;
+								}
+							}
+
+		CVolumeNode			*parent;			// The parent node (NULL for the root)
+		short				x,y,z,d;			// The spatial index of the brick of this node
+		float				localMax;			// The maximum density stored in the brick of this node
+		float				dilatedMax;			// The maximum density in the brick and its neighbours at the same depth
+		float				cellMax[8];			// The majorant of every missing child
+		CVolumeNode			*children[8];		// The children (NULL if the brick doesn't exist)
+	};
+
+public:
+							CVolume(const char *name,CBrickMap *map,const char *channel);
+							~CVolume();
+
+							// March a number of segments through the volume
+	void					march(int numRays,float *opacity,float *data,const float *from,const float *to,const float *stepSize,const float *densityScale,CShadingContext *context);
+
+	CBrickMap				*map;				// The brickmap that holds the data (NULL if we failed to load)
+
+private:
+	float					region(const float *P,const float *from,const float *dir,float &tExit);
+	CVolumeNode				*findNode(int x,int y,int z,int d) const;
+	float					computeLocalMax(CVolumeNode *cNode);
+	float					computeDilatedMax(CVolumeNode *cNode);
+	float					computeNearMax(CVolumeNode *cNode,const float *cellMin,float cellSide);
+	float					computeCellMax(CVolumeNode *cNode,int child);
+	void					destroy(CVolumeNode *cNode);
+
+	CVolumeNode				*root;				// The root of the majorant hierarchy
+	int						densityEntry;		// The entry of the density in the brickmap data
+	float					minStep;			// The smallest step we take (half the size of the finest voxel)
+};
+
+#endif
+
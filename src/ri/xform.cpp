@@ -35,6 +35,7 @@
 #include "xform.h"
 #include "error.h"
 #include "stats.h"
+#include "common/containers.h"
 
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CXform
@@ -88,6 +89,41 @@ CXform::~CXform() {
 }
 
 
+///////////////////////////////////////////////////////////////////////
+// Class				:	CXform
+// Method				:	hash
+// Description			:
+/// \brief					Compute a hash key for the transformation
+// Return Value			:	The key
+// Comments				:
+unsigned int	CXform::hash() const {
+	unsigned int	key	=	2166136261u;
+	const CXform	*cXform;
+
+	for (cXform=this;cXform!=NULL;cXform=cXform->next)
+		key	=	hashBytes(key,cXform->from,sizeof(matrix));
+
+	return key;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CXform
+// Method				:	equals
+// Description			:
+/// \brief					Check if two transformations are identical
+// Return Value			:	TRUE if they are
+// Comments				:	The flip flag is derived from the matrices
+int		CXform::equals(const CXform *other) const {
+	const CXform	*cXform;
+
+	for (cXform=this;(cXform!=NULL) && (other!=NULL);cXform=cXform->next,other=other->next) {
+		if (memcmp(cXform->from,other->from,sizeof(matrix)) != 0)	return FALSE;
+		if (memcmp(cXform->to,other->to,sizeof(matrix)) != 0)		return FALSE;
+	}
+
+	return (cXform == other);
+}
+
 ///////////////////////////////////////////////////////////////////////
 // Class				:	CXform
 // Method				:	restore
@@ -51,6 +51,8 @@ public:
 	CXform		*next;		// points to the next xform in case of motion blur
 
 	void		restore(const CXform *xform);
+	unsigned int	hash() const;						// Used to find identical transformations
+	int			equals(const CXform *other) const;
 
 	void		identity();							// Transformations
 	void		translate(float,float,float);		// Concetenate from right
@@ -1078,6 +1078,7 @@ CScriptContext::CScriptContext(int s) {
 
 	addBuiltInFunction("bake3d","f=SSpn!",0);
 	addBuiltInFunction("texture3d","f=Spn!",0);
+	addBuiltInFunction("volume3d","f=Spp!",0);
 
 	// The global variables
 	addGlobalVariable("P",		SLC_VECTOR | SLC_VPOINT,	SLC_SURFACE | SLC_DISPLACEMENT | SLC_LIGHT | SLC_VOLUME | SLC_IMAGER);
@@ -0,0 +1,277 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	shmem.cpp
+//  Classes				:	CShmemFramebuffer
+//  Description			:
+/// \brief					This file implements a display driver that publishes
+//							the image into a POSIX shared memory segment
+//
+//							Viewers and compositors on the same machine can map
+//							the segment and display the buckets as they arrive
+//							without any copying or socket traffic. See shmem.h
+//							for the layout and shmemread.cpp for a reader.
+//
+////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/global.h"
+#include "common/os.h"
+#include "ri/dsply.h"							// The display functions
+#include "shmem.h"
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	shmemIncrement
+// Description			:
+/// \brief					Atomically increment an integer in the segment
+// Return Value			:	-
+// Comments				:	The segment is shared between processes, so we use the
+//							compiler's interlocked builtins which act as full barriers
+inline	void	shmemIncrement(volatile int *value) {
+	__sync_fetch_and_add(value,1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	shmemDecrement
+// Description			:
+/// \brief					Atomically decrement an integer in the segment
+// Return Value			:	-
+// Comments				:
+inline	void	shmemDecrement(volatile int *value) {
+	__sync_fetch_and_sub(value,1);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	CShmemFramebuffer
+// Description			:
+/// \brief					Holds the mapped segment
+// Comments				:
+class	CShmemFramebuffer {
+public:
+				///////////////////////////////////////////////////////////////////////
+				// Class				:	CShmemFramebuffer
+				// Method				:	CShmemFramebuffer
+				// Description			:
+/// \brief					Ctor
+				// Return Value			:	-
+				// Comments				:	If a segment with the same layout already exists,
+				//							it is reused so that viewers stay attached across frames
+				CShmemFramebuffer(const char *name,int width,int height,int numSamples,const char *samples,TDisplayParameterFunction findParameter) {
+					TShmemHeader	layout;
+					const char		*segment;
+					struct stat		st;
+					int				fd;
+
+					base		=	NULL;
+					header		=	NULL;
+
+					if ((segment = (const char *) findParameter("segment",STRING_PARAMETER,1)) == NULL)	segment	=	name;
+					shmemSegmentName(segmentName,segment,sizeof(segmentName));
+
+					size		=	shmemSegmentSize(&layout,width,height,numSamples);
+
+					// Only the owner may attach to the framebuffer
+					if ((fd = shm_open(segmentName,O_RDWR | O_CREAT,0600)) < 0) {
+						fprintf(stderr,"shmem: Unable to open shared memory segment %s\n",segmentName);
+						return;
+					}
+
+					// The mode is only applied to new segments, so check an existing one
+					if ((fstat(fd,&st) != 0) || (st.st_uid != geteuid()) || ((st.st_mode & 077) != 0)) {
+						fprintf(stderr,"shmem: Shared memory segment %s is not private to this user, remove it and try again\n",segmentName);
+						close(fd);
+						return;
+					}
+
+					// Resize the segment if it does not match
+					if ((size_t) st.st_size != size) {
+						if (ftruncate(fd,(off_t) size) != 0) {
+							fprintf(stderr,"shmem: Unable to allocate %d bytes for shared memory segment %s\n",(int) size,segmentName);
+							close(fd);
+							return;
+						}
+					}
+
+					base		=	mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_SHARED,fd,0);
+					close(fd);
+
+					if (base == MAP_FAILED) {
+						fprintf(stderr,"shmem: Unable to map shared memory segment %s\n",segmentName);
+						base	=	NULL;
+						return;
+					}
+
+					header		=	(TShmemHeader *) base;
+					tiles		=	(TShmemTile *) ((char *) base + layout.tileOffset);
+					ring		=	(TShmemUpdate *) ((char *) base + layout.ringOffset);
+					pixels		=	(float *) ((char *) base + layout.pixelOffset);
+
+					// Initialize the header unless an identical segment is being reused
+					if ((header->magic != SHMEM_MAGIC) || (header->version != SHMEM_VERSION) ||
+						(header->width != width) || (header->height != height) || (header->numSamples != numSamples)) {
+						memset(base,0,layout.pixelOffset);
+						memcpy(header,&layout,sizeof(TShmemHeader));
+						header->version	=	SHMEM_VERSION;
+						header->magic	=	SHMEM_MAGIC;
+					}
+
+					strncpy(header->samples,samples,SHMEM_MAX_SAMPLES-1);
+					header->samples[SHMEM_MAX_SAMPLES-1]	=	'\0';
+					header->numUpdates	=	0;
+					header->done		=	FALSE;
+					shmemIncrement(&header->frame);
+
+					osCreateMutex(ringMutex);
+				}
+
+				///////////////////////////////////////////////////////////////////////
+				// Class				:	CShmemFramebuffer
+				// Method				:	~CShmemFramebuffer
+				// Description			:
+/// \brief					Dtor
+				// Return Value			:	-
+				// Comments				:	The segment is not unlinked so that viewers can
+				//							keep displaying the final image
+				~CShmemFramebuffer() {
+					if (base == NULL)	return;
+
+					header->done	=	TRUE;
+					munmap(base,size);
+
+					osDeleteMutex(ringMutex);
+				}
+
+				///////////////////////////////////////////////////////////////////////
+				// Class				:	CShmemFramebuffer
+				// Method				:	write
+				// Description			:
+/// \brief					Publish a bucket
+				// Return Value			:	-
+				// Comments				:	This function may be called from multiple threads
+	void		write(int x,int y,int w,int h,const float *data) {
+					const int	tileSize	=	header->tileSize;
+					const int	xTiles		=	header->xTiles;
+					const int	width		=	header->width;
+					const int	numSamples	=	header->numSamples;
+					const int	tx0			=	x / tileSize;
+					const int	ty0			=	y / tileSize;
+					const int	tx1			=	(x + w - 1) / tileSize;
+					const int	ty1			=	(y + h - 1) / tileSize;
+					int			i,tx,ty;
+					TShmemUpdate	*update;
+
+					// Mark the tiles we're touching as busy
+					for (ty=ty0;ty<=ty1;ty++)
+						for (tx=tx0;tx<=tx1;tx++)	shmemIncrement(&tiles[ty*xTiles + tx].writers);
+
+					for (i=0;i<h;i++) {
+						memcpy(pixels + ((size_t) (y+i)*width + x)*numSamples,data + i*w*numSamples,w*numSamples*sizeof(float));
+					}
+
+					// Publish the new versions
+					for (ty=ty0;ty<=ty1;ty++)
+						for (tx=tx0;tx<=tx1;tx++) {
+							TShmemTile	*tile	=	tiles + ty*xTiles + tx;
+
+							shmemIncrement(&tile->version);
+							shmemDecrement(&tile->writers);
+						}
+
+					// Record the update
+					osLock(ringMutex);
+					update			=	ring + (header->numUpdates % header->ringSize);
+					update->serial	=	0;
+					update->x		=	x;
+					update->y		=	y;
+					update->w		=	w;
+					update->h		=	h;
+					update->serial	=	header->numUpdates + 1;
+					shmemIncrement(&header->numUpdates);
+					osUnlock(ringMutex);
+				}
+
+	void			*base;						// The mapped segment
+	size_t			size;						// The size of the segment
+	TShmemHeader	*header;					// The segment header (NULL if we failed to map)
+	TShmemTile		*tiles;						// The tile index
+	TShmemUpdate	*ring;						// The update ring
+	float			*pixels;					// The image
+	TMutex			ringMutex;					// Serializes the update ring
+	char			segmentName[OS_MAX_PATH_LENGTH];
+};
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	displayStart
+// Description			:
+/// \brief					Begin receiving an image
+// Return Value			:	The handle to the image on success, NULL othervise
+// Comments				:
+void	*displayStart(const char *name,int width,int height,int numSamples,const char *samples,TDisplayParameterFunction findParameter) {
+	CShmemFramebuffer	*fb	=	new CShmemFramebuffer(name,width,height,numSamples,samples,findParameter);
+
+	if (fb->header == NULL) {
+		delete fb;
+		return NULL;
+	}
+
+	return fb;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	displayData
+// Description			:
+/// \brief					Receive image data
+// Return Value			:	TRUE on success, FALSE otherwise
+// Comments				:
+int		displayData(void *im,int x,int y,int w,int h,float *data) {
+	CShmemFramebuffer	*fb	=	(CShmemFramebuffer *) im;
+	
+	assert(fb != NULL);
+
+	fb->write(x,y,w,h,data);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	displayFinish
+// Description			:
+/// \brief					Finish receiving an image
+// Return Value			:	TRUE on success, FALSE othervise
+// Comments				:
+void	displayFinish(void *im) {
+	CShmemFramebuffer	*fb	=	(CShmemFramebuffer *) im;
+
+	assert(fb != NULL);
+
+	delete fb;
+}
+
@@ -0,0 +1,151 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	shmem.h
+//  Classes				:	-
+//  Description			:
+/// \brief					The layout of the shared memory segment the shmem
+//							display driver publishes into
+//
+//							The segment is laid out as:
+//
+//							TShmemHeader						(one)
+//							TShmemTile							(xTiles*yTiles)
+//							TShmemUpdate						(ringSize)
+//							float								(width*height*numSamples)
+//
+//							The pixels are stored as a plain scanline order float
+//							image so that a viewer can map the segment and use the
+//							pixels in place. Each tile of the image has a writer
+//							count and a version number which together act as a
+//							sequence lock: a reader that sees the same version
+//							before and after copying a tile with no writers active
+//							has a consistent copy. The update ring records the
+//							most recent buckets so viewers can redraw only the
+//							regions that changed.
+//
+////////////////////////////////////////////////////////////////////////
+#ifndef SHMEM_H
+#define SHMEM_H
+
+#include <string.h>
+
+// The segment signature and layout version
+#define	SHMEM_MAGIC				0x4d535850		// "PXSM"
+#define	SHMEM_VERSION			1
+
+// The size of a tile in the tile index
+#define	SHMEM_TILE_SIZE			32
+
+// The number of entries in the update ring
+#define	SHMEM_RING_SIZE			256
+
+// The maximum length of the sample description
+#define	SHMEM_MAX_SAMPLES		64
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	TShmemHeader
+// Description			:
+/// \brief					The header at the beginning of the segment
+// Comments				:	The offsets are in bytes from the start of the segment
+typedef struct {
+	int				magic;						// SHMEM_MAGIC
+	int				version;					// SHMEM_VERSION
+	int				width,height,numSamples;	// The image dimensions
+	int				tileSize,xTiles,yTiles;		// The tile index dimensions
+	int				ringSize;					// The number of update ring entries
+	int				tileOffset;					// Where the tile index starts
+	int				ringOffset;					// Where the update ring starts
+	int				pixelOffset;				// Where the pixels start
+	volatile int	frame;						// Incremented every time a new image starts
+	volatile int	numUpdates;					// The number of buckets published for this frame
+	volatile int	done;						// TRUE when the frame is complete
+	char			samples[SHMEM_MAX_SAMPLES];	// The sample description ("rgba" etc.)
+} TShmemHeader;
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	TShmemTile
+// Description			:
+/// \brief					The sequence lock for a tile of the image
+// Comments				:
+typedef struct {
+	volatile int	writers;					// The number of buckets being written into the tile
+	volatile int	version;					// Incremented after every completed write
+} TShmemTile;
+
+///////////////////////////////////////////////////////////////////////
+// Class				:	TShmemUpdate
+// Description			:
+/// \brief					An entry in the update ring
+// Comments				:	Update n lives in entry n % ringSize and is valid
+//							when its serial is n+1
+typedef struct {
+	volatile int	serial;						// The update number + 1 (0 while being filled)
+	int				x,y,w,h;					// The region that was updated
+} TShmemUpdate;
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	shmemSegmentName
+// Description			:
+/// \brief					Convert a display name into a shared memory object name
+// Return Value			:	-
+// Comments				:	POSIX object names must start with a single slash
+//							and contain no others
+inline	void	shmemSegmentName(char *dest,const char *name,int size) {
+	const char	*base;
+	int			i;
+
+	if ((base = strrchr(name,'/')) != NULL)		name	=	base + 1;
+
+	strcpy(dest,"/pixie-");
+	for (i=(int) strlen(dest);(*name != '\0') && (i < size-1);i++,name++) {
+		dest[i]	=	((*name == '/') || (*name == '\\')) ? '_' : *name;
+	}
+	dest[i]	=	'\0';
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	shmemSegmentSize
+// Description			:
+/// \brief					Compute the layout of a segment
+// Return Value			:	The total size of the segment in bytes
+// Comments				:
+inline	size_t	shmemSegmentSize(TShmemHeader *header,int width,int height,int numSamples) {
+	header->width			=	width;
+	header->height			=	height;
+	header->numSamples		=	numSamples;
+	header->tileSize		=	SHMEM_TILE_SIZE;
+	header->xTiles			=	(width + SHMEM_TILE_SIZE - 1) / SHMEM_TILE_SIZE;
+	header->yTiles			=	(height + SHMEM_TILE_SIZE - 1) / SHMEM_TILE_SIZE;
+	header->ringSize		=	SHMEM_RING_SIZE;
+	header->tileOffset		=	(int) ((sizeof(TShmemHeader) + 15) & ~15);
+	header->ringOffset		=	header->tileOffset + header->xTiles*header->yTiles*(int) sizeof(TShmemTile);
+	header->pixelOffset		=	(header->ringOffset + header->ringSize*(int) sizeof(TShmemUpdate) + 63) & ~63;
+
+	return (size_t) header->pixelOffset + (size_t) width*height*numSamples*sizeof(float);
+}
+
+#endif
+
@@ -0,0 +1,252 @@
+//////////////////////////////////////////////////////////////////////
+//
+//                             Pixie
+//
+// Copyright  1999 - 2010, Okan Arikan
+//
+// Contact: okan@cs.utexas.edu
+//
+//	This library is free software; you can redistribute it and/or
+//	modify it under the terms of the GNU Lesser General Public
+//	License as published by the Free Software Foundation; either
+//	version 2.1 of the License, or (at your option) any later version.
+//
+//	This library is distributed in the hope that it will be useful,
+//	but WITHOUT ANY WARRANTY; without even the implied warranty of
+//	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+//	Lesser General Public License for more details.
+//
+//	You should have received a copy of the GNU Lesser General Public
+//	License along with this library; if not, write to the Free Software
+//	Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+//
+///////////////////////////////////////////////////////////////////////
+///////////////////////////////////////////////////////////////////////
+//
+//  File				:	shmemread.cpp
+//  Classes				:	-
+//  Description			:
+/// \brief					A reference reader for the shmem display driver
+//
+//							Maps a segment published by the shmem display,
+//							optionally follows the buckets as they arrive and
+//							writes a consistent snapshot of the image as a
+//							portable float map
+//
+////////////////////////////////////////////////////////////////////////
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common/global.h"
+#include "shmem.h"
+
+// The polling interval in microseconds
+#define	SHMEM_POLL_INTERVAL		20000
+
+void	printUsage() {
+	printf("Usage: shmemread [-follow] [-o <file.pfm>] [-unlink] <name>\n");
+	printf("  -follow   Print the buckets as they arrive until the frame is complete\n");
+	printf("  -o        Write a snapshot of the image into a portable float map\n");
+	printf("  -unlink   Remove the segment when done\n");
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	follow
+// Description			:
+/// \brief					Print the updates until the frame finishes
+// Return Value			:	-
+// Comments				:
+static	void	follow(const TShmemHeader *header,const TShmemUpdate *ring) {
+	const int	frame	=	header->frame;
+	int			seen	=	0;
+
+	while(TRUE) {
+		const int	done		=	header->done;
+		const int	numUpdates	=	header->numUpdates;
+
+		if (header->frame != frame) {
+			printf("Frame %d started\n",header->frame);
+			return;
+		}
+
+		// If the ring wrapped around us, skip the lost updates
+		if (numUpdates - seen > header->ringSize) {
+			printf("Missed %d updates\n",numUpdates - header->ringSize - seen);
+			seen	=	numUpdates - header->ringSize;
+		}
+
+		for (;seen<numUpdates;seen++) {
+			const TShmemUpdate	*update	=	ring + (seen % header->ringSize);
+			TShmemUpdate		copy;
+
+			copy.x	=	update->x;
+			copy.y	=	update->y;
+			copy.w	=	update->w;
+			copy.h	=	update->h;
+
+			if (update->serial != seen + 1)	printf("Update %d overwritten\n",seen);
+			else							printf("Update %d: %d %d %dx%d\n",seen,copy.x,copy.y,copy.w,copy.h);
+		}
+
+		if (done)	break;
+
+		fflush(stdout);
+		usleep(SHMEM_POLL_INTERVAL);
+	}
+
+	printf("Frame %d complete (%d buckets)\n",frame,seen);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	snapshot
+// Description			:
+/// \brief					Copy the image tile by tile
+// Return Value			:	-
+// Comments				:	Each tile is retried until it is copied while no
+//							bucket is being written into it
+static	void	snapshot(const TShmemHeader *header,const TShmemTile *tiles,const float *pixels,float *dest) {
+	const int	width		=	header->width;
+	const int	height		=	header->height;
+	const int	numSamples	=	header->numSamples;
+	const int	tileSize	=	header->tileSize;
+	int			tx,ty,y;
+
+	for (ty=0;ty<header->yTiles;ty++) {
+		for (tx=0;tx<header->xTiles;tx++) {
+			const TShmemTile	*tile	=	tiles + ty*header->xTiles + tx;
+			const int			x0		=	tx*tileSize;
+			const int			y0		=	ty*tileSize;
+			const int			w		=	min(tileSize,width - x0);
+			const int			h		=	min(tileSize,height - y0);
+			int					version;
+
+			do {
+				while(tile->writers != 0)	usleep(0);
+
+				version	=	tile->version;
+
+				for (y=y0;y<y0+h;y++) {
+					const size_t	offset	=	((size_t) y*width + x0)*numSamples;
+
+					memcpy(dest + offset,pixels + offset,w*numSamples*sizeof(float));
+				}
+
+			} while((tile->writers != 0) || (tile->version != version));
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	writePfm
+// Description			:
+/// \brief					Write the image into a portable float map
+// Return Value			:	TRUE on success
+// Comments				:	Only the first three channels are written
+static	int		writePfm(const char *fileName,const TShmemHeader *header,const float *data) {
+	const int	numSamples	=	header->numSamples;
+	const int	numChannels	=	(numSamples >= 3) ? 3 : 1;
+	FILE		*out;
+	int			x,y;
+
+	if ((out = fopen(fileName,"wb")) == NULL)	return FALSE;
+
+	fprintf(out,"%s\n%d %d\n-1.0\n",(numChannels == 3) ? "PF" : "Pf",header->width,header->height);
+
+	// PFM stores the bottom scanline first
+	for (y=header->height-1;y>=0;y--) {
+		const float	*src	=	data + (size_t) y*header->width*numSamples;
+
+		for (x=0;x<header->width;x++,src+=numSamples) {
+			fwrite(src,sizeof(float),numChannels,out);
+		}
+	}
+
+	fclose(out);
+
+	return TRUE;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	main
+// Description			:
+/// \brief					Da main
+// Return Value			:	-
+// Comments				:
+int		main(int argc,char *argv[]) {
+	const char		*name		=	NULL;
+	const char		*output		=	NULL;
+	int				doFollow	=	FALSE;
+	int				doUnlink	=	FALSE;
+	char			segmentName[512];
+	struct stat		st;
+	TShmemHeader	*header;
+	void			*base;
+	int				fd,i;
+
+	for (i=1;i<argc;i++) {
+		if (strcmp(argv[i],"-follow") == 0)				doFollow	=	TRUE;
+		else if (strcmp(argv[i],"-unlink") == 0)		doUnlink	=	TRUE;
+		else if ((strcmp(argv[i],"-o") == 0) && (i+1 < argc))	output	=	argv[++i];
+		else if (argv[i][0] == '-') {
+			printUsage();
+			exit(1);
+		} else											name		=	argv[i];
+	}
+
+	if (name == NULL) {
+		printUsage();
+		exit(1);
+	}
+
+	shmemSegmentName(segmentName,name,sizeof(segmentName));
+
+	if ((fd = shm_open(segmentName,O_RDONLY,0)) < 0) {
+		fprintf(stderr,"Unable to open shared memory segment %s\n",segmentName);
+		exit(1);
+	}
+
+	if ((fstat(fd,&st) != 0) || ((size_t) st.st_size < sizeof(TShmemHeader)) ||
+		((base = mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED)) {
+		fprintf(stderr,"Unable to map shared memory segment %s\n",segmentName);
+		close(fd);
+		exit(1);
+	}
+	close(fd);
+
+	header	=	(TShmemHeader *) base;
+	if ((header->magic != SHMEM_MAGIC) || (header->version != SHMEM_VERSION) ||
+		((size_t) header->pixelOffset + (size_t) header->width*header->height*header->numSamples*sizeof(float) > (size_t) st.st_size)) {
+		fprintf(stderr,"%s is not a valid Pixie shared memory segment\n",segmentName);
+		munmap(base,st.st_size);
+		exit(1);
+	}
+
+	printf("Segment    : %s\n",segmentName);
+	printf("Image      : %dx%d, %d samples (%s)\n",header->width,header->height,header->numSamples,header->samples);
+	printf("Tiles      : %dx%d of %d pixels\n",header->xTiles,header->yTiles,header->tileSize);
+	printf("Frame      : %d, %d buckets%s\n",header->frame,header->numUpdates,header->done ? ", complete" : "");
+
+	if (doFollow)	follow(header,(const TShmemUpdate *) ((char *) base + header->ringOffset));
+
+	if (output != NULL) {
+		float	*data	=	new float[(size_t) header->width*header->height*header->numSamples];
+
+		snapshot(header,(const TShmemTile *) ((char *) base + header->tileOffset),(const float *) ((char *) base + header->pixelOffset),data);
+
+		if (writePfm(output,header,data) == FALSE)	fprintf(stderr,"Unable to write %s\n",output);
+
+		delete [] data;
+	}
+
+	munmap(base,st.st_size);
+
+	if (doUnlink)	shm_unlink(segmentName);
+
+	return 0;
+}
+
@@ -32,11 +32,26 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 #include "common/global.h"
 #include "common/os.h"
 #include "ri/ri.h"
 
+#ifdef _WIN32
+typedef intptr_t	TProcess;
+#else
+typedef pid_t		TProcess;
+#endif
+
 const	char	*tileSizeArgument			=	"-tilesize";
 const	char	*resizeModeArgument			=	"-resize";
 const	char	*smodeArgument				=	"-smode";
@@ -55,10 +70,172 @@ const	char	*texture3dArgument			=	"-texture3d";
 const	char	*maxerrorArgument			=	"-maxerror";
 const	char	*radiusscaleArgument		=	"-radiusscale";
 const	char	*maxdepthArgument			=	"-maxdepth";
+const	char	*threadsArgument			=	"-threads";
+const	char	*batchArgument				=	"-batch";
+const	char	*jobsArgument				=	"-jobs";
+const	char	*forceArgument				=	"-force";
+const	char	*halfArgument				=	"-half";
 
 void	printUsage() {
-	printf("Usage: texmake [-(shadow|envlatl|envcube)] [-resize <mode>] [-smode <mode>] [-tmode <mode>] [-filter <filter>] [-filterwidth <width>] [-filterheight <height>] [-sfilterwidth <width>] [-tfilterwidth <width>] <inputfile> <outputfile>\n");
+	printf("Usage: texmake [-(shadow|envlatl|envcube)] [-resize <mode>] [-smode <mode>] [-tmode <mode>] [-filter <filter>] [-filterwidth <width>] [-filterheight <height>] [-sfilterwidth <width>] [-tfilterwidth <width>] [-half] [-threads <n>] <inputfile> <outputfile>\n");
 	printf("       texmake -texture3d [-maxerror <number>] [-radiusscale <number>] [-maxdepth <number>] <inputfile> <outputfile>\n");
+	printf("       texmake -batch [-jobs <n>] [-force] [-output <directory>] [texture options] <inputfile> ...\n");
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	beginTexmake
+// Description			:
+/// \brief					Start the renderer for making a texture
+// Return Value			:
+// Comments				:
+static	void	beginTexmake(int numThreads) {
+	RiBegin(RI_NULL);
+
+	if (numThreads > 0)	RiOption(RI_LIMITS,RI_NUMTHREADS,&numThreads,RI_NULL);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	upToDate
+// Description			:
+/// \brief					Check if an output is newer than its input
+// Return Value			:	TRUE if it is
+// Comments				:
+static	int		upToDate(const char *input,const char *output) {
+	struct stat	inStat,outStat;
+
+	if (stat(input,&inStat) != 0)		return FALSE;
+	if (stat(output,&outStat) != 0)		return FALSE;
+
+	return (outStat.st_mtime >= inStat.st_mtime);
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	launchJob
+// Description			:
+/// \brief					Run another texmake to convert a single file
+// Return Value			:	The process or -1 on error
+// Comments				:
+static	TProcess	launchJob(char **args) {
+#ifdef _WIN32
+	return _spawnvp(_P_NOWAIT,args[0],args);
+#else
+	TProcess	pid	=	fork();
+
+	if (pid == 0) {
+		execvp(args[0],args);
+		_exit(1);
+	}
+
+	return pid;
+#endif
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	waitJob
+// Description			:
+/// \brief					Wait for one of the running conversions to finish
+// Return Value			:	TRUE if it succeeded
+// Comments				:
+static	int		waitJob(TProcess *running,int &numRunning) {
+	int			status	=	0;
+	int			i;
+
+#ifdef _WIN32
+	TProcess	pid		=	_cwait(&status,running[0],0);
+	int			success	=	(pid != -1) && (status == 0);
+#else
+	TProcess	pid		=	waitpid(-1,&status,0);
+	int			success	=	(pid != -1) && WIFEXITED(status) && (WEXITSTATUS(status) == 0);
+#endif
+
+	if (pid == -1) {
+		numRunning	=	0;
+		return FALSE;
+	}
+
+	for (i=0;i<numRunning;i++) {
+		if (running[i] == pid) {
+			running[i]	=	running[--numRunning];
+			break;
+		}
+	}
+
+	return success;
+}
+
+///////////////////////////////////////////////////////////////////////
+// Function				:	batchTexmake
+// Description			:
+/// \brief					Convert many files concurrently
+// Return Value			:	The number of failed conversions
+// Comments				:	Every input is converted by a separate texmake into
+//							<outPath>/<name>.tex, skipping the ones that are up to date
+static	int		batchTexmake(const char *program,int numArgs,const char **args,int numFiles,const char **files,const char *outPath,int numJobs,int numThreads,int force) {
+	char		**childArgs		=	new char*[numArgs + 6];
+	char		output[OS_MAX_PATH_LENGTH];
+	char		threads[32];
+	TProcess	*running		=	new TProcess[numJobs];
+	int			numRunning		=	0;
+	int			numFailed		=	0;
+	int			numSkipped		=	0;
+	int			i;
+
+	// The arguments shared by all the conversions
+	childArgs[0]	=	(char *) program;
+	for (i=0;i<numArgs;i++)	childArgs[i+1]	=	(char *) args[i];
+	
+	// Split the threads between the jobs unless told otherwise
+	if (numThreads <= 0)	numThreads	=	max(osAvailableCPUs() / numJobs,1);
+	sprintf(threads,"%d",numThreads);
+	childArgs[numArgs+1]	=	(char *) threadsArgument;
+	childArgs[numArgs+2]	=	threads;
+	childArgs[numArgs+5]	=	NULL;
+
+	for (i=0;i<numFiles;i++) {
+		const char	*name	=	strrchr(files[i],'/');
+		const char	*bname	=	strrchr(files[i],'\\');
+		char		*ext;
+
+		if ((name == NULL) || ((bname != NULL) && (bname > name)))	name	=	bname;
+		name	=	(name == NULL ? files[i] : name + 1);
+
+		sprintf(output,"%s/%s",outPath,name);
+		if ((ext = strrchr(output,'.')) != NULL && (ext > output + strlen(outPath)))	*ext	=	'\0';
+		strcat(output,".tex");
+
+		if ((force == FALSE) && upToDate(files[i],output)) {
+			numSkipped++;
+			continue;
+		}
+
+		// Throttle the conversions
+		if (numRunning == numJobs) {
+			if (waitJob(running,numRunning) == FALSE)	numFailed++;
+		}
+
+		childArgs[numArgs+3]	=	(char *) files[i];
+		childArgs[numArgs+4]	=	output;
+
+		TProcess	pid	=	launchJob(childArgs);
+
+		if (pid == -1) {
+			fprintf(stderr,"Failed to launch the conversion of %s\n",files[i]);
+			numFailed++;
+		} else {
+			running[numRunning++]	=	pid;
+		}
+	}
+
+	while(numRunning > 0) {
+		if (waitJob(running,numRunning) == FALSE)	numFailed++;
+	}
+
+	printf("texmake: %d converted, %d up to date, %d failed\n",numFiles - numSkipped - numFailed,numSkipped,numFailed);
+
+	delete [] running;
+	delete [] childArgs;
+
+	return numFailed;
 }
 
 int main(int argc, char* argv[]) {
@@ -77,13 +254,20 @@ int main(int argc, char* argv[]) {
 	int				maxDepth		=	10;
 	int				i;
 	const char		*textureMode	=	"texture";
+	const char		*tileFormat		=	"float";
 	int				processed;
+	int				numThreads		=	0;
+	int				batch			=	FALSE;
+	int				numJobs			=	osAvailableCPUs();
+	int				force			=	FALSE;
 
 	RtToken			tokens[50];
 	RtPointer		vals[50];
-	const char		*files[50];
+	const char		**files				=	new const char*[argc];
+	const char		**args				=	new const char*[argc];
 	int				currentFile			=	0;
 	int				currentParameter	=	0;
+	int				currentArg			=	0;
 
 	if (argc == 1) {
 		printUsage();
@@ -91,6 +275,8 @@ int main(int argc, char* argv[]) {
 	}
 
 	for (i=1;i<argc;i++) {
+		const int	firstArg	=	i;
+
 		if (strcmp(argv[i],"--help") == 0) {
 			printUsage();
 		} else if (strcmp(argv[i],shadowArgument) == 0) {
@@ -156,18 +342,55 @@ int main(int argc, char* argv[]) {
 		} else if (strcmp(argv[i],outputPathArgument) == 0) {
 			i++;
 			outPath		=	argv[i];
+		} else if (strcmp(argv[i],halfArgument) == 0) {
+			tileFormat	=	"half";
+		} else if (strcmp(argv[i],threadsArgument) == 0) {
+			i++;
+			numThreads	=	atoi(argv[i]);
+		} else if (strcmp(argv[i],batchArgument) == 0) {
+			batch		=	TRUE;
+			continue;
+		} else if (strcmp(argv[i],jobsArgument) == 0) {
+			i++;
+			numJobs		=	max(atoi(argv[i]),1);
+			continue;
+		} else if (strcmp(argv[i],forceArgument) == 0) {
+			force		=	TRUE;
+			continue;
 		} else {
 			files[currentFile++]	=	argv[i];
+			continue;
 		}
+
+		// Remember the option for the batch conversions
+		for (int j=firstArg;j<=i;j++)	args[currentArg++]	=	argv[j];
+	}
+
+	if (batch) {
+		int	numFailed	=	0;
+
+		if ((strcmp(textureMode,"envcube") == 0) || (strcmp(textureMode,"texture3d") == 0)) {
+			fprintf(stderr,"Batch mode is not supported for \"%s\"\n",textureMode);
+			numFailed	=	1;
+		} else {
+			numFailed	=	batchTexmake(argv[0],currentArg,args,currentFile,files,outPath,numJobs,numThreads,force);
+		}
+
+		delete [] files;
+		delete [] args;
+
+		return (numFailed == 0 ? 0 : 1);
 	}
 
 	processed	=	FALSE;
 
 	if (strcmp(textureMode,"texture") == 0) {
 		if (currentFile == 2) {
-			RiBegin(RI_NULL);
+			beginTexmake(numThreads);
 			tokens[currentParameter]	=	"resize";
 			vals[currentParameter++]	=	(RtPointer) &resizeMode;
+			tokens[currentParameter]	=	"format";
+			vals[currentParameter++]	=	(RtPointer) &tileFormat;
 			RiMakeTextureV(files[0],files[1],smode,tmode,filter,filterWidth,filterHeight,currentParameter,tokens,vals);
 			RiEnd();
 
@@ -175,9 +398,11 @@ int main(int argc, char* argv[]) {
 		}
 	} else if (strcmp(textureMode,"shadow") == 0) {
 		if (currentFile == 2) {
-			RiBegin(RI_NULL);
+			beginTexmake(numThreads);
 			tokens[currentParameter]	=	"resize";
 			vals[currentParameter++]	=	(RtPointer) &resizeMode;
+			tokens[currentParameter]	=	"format";
+			vals[currentParameter++]	=	(RtPointer) &tileFormat;
 			RiMakeShadowV(files[0],files[1],currentParameter,tokens,vals);
 			RiEnd();
 
@@ -185,9 +410,11 @@ int main(int argc, char* argv[]) {
 		}
 	} else if (strcmp(textureMode,"envlat") == 0) {
 		if (currentFile == 2) {
-			RiBegin(RI_NULL);
+			beginTexmake(numThreads);
 			tokens[currentParameter]	=	"resize";
 			vals[currentParameter++]	=	(RtPointer) &resizeMode;
+			tokens[currentParameter]	=	"format";
+			vals[currentParameter++]	=	(RtPointer) &tileFormat;
 			RiMakeLatLongEnvironmentV(files[0],files[1],filter,filterWidth,filterHeight,currentParameter,tokens,vals);
 			RiEnd();
 
@@ -195,9 +422,11 @@ int main(int argc, char* argv[]) {
 		}
 	} else if (strcmp(textureMode,"envcube") == 0) {
 		if (currentFile == 7) {
-			RiBegin(RI_NULL);
+			beginTexmake(numThreads);
 			tokens[currentParameter]	=	"resize";
 			vals[currentParameter++]	=	&resizeMode;
+			tokens[currentParameter]	=	"format";
+			vals[currentParameter++]	=	&tileFormat;
 			RiMakeCubeFaceEnvironmentV(files[0],files[1],files[2],files[3],files[4],files[5],files[6],fov,filter,filterWidth,filterHeight,currentParameter,tokens,vals);
 			RiEnd();
 
@@ -205,7 +434,7 @@ int main(int argc, char* argv[]) {
 		}
 	} else if (strcmp(textureMode,"texture3d") == 0) {
 		if (currentFile == 2) {
-			RiBegin(RI_NULL);
+			beginTexmake(numThreads);
 			tokens[currentParameter]			=	RI_MAXERROR;
 			vals[currentParameter++]			= 	(RtPointer) &maxerror;
 			tokens[currentParameter]			=	"radiusscale";
@@ -223,6 +452,9 @@ int main(int argc, char* argv[]) {
 		fprintf(stderr,"Unknown texture mode (\"%s\") or invalid number of arguments (%d)\n",textureMode,currentFile);
 	}
 
-	return 0;
+	delete [] files;
+	delete [] args;
+
+	return ((processed == FALSE) || (RiLastError != RIE_NOERROR)) ? 1 : 0;
 }
 